@@ -1,25 +1,185 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "fs/fs.h"
 #include "tinydir/tinydir.h"
 #include "copy.h"
 
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#endif
+
+// glibc wraps copy_file_range(2) since 2.27, older ones get the syscall
+#if defined(__GLIBC__) && \
+    (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+#define copy_range(from, to, size) \
+    copy_file_range(from, NULL, to, NULL, size, 0)
+#elif defined(__linux__) && defined(SYS_copy_file_range)
+#define copy_range(from, to, size) \
+    (ssize_t) syscall(SYS_copy_file_range, from, NULL, to, NULL, size, 0)
+#endif
+
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+#define COPY_BUFFER_SIZE 65536
+#define COPY_CHUNK_SIZE 0x40000000
 
 #define is_dot_file(file) 0 == strcmp(".", file.name) || 0 == strcmp("..", file.name)
 #define check_err(x) if (0 != (err = x)) break;
 
 
-int copy_file(char *from, char *to)
+typedef struct {
+    char *from;
+    char *to;
+} copy_job_t;
+
+typedef struct {
+    copy_job_t *jobs;
+    size_t count;
+    size_t size;
+    size_t next;
+    int err;
+    copy_dir_opts_t *opts;
+#ifdef HAVE_PTHREADS
+    pthread_mutex_t mutex;
+#endif
+} copy_queue_t;
+
+
+/**
+ * Copies with a fixed size buffer, retrying short and interrupted writes.
+ */
+static int copy_buffered(int from, int to)
 {
-    char *content = fs_read(from);
-    if (!content) {
-        return -1;
+    char buffer[COPY_BUFFER_SIZE];
+    ssize_t n;
+
+    while ((n = read(from, buffer, sizeof(buffer))) != 0) {
+        char *p = buffer;
+
+        if (n < 0) {
+            if (EINTR == errno) continue;
+            return -1;
+        }
+        while (n > 0) {
+            ssize_t written = write(to, p, n);
+
+            if (written < 0) {
+                if (EINTR == errno) continue;
+                return -1;
+            }
+            p += written;
+            n -= written;
+        }
     }
-    fs_write(to, content);
-    free(content);
 
     return 0;
 }
 
+/**
+ * Lets the kernel move the data, without a round trip through userspace.
+ * Returns 1 if the caller should fall back to a buffered copy.
+ */
+static int copy_kernel(int from, int to, off_t size)
+{
+#ifdef __linux__
+    off_t done = 0;
+    ssize_t n = 0;
+
+#ifdef FICLONE
+    if (0 == ioctl(to, FICLONE, from)) {
+        return 0;
+    }
+#endif
+
+#ifdef copy_range
+    while (done < size) {
+        n = copy_range(from, to, COPY_CHUNK_SIZE);
+        if (n <= 0) break;
+        done += n;
+    }
+    if (done >= size && n >= 0) {
+        return 0;
+    }
+#endif
+    // nothing was written yet, so sendfile can start from the same offset
+    if (0 == done) {
+        while (done < size) {
+            n = sendfile(to, from, NULL, COPY_CHUNK_SIZE);
+            if (n <= 0) break;
+            done += n;
+        }
+        if (done >= size && n >= 0) {
+            return 0;
+        }
+    }
+    if (done > 0) {
+        // finish whatever is left from the current offsets
+        return copy_buffered(from, to);
+    }
+#endif
+
+    return 1;
+}
+
+static int copy_file_mode(char *from_path, char *to_path, int preserve_mode)
+{
+    struct stat stats;
+    int rc = -1;
+    int from = open(from_path, O_RDONLY | O_BINARY);
+    int to = -1;
+
+    if (from < 0) {
+        return -1;
+    }
+    if (0 != fstat(from, &stats)) {
+        goto cleanup;
+    }
+
+    to = open(to_path, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, stats.st_mode & 0777);
+    if (to < 0) {
+        goto cleanup;
+    }
+
+    rc = copy_kernel(from, to, stats.st_size);
+    if (1 == rc) {
+        rc = copy_buffered(from, to);
+    }
+    if (0 == rc && preserve_mode) {
+        rc = fchmod(to, stats.st_mode & 07777);
+    }
+
+cleanup:
+    close(from);
+    if (to >= 0 && 0 != close(to)) {
+        rc = -1;
+    }
+
+    return rc;
+}
+
+int copy_file(char *from, char *to)
+{
+    return copy_file_mode(from, to, 0);
+}
+
 static void check_dir(char *dir)
 {
     if (0 != fs_exists(dir)) {
@@ -27,25 +187,57 @@ static void check_dir(char *dir)
     }
 }
 
-static int copy(tinydir_file file, char *target_dir)
+static int copy_job(copy_job_t *job, copy_dir_opts_t *opts)
 {
-    char target_path[strlen(target_dir) + strlen(file.name) + 2];
+    if (opts->link) {
+        unlink(job->to);
+        if (0 == link(job->from, job->to)) {
+            return 0;
+        }
+    }
+
+    return copy_file_mode(job->from, job->to, opts->preserve_mode);
+}
+
+static int enqueue(copy_queue_t *queue, char *from, char *to)
+{
+    if (queue->count == queue->size) {
+        size_t size = queue->size ? queue->size * 2 : 16;
+        copy_job_t *jobs = realloc(queue->jobs, size * sizeof(copy_job_t));
+
+        if (!jobs) {
+            return -1;
+        }
+        queue->jobs = jobs;
+        queue->size = size;
+    }
 
-    sprintf(target_path, "%s/%s", target_dir, file.name);
+    copy_job_t *job = &queue->jobs[queue->count];
 
-    if (file.is_dir) {
-        return copy_dir(file.path, target_path);
+    job->from = strdup(from);
+    job->to = strdup(to);
+    if (!job->from || !job->to) {
+        free(job->from);
+        free(job->to);
+        return -1;
     }
+    queue->count++;
 
-    return copy_file(file.path, target_path);
+    return 0;
 }
 
-int copy_dir(char *dir_path, char *target_dir)
+/**
+ * Creates the target directories, and collects the files to copy.
+ */
+static int collect(copy_queue_t *queue, char *dir_path, char *target_dir)
 {
     int err = 0;
     tinydir_dir dir;
     tinydir_file file;
-    tinydir_open(&dir, dir_path);
+
+    if (-1 == tinydir_open(&dir, dir_path)) {
+        return -1;
+    }
     check_dir(target_dir);
 
     while (dir.has_next) {
@@ -54,7 +246,17 @@ int copy_dir(char *dir_path, char *target_dir)
         if (is_dot_file(file)) {
             goto next;
         }
-        check_err(copy(file, target_dir));
+        {
+            char target_path[strlen(target_dir) + strlen(file.name) + 2];
+
+            sprintf(target_path, "%s/%s", target_dir, file.name);
+
+            if (file.is_dir) {
+                check_err(collect(queue, file.path, target_path));
+            } else {
+                check_err(enqueue(queue, file.path, target_path));
+            }
+        }
 
         next:
         check_err(tinydir_next(&dir));
@@ -63,3 +265,88 @@ int copy_dir(char *dir_path, char *target_dir)
 
     return err;
 }
+
+static void *copy_worker(void *data)
+{
+    copy_queue_t *queue = data;
+
+    while (1) {
+        copy_job_t *job = NULL;
+
+#ifdef HAVE_PTHREADS
+        pthread_mutex_lock(&queue->mutex);
+#endif
+        if (queue->next < queue->count && 0 == queue->err) {
+            job = &queue->jobs[queue->next++];
+        }
+#ifdef HAVE_PTHREADS
+        pthread_mutex_unlock(&queue->mutex);
+#endif
+
+        if (!job) break;
+
+        if (0 != copy_job(job, queue->opts)) {
+#ifdef HAVE_PTHREADS
+            pthread_mutex_lock(&queue->mutex);
+#endif
+            queue->err = -1;
+#ifdef HAVE_PTHREADS
+            pthread_mutex_unlock(&queue->mutex);
+#endif
+        }
+    }
+
+    return NULL;
+}
+
+int copy_dir_with_opts(char *dir_path, char *target_dir, copy_dir_opts_t *opts)
+{
+    copy_dir_opts_t defaults = {0};
+    copy_queue_t queue;
+    int err;
+
+    memset(&queue, 0, sizeof(queue));
+    queue.opts = opts ? opts : &defaults;
+
+    err = collect(&queue, dir_path, target_dir);
+
+    if (0 == err) {
+#ifdef HAVE_PTHREADS
+        int workers = queue.opts->parallel;
+        pthread_t threads[COPY_MAX_PARALLEL];
+        int started = 0;
+
+        if (workers > COPY_MAX_PARALLEL) workers = COPY_MAX_PARALLEL;
+        if (workers > (int) queue.count) workers = (int) queue.count;
+
+        pthread_mutex_init(&queue.mutex, NULL);
+        // the calling thread is a worker too
+        for (; started < workers - 1; started++) {
+            if (0 != pthread_create(&threads[started], NULL, copy_worker, &queue)) {
+                break;
+            }
+        }
+        copy_worker(&queue);
+        for (int i = 0; i < started; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        pthread_mutex_destroy(&queue.mutex);
+#else
+        copy_worker(&queue);
+#endif
+        err = queue.err;
+    }
+
+    for (size_t i = 0; i < queue.count; i++) {
+        free(queue.jobs[i].from);
+        free(queue.jobs[i].to);
+    }
+    free(queue.jobs);
+
+    return err;
+}
+
+int copy_dir(char *dir_path, char *target_dir)
+{
+    return copy_dir_with_opts(dir_path, target_dir, NULL);
+}
@@ -1,9 +1,19 @@
 #ifndef COPY_DIR_H
 #define COPY_DIR_H
 
+#define COPY_MAX_PARALLEL 32
+
+typedef struct {
+    int parallel;       // number of files copied at once, 0 or 1 to copy sequentially
+    int preserve_mode;  // apply the exact source mode, including what umask would drop
+    int link;           // hard link files instead of copying, where possible
+} copy_dir_opts_t;
 
 /**
- *  Copies one file
+ *  Copies one file, without loading it into memory. The kernel moves the
+ *  data where it can (reflink, copy_file_range, sendfile), otherwise it
+ *  goes through a fixed size buffer. The new file gets the mode of the
+ *  source, minus the umask.
  *
  *  @example copy_file("./dir/file.txt", "./target_dir/file.txt");
  *           "./target_dir/file.txt" will be created if it doesn't exist
@@ -22,5 +32,15 @@ int copy_file(char *from_path, char *to_path);
  */
 int copy_dir(char *dir, char *target_dir);
 
+/**
+ * Same as copy_dir, with the given options. NULL means the defaults.
+ *
+ * @example copy_dir_opts_t opts = { .parallel = 4, .preserve_mode = 1 };
+ *          copy_dir_with_opts("./dir", "./target_dir", &opts)
+ *
+ * @return 0 on success, -1 otherwise
+ */
+int copy_dir_with_opts(char *dir, char *target_dir, copy_dir_opts_t *opts);
+
 
 #endif
@@ -1,17 +0,0 @@
-
-//
-// get-element-by-id.h
-//
-// Copyright (c) 2014 Stephen Mathieson
-// MIT licensed
-//
-
-#ifndef GUMBO_GET_ELEMENT_BY_ID
-#define GUMBO_GET_ELEMENT_BY_ID 1
-
-#include "gumbo-parser/gumbo.h"
-
-GumboNode *
-gumbo_get_element_by_id(const char *, GumboNode *);
-
-#endif
@@ -1,11 +0,0 @@
-
-#ifndef GUMBO_GET_ELEMENTS_BY_TAG_NAME_H
-#define GUMBO_GET_ELEMENTS_BY_TAG_NAME_H 1
-
-#include "list/list.h"
-#include "gumbo-parser/gumbo.h"
-
-list_t *
-gumbo_get_elements_by_tag_name(const char *, GumboNode *);
-
-#endif
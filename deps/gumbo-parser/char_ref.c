@@ -33,14 +33,13 @@ const int kGumboNoChar = -1;
 // Table of named character entities, and functions for looking them up.
 // http://www.whatwg.org/specs/web-apps/current-work/multipage/named-character-references.html
 //
-// TODO(jdtang): I'd thought of using more efficient means of this, eg. binary
-// searching the table (which can only be done if we know for sure that there's
-// enough room in the buffer for our memcmps, otherwise we need to fall back on
-// linear search) or compiling the list of named entities to a Ragel state
-// machine.  But I'll start with the simple approach and optimize only if
-// profiling calls for it.  The one concession to efficiency is to store the
-// length of the entity with it, so that we don't need to run a strlen to detect
-// potential buffer overflows.
+// The table is sorted by name, byte by byte, which makes it a flattened trie:
+// the names starting with a given prefix are always a contiguous range of it,
+// and a name comes right before the longer names it is a prefix of.  The
+// lookup narrows that range one input character at a time, with two binary
+// searches, and stops as soon as it is empty.  The length of each entity is
+// stored with it, so that we don't need to run a strlen to tell names apart
+// from their extensions.
 typedef struct {
   const char* name;
   size_t length;
@@ -51,19 +50,16 @@ typedef struct {
 #define MULTI_CHAR_REF(name, code_point, code_point2) \
     { name, sizeof(name) - 1, { code_point, code_point2 } }
 
-// Versions with the semicolon must come before versions without the semicolon,
-// otherwise they'll match the invalid name first and record a parse error.
-// TODO(jdtang): Replace with a FSM that'll do longest-match-first and probably
-// give better performance besides.
+// Must stay sorted by name, see find_named_char_ref.
 static const NamedCharRef kNamedEntities[] = {
   CHAR_REF("AElig", 0xc6),
-  CHAR_REF("AMP;", 0x26),
   CHAR_REF("AMP", 0x26),
-  CHAR_REF("Aacute;", 0xc1),
+  CHAR_REF("AMP;", 0x26),
   CHAR_REF("Aacute", 0xc1),
+  CHAR_REF("Aacute;", 0xc1),
   CHAR_REF("Abreve;", 0x0102),
-  CHAR_REF("Acirc;", 0xc2),
   CHAR_REF("Acirc", 0xc2),
+  CHAR_REF("Acirc;", 0xc2),
   CHAR_REF("Acy;", 0x0410),
   CHAR_REF("Afr;", 0x0001d504),
   CHAR_REF("Agrave", 0xc0),
@@ -74,14 +70,14 @@ static const NamedCharRef kNamedEntities[] = {
   CHAR_REF("Aogon;", 0x0104),
   CHAR_REF("Aopf;", 0x0001d538),
   CHAR_REF("ApplyFunction;", 0x2061),
-  CHAR_REF("Aring;", 0xc5),
   CHAR_REF("Aring", 0xc5),
+  CHAR_REF("Aring;", 0xc5),
   CHAR_REF("Ascr;", 0x0001d49c),
   CHAR_REF("Assign;", 0x2254),
-  CHAR_REF("Atilde;", 0xc3),
   CHAR_REF("Atilde", 0xc3),
-  CHAR_REF("Auml;", 0xc4),
+  CHAR_REF("Atilde;", 0xc3),
   CHAR_REF("Auml", 0xc4),
+  CHAR_REF("Auml;", 0xc4),
   CHAR_REF("Backslash;", 0x2216),
   CHAR_REF("Barv;", 0x2ae7),
   CHAR_REF("Barwed;", 0x2306),
@@ -95,15 +91,15 @@ static const NamedCharRef kNamedEntities[] = {
   CHAR_REF("Bscr;", 0x212c),
   CHAR_REF("Bumpeq;", 0x224e),
   CHAR_REF("CHcy;", 0x0427),
-  CHAR_REF("COPY;", 0xa9),
   CHAR_REF("COPY", 0xa9),
+  CHAR_REF("COPY;", 0xa9),
   CHAR_REF("Cacute;", 0x0106),
   CHAR_REF("Cap;", 0x22d2),
   CHAR_REF("CapitalDifferentialD;", 0x2145),
   CHAR_REF("Cayleys;", 0x212d),
   CHAR_REF("Ccaron;", 0x010c),
-  CHAR_REF("Ccedil;", 0xc7),
   CHAR_REF("Ccedil", 0xc7),
+  CHAR_REF("Ccedil;", 0xc7),
   CHAR_REF("Ccirc;", 0x0108),
   CHAR_REF("Cconint;", 0x2230),
   CHAR_REF("Cdot;", 0x010a),
@@ -185,18 +181,18 @@ static const NamedCharRef kNamedEntities[] = {
   CHAR_REF("Dscr;", 0x0001d49f),
   CHAR_REF("Dstrok;", 0x0110),
   CHAR_REF("ENG;", 0x014a),
-  CHAR_REF("ETH;", 0xd0),
   CHAR_REF("ETH", 0xd0),
-  CHAR_REF("Eacute;", 0xc9),
+  CHAR_REF("ETH;", 0xd0),
   CHAR_REF("Eacute", 0xc9),
+  CHAR_REF("Eacute;", 0xc9),
   CHAR_REF("Ecaron;", 0x011a),
-  CHAR_REF("Ecirc;", 0xca),
   CHAR_REF("Ecirc", 0xca),
+  CHAR_REF("Ecirc;", 0xca),
   CHAR_REF("Ecy;", 0x042d),
   CHAR_REF("Edot;", 0x0116),
   CHAR_REF("Efr;", 0x0001d508),
-  CHAR_REF("Egrave;", 0xc8),
   CHAR_REF("Egrave", 0xc8),
+  CHAR_REF("Egrave;", 0xc8),
   CHAR_REF("Element;", 0x2208),
   CHAR_REF("Emacr;", 0x0112),
   CHAR_REF("EmptySmallSquare;", 0x25fb),
@@ -210,8 +206,8 @@ static const NamedCharRef kNamedEntities[] = {
   CHAR_REF("Escr;", 0x2130),
   CHAR_REF("Esim;", 0x2a73),
   CHAR_REF("Eta;", 0x0397),
-  CHAR_REF("Euml;", 0xcb),
   CHAR_REF("Euml", 0xcb),
+  CHAR_REF("Euml;", 0xcb),
   CHAR_REF("Exists;", 0x2203),
   CHAR_REF("ExponentialE;", 0x2147),
   CHAR_REF("Fcy;", 0x0424),
@@ -223,8 +219,8 @@ static const NamedCharRef kNamedEntities[] = {
   CHAR_REF("Fouriertrf;", 0x2131),
   CHAR_REF("Fscr;", 0x2131),
   CHAR_REF("GJcy;", 0x0403),
-  CHAR_REF("GT;", 0x3e),
   CHAR_REF("GT", 0x3e),
+  CHAR_REF("GT;", 0x3e),
   CHAR_REF("Gamma;", 0x0393),
   CHAR_REF("Gammad;", 0x03dc),
   CHAR_REF("Gbreve;", 0x011e),
@@ -259,15 +255,15 @@ static const NamedCharRef kNamedEntities[] = {
   CHAR_REF("IEcy;", 0x0415),
   CHAR_REF("IJlig;", 0x0132),
   CHAR_REF("IOcy;", 0x0401),
-  CHAR_REF("Iacute;", 0xcd),
   CHAR_REF("Iacute", 0xcd),
-  CHAR_REF("Icirc;", 0xce),
+  CHAR_REF("Iacute;", 0xcd),
   CHAR_REF("Icirc", 0xce),
+  CHAR_REF("Icirc;", 0xce),
   CHAR_REF("Icy;", 0x0418),
   CHAR_REF("Idot;", 0x0130),
   CHAR_REF("Ifr;", 0x2111),
-  CHAR_REF("Igrave;", 0xcc),
   CHAR_REF("Igrave", 0xcc),
+  CHAR_REF("Igrave;", 0xcc),
   CHAR_REF("Im;", 0x2111),
   CHAR_REF("Imacr;", 0x012a),
   CHAR_REF("ImaginaryI;", 0x2148),
@@ -283,8 +279,8 @@ static const NamedCharRef kNamedEntities[] = {
   CHAR_REF("Iscr;", 0x2110),
   CHAR_REF("Itilde;", 0x0128),
   CHAR_REF("Iukcy;", 0x0406),
-  CHAR_REF("Iuml;", 0xcf),
   CHAR_REF("Iuml", 0xcf),
+  CHAR_REF("Iuml;", 0xcf),
   CHAR_REF("Jcirc;", 0x0134),
   CHAR_REF("Jcy;", 0x0419),
   CHAR_REF("Jfr;", 0x0001d50d),
@@ -301,8 +297,8 @@ static const NamedCharRef kNamedEntities[] = {
   CHAR_REF("Kopf;", 0x0001d542),
   CHAR_REF("Kscr;", 0x0001d4a6),
   CHAR_REF("LJcy;", 0x0409),
-  CHAR_REF("LT;", 0x3c),
   CHAR_REF("LT", 0x3c),
+  CHAR_REF("LT;", 0x3c),
   CHAR_REF("Lacute;", 0x0139),
   CHAR_REF("Lambda;", 0x039b),
   CHAR_REF("Lang;", 0x27ea),
@@ -438,19 +434,19 @@ static const NamedCharRef kNamedEntities[] = {
   CHAR_REF("NotTildeTilde;", 0x2249),
   CHAR_REF("NotVerticalBar;", 0x2224),
   CHAR_REF("Nscr;", 0x0001d4a9),
-  CHAR_REF("Ntilde;", 0xd1),
   CHAR_REF("Ntilde", 0xd1),
+  CHAR_REF("Ntilde;", 0xd1),
   CHAR_REF("Nu;", 0x039d),
   CHAR_REF("OElig;", 0x0152),
-  CHAR_REF("Oacute;", 0xd3),
   CHAR_REF("Oacute", 0xd3),
-  CHAR_REF("Ocirc;", 0xd4),
+  CHAR_REF("Oacute;", 0xd3),
   CHAR_REF("Ocirc", 0xd4),
+  CHAR_REF("Ocirc;", 0xd4),
   CHAR_REF("Ocy;", 0x041e),
   CHAR_REF("Odblac;", 0x0150),
   CHAR_REF("Ofr;", 0x0001d512),
-  CHAR_REF("Ograve;", 0xd2),
   CHAR_REF("Ograve", 0xd2),
+  CHAR_REF("Ograve;", 0xd2),
   CHAR_REF("Omacr;", 0x014c),
   CHAR_REF("Omega;", 0x03a9),
   CHAR_REF("Omicron;", 0x039f),
@@ -459,10 +455,10 @@ static const NamedCharRef kNamedEntities[] = {
   CHAR_REF("OpenCurlyQuote;", 0x2018),
   CHAR_REF("Or;", 0x2a54),
   CHAR_REF("Oscr;", 0x0001d4aa),
-  CHAR_REF("Oslash;", 0xd8),
   CHAR_REF("Oslash", 0xd8),
-  CHAR_REF("Otilde;", 0xd5),
+  CHAR_REF("Oslash;", 0xd8),
   CHAR_REF("Otilde", 0xd5),
+  CHAR_REF("Otilde;", 0xd5),
   CHAR_REF("Otimes;", 0x2a37),
   CHAR_REF("Ouml", 0xd6),
   CHAR_REF("Ouml;", 0xd6),
@@ -489,14 +485,14 @@ static const NamedCharRef kNamedEntities[] = {
   CHAR_REF("Proportional;", 0x221d),
   CHAR_REF("Pscr;", 0x0001d4ab),
   CHAR_REF("Psi;", 0x03a8),
-  CHAR_REF("QUOT;", 0x22),
   CHAR_REF("QUOT", 0x22),
+  CHAR_REF("QUOT;", 0x22),
   CHAR_REF("Qfr;", 0x0001d514),
   CHAR_REF("Qopf;", 0x211a),
   CHAR_REF("Qscr;", 0x0001d4ac),
   CHAR_REF("RBarr;", 0x2910),
-  CHAR_REF("REG;", 0xae),
   CHAR_REF("REG", 0xae),
+  CHAR_REF("REG;", 0xae),
   CHAR_REF("Racute;", 0x0154),
   CHAR_REF("Rang;", 0x27eb),
   CHAR_REF("Rarr;", 0x21a0),
@@ -579,8 +575,8 @@ static const NamedCharRef kNamedEntities[] = {
   CHAR_REF("Superset;", 0x2283),
   CHAR_REF("SupersetEqual;", 0x2287),
   CHAR_REF("Supset;", 0x22d1),
-  CHAR_REF("THORN;", 0xde),
   CHAR_REF("THORN", 0xde),
+  CHAR_REF("THORN;", 0xde),
   CHAR_REF("TRADE;", 0x2122),
   CHAR_REF("TSHcy;", 0x040b),
   CHAR_REF("TScy;", 0x0426),
@@ -602,19 +598,19 @@ static const NamedCharRef kNamedEntities[] = {
   CHAR_REF("TripleDot;", 0x20db),
   CHAR_REF("Tscr;", 0x0001d4af),
   CHAR_REF("Tstrok;", 0x0166),
-  CHAR_REF("Uacute;", 0xda),
   CHAR_REF("Uacute", 0xda),
+  CHAR_REF("Uacute;", 0xda),
   CHAR_REF("Uarr;", 0x219f),
   CHAR_REF("Uarrocir;", 0x2949),
   CHAR_REF("Ubrcy;", 0x040e),
   CHAR_REF("Ubreve;", 0x016c),
-  CHAR_REF("Ucirc;", 0xdb),
   CHAR_REF("Ucirc", 0xdb),
+  CHAR_REF("Ucirc;", 0xdb),
   CHAR_REF("Ucy;", 0x0423),
   CHAR_REF("Udblac;", 0x0170),
   CHAR_REF("Ufr;", 0x0001d518),
-  CHAR_REF("Ugrave;", 0xd9),
   CHAR_REF("Ugrave", 0xd9),
+  CHAR_REF("Ugrave;", 0xd9),
   CHAR_REF("Umacr;", 0x016a),
   CHAR_REF("UnderBar;", 0x5f),
   CHAR_REF("UnderBrace;", 0x23df),
@@ -640,8 +636,8 @@ static const NamedCharRef kNamedEntities[] = {
   CHAR_REF("Uring;", 0x016e),
   CHAR_REF("Uscr;", 0x0001d4b0),
   CHAR_REF("Utilde;", 0x0168),
-  CHAR_REF("Uuml;", 0xdc),
   CHAR_REF("Uuml", 0xdc),
+  CHAR_REF("Uuml;", 0xdc),
   CHAR_REF("VDash;", 0x22ab),
   CHAR_REF("Vbar;", 0x2aeb),
   CHAR_REF("Vcy;", 0x0412),
@@ -689,30 +685,30 @@ static const NamedCharRef kNamedEntities[] = {
   CHAR_REF("Zfr;", 0x2128),
   CHAR_REF("Zopf;", 0x2124),
   CHAR_REF("Zscr;", 0x0001d4b5),
-  CHAR_REF("aacute;", 0xe1),
   CHAR_REF("aacute", 0xe1),
+  CHAR_REF("aacute;", 0xe1),
   CHAR_REF("abreve;", 0x0103),
   CHAR_REF("ac;", 0x223e),
   MULTI_CHAR_REF("acE;", 0x223e, 0x0333),
   CHAR_REF("acd;", 0x223f),
-  CHAR_REF("acirc;", 0xe2),
   CHAR_REF("acirc", 0xe2),
-  CHAR_REF("acute;", 0xb4),
+  CHAR_REF("acirc;", 0xe2),
   CHAR_REF("acute", 0xb4),
+  CHAR_REF("acute;", 0xb4),
   CHAR_REF("acy;", 0x0430),
-  CHAR_REF("aelig;", 0xe6),
   CHAR_REF("aelig", 0xe6),
+  CHAR_REF("aelig;", 0xe6),
   CHAR_REF("af;", 0x2061),
   CHAR_REF("afr;", 0x0001d51e),
-  CHAR_REF("agrave;", 0xe0),
   CHAR_REF("agrave", 0xe0),
+  CHAR_REF("agrave;", 0xe0),
   CHAR_REF("alefsym;", 0x2135),
   CHAR_REF("aleph;", 0x2135),
   CHAR_REF("alpha;", 0x03b1),
   CHAR_REF("amacr;", 0x0101),
   CHAR_REF("amalg;", 0x2a3f),
-  CHAR_REF("amp;", 0x26),
   CHAR_REF("amp", 0x26),
+  CHAR_REF("amp;", 0x26),
   CHAR_REF("and;", 0x2227),
   CHAR_REF("andand;", 0x2a55),
   CHAR_REF("andd;", 0x2a5c),
@@ -746,16 +742,16 @@ static const NamedCharRef kNamedEntities[] = {
   CHAR_REF("apos;", 0x27),
   CHAR_REF("approx;", 0x2248),
   CHAR_REF("approxeq;", 0x224a),
-  CHAR_REF("aring;", 0xe5),
   CHAR_REF("aring", 0xe5),
+  CHAR_REF("aring;", 0xe5),
   CHAR_REF("ascr;", 0x0001d4b6),
   CHAR_REF("ast;", 0x2a),
   CHAR_REF("asymp;", 0x2248),
   CHAR_REF("asympeq;", 0x224d),
-  CHAR_REF("atilde;", 0xe3),
   CHAR_REF("atilde", 0xe3),
-  CHAR_REF("auml;", 0xe4),
+  CHAR_REF("atilde;", 0xe3),
   CHAR_REF("auml", 0xe4),
+  CHAR_REF("auml;", 0xe4),
   CHAR_REF("awconint;", 0x2233),
   CHAR_REF("awint;", 0x2a11),
   CHAR_REF("bNot;", 0x2aed),
@@ -859,8 +855,8 @@ static const NamedCharRef kNamedEntities[] = {
   CHAR_REF("boxvr;", 0x251c),
   CHAR_REF("bprime;", 0x2035),
   CHAR_REF("breve;", 0x02d8),
-  CHAR_REF("brvbar;", 0xa6),
   CHAR_REF("brvbar", 0xa6),
+  CHAR_REF("brvbar;", 0xa6),
   CHAR_REF("bscr;", 0x0001d4b7),
   CHAR_REF("bsemi;", 0x204f),
   CHAR_REF("bsim;", 0x223d),
@@ -886,17 +882,17 @@ static const NamedCharRef kNamedEntities[] = {
   CHAR_REF("caron;", 0x02c7),
   CHAR_REF("ccaps;", 0x2a4d),
   CHAR_REF("ccaron;", 0x010d),
-  CHAR_REF("ccedil;", 0xe7),
   CHAR_REF("ccedil", 0xe7),
+  CHAR_REF("ccedil;", 0xe7),
   CHAR_REF("ccirc;", 0x0109),
   CHAR_REF("ccups;", 0x2a4c),
   CHAR_REF("ccupssm;", 0x2a50),
   CHAR_REF("cdot;", 0x010b),
-  CHAR_REF("cedil;", 0xb8),
   CHAR_REF("cedil", 0xb8),
+  CHAR_REF("cedil;", 0xb8),
   CHAR_REF("cemptyv;", 0x29b2),
-  CHAR_REF("cent;", 0xa2),
   CHAR_REF("cent", 0xa2),
+  CHAR_REF("cent;", 0xa2),
   CHAR_REF("centerdot;", 0xb7),
   CHAR_REF("cfr;", 0x0001d520),
   CHAR_REF("chcy;", 0x0447),
@@ -934,8 +930,8 @@ static const NamedCharRef kNamedEntities[] = {
   CHAR_REF("conint;", 0x222e),
   CHAR_REF("copf;", 0x0001d554),
   CHAR_REF("coprod;", 0x2210),
-  CHAR_REF("copy;", 0xa9),
   CHAR_REF("copy", 0xa9),
+  CHAR_REF("copy;", 0xa9),
   CHAR_REF("copysr;", 0x2117),
   CHAR_REF("crarr;", 0x21b5),
   CHAR_REF("cross;", 0x2717),
@@ -964,8 +960,8 @@ static const NamedCharRef kNamedEntities[] = {
   CHAR_REF("curlyeqsucc;", 0x22df),
   CHAR_REF("curlyvee;", 0x22ce),
   CHAR_REF("curlywedge;", 0x22cf),
-  CHAR_REF("curren;", 0xa4),
   CHAR_REF("curren", 0xa4),
+  CHAR_REF("curren;", 0xa4),
   CHAR_REF("curvearrowleft;", 0x21b6),
   CHAR_REF("curvearrowright;", 0x21b7),
   CHAR_REF("cuvee;", 0x22ce),
@@ -988,8 +984,8 @@ static const NamedCharRef kNamedEntities[] = {
   CHAR_REF("ddagger;", 0x2021),
   CHAR_REF("ddarr;", 0x21ca),
   CHAR_REF("ddotseq;", 0x2a77),
-  CHAR_REF("deg;", 0xb0),
   CHAR_REF("deg", 0xb0),
+  CHAR_REF("deg;", 0xb0),
   CHAR_REF("delta;", 0x03b4),
   CHAR_REF("demptyv;", 0x29b1),
   CHAR_REF("dfisht;", 0x297f),
@@ -1004,8 +1000,8 @@ static const NamedCharRef kNamedEntities[] = {
   CHAR_REF("digamma;", 0x03dd),
   CHAR_REF("disin;", 0x22f2),
   CHAR_REF("div;", 0xf7),
-  CHAR_REF("divide;", 0xf7),
   CHAR_REF("divide", 0xf7),
+  CHAR_REF("divide;", 0xf7),
   CHAR_REF("divideontimes;", 0x22c7),
   CHAR_REF("divonx;", 0x22c7),
   CHAR_REF("djcy;", 0x0452),
@@ -1041,13 +1037,13 @@ static const NamedCharRef kNamedEntities[] = {
   CHAR_REF("dzigrarr;", 0x27ff),
   CHAR_REF("eDDot;", 0x2a77),
   CHAR_REF("eDot;", 0x2251),
-  CHAR_REF("eacute;", 0xe9),
   CHAR_REF("eacute", 0xe9),
+  CHAR_REF("eacute;", 0xe9),
   CHAR_REF("easter;", 0x2a6e),
   CHAR_REF("ecaron;", 0x011b),
   CHAR_REF("ecir;", 0x2256),
-  CHAR_REF("ecirc;", 0xea),
   CHAR_REF("ecirc", 0xea),
+  CHAR_REF("ecirc;", 0xea),
   CHAR_REF("ecolon;", 0x2255),
   CHAR_REF("ecy;", 0x044d),
   CHAR_REF("edot;", 0x0117),
@@ -1055,8 +1051,8 @@ static const NamedCharRef kNamedEntities[] = {
   CHAR_REF("efDot;", 0x2252),
   CHAR_REF("efr;", 0x0001d522),
   CHAR_REF("eg;", 0x2a9a),
-  CHAR_REF("egrave;", 0xe8),
   CHAR_REF("egrave", 0xe8),
+  CHAR_REF("egrave;", 0xe8),
   CHAR_REF("egs;", 0x2a96),
   CHAR_REF("egsdot;", 0x2a98),
   CHAR_REF("el;", 0x2a99),
@@ -1097,10 +1093,10 @@ static const NamedCharRef kNamedEntities[] = {
   CHAR_REF("esdot;", 0x2250),
   CHAR_REF("esim;", 0x2242),
   CHAR_REF("eta;", 0x03b7),
-  CHAR_REF("eth;", 0xf0),
   CHAR_REF("eth", 0xf0),
-  CHAR_REF("euml;", 0xeb),
+  CHAR_REF("eth;", 0xf0),
   CHAR_REF("euml", 0xeb),
+  CHAR_REF("euml;", 0xeb),
   CHAR_REF("euro;", 0x20ac),
   CHAR_REF("excl;", 0x21),
   CHAR_REF("exist;", 0x2203),
@@ -1189,8 +1185,8 @@ static const NamedCharRef kNamedEntities[] = {
   CHAR_REF("gsim;", 0x2273),
   CHAR_REF("gsime;", 0x2a8e),
   CHAR_REF("gsiml;", 0x2a90),
-  CHAR_REF("gt;", 0x3e),
   CHAR_REF("gt", 0x3e),
+  CHAR_REF("gt;", 0x3e),
   CHAR_REF("gtcc;", 0x2aa7),
   CHAR_REF("gtcir;", 0x2a7a),
   CHAR_REF("gtdot;", 0x22d7),
@@ -1233,19 +1229,19 @@ static const NamedCharRef kNamedEntities[] = {
   CHAR_REF("hstrok;", 0x0127),
   CHAR_REF("hybull;", 0x2043),
   CHAR_REF("hyphen;", 0x2010),
-  CHAR_REF("iacute;", 0xed),
   CHAR_REF("iacute", 0xed),
+  CHAR_REF("iacute;", 0xed),
   CHAR_REF("ic;", 0x2063),
-  CHAR_REF("icirc;", 0xee),
   CHAR_REF("icirc", 0xee),
+  CHAR_REF("icirc;", 0xee),
   CHAR_REF("icy;", 0x0438),
   CHAR_REF("iecy;", 0x0435),
-  CHAR_REF("iexcl;", 0xa1),
   CHAR_REF("iexcl", 0xa1),
+  CHAR_REF("iexcl;", 0xa1),
   CHAR_REF("iff;", 0x21d4),
   CHAR_REF("ifr;", 0x0001d526),
-  CHAR_REF("igrave;", 0xec),
   CHAR_REF("igrave", 0xec),
+  CHAR_REF("igrave;", 0xec),
   CHAR_REF("ii;", 0x2148),
   CHAR_REF("iiiint;", 0x2a0c),
   CHAR_REF("iiint;", 0x222d),
@@ -1275,8 +1271,8 @@ static const NamedCharRef kNamedEntities[] = {
   CHAR_REF("iopf;", 0x0001d55a),
   CHAR_REF("iota;", 0x03b9),
   CHAR_REF("iprod;", 0x2a3c),
-  CHAR_REF("iquest;", 0xbf),
   CHAR_REF("iquest", 0xbf),
+  CHAR_REF("iquest;", 0xbf),
   CHAR_REF("iscr;", 0x0001d4be),
   CHAR_REF("isin;", 0x2208),
   CHAR_REF("isinE;", 0x22f9),
@@ -1287,8 +1283,8 @@ static const NamedCharRef kNamedEntities[] = {
   CHAR_REF("it;", 0x2062),
   CHAR_REF("itilde;", 0x0129),
   CHAR_REF("iukcy;", 0x0456),
-  CHAR_REF("iuml;", 0xef),
   CHAR_REF("iuml", 0xef),
+  CHAR_REF("iuml;", 0xef),
   CHAR_REF("jcirc;", 0x0135),
   CHAR_REF("jcy;", 0x0439),
   CHAR_REF("jfr;", 0x0001d527),
@@ -1322,8 +1318,8 @@ static const NamedCharRef kNamedEntities[] = {
   CHAR_REF("langd;", 0x2991),
   CHAR_REF("langle;", 0x27e8),
   CHAR_REF("lap;", 0x2a85),
-  CHAR_REF("laquo;", 0xab),
   CHAR_REF("laquo", 0xab),
+  CHAR_REF("laquo;", 0xab),
   CHAR_REF("larr;", 0x2190),
   CHAR_REF("larrb;", 0x21e4),
   CHAR_REF("larrbfs;", 0x291f),
@@ -1444,8 +1440,8 @@ static const NamedCharRef kNamedEntities[] = {
   CHAR_REF("lsquo;", 0x2018),
   CHAR_REF("lsquor;", 0x201a),
   CHAR_REF("lstrok;", 0x0142),
-  CHAR_REF("lt;", 0x3c),
   CHAR_REF("lt", 0x3c),
+  CHAR_REF("lt;", 0x3c),
   CHAR_REF("ltcc;", 0x2aa6),
   CHAR_REF("ltcir;", 0x2a79),
   CHAR_REF("ltdot;", 0x22d6),
@@ -1462,8 +1458,8 @@ static const NamedCharRef kNamedEntities[] = {
   MULTI_CHAR_REF("lvertneqq;", 0x2268, 0xfe00),
   MULTI_CHAR_REF("lvnE;", 0x2268, 0xfe00),
   CHAR_REF("mDDot;", 0x223a),
-  CHAR_REF("macr;", 0xaf),
   CHAR_REF("macr", 0xaf),
+  CHAR_REF("macr;", 0xaf),
   CHAR_REF("male;", 0x2642),
   CHAR_REF("malt;", 0x2720),
   CHAR_REF("maltese;", 0x2720),
@@ -1479,13 +1475,13 @@ static const NamedCharRef kNamedEntities[] = {
   CHAR_REF("measuredangle;", 0x2221),
   CHAR_REF("mfr;", 0x0001d52a),
   CHAR_REF("mho;", 0x2127),
-  CHAR_REF("micro;", 0xb5),
   CHAR_REF("micro", 0xb5),
+  CHAR_REF("micro;", 0xb5),
   CHAR_REF("mid;", 0x2223),
   CHAR_REF("midast;", 0x2a),
   CHAR_REF("midcir;", 0x2af0),
-  CHAR_REF("middot;", 0xb7),
   CHAR_REF("middot", 0xb7),
+  CHAR_REF("middot;", 0xb7),
   CHAR_REF("minus;", 0x2212),
   CHAR_REF("minusb;", 0x229f),
   CHAR_REF("minusd;", 0x2238),
@@ -1523,8 +1519,8 @@ static const NamedCharRef kNamedEntities[] = {
   CHAR_REF("natur;", 0x266e),
   CHAR_REF("natural;", 0x266e),
   CHAR_REF("naturals;", 0x2115),
-  CHAR_REF("nbsp;", 0xa0),
   CHAR_REF("nbsp", 0xa0),
+  CHAR_REF("nbsp;", 0xa0),
   MULTI_CHAR_REF("nbump;", 0x224e, 0x0338),
   MULTI_CHAR_REF("nbumpe;", 0x224f, 0x0338),
   CHAR_REF("ncap;", 0x2a43),
@@ -1582,6 +1578,7 @@ static const NamedCharRef kNamedEntities[] = {
   CHAR_REF("nltrie;", 0x22ec),
   CHAR_REF("nmid;", 0x2224),
   CHAR_REF("nopf;", 0x0001d55f),
+  CHAR_REF("not", 0xac),
   CHAR_REF("not;", 0xac),
   CHAR_REF("notin;", 0x2209),
   MULTI_CHAR_REF("notinE;", 0x22f9, 0x0338),
@@ -1593,7 +1590,6 @@ static const NamedCharRef kNamedEntities[] = {
   CHAR_REF("notniva;", 0x220c),
   CHAR_REF("notnivb;", 0x22fe),
   CHAR_REF("notnivc;", 0x22fd),
-  CHAR_REF("not", 0xac),
   CHAR_REF("npar;", 0x2226),
   CHAR_REF("nparallel;", 0x2226),
   MULTI_CHAR_REF("nparsl;", 0x2afd, 0x20e5),
@@ -1639,8 +1635,8 @@ static const NamedCharRef kNamedEntities[] = {
   CHAR_REF("nsupseteq;", 0x2289),
   MULTI_CHAR_REF("nsupseteqq;", 0x2ac6, 0x0338),
   CHAR_REF("ntgl;", 0x2279),
-  CHAR_REF("ntilde;", 0xf1),
   CHAR_REF("ntilde", 0xf1),
+  CHAR_REF("ntilde;", 0xf1),
   CHAR_REF("ntlg;", 0x2278),
   CHAR_REF("ntriangleleft;", 0x22ea),
   CHAR_REF("ntrianglelefteq;", 0x22ec),
@@ -1670,12 +1666,12 @@ static const NamedCharRef kNamedEntities[] = {
   CHAR_REF("nwarrow;", 0x2196),
   CHAR_REF("nwnear;", 0x2927),
   CHAR_REF("oS;", 0x24c8),
-  CHAR_REF("oacute;", 0xf3),
   CHAR_REF("oacute", 0xf3),
+  CHAR_REF("oacute;", 0xf3),
   CHAR_REF("oast;", 0x229b),
   CHAR_REF("ocir;", 0x229a),
-  CHAR_REF("ocirc;", 0xf4),
   CHAR_REF("ocirc", 0xf4),
+  CHAR_REF("ocirc;", 0xf4),
   CHAR_REF("ocy;", 0x043e),
   CHAR_REF("odash;", 0x229d),
   CHAR_REF("odblac;", 0x0151),
@@ -1686,8 +1682,8 @@ static const NamedCharRef kNamedEntities[] = {
   CHAR_REF("ofcir;", 0x29bf),
   CHAR_REF("ofr;", 0x0001d52c),
   CHAR_REF("ogon;", 0x02db),
-  CHAR_REF("ograve;", 0xf2),
   CHAR_REF("ograve", 0xf2),
+  CHAR_REF("ograve;", 0xf2),
   CHAR_REF("ogt;", 0x29c1),
   CHAR_REF("ohbar;", 0x29b5),
   CHAR_REF("ohm;", 0x03a9),
@@ -1711,28 +1707,28 @@ static const NamedCharRef kNamedEntities[] = {
   CHAR_REF("ord;", 0x2a5d),
   CHAR_REF("order;", 0x2134),
   CHAR_REF("orderof;", 0x2134),
-  CHAR_REF("ordf;", 0xaa),
   CHAR_REF("ordf", 0xaa),
-  CHAR_REF("ordm;", 0xba),
+  CHAR_REF("ordf;", 0xaa),
   CHAR_REF("ordm", 0xba),
+  CHAR_REF("ordm;", 0xba),
   CHAR_REF("origof;", 0x22b6),
   CHAR_REF("oror;", 0x2a56),
   CHAR_REF("orslope;", 0x2a57),
   CHAR_REF("orv;", 0x2a5b),
   CHAR_REF("oscr;", 0x2134),
-  CHAR_REF("oslash;", 0xf8),
   CHAR_REF("oslash", 0xf8),
+  CHAR_REF("oslash;", 0xf8),
   CHAR_REF("osol;", 0x2298),
-  CHAR_REF("otilde;", 0xf5),
   CHAR_REF("otilde", 0xf5),
+  CHAR_REF("otilde;", 0xf5),
   CHAR_REF("otimes;", 0x2297),
   CHAR_REF("otimesas;", 0x2a36),
-  CHAR_REF("ouml;", 0xf6),
   CHAR_REF("ouml", 0xf6),
+  CHAR_REF("ouml;", 0xf6),
   CHAR_REF("ovbar;", 0x233d),
   CHAR_REF("par;", 0x2225),
-  CHAR_REF("para;", 0xb6),
   CHAR_REF("para", 0xb6),
+  CHAR_REF("para;", 0xb6),
   CHAR_REF("parallel;", 0x2225),
   CHAR_REF("parsim;", 0x2af3),
   CHAR_REF("parsl;", 0x2afd),
@@ -1761,15 +1757,15 @@ static const NamedCharRef kNamedEntities[] = {
   CHAR_REF("plusdo;", 0x2214),
   CHAR_REF("plusdu;", 0x2a25),
   CHAR_REF("pluse;", 0x2a72),
-  CHAR_REF("plusmn;", 0xb1),
   CHAR_REF("plusmn", 0xb1),
+  CHAR_REF("plusmn;", 0xb1),
   CHAR_REF("plussim;", 0x2a26),
   CHAR_REF("plustwo;", 0x2a27),
   CHAR_REF("pm;", 0xb1),
   CHAR_REF("pointint;", 0x2a15),
   CHAR_REF("popf;", 0x0001d561),
-  CHAR_REF("pound;", 0xa3),
   CHAR_REF("pound", 0xa3),
+  CHAR_REF("pound;", 0xa3),
   CHAR_REF("pr;", 0x227a),
   CHAR_REF("prE;", 0x2ab3),
   CHAR_REF("prap;", 0x2ab7),
@@ -1808,8 +1804,8 @@ static const NamedCharRef kNamedEntities[] = {
   CHAR_REF("quatint;", 0x2a16),
   CHAR_REF("quest;", 0x3f),
   CHAR_REF("questeq;", 0x225f),
-  CHAR_REF("quot;", 0x22),
   CHAR_REF("quot", 0x22),
+  CHAR_REF("quot;", 0x22),
   CHAR_REF("rAarr;", 0x21db),
   CHAR_REF("rArr;", 0x21d2),
   CHAR_REF("rAtail;", 0x291c),
@@ -1823,8 +1819,8 @@ static const NamedCharRef kNamedEntities[] = {
   CHAR_REF("rangd;", 0x2992),
   CHAR_REF("range;", 0x29a5),
   CHAR_REF("rangle;", 0x27e9),
-  CHAR_REF("raquo;", 0xbb),
   CHAR_REF("raquo", 0xbb),
+  CHAR_REF("raquo;", 0xbb),
   CHAR_REF("rarr;", 0x2192),
   CHAR_REF("rarrap;", 0x2975),
   CHAR_REF("rarrb;", 0x21e5),
@@ -1862,8 +1858,8 @@ static const NamedCharRef kNamedEntities[] = {
   CHAR_REF("realpart;", 0x211c),
   CHAR_REF("reals;", 0x211d),
   CHAR_REF("rect;", 0x25ad),
-  CHAR_REF("reg;", 0xae),
   CHAR_REF("reg", 0xae),
+  CHAR_REF("reg;", 0xae),
   CHAR_REF("rfisht;", 0x297d),
   CHAR_REF("rfloor;", 0x230b),
   CHAR_REF("rfr;", 0x0001d52f),
@@ -1937,8 +1933,8 @@ static const NamedCharRef kNamedEntities[] = {
   CHAR_REF("searhk;", 0x2925),
   CHAR_REF("searr;", 0x2198),
   CHAR_REF("searrow;", 0x2198),
-  CHAR_REF("sect;", 0xa7),
   CHAR_REF("sect", 0xa7),
+  CHAR_REF("sect;", 0xa7),
   CHAR_REF("semi;", 0x3b),
   CHAR_REF("seswar;", 0x2929),
   CHAR_REF("setminus;", 0x2216),
@@ -1951,8 +1947,8 @@ static const NamedCharRef kNamedEntities[] = {
   CHAR_REF("shcy;", 0x0448),
   CHAR_REF("shortmid;", 0x2223),
   CHAR_REF("shortparallel;", 0x2225),
-  CHAR_REF("shy;", 0xad),
   CHAR_REF("shy", 0xad),
+  CHAR_REF("shy;", 0xad),
   CHAR_REF("sigma;", 0x03c3),
   CHAR_REF("sigmaf;", 0x03c2),
   CHAR_REF("sigmav;", 0x03c2),
@@ -2038,12 +2034,12 @@ static const NamedCharRef kNamedEntities[] = {
   CHAR_REF("succsim;", 0x227f),
   CHAR_REF("sum;", 0x2211),
   CHAR_REF("sung;", 0x266a),
-  CHAR_REF("sup1;", 0xb9),
   CHAR_REF("sup1", 0xb9),
-  CHAR_REF("sup2;", 0xb2),
+  CHAR_REF("sup1;", 0xb9),
   CHAR_REF("sup2", 0xb2),
-  CHAR_REF("sup3;", 0xb3),
+  CHAR_REF("sup2;", 0xb2),
   CHAR_REF("sup3", 0xb3),
+  CHAR_REF("sup3;", 0xb3),
   CHAR_REF("sup;", 0x2283),
   CHAR_REF("supE;", 0x2ac6),
   CHAR_REF("supdot;", 0x2abe),
@@ -2070,8 +2066,8 @@ static const NamedCharRef kNamedEntities[] = {
   CHAR_REF("swarr;", 0x2199),
   CHAR_REF("swarrow;", 0x2199),
   CHAR_REF("swnwar;", 0x292a),
-  CHAR_REF("szlig;", 0xdf),
   CHAR_REF("szlig", 0xdf),
+  CHAR_REF("szlig;", 0xdf),
   CHAR_REF("target;", 0x2316),
   CHAR_REF("tau;", 0x03c4),
   CHAR_REF("tbrk;", 0x23b4),
@@ -2091,11 +2087,11 @@ static const NamedCharRef kNamedEntities[] = {
   CHAR_REF("thinsp;", 0x2009),
   CHAR_REF("thkap;", 0x2248),
   CHAR_REF("thksim;", 0x223c),
-  CHAR_REF("thorn;", 0xfe),
   CHAR_REF("thorn", 0xfe),
+  CHAR_REF("thorn;", 0xfe),
   CHAR_REF("tilde;", 0x02dc),
-  CHAR_REF("times;", 0xd7),
   CHAR_REF("times", 0xd7),
+  CHAR_REF("times;", 0xd7),
   CHAR_REF("timesb;", 0x22a0),
   CHAR_REF("timesbar;", 0x2a31),
   CHAR_REF("timesd;", 0x2a30),
@@ -2132,21 +2128,21 @@ static const NamedCharRef kNamedEntities[] = {
   CHAR_REF("twoheadrightarrow;", 0x21a0),
   CHAR_REF("uArr;", 0x21d1),
   CHAR_REF("uHar;", 0x2963),
-  CHAR_REF("uacute;", 0xfa),
   CHAR_REF("uacute", 0xfa),
+  CHAR_REF("uacute;", 0xfa),
   CHAR_REF("uarr;", 0x2191),
   CHAR_REF("ubrcy;", 0x045e),
   CHAR_REF("ubreve;", 0x016d),
-  CHAR_REF("ucirc;", 0xfb),
   CHAR_REF("ucirc", 0xfb),
+  CHAR_REF("ucirc;", 0xfb),
   CHAR_REF("ucy;", 0x0443),
   CHAR_REF("udarr;", 0x21c5),
   CHAR_REF("udblac;", 0x0171),
   CHAR_REF("udhar;", 0x296e),
   CHAR_REF("ufisht;", 0x297e),
   CHAR_REF("ufr;", 0x0001d532),
-  CHAR_REF("ugrave;", 0xf9),
   CHAR_REF("ugrave", 0xf9),
+  CHAR_REF("ugrave;", 0xf9),
   CHAR_REF("uharl;", 0x21bf),
   CHAR_REF("uharr;", 0x21be),
   CHAR_REF("uhblk;", 0x2580),
@@ -2155,8 +2151,8 @@ static const NamedCharRef kNamedEntities[] = {
   CHAR_REF("ulcrop;", 0x230f),
   CHAR_REF("ultri;", 0x25f8),
   CHAR_REF("umacr;", 0x016b),
-  CHAR_REF("uml;", 0xa8),
   CHAR_REF("uml", 0xa8),
+  CHAR_REF("uml;", 0xa8),
   CHAR_REF("uogon;", 0x0173),
   CHAR_REF("uopf;", 0x0001d566),
   CHAR_REF("uparrow;", 0x2191),
@@ -2179,8 +2175,8 @@ static const NamedCharRef kNamedEntities[] = {
   CHAR_REF("utri;", 0x25b5),
   CHAR_REF("utrif;", 0x25b4),
   CHAR_REF("uuarr;", 0x21c8),
-  CHAR_REF("uuml;", 0xfc),
   CHAR_REF("uuml", 0xfc),
+  CHAR_REF("uuml;", 0xfc),
   CHAR_REF("uwangle;", 0x29a7),
   CHAR_REF("vArr;", 0x21d5),
   CHAR_REF("vBar;", 0x2ae8),
@@ -2259,20 +2255,20 @@ static const NamedCharRef kNamedEntities[] = {
   CHAR_REF("xutri;", 0x25b3),
   CHAR_REF("xvee;", 0x22c1),
   CHAR_REF("xwedge;", 0x22c0),
-  CHAR_REF("yacute;", 0xfd),
   CHAR_REF("yacute", 0xfd),
+  CHAR_REF("yacute;", 0xfd),
   CHAR_REF("yacy;", 0x044f),
   CHAR_REF("ycirc;", 0x0177),
   CHAR_REF("ycy;", 0x044b),
-  CHAR_REF("yen;", 0xa5),
   CHAR_REF("yen", 0xa5),
+  CHAR_REF("yen;", 0xa5),
   CHAR_REF("yfr;", 0x0001d536),
   CHAR_REF("yicy;", 0x0457),
   CHAR_REF("yopf;", 0x0001d56a),
   CHAR_REF("yscr;", 0x0001d4ce),
   CHAR_REF("yucy;", 0x044e),
-  CHAR_REF("yuml;", 0xff),
   CHAR_REF("yuml", 0xff),
+  CHAR_REF("yuml;", 0xff),
   CHAR_REF("zacute;", 0x017a),
   CHAR_REF("zcaron;", 0x017e),
   CHAR_REF("zcy;", 0x0437),
@@ -2286,10 +2282,11 @@ static const NamedCharRef kNamedEntities[] = {
   CHAR_REF("zscr;", 0x0001d4cf),
   CHAR_REF("zwj;", 0x200d),
   CHAR_REF("zwnj;", 0x200c),
-  // Terminator.
-  CHAR_REF("", -1)
 };
 
+static const size_t kNumNamedEntities =
+    sizeof(kNamedEntities) / sizeof(kNamedEntities[0]);
+
 // Table of replacement characters.  The spec specifies that any occurrence of
 // the first character should be replaced by the second character, and a parse
 // error recorded.
@@ -2454,19 +2451,52 @@ static bool consume_numeric_ref(
   return status;
 }
 
+// Returns the first entity in [lo, hi) whose character at index i is not less
+// than c (or, with 'after', greater than c).  All of them are at least i + 1
+// characters long.
+static size_t search_char_refs(
+    size_t lo, size_t hi, size_t i, unsigned char c, bool after) {
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    unsigned char current = (unsigned char) kNamedEntities[mid].name[i];
+    if (current < c || (after && current == c)) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+// Consumes the longest entity name the input starts with, as the spec asks,
+// and returns it, or NULL if there's none.
 static const NamedCharRef* find_named_char_ref(Utf8Iterator* input) {
-  for (int i = 0; kNamedEntities[i].codepoints.first != -1; ++i) {
-    const NamedCharRef* current = &kNamedEntities[i];
-    assert(strlen(current->name) == current->length);
-    if (utf8iterator_maybe_consume_match(
-        input, current->name, current->length, true)) {
-      assert(current->name != NULL);
-      assert(current->length > 0);
-      assert(current->codepoints.first != kGumboNoChar);
-      return current;
+  const char* start = utf8iterator_get_char_pointer(input);
+  const char* end = utf8iterator_get_end_pointer(input);
+  const NamedCharRef* match = NULL;
+  size_t lo = 0;
+  size_t hi = kNumNamedEntities;
+  for (size_t i = 0; lo < hi; ++i) {
+    // [lo, hi) holds the entities starting with the first i input characters,
+    // the one that is exactly those characters, if any, coming first.
+    if (kNamedEntities[lo].length == i) {
+      match = &kNamedEntities[lo++];
+    }
+    if (start + i == end) {
+      break;
+    }
+    unsigned char c = (unsigned char) start[i];
+    lo = search_char_refs(lo, hi, i, c, false);
+    hi = search_char_refs(lo, hi, i, c, true);
+  }
+  if (match) {
+    assert(strlen(match->name) == match->length);
+    assert(match->codepoints.first != kGumboNoChar);
+    for (size_t i = 0; i < match->length; ++i) {
+      utf8iterator_next(input);
     }
   }
-  return NULL;
+  return match;
 }
 
 static bool is_legal_attribute_char_next(Utf8Iterator* input) {
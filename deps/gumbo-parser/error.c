@@ -87,6 +87,7 @@ static void handle_parser_error(GumboParser* parser,
       return;
     case GUMBO_TOKEN_WHITESPACE:
     case GUMBO_TOKEN_CHARACTER:
+    case GUMBO_TOKEN_TEXT:
       print_message(parser, output, "Character tokens aren't legal here");
       return;
     case GUMBO_TOKEN_NULL:
@@ -135,7 +136,7 @@ static const char* find_next_newline(
 
 GumboError* gumbo_add_error(GumboParser* parser) {
   int max_errors = parser->_options->max_errors;
-  if (max_errors < 0 && parser->_output->errors.length >= max_errors) {
+  if (max_errors >= 0 && parser->_output->errors.length >= (unsigned int) max_errors) {
     return NULL;
   }
   GumboError* error = gumbo_parser_allocate(parser, sizeof(GumboError));
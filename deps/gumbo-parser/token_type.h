@@ -30,7 +30,10 @@ typedef enum {
   GUMBO_TOKEN_WHITESPACE,
   GUMBO_TOKEN_CHARACTER,
   GUMBO_TOKEN_NULL,
-  GUMBO_TOKEN_EOF
+  GUMBO_TOKEN_EOF,
+  // A run of characters, only emitted once enabled with
+  // gumbo_tokenizer_set_emit_text.
+  GUMBO_TOKEN_TEXT
 } GumboTokenType;
 
 #ifdef __cplusplus
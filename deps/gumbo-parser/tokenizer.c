@@ -136,6 +136,10 @@ typedef struct GumboInternalTokenizerState {
   // markup declaration state.
   bool _is_current_node_foreign;
 
+  // A flag indicating whether runs of text are emitted as a single token.  Set
+  // by gumbo_tokenizer_set_emit_text.
+  bool _emit_text;
+
   // Certain states (notably character references) may emit two character tokens
   // at once, but the contract for lex() fills in only one token at a time.  The
   // extra character is buffered here, and then this is checked on entry to
@@ -503,6 +507,23 @@ static bool emit_current_char(GumboParser* parser, GumboToken* output) {
   return RETURN_SUCCESS;
 }
 
+// Writes the current input character out as a character token, or when text
+// runs are enabled, the whole run of plain text it starts as a text token.
+// Always returns RETURN_SUCCESS.
+static bool emit_current_text(GumboParser* parser, GumboToken* output) {
+  GumboTokenizerState* tokenizer = parser->_tokenizer_state;
+  int c = utf8iterator_current(&tokenizer->_input);
+  if (!tokenizer->_emit_text ||
+      get_char_token_type(c) != GUMBO_TOKEN_CHARACTER ||
+      !utf8iterator_is_text(&tokenizer->_input)) {
+    return emit_current_char(parser, output);
+  }
+  utf8iterator_skip_text(&tokenizer->_input);
+  output->type = GUMBO_TOKEN_TEXT;
+  finish_token(parser, output);
+  return RETURN_SUCCESS;
+}
+
 // Writes out a doctype token, copying it from the tokenizer state.
 static void emit_doctype(GumboParser* parser, GumboToken* output) {
   output->type = GUMBO_TOKEN_DOCTYPE;
@@ -848,6 +869,7 @@ void gumbo_tokenizer_state_init(
   gumbo_tokenizer_set_state(parser, GUMBO_LEX_DATA);
   tokenizer->_reconsume_current_input = false;
   tokenizer->_is_current_node_foreign = false;
+  tokenizer->_emit_text = false;
   tokenizer->_tag_state._last_start_tag = GUMBO_TAG_LAST;
 
   tokenizer->_buffered_emit_char = kGumboNoChar;
@@ -877,6 +899,10 @@ void gumbo_tokenizer_set_state(GumboParser* parser, GumboTokenizerEnum state) {
   parser->_tokenizer_state->_state = state;
 }
 
+void gumbo_tokenizer_set_emit_text(GumboParser* parser, bool emit_text) {
+  parser->_tokenizer_state->_emit_text = emit_text;
+}
+
 void gumbo_tokenizer_set_is_current_node_foreign(
     GumboParser* parser, bool is_foreign) {
   if (is_foreign != parser->_tokenizer_state->_is_current_node_foreign) {
@@ -908,7 +934,7 @@ static StateResult handle_data_state(
       emit_char(parser, c, output);
       return RETURN_ERROR;
     default:
-      return emit_current_char(parser, output);
+      return emit_current_text(parser, output);
   }
 }
 
@@ -939,7 +965,7 @@ static StateResult handle_rcdata_state(
     case -1:
       return emit_eof(parser, output);
     default:
-      return emit_current_char(parser, output);
+      return emit_current_text(parser, output);
   }
 }
 
@@ -966,7 +992,7 @@ static StateResult handle_rawtext_state(
     case -1:
       return emit_eof(parser, output);
     default:
-      return emit_current_char(parser, output);
+      return emit_current_text(parser, output);
   }
 }
 
@@ -985,7 +1011,7 @@ static StateResult handle_script_state(
     case -1:
       return emit_eof(parser, output);
     default:
-      return emit_current_char(parser, output);
+      return emit_current_text(parser, output);
   }
 }
 
@@ -999,7 +1025,7 @@ static StateResult handle_plaintext_state(
     case -1:
       return emit_eof(parser, output);
     default:
-      return emit_current_char(parser, output);
+      return emit_current_text(parser, output);
   }
 }
 
@@ -66,6 +66,7 @@ typedef struct GumboInternalToken {
     GumboTag end_tag;
     const char* text;    // For comments.
     int character;      // For character, whitespace, null, and EOF tokens.
+                        // Text tokens only have their original_text.
   } v;
 } GumboToken;
 
@@ -91,6 +92,16 @@ void gumbo_tokenizer_set_state(
 void gumbo_tokenizer_set_is_current_node_foreign(
     struct GumboInternalParser* parser, bool is_foreign);
 
+// Flags whether runs of plain ASCII text in the data, RCDATA, RAWTEXT, script
+// and plaintext states are emitted as a single GUMBO_TOKEN_TEXT token, spanning
+// the whole run in its original_text, instead of one token per character.
+// A run starts at a character that isn't whitespace and ends right before the
+// next character needing any processing.  This is only meant for callers
+// driving the tokenizer themselves, as the tree construction stage expects
+// one token per character.
+void gumbo_tokenizer_set_emit_text(
+    struct GumboInternalParser* parser, bool emit_text);
+
 // Lexes a single token from the specified buffer, filling the output with the
 // parsed GumboToken data structure.  Returns true for a successful
 // tokenization, false if a parse error occurs.
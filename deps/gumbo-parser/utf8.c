@@ -27,6 +27,16 @@
 #include "util.h"
 #include "vector.h"
 
+#if defined(__GNUC__) && defined(__SSE2__)
+#include <emmintrin.h>
+#define GUMBO_SSE2 1
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define GUMBO_AVX2 1
+#endif
+
 const int kUtf8ReplacementChar = 0xFFFD;
 
 // Reference material:
@@ -182,6 +192,101 @@ static void update_position(Utf8Iterator* iter) {
   }
 }
 
+// Plain text is the run of ASCII characters the tokenizer can pass through as
+// is: printable characters and newlines, but not the characters starting
+// markup or character references, nor the ones read_char has to rewrite or
+// report (NUL, \r, other controls and DEL).  Tabs are left out as well, since
+// their column depends on the tab stop.
+static bool is_text_char(unsigned char c) {
+  return (c >= ' ' && c < 0x7F && c != '<' && c != '&') || c == '\n';
+}
+
+static const char* find_text_end_scalar(const char* c, const char* end) {
+  while (c < end && is_text_char((unsigned char) *c)) {
+    ++c;
+  }
+  return c;
+}
+
+#ifdef GUMBO_SSE2
+// Checks 16 bytes at a time.  The signed comparison against ' ' catches both
+// the controls and every byte of a multibyte sequence.
+static const char* find_text_end_sse2(const char* c, const char* end) {
+  const __m128i space = _mm_set1_epi8(' ');
+  const __m128i newline = _mm_set1_epi8('\n');
+  const __m128i lt = _mm_set1_epi8('<');
+  const __m128i amp = _mm_set1_epi8('&');
+  const __m128i del = _mm_set1_epi8(0x7F);
+  for (; end - c >= 16; c += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*) c);
+    __m128i stop = _mm_andnot_si128(
+        _mm_cmpeq_epi8(v, newline), _mm_cmplt_epi8(v, space));
+    stop = _mm_or_si128(stop, _mm_cmpeq_epi8(v, lt));
+    stop = _mm_or_si128(stop, _mm_cmpeq_epi8(v, amp));
+    stop = _mm_or_si128(stop, _mm_cmpeq_epi8(v, del));
+    int mask = _mm_movemask_epi8(stop);
+    if (mask) {
+      return c + __builtin_ctz(mask);
+    }
+  }
+  return find_text_end_scalar(c, end);
+}
+#endif
+
+#ifdef GUMBO_AVX2
+// Same as above, 32 bytes at a time.  Only called once the CPU is known to
+// support AVX2, see init_find_text_end.
+__attribute__((target("avx2")))
+static const char* find_text_end_avx2(const char* c, const char* end) {
+  const __m256i space = _mm256_set1_epi8(' ');
+  const __m256i newline = _mm256_set1_epi8('\n');
+  const __m256i lt = _mm256_set1_epi8('<');
+  const __m256i amp = _mm256_set1_epi8('&');
+  const __m256i del = _mm256_set1_epi8(0x7F);
+  for (; end - c >= 32; c += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i*) c);
+    __m256i stop = _mm256_andnot_si256(
+        _mm256_cmpeq_epi8(v, newline), _mm256_cmpgt_epi8(space, v));
+    stop = _mm256_or_si256(stop, _mm256_cmpeq_epi8(v, lt));
+    stop = _mm256_or_si256(stop, _mm256_cmpeq_epi8(v, amp));
+    stop = _mm256_or_si256(stop, _mm256_cmpeq_epi8(v, del));
+    unsigned int mask = (unsigned int) _mm256_movemask_epi8(stop);
+    if (mask) {
+      return c + __builtin_ctz(mask);
+    }
+  }
+  return find_text_end_scalar(c, end);
+}
+#endif
+
+typedef const char* (*FindTextEnd)(const char*, const char*);
+
+// Valid from the start, as every CPU of the target has SSE2 when it is
+// compiled in.  The constructor below only widens it, before any thread
+// exists that could read it.
+#if defined(GUMBO_SSE2)
+static FindTextEnd find_text_end_impl = find_text_end_sse2;
+#else
+static FindTextEnd find_text_end_impl = find_text_end_scalar;
+#endif
+
+#if defined(GUMBO_AVX2)
+// Picks AVX2 when the CPU supports it.
+__attribute__((constructor))
+static void init_find_text_end(void) {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    find_text_end_impl = find_text_end_avx2;
+  }
+}
+#endif
+
+// Returns a pointer to the first byte in [c, end) that isn't plain text, or
+// end.
+static const char* find_text_end(const char* c, const char* end) {
+  return find_text_end_impl(c, end);
+}
+
 // Returns true if this Unicode code point is in the list of characters
 // forbidden by the HTML5 spec, such as undefined control chars.
 bool utf8_is_invalid_code_point(int c) {
@@ -219,6 +324,38 @@ void utf8iterator_next(Utf8Iterator* iter) {
   }
 }
 
+bool utf8iterator_is_text(const Utf8Iterator* iter) {
+  // Looks at the input rather than the code point, which may be a lone \r
+  // read as a newline.
+  return iter->_start < iter->_end &&
+      is_text_char((unsigned char) *iter->_start);
+}
+
+void utf8iterator_skip_text(Utf8Iterator* iter) {
+  assert(utf8iterator_is_text(iter));
+  const char* last = find_text_end(iter->_start + 1, iter->_end) - 1;
+  if (last == iter->_start) {
+    return;
+  }
+  // Everything before the last character is consumed here, the same way
+  // utf8iterator_next would have one byte at a time.
+  const char* newline = NULL;
+  for (const char* c = iter->_start;
+       (c = memchr(c, '\n', last - c)) != NULL; ++c) {
+    newline = c;
+    ++iter->_pos.line;
+  }
+  if (newline) {
+    iter->_pos.column = last - newline;
+  } else {
+    iter->_pos.column += last - iter->_start;
+  }
+  iter->_pos.offset += last - iter->_start;
+  iter->_start = last;
+  iter->_width = 1;
+  iter->_current = (unsigned char) *last;
+}
+
 int utf8iterator_current(const Utf8Iterator* iter) {
   return iter->_current;
 }
@@ -232,6 +369,10 @@ const char* utf8iterator_get_char_pointer(const Utf8Iterator* iter) {
   return iter->_start;
 }
 
+const char* utf8iterator_get_end_pointer(const Utf8Iterator* iter) {
+  return iter->_end;
+}
+
 bool utf8iterator_maybe_consume_match(
     Utf8Iterator* iter, const char* prefix, size_t length,
     bool case_sensitive) {
@@ -88,6 +88,17 @@ void utf8iterator_init(
 // Advances the current position by one code point.
 void utf8iterator_next(Utf8Iterator* iter);
 
+// Returns true if the current character is plain ASCII text, that is a
+// character utf8iterator_skip_text can skip.
+bool utf8iterator_is_text(const Utf8Iterator* iter);
+
+// Advances the current position to the last character of the run of plain
+// ASCII text starting at the current character, which must be plain text
+// itself.  Text is a printable character other than '<' and '&', or a
+// newline; runs of it are found 16 or 32 bytes at a time where SSE2 or AVX2
+// is available.
+void utf8iterator_skip_text(Utf8Iterator* iter);
+
 // Returns the current code point as an integer.
 int utf8iterator_current(const Utf8Iterator* iter);
 
@@ -98,6 +109,12 @@ void utf8iterator_get_position(
 // Retrieves a character pointer to the start of the current character.
 const char* utf8iterator_get_char_pointer(const Utf8Iterator* iter);
 
+// Retrieves a character pointer to 1 past the end of the buffer.  This is
+// necessary for certain state machines and string comparisons that would like
+// to look directly for ASCII text in the buffer without going through the
+// decoder.
+const char* utf8iterator_get_end_pointer(const Utf8Iterator* iter);
+
 // If the upcoming text in the buffer matches the specified prefix (which has
 // length 'length'), consume it and return true.  Otherwise, return false with
 // no other effects.  If the length of the string would overflow the buffer,
@@ -11,6 +11,142 @@
 #include <stdlib.h>
 #include "http-get.h"
 
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
+/**
+ * Process wide client context: a share holding the DNS cache, TLS sessions
+ * and connections of every request that does not bring its own share, and
+ * a pool of easy handles attached to it, so that each request reuses the
+ * lookups, sessions and connections of the previous ones.
+ */
+
+#define HTTP_GET_POOL_MAX 16
+
+static CURLSH *http_get_global_share = NULL;
+static CURL *http_get_pool[HTTP_GET_POOL_MAX];
+static int http_get_pool_len = 0;
+
+#ifdef HAVE_PTHREADS
+static pthread_mutex_t http_get_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t http_get_share_locks[CURL_LOCK_DATA_LAST];
+
+#define HTTP_GET_LOCK() pthread_mutex_lock(&http_get_mutex)
+#define HTTP_GET_UNLOCK() pthread_mutex_unlock(&http_get_mutex)
+
+static void http_get_share_lock(CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr) {
+  pthread_mutex_lock(&http_get_share_locks[data]);
+}
+
+static void http_get_share_unlock(CURL *handle, curl_lock_data data, void *userptr) {
+  pthread_mutex_unlock(&http_get_share_locks[data]);
+}
+#else
+#define HTTP_GET_LOCK()
+#define HTTP_GET_UNLOCK()
+#endif
+
+/**
+ * The process wide share, created on first use
+ */
+
+void *http_get_share(void) {
+  HTTP_GET_LOCK();
+
+  if (!http_get_global_share && CURLE_OK == curl_global_init(CURL_GLOBAL_DEFAULT)) {
+    CURLSH *share = curl_share_init();
+
+    if (share) {
+#ifdef HAVE_PTHREADS
+      for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        pthread_mutex_init(&http_get_share_locks[i], NULL);
+      }
+      curl_share_setopt(share, CURLSHOPT_LOCKFUNC, http_get_share_lock);
+      curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, http_get_share_unlock);
+#endif
+      curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+      curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+      curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+    } else {
+      curl_global_cleanup();
+    }
+
+    http_get_global_share = share;
+  }
+
+  CURLSH *share = http_get_global_share;
+  HTTP_GET_UNLOCK();
+
+  return share;
+}
+
+/**
+ * Free the pooled handles and the process wide share
+ */
+
+void http_get_cleanup(void) {
+  HTTP_GET_LOCK();
+
+  while (http_get_pool_len > 0) {
+    curl_easy_cleanup(http_get_pool[--http_get_pool_len]);
+  }
+
+  if (http_get_global_share) {
+    curl_share_cleanup(http_get_global_share);
+    http_get_global_share = NULL;
+    curl_global_cleanup();
+  }
+
+  HTTP_GET_UNLOCK();
+}
+
+/**
+ * An easy handle attached to `share`, taken from the pool when `share` is
+ * the process wide one
+ */
+
+static CURL *http_get_handle(CURLSH *share) {
+  CURL *req = NULL;
+
+  if (share && share == http_get_global_share) {
+    HTTP_GET_LOCK();
+    if (http_get_pool_len > 0) req = http_get_pool[--http_get_pool_len];
+    HTTP_GET_UNLOCK();
+
+    // the share outlives curl_easy_reset()
+    if (req) return req;
+  }
+
+  if ((req = curl_easy_init()) && share) {
+    curl_easy_setopt(req, CURLOPT_SHARE, share);
+  }
+
+  return req;
+}
+
+/**
+ * Give `req` back to the pool, or free it. Pooled handles keep their own
+ * caches too, on top of the share.
+ */
+
+static void http_get_release(CURL *req, CURLSH *share) {
+  if (!req) return;
+
+  if (share && share == http_get_global_share) {
+    curl_easy_reset(req);
+
+    HTTP_GET_LOCK();
+    if (http_get_pool_len < HTTP_GET_POOL_MAX) {
+      http_get_pool[http_get_pool_len++] = req;
+      req = NULL;
+    }
+    HTTP_GET_UNLOCK();
+  }
+
+  if (req) curl_easy_cleanup(req);
+}
+
 /**
  * HTTP GET write callback
  */
@@ -40,16 +176,106 @@ static size_t http_get_cb(void *contents, size_t size, size_t nmemb, void *userp
   return realsize;
 }
 
+/**
+ * Copy the value of the `name` header line in `line`, without the
+ * trailing CRLF, or return NULL if it is another header
+ */
+
+static char *http_get_header_value(const char *line, size_t len, const char *name) {
+  size_t name_len = strlen(name);
+  size_t i = 0;
+
+  if (len <= name_len || ':' != line[name_len]) return NULL;
+
+  for (i = 0; i < name_len; i++) {
+    char c = line[i];
+    if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+    if (c != name[i]) return NULL;
+  }
+
+  line += name_len + 1;
+  len -= name_len + 1;
+
+  while (len > 0 && (' ' == *line || '\t' == *line)) {
+    line++;
+    len--;
+  }
+  while (len > 0 && ('\r' == line[len - 1] || '\n' == line[len - 1])) {
+    len--;
+  }
+
+  char *value = malloc(len + 1);
+  if (!value) return NULL;
+
+  memcpy(value, line, len);
+  value[len] = 0;
+  return value;
+}
+
+/**
+ * HTTP GET header callback, keeps the cache validators
+ */
+
+static size_t http_get_header_cb(char *buffer, size_t size, size_t nitems, void *userp) {
+  size_t len = size * nitems;
+  http_get_response_t *res = userp;
+  char *value = NULL;
+
+  // a redirect starts a new set of headers
+  if (len > 5 && 0 == strncmp(buffer, "HTTP/", 5)) {
+    free(res->etag);
+    free(res->last_modified);
+    res->etag = NULL;
+    res->last_modified = NULL;
+  } else if ((value = http_get_header_value(buffer, len, "etag"))) {
+    free(res->etag);
+    res->etag = value;
+  } else if ((value = http_get_header_value(buffer, len, "last-modified"))) {
+    free(res->last_modified);
+    res->last_modified = value;
+  }
+
+  return len;
+}
+
 http_get_response_t *http_get_shared(const char *url, CURLSH *share) {
-  CURL *req = curl_easy_init();
+  return http_get_shared_conditional(url, share, NULL, NULL);
+}
+
+http_get_response_t *http_get_shared_conditional(const char *url, CURLSH *share, const char *etag, const char *last_modified) {
+  if (!share) share = http_get_share();
+
+  CURL *req = http_get_handle(share);
+  struct curl_slist *headers = NULL;
 
   http_get_response_t *res = malloc(sizeof(http_get_response_t));
   memset(res, 0, sizeof(http_get_response_t));
 
-  if (share) {
-    curl_easy_setopt(req, CURLOPT_SHARE, share);
+  if (etag && *etag) {
+    char *header = malloc(strlen("If-None-Match: ") + strlen(etag) + 1);
+    if (header) {
+      sprintf(header, "If-None-Match: %s", etag);
+      headers = curl_slist_append(headers, header);
+      free(header);
+    }
   }
 
+  if (last_modified && *last_modified) {
+    char *header = malloc(strlen("If-Modified-Since: ") + strlen(last_modified) + 1);
+    if (header) {
+      sprintf(header, "If-Modified-Since: %s", last_modified);
+      headers = curl_slist_append(headers, header);
+      free(header);
+    }
+  }
+
+  if (headers) {
+    curl_easy_setopt(req, CURLOPT_HTTPHEADER, headers);
+  }
+
+  curl_easy_setopt(req, CURLOPT_HEADERFUNCTION, http_get_header_cb);
+  curl_easy_setopt(req, CURLOPT_HEADERDATA, (void *) res);
+
   curl_easy_setopt(req, CURLOPT_URL, url);
   curl_easy_setopt(req, CURLOPT_HTTPGET, 1);
   curl_easy_setopt(req, CURLOPT_FOLLOWLOCATION, 1);
@@ -61,13 +287,14 @@ http_get_response_t *http_get_shared(const char *url, CURLSH *share) {
 
   curl_easy_getinfo(req, CURLINFO_RESPONSE_CODE, &res->status);
   res->ok = (200 == res->status && CURLE_ABORTED_BY_CALLBACK != c) ? 1 : 0;
-  curl_easy_cleanup(req);
+  http_get_release(req, share);
+  curl_slist_free_all(headers);
 
   return res;
 }
 
 /**
- * Perform an HTTP(S) GET on `url`
+ * Perform an HTTP(S) GET on `url`, through the process wide share
  */
 
 http_get_response_t *http_get(const char *url) {
@@ -89,14 +316,15 @@ static size_t http_get_file_cb(void *ptr, size_t size, size_t nmemb, void *strea
  */
 
 int http_get_file_shared(const char *url, const char *file, CURLSH *share) {
-  CURL *req = curl_easy_init();
-  if (!req) return -1;
+  if (!share) share = http_get_share();
 
   FILE *fp = fopen(file, "wb");
   if (!fp) return -1;
 
-  if (share) {
-    curl_easy_setopt(req, CURLOPT_SHARE, share);
+  CURL *req = http_get_handle(share);
+  if (!req) {
+    fclose(fp);
+    return -1;
   }
 
   curl_easy_setopt(req, CURLOPT_URL, url);
@@ -109,7 +337,7 @@ int http_get_file_shared(const char *url, const char *file, CURLSH *share) {
   long status;
   curl_easy_getinfo(req, CURLINFO_RESPONSE_CODE, &status);
 
-  curl_easy_cleanup(req);
+  http_get_release(req, share);
   fclose(fp);
 
   return (200 == status && CURLE_ABORTED_BY_CALLBACK != res) ? 0 : -1;
@@ -119,6 +347,369 @@ int http_get_file(const char *url, const char *file) {
   return http_get_file_shared(url, file, NULL);
 }
 
+/**
+ * HTTP GET stream write callback
+ */
+
+typedef struct {
+  CURL *req;
+  http_get_stream_cb cb;
+  void *data;
+} http_get_stream_t;
+
+static size_t http_get_stream_write_cb(void *ptr, size_t size, size_t nmemb, void *userp) {
+  http_get_stream_t *stream = (http_get_stream_t *) userp;
+  size_t realsize = size * nmemb;
+  long status = 0;
+
+  // redirects are not written, but error pages are
+  curl_easy_getinfo(stream->req, CURLINFO_RESPONSE_CODE, &status);
+  if (200 != status) return 0;
+
+  return 0 == stream->cb(ptr, realsize, stream->data) ? realsize : 0;
+}
+
+/**
+ * Request `url` and hand its body to `cb` as it arrives
+ */
+
+int http_get_stream_shared(const char *url, http_get_stream_cb cb, void *data, CURLSH *share) {
+  if (!share) share = http_get_share();
+
+  http_get_stream_t stream;
+  stream.req = http_get_handle(share);
+  stream.cb = cb;
+  stream.data = data;
+  if (!stream.req) return -1;
+
+  curl_easy_setopt(stream.req, CURLOPT_URL, url);
+  curl_easy_setopt(stream.req, CURLOPT_HTTPGET, 1L);
+  curl_easy_setopt(stream.req, CURLOPT_FOLLOWLOCATION, 1L);
+  curl_easy_setopt(stream.req, CURLOPT_WRITEFUNCTION, http_get_stream_write_cb);
+  curl_easy_setopt(stream.req, CURLOPT_WRITEDATA, &stream);
+  int res = curl_easy_perform(stream.req);
+
+  long status;
+  curl_easy_getinfo(stream.req, CURLINFO_RESPONSE_CODE, &status);
+
+  http_get_release(stream.req, share);
+
+  return (200 == status && CURLE_OK == res) ? 0 : -1;
+}
+
+int http_get_stream(const char *url, http_get_stream_cb cb, void *data) {
+  return http_get_stream_shared(url, cb, data, NULL);
+}
+
+/**
+ * Multi handle file downloads
+ */
+
+#define HTTP_GET_MULTI_DEFAULT_MAX 8
+
+typedef struct http_get_multi_job http_get_multi_job_t;
+
+struct http_get_multi_job {
+  char *url;
+  char *file;
+  FILE *fp;
+  CURL *req;
+  http_get_length_cb length;
+  http_get_stream_cb write;
+  http_get_multi_cb cb;
+  void *data;
+  http_get_multi_job_t *next;
+};
+
+struct http_get_multi {
+  CURLM *multi;
+  CURLSH *share;
+  int max;
+  int running;
+  int failed;
+  http_get_multi_job_t *head;
+  http_get_multi_job_t *tail;
+  http_get_multi_job_t *active; // jobs attached to `multi`
+};
+
+static char *http_get_strdup(const char *str) {
+  size_t len = strlen(str) + 1;
+  char *copy = malloc(len);
+  if (copy) memcpy(copy, str, len);
+  return copy;
+}
+
+static void http_get_multi_job_free(http_get_multi_t *h, http_get_multi_job_t *job) {
+  http_get_release(job->req, h->share);
+  if (job->fp) fclose(job->fp);
+  free(job->url);
+  free(job->file);
+  free(job);
+}
+
+http_get_multi_t *http_get_multi_new(CURLSH *share, int max) {
+  http_get_multi_t *h = malloc(sizeof(http_get_multi_t));
+  if (!h) return NULL;
+
+  memset(h, 0, sizeof(http_get_multi_t));
+
+  if (!(h->multi = curl_multi_init())) {
+    free(h);
+    return NULL;
+  }
+
+  h->share = share ? share : http_get_share();
+  h->max = max > 0 ? max : HTTP_GET_MULTI_DEFAULT_MAX;
+
+  curl_multi_setopt(h->multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+  curl_multi_setopt(h->multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, (long) h->max);
+
+  return h;
+}
+
+/**
+ * Queue a download of `url` to `file`. Nothing is transferred until
+ * `http_get_multi_perform()`.
+ */
+
+static int http_get_multi_add(http_get_multi_t *h, const char *url, const char *file, http_get_length_cb length, http_get_stream_cb write, http_get_multi_cb cb, void *data) {
+  http_get_multi_job_t *job = malloc(sizeof(http_get_multi_job_t));
+  if (!job) return -1;
+
+  memset(job, 0, sizeof(http_get_multi_job_t));
+  job->url = http_get_strdup(url);
+  job->file = file ? http_get_strdup(file) : NULL;
+  job->length = length;
+  job->write = write;
+  job->cb = cb;
+  job->data = data;
+
+  if (!job->url || (file && !job->file)) {
+    http_get_multi_job_free(h, job);
+    return -1;
+  }
+
+  if (h->tail) {
+    h->tail->next = job;
+  } else {
+    h->head = job;
+  }
+  h->tail = job;
+
+  return 0;
+}
+
+int http_get_multi_add_file(http_get_multi_t *h, const char *url, const char *file, http_get_multi_cb cb, void *data) {
+  if (!h || !url || !file) return -1;
+  return http_get_multi_add(h, url, file, NULL, NULL, cb, data);
+}
+
+/**
+ * Queue a request of `url` whose body goes to `write` as it arrives, once
+ * `length`, if any, accepted its size. `cb` is called with a NULL file
+ * once it completes.
+ */
+
+int http_get_multi_add_stream(http_get_multi_t *h, const char *url, http_get_length_cb length, http_get_stream_cb write, http_get_multi_cb cb, void *data) {
+  if (!h || !url || !write) return -1;
+  return http_get_multi_add(h, url, NULL, length, write, cb, data);
+}
+
+/**
+ * Hand the Content-Length of a 200 response to the job's `length`
+ * callback. Those of redirects are not its size.
+ */
+
+static size_t http_get_multi_header_cb(char *buffer, size_t size, size_t nitems, void *userp) {
+  http_get_multi_job_t *job = (http_get_multi_job_t *) userp;
+  size_t len = size * nitems;
+  char *value = NULL;
+  char *end = NULL;
+  unsigned long long length = 0;
+  long status = 0;
+  int rc = 0;
+
+  if (!(value = http_get_header_value(buffer, len, "content-length"))) return len;
+
+  curl_easy_getinfo(job->req, CURLINFO_RESPONSE_CODE, &status);
+  length = strtoull(value, &end, 10);
+  if (200 == status && end != value && '\0' == *end) {
+    rc = job->length(length > (size_t) -1 ? (size_t) -1 : (size_t) length, job->data);
+  }
+
+  free(value);
+  return 0 == rc ? len : 0;
+}
+
+static size_t http_get_multi_write_cb(void *ptr, size_t size, size_t nmemb, void *userp) {
+  http_get_multi_job_t *job = (http_get_multi_job_t *) userp;
+  size_t realsize = size * nmemb;
+  long status = 0;
+
+  curl_easy_getinfo(job->req, CURLINFO_RESPONSE_CODE, &status);
+  if (200 != status) return 0;
+
+  return 0 == job->write(ptr, realsize, job->data) ? realsize : 0;
+}
+
+static void http_get_multi_done(http_get_multi_t *h, http_get_multi_job_t *job, int ok, long status) {
+  if (job->fp) {
+    if (0 != fclose(job->fp)) ok = 0;
+    job->fp = NULL;
+  }
+
+  if (!ok) {
+    if (job->file) remove(job->file);
+    h->failed++;
+  }
+
+  if (job->cb) job->cb(job->url, job->file, ok, status, job->data);
+
+  http_get_multi_job_free(h, job);
+}
+
+/**
+ * Start the next queued job. Files are opened here rather than when
+ * queued, so at most `max` descriptors are open at once.
+ */
+
+static int http_get_multi_start(http_get_multi_t *h) {
+  http_get_multi_job_t *job = h->head;
+
+  h->head = job->next;
+  if (!h->head) h->tail = NULL;
+  job->next = NULL;
+
+  if ((job->file && !(job->fp = fopen(job->file, "wb"))) || !(job->req = http_get_handle(h->share))) {
+    http_get_multi_done(h, job, 0, 0);
+    return -1;
+  }
+
+  curl_easy_setopt(job->req, CURLOPT_URL, job->url);
+  curl_easy_setopt(job->req, CURLOPT_HTTPGET, 1L);
+  curl_easy_setopt(job->req, CURLOPT_FOLLOWLOCATION, 1L);
+  curl_easy_setopt(job->req, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+  // wait for a connection that can multiplex rather than opening another
+  curl_easy_setopt(job->req, CURLOPT_PIPEWAIT, 1L);
+  if (job->write) {
+    curl_easy_setopt(job->req, CURLOPT_WRITEFUNCTION, http_get_multi_write_cb);
+    curl_easy_setopt(job->req, CURLOPT_WRITEDATA, job);
+  } else {
+    curl_easy_setopt(job->req, CURLOPT_WRITEDATA, job->fp);
+  }
+  if (job->length) {
+    curl_easy_setopt(job->req, CURLOPT_HEADERFUNCTION, http_get_multi_header_cb);
+    curl_easy_setopt(job->req, CURLOPT_HEADERDATA, job);
+  }
+  curl_easy_setopt(job->req, CURLOPT_PRIVATE, job);
+  curl_easy_setopt(job->req, CURLOPT_USERAGENT, "http-get.c/"HTTP_GET_VERSION);
+
+  if (CURLM_OK != curl_multi_add_handle(h->multi, job->req)) {
+    http_get_multi_done(h, job, 0, 0);
+    return -1;
+  }
+
+  job->next = h->active;
+  h->active = job;
+  h->running++;
+  return 0;
+}
+
+static void http_get_multi_detach(http_get_multi_t *h, http_get_multi_job_t *job) {
+  http_get_multi_job_t **link = &h->active;
+
+  while (*link && *link != job) link = &(*link)->next;
+  if (*link) *link = job->next;
+  job->next = NULL;
+
+  curl_multi_remove_handle(h->multi, job->req);
+  h->running--;
+}
+
+/**
+ * Drop every job, queued or in flight, without calling its callback, so
+ * that none outlives the data it was given.
+ */
+
+static void http_get_multi_cancel(http_get_multi_t *h) {
+  while (h->active) {
+    http_get_multi_job_t *job = h->active;
+    http_get_multi_detach(h, job);
+    if (job->file) remove(job->file);
+    http_get_multi_job_free(h, job);
+  }
+
+  while (h->head) {
+    http_get_multi_job_t *job = h->head;
+    h->head = job->next;
+    http_get_multi_job_free(h, job);
+  }
+
+  h->tail = NULL;
+}
+
+/**
+ * Run every queued job to completion, calling each job's callback as it
+ * finishes. Jobs may be queued from the callbacks.
+ *
+ * Returns the number of failed jobs, or -1 on error, in which case every
+ * remaining job is dropped without its callback.
+ */
+
+int http_get_multi_perform(http_get_multi_t *h) {
+  if (!h) return -1;
+
+  int still_running = 0;
+  int left = 0;
+  CURLMsg *msg = NULL;
+
+  h->failed = 0;
+
+  while (h->head || h->running > 0) {
+    while (h->head && h->running < h->max) {
+      http_get_multi_start(h);
+    }
+
+    if (CURLM_OK != curl_multi_perform(h->multi, &still_running)) {
+      http_get_multi_cancel(h);
+      return -1;
+    }
+
+    while ((msg = curl_multi_info_read(h->multi, &left))) {
+      if (CURLMSG_DONE != msg->msg) continue;
+
+      http_get_multi_job_t *job = NULL;
+      CURL *req = msg->easy_handle;
+      CURLcode res = msg->data.result;
+      long status = 0;
+
+      curl_easy_getinfo(req, CURLINFO_PRIVATE, (char **) &job);
+      curl_easy_getinfo(req, CURLINFO_RESPONSE_CODE, &status);
+      http_get_multi_detach(h, job);
+
+      http_get_multi_done(h, job, CURLE_OK == res && 200 == status, status);
+    }
+
+    if (still_running > 0) {
+#if LIBCURL_VERSION_NUM >= 0x074200
+      curl_multi_poll(h->multi, NULL, 0, 1000, NULL);
+#else
+      curl_multi_wait(h->multi, NULL, 0, 1000, NULL);
+#endif
+    }
+  }
+
+  return h->failed;
+}
+
+void http_get_multi_free(http_get_multi_t *h) {
+  if (!h) return;
+
+  http_get_multi_cancel(h);
+  curl_multi_cleanup(h->multi);
+  free(h);
+}
+
 /**
  * Free the given `res`
  */
@@ -126,6 +717,8 @@ int http_get_file(const char *url, const char *file) {
 void http_get_free(http_get_response_t *res) {
   if (NULL == res) return;
   if (NULL != res->data) free(res->data);
+  if (NULL != res->etag) free(res->etag);
+  if (NULL != res->last_modified) free(res->last_modified);
   res->data = NULL;
   res->size = 0;
   free(res);
@@ -19,14 +19,82 @@ typedef struct {
   size_t size;
   long status;
   int ok;
+  char *etag;
+  char *last_modified;
 } http_get_response_t;
 
+/**
+ * Requests made without a share of their own (NULL) go through a process
+ * wide one, which keeps the DNS cache, TLS sessions and connections, and
+ * reuse easy handles from a pool. `http_get_cleanup()` frees both.
+ */
+
+void *http_get_share(void);
+void http_get_cleanup(void);
+
 http_get_response_t *http_get(const char *);
 http_get_response_t *http_get_shared(const char *, void *);
 
+/**
+ * GET `url` unless it changed since the response that carried `etag` and
+ * `last_modified` (either may be NULL). An unchanged resource gives a
+ * response with `status` 304, no data, and `ok` unset.
+ */
+
+http_get_response_t *http_get_shared_conditional(const char *, void *,
+                                                 const char *, const char *);
+
 int http_get_file(const char *, const char *);
 int http_get_file_shared(const char *, const char *, void *);
 
+/**
+ * Called with each chunk of a 200 response body as it is received.
+ * Returning anything but 0 aborts the transfer.
+ */
+
+typedef int (*http_get_stream_cb)(const void *data, size_t size, void *userdata);
+
+int http_get_stream(const char *, http_get_stream_cb, void *);
+int http_get_stream_shared(const char *, http_get_stream_cb, void *, void *);
+
 void http_get_free(http_get_response_t *);
 
+/**
+ * Batch of file downloads run on one curl multi handle. Up to `max`
+ * transfers are in flight at once, multiplexed over HTTP/2 connections
+ * where the server allows it. As soon as one finishes, the next queued
+ * job starts.
+ */
+
+typedef struct http_get_multi http_get_multi_t;
+
+/**
+ * Called once per job when it completes. `ok` is 1 when the file was saved
+ * with a 200 response. On failure, the partial file has been removed.
+ */
+
+typedef void (*http_get_multi_cb)(const char *url, const char *file, int ok,
+                                  long status, void *data);
+
+http_get_multi_t *http_get_multi_new(void *, int);
+
+int http_get_multi_add_file(http_get_multi_t *, const char *, const char *,
+                            http_get_multi_cb, void *);
+
+/**
+ * Called with the Content-Length of a 200 response as soon as its headers
+ * arrive, before any of the body. Returning anything but 0 aborts the
+ * transfer. Responses sent without a length never reach it.
+ */
+
+typedef int (*http_get_length_cb)(size_t length, void *userdata);
+
+int http_get_multi_add_stream(http_get_multi_t *, const char *,
+                              http_get_length_cb, http_get_stream_cb,
+                              http_get_multi_cb, void *);
+
+int http_get_multi_perform(http_get_multi_t *);
+
+void http_get_multi_free(http_get_multi_t *);
+
 #endif
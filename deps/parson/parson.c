@@ -32,17 +32,47 @@
 #include <ctype.h>
 #include <math.h>
 
+#if defined(_WIN32)
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+#if defined(__GNUC__) && defined(__SSE2__)
+#include <emmintrin.h>
+#define PARSON_SSE2 1
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define PARSON_AVX2 1
+#endif
+
+/* The vector scans below read whole aligned blocks, which may run past the
+   terminating null byte but never into another page. */
+#if defined(__GNUC__)
+#define PARSON_NO_SANITIZE __attribute__((no_sanitize_address))
+#else
+#define PARSON_NO_SANITIZE
+#endif
+
 #define STARTING_CAPACITY         15
 #define ARRAY_MAX_CAPACITY    122880 /* 15*(2^13) */
 #define OBJECT_MAX_CAPACITY      960 /* 15*(2^6)  */
+#define OBJECT_INDEX_THRESHOLD     8 /* objects with more names are hash indexed */
 #define MAX_NESTING               19
 #define DOUBLE_SERIALIZATION_FORMAT "%f"
 
 #define SIZEOF_TOKEN(a)       (sizeof(a) - 1)
 #define SKIP_CHAR(str)        ((*str)++)
-#define SKIP_WHITESPACES(str) while (isspace(**str)) { SKIP_CHAR(str); }
+#define SKIP_WHITESPACES(str) (*(str) += count_whitespaces(*(str)))
 #define MAX(a, b)             ((a) > (b) ? (a) : (b))
 
+#define ARENA_CHUNK_SIZE      4096
+#define ARENA_ALIGN(n)        (((n) + sizeof(double) - 1) & ~(sizeof(double) - 1))
+#define ARENA_HEADER_SIZE     ARENA_ALIGN(sizeof(JSON_Arena_Chunk))
+
 #undef malloc
 #undef free
 
@@ -71,6 +101,8 @@ struct json_object_t {
     JSON_Value **values;
     size_t       count;
     size_t       capacity;
+    size_t      *cells;       /* open addressing index of names, NULL for small objects */
+    size_t       cells_count; /* power of two, at least twice the capacity */
 };
 
 struct json_array_t {
@@ -79,6 +111,22 @@ struct json_array_t {
     size_t       capacity;
 };
 
+typedef struct json_arena_chunk_t {
+    struct json_arena_chunk_t *next;
+    size_t                     size;
+} JSON_Arena_Chunk;
+
+struct json_arena_t {
+    JSON_Arena_Chunk *chunks; /* current chunk first */
+    char             *top;
+    size_t            left;
+};
+
+/* Arena */
+static void * arena_malloc(JSON_Arena *arena, size_t n);
+static void   arena_free(JSON_Arena *arena, void *ptr);
+static void   arena_value_free(JSON_Arena *arena, JSON_Value *value);
+
 /* Various */
 static char * read_file(const char *filename);
 static void   remove_comments(char *string, const char *start_token, const char *end_token);
@@ -91,39 +139,81 @@ static int    is_valid_utf8(const char *string, size_t string_len);
 static int    is_decimal(const char *string, size_t length);
 
 /* JSON Object */
-static JSON_Object * json_object_init(void);
-static JSON_Status   json_object_add(JSON_Object *object, const char *name, JSON_Value *value);
-static JSON_Status   json_object_resize(JSON_Object *object, size_t new_capacity);
+static JSON_Object * json_object_init(JSON_Arena *arena);
+static JSON_Status   json_object_add(JSON_Arena *arena, JSON_Object *object, const char *name, JSON_Value *value);
+static JSON_Status   json_object_resize(JSON_Arena *arena, JSON_Object *object, size_t new_capacity);
+static size_t        json_object_find(const JSON_Object *object, const char *name, size_t n);
+static void          json_object_index(JSON_Arena *arena, JSON_Object *object);
+static void          json_object_index_add(JSON_Object *object, size_t index);
 static JSON_Value  * json_object_nget_value(const JSON_Object *object, const char *name, size_t n);
 static void          json_object_free(JSON_Object *object);
 
 /* JSON Array */
-static JSON_Array * json_array_init(void);
-static JSON_Status  json_array_add(JSON_Array *array, JSON_Value *value);
-static JSON_Status  json_array_resize(JSON_Array *array, size_t new_capacity);
+static JSON_Array * json_array_init(JSON_Arena *arena);
+static JSON_Status  json_array_add(JSON_Arena *arena, JSON_Array *array, JSON_Value *value);
+static JSON_Status  json_array_resize(JSON_Arena *arena, JSON_Array *array, size_t new_capacity);
 static void         json_array_free(JSON_Array *array);
 
 /* JSON Value */
-static JSON_Value * json_value_init_string_no_copy(char *string);
+static JSON_Value * json_value_init_string_no_copy(JSON_Arena *arena, char *string);
+static JSON_Value * json_value_init_type(JSON_Arena *arena, JSON_Value_Type type);
+
+/* Scanning */
+static size_t       count_whitespaces(const char *string);
+static const char * find_string_special(const char *string);
 
 /* Parser */
-static void         skip_quotes(const char **string);
+static int          skip_quotes(const char **string);
 static int          parse_utf_16(const char **unprocessed, char **processed);
-static char *       process_string(const char *input, size_t len);
-static char *       get_quoted_string(const char **string);
-static JSON_Value * parse_object_value(const char **string, size_t nesting);
-static JSON_Value * parse_array_value(const char **string, size_t nesting);
-static JSON_Value * parse_string_value(const char **string);
-static JSON_Value * parse_boolean_value(const char **string);
-static JSON_Value * parse_number_value(const char **string);
-static JSON_Value * parse_null_value(const char **string);
-static JSON_Value * parse_value(const char **string, size_t nesting);
+static char *       process_string(JSON_Arena *arena, const char *input, size_t len);
+static char *       get_quoted_string(JSON_Arena *arena, const char **string);
+static JSON_Value * parse_object_value(JSON_Arena *arena, const char **string, size_t nesting);
+static JSON_Value * parse_array_value(JSON_Arena *arena, const char **string, size_t nesting);
+static JSON_Value * parse_string_value(JSON_Arena *arena, const char **string);
+static JSON_Value * parse_boolean_value(JSON_Arena *arena, const char **string);
+static JSON_Value * parse_number_value(JSON_Arena *arena, const char **string);
+static JSON_Value * parse_null_value(JSON_Arena *arena, const char **string);
+static JSON_Value * parse_value(JSON_Arena *arena, const char **string, size_t nesting);
 
 /* Serialization */
-static int    json_serialize_to_buffer_r(const JSON_Value *value, char *buf, int level, int is_pretty, char *num_buf);
-static int    json_serialize_string(const char *string, char *buf);
-static int    append_indent(char *buf, int level);
-static int    append_string(char *buf, const char *string);
+typedef struct json_writer_t {
+    char               *buf;       /* NULL when only counting */
+    size_t              capacity;
+    size_t              length;
+    int                 can_grow;  /* buf is parson_malloc'd and may be replaced */
+    JSON_Write_Function write_fun; /* if set, buf is flushed to it when full */
+    void               *context;
+    int                 failed;
+} JSON_Writer;
+
+static void   writer_append(JSON_Writer *writer, const char *data, size_t n);
+static void   writer_flush(JSON_Writer *writer);
+static void   json_serialize_r(const JSON_Value *value, JSON_Writer *writer, int level, int is_pretty);
+static void   json_serialize_string(const char *string, JSON_Writer *writer);
+static void   json_serialize_number(double num, JSON_Writer *writer);
+static void   append_indent(JSON_Writer *writer, int level);
+static void   append_string(JSON_Writer *writer, const char *string);
+static size_t serialization_size(const JSON_Value *value, int is_pretty);
+static JSON_Status serialize_to_buffer(const JSON_Value *value, char *buf, size_t buf_size_in_bytes, int is_pretty);
+static char * serialize_to_string(const JSON_Value *value, int is_pretty);
+static JSON_Status serialize_to_writer(const JSON_Value *value, JSON_Write_Function write_fun, void *context, int is_pretty);
+static JSON_Status write_to_stream(void *context, const char *data, size_t size);
+static JSON_Status serialize_to_file(const JSON_Value *value, const char *filename, int is_pretty);
+
+/* Arena */
+static void * arena_malloc(JSON_Arena *arena, size_t n) {
+    return arena ? json_arena_alloc(arena, n) : parson_malloc(n);
+}
+
+static void arena_free(JSON_Arena *arena, void *ptr) {
+    if (arena == NULL)
+        parson_free(ptr);
+}
+
+static void arena_value_free(JSON_Arena *arena, JSON_Value *value) {
+    if (arena == NULL)
+        json_value_free(value);
+}
 
 /* Various */
 static char * parson_strndup(const char *string, size_t n) {
@@ -287,18 +377,21 @@ static void remove_comments(char *string, const char *start_token, const char *e
 }
 
 /* JSON Object */
-static JSON_Object * json_object_init(void) {
-    JSON_Object *new_obj = (JSON_Object*)parson_malloc(sizeof(JSON_Object));
+static JSON_Object * json_object_init(JSON_Arena *arena) {
+    JSON_Object *new_obj = (JSON_Object*)arena_malloc(arena, sizeof(JSON_Object));
     if (!new_obj)
         return NULL;
     new_obj->names = (char**)NULL;
     new_obj->values = (JSON_Value**)NULL;
     new_obj->capacity = 0;
     new_obj->count = 0;
+    new_obj->cells = NULL;
+    new_obj->cells_count = 0;
     return new_obj;
 }
 
-static JSON_Status json_object_add(JSON_Object *object, const char *name, JSON_Value *value) {
+/* Names are copied, except in an arena where they already live. */
+static JSON_Status json_object_add(JSON_Arena *arena, JSON_Object *object, const char *name, JSON_Value *value) {
     size_t index = 0;
     if (object == NULL || name == NULL || value == NULL) {
         return JSONFailure;
@@ -307,21 +400,25 @@ static JSON_Status json_object_add(JSON_Object *object, const char *name, JSON_V
         size_t new_capacity = MAX(object->capacity * 2, STARTING_CAPACITY);
         if (new_capacity > OBJECT_MAX_CAPACITY)
             return JSONFailure;
-        if (json_object_resize(object, new_capacity) == JSONFailure)
+        if (json_object_resize(arena, object, new_capacity) == JSONFailure)
             return JSONFailure;
     }
     if (json_object_get_value(object, name) != NULL)
         return JSONFailure;
     index = object->count;
-    object->names[index] = parson_strdup(name);
+    object->names[index] = arena ? (char*)name : parson_strdup(name);
     if (object->names[index] == NULL)
         return JSONFailure;
     object->values[index] = value;
     object->count++;
+    if (object->cells != NULL)
+        json_object_index_add(object, index);
+    else if (object->count > OBJECT_INDEX_THRESHOLD)
+        json_object_index(arena, object);
     return JSONSuccess;
 }
 
-static JSON_Status json_object_resize(JSON_Object *object, size_t new_capacity) {
+static JSON_Status json_object_resize(JSON_Arena *arena, JSON_Object *object, size_t new_capacity) {
     char **temp_names = NULL;
     JSON_Value **temp_values = NULL;
 
@@ -331,13 +428,13 @@ static JSON_Status json_object_resize(JSON_Object *object, size_t new_capacity)
             return JSONFailure; /* Shouldn't happen */
     }
 
-    temp_names = (char**)parson_malloc(new_capacity * sizeof(char*));
+    temp_names = (char**)arena_malloc(arena, new_capacity * sizeof(char*));
     if (temp_names == NULL)
         return JSONFailure;
 
-    temp_values = (JSON_Value**)parson_malloc(new_capacity * sizeof(JSON_Value*));
+    temp_values = (JSON_Value**)arena_malloc(arena, new_capacity * sizeof(JSON_Value*));
     if (temp_names == NULL) {
-        parson_free(temp_names);
+        arena_free(arena, temp_names);
         return JSONFailure;
     }
 
@@ -345,24 +442,79 @@ static JSON_Status json_object_resize(JSON_Object *object, size_t new_capacity)
         memcpy(temp_names, object->names, object->count * sizeof(char*));
         memcpy(temp_values, object->values, object->count * sizeof(JSON_Value*));
     }
-    parson_free(object->names);
-    parson_free(object->values);
+    arena_free(arena, object->names);
+    arena_free(arena, object->values);
     object->names = temp_names;
     object->values = temp_values;
     object->capacity = new_capacity;
+    if (object->cells != NULL)
+        json_object_index(arena, object);
     return JSONSuccess;
 }
 
-static JSON_Value * json_object_nget_value(const JSON_Object *object, const char *name, size_t n) {
-    size_t i, name_length;
-    for (i = 0; i < json_object_get_count(object); i++) {
-        name_length = strlen(object->names[i]);
-        if (name_length != n)
-            continue;
-        if (strncmp(object->names[i], name, n) == 0)
-            return object->values[i];
+static size_t hash_name(const char *name, size_t n) {
+    size_t hash = 2166136261u; /* FNV-1a */
+    while (n--) {
+        hash ^= (unsigned char)*name++;
+        hash *= 16777619u;
     }
-    return NULL;
+    return hash;
+}
+
+/* Returns the position of name in object, or its count when missing. */
+static size_t json_object_find(const JSON_Object *object, const char *name, size_t n) {
+    size_t i, mask;
+    const char *item;
+    if (object->cells == NULL) {
+        for (i = 0; i < object->count; i++) {
+            item = object->names[i];
+            if (strncmp(item, name, n) == 0 && item[n] == '\0')
+                return i;
+        }
+        return object->count;
+    }
+    mask = object->cells_count - 1;
+    for (i = hash_name(name, n) & mask; object->cells[i] != 0; i = (i + 1) & mask) {
+        item = object->names[object->cells[i] - 1];
+        if (strncmp(item, name, n) == 0 && item[n] == '\0')
+            return object->cells[i] - 1;
+    }
+    return object->count;
+}
+
+/* Rebuilds the index for the current capacity. Lookups fall back to a linear
+   scan if there is no memory for it. */
+static void json_object_index(JSON_Arena *arena, JSON_Object *object) {
+    size_t i, cells_count = 1;
+    arena_free(arena, object->cells);
+    object->cells = NULL;
+    object->cells_count = 0;
+    if (object->count <= OBJECT_INDEX_THRESHOLD)
+        return;
+    while (cells_count < object->capacity * 2)
+        cells_count *= 2;
+    object->cells = (size_t*)arena_malloc(arena, cells_count * sizeof(size_t));
+    if (object->cells == NULL)
+        return;
+    memset(object->cells, 0, cells_count * sizeof(size_t));
+    object->cells_count = cells_count;
+    for (i = 0; i < object->count; i++)
+        json_object_index_add(object, i);
+}
+
+/* Cells hold positions plus one, so that zero marks an empty cell. */
+static void json_object_index_add(JSON_Object *object, size_t index) {
+    const char *name = object->names[index];
+    size_t mask = object->cells_count - 1;
+    size_t i = hash_name(name, strlen(name)) & mask;
+    while (object->cells[i] != 0)
+        i = (i + 1) & mask;
+    object->cells[i] = index + 1;
+}
+
+static JSON_Value * json_object_nget_value(const JSON_Object *object, const char *name, size_t n) {
+    size_t i = json_object_find(object, name, n);
+    return i < object->count ? object->values[i] : NULL;
 }
 
 static void json_object_free(JSON_Object *object) {
@@ -372,12 +524,13 @@ static void json_object_free(JSON_Object *object) {
     }
     parson_free(object->names);
     parson_free(object->values);
+    parson_free(object->cells);
     parson_free(object);
 }
 
 /* JSON Array */
-static JSON_Array * json_array_init(void) {
-    JSON_Array *new_array = (JSON_Array*)parson_malloc(sizeof(JSON_Array));
+static JSON_Array * json_array_init(JSON_Arena *arena) {
+    JSON_Array *new_array = (JSON_Array*)arena_malloc(arena, sizeof(JSON_Array));
     if (!new_array)
         return NULL;
     new_array->items = (JSON_Value**)NULL;
@@ -386,12 +539,12 @@ static JSON_Array * json_array_init(void) {
     return new_array;
 }
 
-static JSON_Status json_array_add(JSON_Array *array, JSON_Value *value) {
+static JSON_Status json_array_add(JSON_Arena *arena, JSON_Array *array, JSON_Value *value) {
     if (array->count >= array->capacity) {
         size_t new_capacity = MAX(array->capacity * 2, STARTING_CAPACITY);
         if (new_capacity > ARRAY_MAX_CAPACITY)
             return JSONFailure;
-        if (json_array_resize(array, new_capacity) == JSONFailure)
+        if (json_array_resize(arena, array, new_capacity) == JSONFailure)
             return JSONFailure;
     }
     array->items[array->count] = value;
@@ -399,19 +552,19 @@ static JSON_Status json_array_add(JSON_Array *array, JSON_Value *value) {
     return JSONSuccess;
 }
 
-static JSON_Status json_array_resize(JSON_Array *array, size_t new_capacity) {
+static JSON_Status json_array_resize(JSON_Arena *arena, JSON_Array *array, size_t new_capacity) {
     JSON_Value **new_items = NULL;
     if (new_capacity == 0) {
         return JSONFailure;
     }
-    new_items = (JSON_Value**)parson_malloc(new_capacity * sizeof(JSON_Value*));
+    new_items = (JSON_Value**)arena_malloc(arena, new_capacity * sizeof(JSON_Value*));
     if (new_items == NULL) {
         return JSONFailure;
     }
     if (array->items != NULL && array->count > 0) {
         memcpy(new_items, array->items, array->count * sizeof(JSON_Value*));
     }
-    parson_free(array->items);
+    arena_free(arena, array->items);
     array->items = new_items;
     array->capacity = new_capacity;
     return JSONSuccess;
@@ -425,29 +578,216 @@ static void json_array_free(JSON_Array *array) {
 }
 
 /* JSON Value */
-static JSON_Value * json_value_init_string_no_copy(char *string) {
-    JSON_Value *new_value = (JSON_Value*)parson_malloc(sizeof(JSON_Value));
+static JSON_Value * json_value_init_string_no_copy(JSON_Arena *arena, char *string) {
+    JSON_Value *new_value = json_value_init_type(arena, JSONString);
     if (!new_value)
         return NULL;
-    new_value->type = JSONString;
     new_value->value.string = string;
     return new_value;
 }
 
+/* Objects and arrays come with their (empty) container. */
+static JSON_Value * json_value_init_type(JSON_Arena *arena, JSON_Value_Type type) {
+    JSON_Value *new_value = (JSON_Value*)arena_malloc(arena, sizeof(JSON_Value));
+    if (!new_value)
+        return NULL;
+    new_value->type = type;
+    if (type == JSONObject) {
+        new_value->value.object = json_object_init(arena);
+        if (!new_value->value.object) {
+            arena_free(arena, new_value);
+            return NULL;
+        }
+    } else if (type == JSONArray) {
+        new_value->value.array = json_array_init(arena);
+        if (!new_value->value.array) {
+            arena_free(arena, new_value);
+            return NULL;
+        }
+    }
+    return new_value;
+}
+
+/* Scanning */
+/* Whitespace is what isspace accepts in the C locale: ' ' and '\t' to '\r'. */
+static int is_whitespace(unsigned char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+#ifndef PARSON_SSE2
+/* Quotes and backslashes end plain runs inside strings, and so do control
+   characters, which include the null byte ending the text. */
+static int is_string_special(unsigned char c) {
+    return c == '\"' || c == '\\' || c < 0x20;
+}
+
+static const char * skip_whitespaces_scalar(const char *c) {
+    while (is_whitespace((unsigned char)*c))
+        c++;
+    return c;
+}
+
+static const char * find_string_special_scalar(const char *c) {
+    while (!is_string_special((unsigned char)*c))
+        c++;
+    return c;
+}
+#endif
+
+#ifdef PARSON_SSE2
+/* Both scans load the aligned 16 bytes holding c and ignore the bytes before
+   it, then move on one block at a time until one of them stops the scan. */
+PARSON_NO_SANITIZE
+static const char * skip_whitespaces_sse2(const char *c) {
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i four = _mm_set1_epi8(4);
+    size_t offset = (size_t)c & 15;
+    const char *block = c - offset;
+    unsigned int skip = (1u << offset) - 1;
+    for (;; block += 16, skip = 0) {
+        __m128i v = _mm_load_si128((const __m128i*)block);
+        __m128i controls = _mm_sub_epi8(v, tab); /* '\t' to '\r' become 0 to 4 */
+        __m128i ws = _mm_or_si128(_mm_cmpeq_epi8(v, space),
+                                  _mm_cmpeq_epi8(_mm_min_epu8(controls, four), controls));
+        unsigned int mask = ~(unsigned int)_mm_movemask_epi8(ws) & 0xFFFF & ~skip;
+        if (mask)
+            return block + __builtin_ctz(mask);
+    }
+}
+
+PARSON_NO_SANITIZE
+static const char * find_string_special_sse2(const char *c) {
+    const __m128i quote = _mm_set1_epi8('\"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i bias = _mm_set1_epi8((char)0x80);
+    const __m128i space = _mm_set1_epi8((char)(0x20 ^ 0x80));
+    size_t offset = (size_t)c & 15;
+    const char *block = c - offset;
+    unsigned int skip = (1u << offset) - 1;
+    for (;; block += 16, skip = 0) {
+        __m128i v = _mm_load_si128((const __m128i*)block);
+        /* flipping the top bit turns the unsigned test c < 0x20 into a signed one */
+        __m128i stop = _mm_cmplt_epi8(_mm_xor_si128(v, bias), space);
+        stop = _mm_or_si128(stop, _mm_cmpeq_epi8(v, quote));
+        stop = _mm_or_si128(stop, _mm_cmpeq_epi8(v, backslash));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(stop) & ~skip;
+        if (mask)
+            return block + __builtin_ctz(mask);
+    }
+}
+#endif
+
+#ifdef PARSON_AVX2
+/* Same as above, 32 bytes at a time. Only called once the CPU is known to
+   support AVX2, see init_scan_functions. */
+__attribute__((target("avx2"))) PARSON_NO_SANITIZE
+static const char * skip_whitespaces_avx2(const char *c) {
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i four = _mm256_set1_epi8(4);
+    size_t offset = (size_t)c & 31;
+    const char *block = c - offset;
+    unsigned int skip = (unsigned int)((1ull << offset) - 1);
+    for (;; block += 32, skip = 0) {
+        __m256i v = _mm256_load_si256((const __m256i*)block);
+        __m256i controls = _mm256_sub_epi8(v, tab);
+        __m256i ws = _mm256_or_si256(_mm256_cmpeq_epi8(v, space),
+                                     _mm256_cmpeq_epi8(_mm256_min_epu8(controls, four), controls));
+        unsigned int mask = ~(unsigned int)_mm256_movemask_epi8(ws) & ~skip;
+        if (mask)
+            return block + __builtin_ctz(mask);
+    }
+}
+
+__attribute__((target("avx2"))) PARSON_NO_SANITIZE
+static const char * find_string_special_avx2(const char *c) {
+    const __m256i quote = _mm256_set1_epi8('\"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i bias = _mm256_set1_epi8((char)0x80);
+    const __m256i space = _mm256_set1_epi8((char)(0x20 ^ 0x80));
+    size_t offset = (size_t)c & 31;
+    const char *block = c - offset;
+    unsigned int skip = (unsigned int)((1ull << offset) - 1);
+    for (;; block += 32, skip = 0) {
+        __m256i v = _mm256_load_si256((const __m256i*)block);
+        __m256i stop = _mm256_cmpgt_epi8(space, _mm256_xor_si256(v, bias));
+        stop = _mm256_or_si256(stop, _mm256_cmpeq_epi8(v, quote));
+        stop = _mm256_or_si256(stop, _mm256_cmpeq_epi8(v, backslash));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(stop) & ~skip;
+        if (mask)
+            return block + __builtin_ctz(mask);
+    }
+}
+#endif
+
+typedef const char * (*Scan_Function)(const char *);
+
+/* The scans start out with what every CPU of the target has, so that they
+   are usable before init_scan_functions runs, and are only ever written
+   by it, before main and any thread it starts. */
+#if defined(PARSON_SSE2)
+static Scan_Function skip_whitespaces_impl = skip_whitespaces_sse2;
+static Scan_Function find_string_special_impl = find_string_special_sse2;
+#else
+static Scan_Function skip_whitespaces_impl = skip_whitespaces_scalar;
+static Scan_Function find_string_special_impl = find_string_special_scalar;
+#endif
+
+#if defined(PARSON_AVX2)
+/* Picks AVX2 when the CPU supports it. */
+__attribute__((constructor))
+static void init_scan_functions(void) {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        skip_whitespaces_impl = skip_whitespaces_avx2;
+        find_string_special_impl = find_string_special_avx2;
+    }
+}
+#endif
+
+/* Most runs between tokens are a single space or none at all, so the vector
+   scan only starts past the second byte. */
+static size_t count_whitespaces(const char *string) {
+    const char *c = string;
+    if (!is_whitespace((unsigned char)c[0]))
+        return 0;
+    if (!is_whitespace((unsigned char)c[1]))
+        return 1;
+    return (size_t)(skip_whitespaces_impl(c + 2) - string);
+}
+
+/* Returns the first quote, backslash or control character from string on. */
+static const char * find_string_special(const char *string) {
+    return find_string_special_impl(string);
+}
+
 /* Parser */
-static void skip_quotes(const char **string) {
+/* Skips to the character after the closing quote, or to the end of the text.
+   Returns whether the string holds neither escapes nor control characters,
+   in which case it can be used as is. */
+static int skip_quotes(const char **string) {
+    int is_plain = 1;
     SKIP_CHAR(string);
-    while (**string != '\"') {
-        if (**string == '\0')
-            return;
-        if (**string == '\\') {
-            SKIP_CHAR(string);
-            if (**string == '\0')
-                return;
+    for (;;) {
+        *string = find_string_special(*string);
+        switch (**string) {
+            case '\"':
+                SKIP_CHAR(string);
+                return is_plain;
+            case '\0':
+                return 0;
+            case '\\':
+                SKIP_CHAR(string);
+                if (**string == '\0')
+                    return 0;
+                break;
+            default:
+                break;
         }
+        is_plain = 0;
         SKIP_CHAR(string);
     }
-    SKIP_CHAR(string);
 }
 
 static int parse_utf_16(const char **unprocessed, char **processed) {
@@ -491,14 +831,18 @@ static int parse_utf_16(const char **unprocessed, char **processed) {
 
 
 /* Copies and processes passed string up to supplied length.
-Example: "\u006Corem ipsum" -> lorem ipsum */
-static char* process_string(const char *input, size_t len) {
+Example: "\u006Corem ipsum" -> lorem ipsum
+In an arena, the input is the arena's own copy of the parsed text: unescaping
+never makes a string longer, so it is processed in place instead. */
+static char* process_string(JSON_Arena *arena, const char *input, size_t len) {
     const char *input_ptr = input;
     size_t initial_size = (len + 1) * sizeof(char);
     size_t final_size = 0;
-    char *output = (char*)parson_malloc(initial_size);
+    char *output = arena ? (char*)input : (char*)parson_malloc(initial_size);
     char *output_ptr = output;
     char *resized_output = NULL;
+    if (output == NULL)
+        return NULL;
     while ((*input_ptr != '\0') && (size_t)(input_ptr - input) < len) {
         if (*input_ptr == '\\') {
             input_ptr++;
@@ -527,6 +871,8 @@ static char* process_string(const char *input, size_t len) {
         input_ptr++;
     }
     *output_ptr = '\0';
+    if (arena)
+        return output;
     /* resize to new length */
     final_size = (size_t)(output_ptr-output) + 1;
     resized_output = (char*)parson_malloc(final_size);
@@ -536,48 +882,53 @@ static char* process_string(const char *input, size_t len) {
     parson_free(output);
     return resized_output;
 error:
-    parson_free(output);
+    arena_free(arena, output);
     return NULL;
 }
 
 /* Return processed contents of a string between quotes and
    skips passed argument to a matching quote. */
-static char * get_quoted_string(const char **string) {
+static char * get_quoted_string(JSON_Arena *arena, const char **string) {
     const char *string_start = *string;
     size_t string_len = 0;
-    skip_quotes(string);
+    int is_plain = skip_quotes(string);
     if (**string == '\0')
         return NULL;
     string_len = *string - string_start - 2; /* length without quotes */
-    return process_string(string_start + 1, string_len);
+    if (!is_plain)
+        return process_string(arena, string_start + 1, string_len);
+    if (arena == NULL)
+        return parson_strndup(string_start + 1, string_len);
+    ((char*)string_start)[string_len + 1] = '\0'; /* the closing quote */
+    return (char*)string_start + 1;
 }
 
-static JSON_Value * parse_value(const char **string, size_t nesting) {
+static JSON_Value * parse_value(JSON_Arena *arena, const char **string, size_t nesting) {
     if (nesting > MAX_NESTING)
         return NULL;
     SKIP_WHITESPACES(string);
     switch (**string) {
         case '{':
-            return parse_object_value(string, nesting + 1);
+            return parse_object_value(arena, string, nesting + 1);
         case '[':
-            return parse_array_value(string, nesting + 1);
+            return parse_array_value(arena, string, nesting + 1);
         case '\"':
-            return parse_string_value(string);
+            return parse_string_value(arena, string);
         case 'f': case 't':
-            return parse_boolean_value(string);
+            return parse_boolean_value(arena, string);
         case '-':
         case '0': case '1': case '2': case '3': case '4':
         case '5': case '6': case '7': case '8': case '9':
-            return parse_number_value(string);
+            return parse_number_value(arena, string);
         case 'n':
-            return parse_null_value(string);
+            return parse_null_value(arena, string);
         default:
             return NULL;
     }
 }
 
-static JSON_Value * parse_object_value(const char **string, size_t nesting) {
-    JSON_Value *output_value = json_value_init_object(), *new_value = NULL;
+static JSON_Value * parse_object_value(JSON_Arena *arena, const char **string, size_t nesting) {
+    JSON_Value *output_value = json_value_init_type(arena, JSONObject), *new_value = NULL;
     JSON_Object *output_object = json_value_get_object(output_value);
     char *new_key = NULL;
     if (output_value == NULL)
@@ -589,26 +940,26 @@ static JSON_Value * parse_object_value(const char **string, size_t nesting) {
         return output_value;
     }
     while (**string != '\0') {
-        new_key = get_quoted_string(string);
+        new_key = get_quoted_string(arena, string);
         SKIP_WHITESPACES(string);
         if (new_key == NULL || **string != ':') {
-            json_value_free(output_value);
+            arena_value_free(arena, output_value);
             return NULL;
         }
         SKIP_CHAR(string);
-        new_value = parse_value(string, nesting);
+        new_value = parse_value(arena, string, nesting);
         if (new_value == NULL) {
-            parson_free(new_key);
-            json_value_free(output_value);
+            arena_free(arena, new_key);
+            arena_value_free(arena, output_value);
             return NULL;
         }
-        if(json_object_add(output_object, new_key, new_value) == JSONFailure) {
-            parson_free(new_key);
-            parson_free(new_value);
-            json_value_free(output_value);
+        if(json_object_add(arena, output_object, new_key, new_value) == JSONFailure) {
+            arena_free(arena, new_key);
+            arena_free(arena, new_value);
+            arena_value_free(arena, output_value);
             return NULL;
         }
-        parson_free(new_key);
+        arena_free(arena, new_key);
         SKIP_WHITESPACES(string);
         if (**string != ',')
             break;
@@ -617,16 +968,16 @@ static JSON_Value * parse_object_value(const char **string, size_t nesting) {
     }
     SKIP_WHITESPACES(string);
     if (**string != '}' || /* Trim object after parsing is over */
-        json_object_resize(output_object, json_object_get_count(output_object)) == JSONFailure) {
-            json_value_free(output_value);
+        (arena == NULL && json_object_resize(arena, output_object, json_object_get_count(output_object)) == JSONFailure)) {
+            arena_value_free(arena, output_value);
             return NULL;
     }
     SKIP_CHAR(string);
     return output_value;
 }
 
-static JSON_Value * parse_array_value(const char **string, size_t nesting) {
-    JSON_Value *output_value = json_value_init_array(), *new_array_value = NULL;
+static JSON_Value * parse_array_value(JSON_Arena *arena, const char **string, size_t nesting) {
+    JSON_Value *output_value = json_value_init_type(arena, JSONArray), *new_array_value = NULL;
     JSON_Array *output_array = json_value_get_array(output_value);
     if (!output_value)
         return NULL;
@@ -637,14 +988,14 @@ static JSON_Value * parse_array_value(const char **string, size_t nesting) {
         return output_value;
     }
     while (**string != '\0') {
-        new_array_value = parse_value(string, nesting);
+        new_array_value = parse_value(arena, string, nesting);
         if (!new_array_value) {
-            json_value_free(output_value);
+            arena_value_free(arena, output_value);
             return NULL;
         }
-        if(json_array_add(output_array, new_array_value) == JSONFailure) {
-            parson_free(new_array_value);
-            json_value_free(output_value);
+        if(json_array_add(arena, output_array, new_array_value) == JSONFailure) {
+            arena_free(arena, new_array_value);
+            arena_value_free(arena, output_value);
             return NULL;
         }
         SKIP_WHITESPACES(string);
@@ -655,229 +1006,310 @@ static JSON_Value * parse_array_value(const char **string, size_t nesting) {
     }
     SKIP_WHITESPACES(string);
     if (**string != ']' || /* Trim array after parsing is over */
-        json_array_resize(output_array, json_array_get_count(output_array)) == JSONFailure) {
-            json_value_free(output_value);
+        (arena == NULL && json_array_resize(arena, output_array, json_array_get_count(output_array)) == JSONFailure)) {
+            arena_value_free(arena, output_value);
             return NULL;
     }
     SKIP_CHAR(string);
     return output_value;
 }
 
-static JSON_Value * parse_string_value(const char **string) {
+static JSON_Value * parse_string_value(JSON_Arena *arena, const char **string) {
     JSON_Value *value = NULL;
-    char *new_string = get_quoted_string(string);
+    char *new_string = get_quoted_string(arena, string);
     if (new_string == NULL)
         return NULL;
-    value = json_value_init_string_no_copy(new_string);
+    value = json_value_init_string_no_copy(arena, new_string);
     if (value == NULL) {
-        parson_free(new_string);
+        arena_free(arena, new_string);
         return NULL;
     }
     return value;
 }
 
-static JSON_Value * parse_boolean_value(const char **string) {
+static JSON_Value * parse_boolean_value(JSON_Arena *arena, const char **string) {
     size_t true_token_size = SIZEOF_TOKEN("true");
     size_t false_token_size = SIZEOF_TOKEN("false");
+    JSON_Value *output_value = NULL;
     if (strncmp("true", *string, true_token_size) == 0) {
         *string += true_token_size;
-        return json_value_init_boolean(1);
+        if ((output_value = json_value_init_type(arena, JSONBoolean)))
+            output_value->value.boolean = 1;
     } else if (strncmp("false", *string, false_token_size) == 0) {
         *string += false_token_size;
-        return json_value_init_boolean(0);
+        if ((output_value = json_value_init_type(arena, JSONBoolean)))
+            output_value->value.boolean = 0;
     }
-    return NULL;
+    return output_value;
 }
 
-static JSON_Value * parse_number_value(const char **string) {
+static JSON_Value * parse_number_value(JSON_Arena *arena, const char **string) {
     char *end;
     double number = strtod(*string, &end);
-    JSON_Value *output_value;
+    JSON_Value *output_value = NULL;
     if (is_decimal(*string, end - *string)) {
         *string = end;
-        output_value = json_value_init_number(number);
-    } else {
-        output_value = NULL;
+        if ((output_value = json_value_init_type(arena, JSONNumber)))
+            output_value->value.number = number;
     }
     return output_value;
 }
 
-static JSON_Value * parse_null_value(const char **string) {
+static JSON_Value * parse_null_value(JSON_Arena *arena, const char **string) {
     size_t token_size = SIZEOF_TOKEN("null");
     if (strncmp("null", *string, token_size) == 0) {
         *string += token_size;
-        return json_value_init_null();
+        return json_value_init_type(arena, JSONNull);
     }
     return NULL;
 }
 
 /* Serialization */
-#define APPEND_STRING(str) do { written = append_string(buf, (str)); \
-                                if (written < 0) { return -1; } \
-                                if (buf != NULL) { buf += written; } \
-                                written_total += written; } while(0)
+/* The writer keeps room for a null byte after the text. Whatever the output,
+   the document is serialized in a single pass. */
+static void writer_append(JSON_Writer *writer, const char *data, size_t n) {
+    char *new_buf = NULL;
+    size_t new_capacity = 0;
+    if (writer->failed)
+        return;
+    if (writer->buf == NULL) {
+        writer->length += n;
+        return;
+    }
+    if (writer->capacity - writer->length <= n) {
+        if (writer->write_fun != NULL) {
+            writer_flush(writer);
+            if (writer->failed)
+                return;
+            if (n >= writer->capacity) {
+                if (writer->write_fun(writer->context, data, n) == JSONFailure)
+                    writer->failed = 1;
+                return;
+            }
+        } else if (writer->can_grow) {
+            new_capacity = MAX(writer->capacity * 2, writer->length + n + 1);
+            new_buf = (char*)parson_malloc(new_capacity);
+            if (new_buf == NULL) {
+                writer->failed = 1;
+                return;
+            }
+            memcpy(new_buf, writer->buf, writer->length);
+            parson_free(writer->buf);
+            writer->buf = new_buf;
+            writer->capacity = new_capacity;
+        } else {
+            writer->failed = 1;
+            return;
+        }
+    }
+    memcpy(writer->buf + writer->length, data, n);
+    writer->length += n;
+}
 
-#define APPEND_INDENT(level) do { written = append_indent(buf, (level)); \
-                                  if (written < 0) { return -1; } \
-                                  if (buf != NULL) { buf += written; } \
-                                  written_total += written; } while(0)
+static void writer_flush(JSON_Writer *writer) {
+    if (writer->failed || writer->length == 0)
+        return;
+    if (writer->write_fun(writer->context, writer->buf, writer->length) == JSONFailure)
+        writer->failed = 1;
+    writer->length = 0;
+}
 
-static int json_serialize_to_buffer_r(const JSON_Value *value, char *buf, int level, int is_pretty, char *num_buf)
+static void json_serialize_r(const JSON_Value *value, JSON_Writer *writer, int level, int is_pretty)
 {
-    const char *key = NULL, *string = NULL;
-    JSON_Value *temp_value = NULL;
+    const char *key = NULL;
     JSON_Array *array = NULL;
     JSON_Object *object = NULL;
     size_t i = 0, count = 0;
-    double num = 0.0;
-    int written = -1, written_total = 0;
 
     switch (json_value_get_type(value)) {
         case JSONArray:
             array = json_value_get_array(value);
             count = json_array_get_count(array);
-            APPEND_STRING("[");
+            append_string(writer, "[");
             if (count > 0 && is_pretty)
-                APPEND_STRING("\n");
+                append_string(writer, "\n");
             for (i = 0; i < count; i++) {
                 if (is_pretty)
-                    APPEND_INDENT(level+1);
-                temp_value = json_array_get_value(array, i);
-                written = json_serialize_to_buffer_r(temp_value, buf, level+1, is_pretty, num_buf);
-                if (written < 0)
-                    return -1;
-                if (buf != NULL)
-                    buf += written;
-                written_total += written;
+                    append_indent(writer, level+1);
+                json_serialize_r(json_array_get_value(array, i), writer, level+1, is_pretty);
                 if (i < (count - 1))
-                    APPEND_STRING(",");
+                    append_string(writer, ",");
                 if (is_pretty)
-                    APPEND_STRING("\n");
+                    append_string(writer, "\n");
             }
             if (count > 0 && is_pretty)
-                APPEND_INDENT(level);
-            APPEND_STRING("]");
-            return written_total;
+                append_indent(writer, level);
+            append_string(writer, "]");
+            break;
         case JSONObject:
             object = json_value_get_object(value);
             count  = json_object_get_count(object);
-            APPEND_STRING("{");
+            append_string(writer, "{");
             if (count > 0 && is_pretty)
-                APPEND_STRING("\n");
+                append_string(writer, "\n");
             for (i = 0; i < count; i++) {
                 key = json_object_get_name(object, i);
                 if (is_pretty)
-                    APPEND_INDENT(level+1);
-                written = json_serialize_string(key, buf);
-                if (written < 0)
-                    return -1;
-                if (buf != NULL)
-                    buf += written;
-                written_total += written;
-                APPEND_STRING(":");
-                if (is_pretty)
-                    APPEND_STRING(" ");
-                temp_value = json_object_get_value(object, key);
-                written = json_serialize_to_buffer_r(temp_value, buf, level+1, is_pretty, num_buf);
-                if (written < 0)
-                    return -1;
-                if (buf != NULL)
-                    buf += written;
-                written_total += written;
+                    append_indent(writer, level+1);
+                json_serialize_string(key, writer);
+                append_string(writer, is_pretty ? ": " : ":");
+                json_serialize_r(object->values[i], writer, level+1, is_pretty);
                 if (i < (count - 1))
-                    APPEND_STRING(",");
+                    append_string(writer, ",");
                 if (is_pretty)
-                    APPEND_STRING("\n");
+                    append_string(writer, "\n");
             }
             if (count > 0 && is_pretty)
-                APPEND_INDENT(level);
-            APPEND_STRING("}");
-            return written_total;
+                append_indent(writer, level);
+            append_string(writer, "}");
+            break;
         case JSONString:
-            string = json_value_get_string(value);
-            written = json_serialize_string(string, buf);
-            if (written < 0)
-                return -1;
-            if (buf != NULL)
-                buf += written;
-            written_total += written;
-            return written_total;
+            json_serialize_string(json_value_get_string(value), writer);
+            break;
         case JSONBoolean:
-            if (json_value_get_boolean(value))
-                APPEND_STRING("true");
-            else
-                APPEND_STRING("false");
-            return written_total;
+            append_string(writer, json_value_get_boolean(value) ? "true" : "false");
+            break;
         case JSONNumber:
-            num = json_value_get_number(value);
-            if (buf != NULL)
-                num_buf = buf;
-            if (num == ((double)(int)num)) /*  check if num is integer */
-                written = sprintf(num_buf, "%d", (int)num);
-            else
-                written = sprintf(num_buf, DOUBLE_SERIALIZATION_FORMAT, num);
-            if (written < 0)
-                return -1;
-            if (buf != NULL)
-                buf += written;
-            written_total += written;
-            return written_total;
+            json_serialize_number(json_value_get_number(value), writer);
+            break;
         case JSONNull:
-            APPEND_STRING("null");
-            return written_total;
-        case JSONError:
-            return -1;
+            append_string(writer, "null");
+            break;
         default:
-            return -1;
-    }
-}
-
-static int json_serialize_string(const char *string, char *buf) {
-    size_t i = 0, len = strlen(string);
-    char c = '\0';
-    int written = -1, written_total = 0;
-    APPEND_STRING("\"");
-    for (i = 0; i < len; i++) {
-        c = string[i];
-        switch (c) {
-            case '\"': APPEND_STRING("\\\""); break;
-            case '\\': APPEND_STRING("\\\\"); break;
-            case '\b': APPEND_STRING("\\b"); break;
-            case '\f': APPEND_STRING("\\f"); break;
-            case '\n': APPEND_STRING("\\n"); break;
-            case '\r': APPEND_STRING("\\r"); break;
-            case '\t': APPEND_STRING("\\t"); break;
-            default:
-                if (buf != NULL) {
-                    buf[0] = c;
-                    buf += 1;
-                }
-                written_total += 1;
-                break;
+            writer->failed = 1;
+            break;
+    }
+}
+
+/* Runs of characters needing no escape are appended at once. */
+static void json_serialize_string(const char *string, JSON_Writer *writer) {
+    const char *run = string;
+    const char *escaped = NULL;
+    append_string(writer, "\"");
+    for (; *string != '\0'; string++) {
+        switch (*string) {
+            case '\"': escaped = "\\\""; break;
+            case '\\': escaped = "\\\\"; break;
+            case '\b': escaped = "\\b"; break;
+            case '\f': escaped = "\\f"; break;
+            case '\n': escaped = "\\n"; break;
+            case '\r': escaped = "\\r"; break;
+            case '\t': escaped = "\\t"; break;
+            default: continue;
         }
+        writer_append(writer, run, (size_t)(string - run));
+        append_string(writer, escaped);
+        run = string + 1;
     }
-    APPEND_STRING("\"");
-    return written_total;
+    writer_append(writer, run, (size_t)(string - run));
+    append_string(writer, "\"");
 }
 
-static int append_indent(char *buf, int level) {
+static void json_serialize_number(double num, JSON_Writer *writer) {
+    char num_buf[1100];
+    int written = -1;
+    if (num == ((double)(int)num)) /*  check if num is integer */
+        written = sprintf(num_buf, "%d", (int)num);
+    else
+        written = sprintf(num_buf, DOUBLE_SERIALIZATION_FORMAT, num);
+    if (written < 0) {
+        writer->failed = 1;
+        return;
+    }
+    writer_append(writer, num_buf, (size_t)written);
+}
+
+static void append_indent(JSON_Writer *writer, int level) {
     int i;
-    int written = -1, written_total = 0;
     for (i = 0; i < level; i++) {
-        APPEND_STRING("  ");
+        writer_append(writer, "  ", 2);
     }
-    return written_total;
 }
 
-static int append_string(char *buf, const char *string) {
-    if (buf == NULL) {
-        return (int)strlen(string);
+static void append_string(JSON_Writer *writer, const char *string) {
+    writer_append(writer, string, strlen(string));
+}
+
+static size_t serialization_size(const JSON_Value *value, int is_pretty) {
+    JSON_Writer writer = { NULL, 0, 0, 0, NULL, NULL, 0 };
+    json_serialize_r(value, &writer, 0, is_pretty);
+    return writer.failed ? 0 : writer.length + 1;
+}
+
+static JSON_Status serialize_to_buffer(const JSON_Value *value, char *buf, size_t buf_size_in_bytes, int is_pretty) {
+    JSON_Writer writer = { NULL, 0, 0, 0, NULL, NULL, 0 };
+    if (buf == NULL || buf_size_in_bytes == 0)
+        return JSONFailure;
+    writer.buf = buf;
+    writer.capacity = buf_size_in_bytes;
+    json_serialize_r(value, &writer, 0, is_pretty);
+    if (writer.failed)
+        return JSONFailure;
+    buf[writer.length] = '\0';
+    return JSONSuccess;
+}
+
+static char * serialize_to_string(const JSON_Value *value, int is_pretty) {
+    JSON_Writer writer = { NULL, 0, 0, 1, NULL, NULL, 0 };
+    writer.capacity = 256;
+    writer.buf = (char*)parson_malloc(writer.capacity);
+    if (writer.buf == NULL)
+        return NULL;
+    json_serialize_r(value, &writer, 0, is_pretty);
+    if (writer.failed) {
+        parson_free(writer.buf);
+        return NULL;
     }
-    return sprintf(buf, "%s", string);
+    writer.buf[writer.length] = '\0';
+    return writer.buf;
 }
 
-#undef APPEND_STRING
-#undef APPEND_INDENT
+static JSON_Status serialize_to_writer(const JSON_Value *value, JSON_Write_Function write_fun, void *context, int is_pretty) {
+    char chunk[4096];
+    JSON_Writer writer = { NULL, 0, 0, 0, NULL, NULL, 0 };
+    if (write_fun == NULL)
+        return JSONFailure;
+    writer.buf = chunk;
+    writer.capacity = sizeof(chunk);
+    writer.write_fun = write_fun;
+    writer.context = context;
+    json_serialize_r(value, &writer, 0, is_pretty);
+    writer_flush(&writer);
+    return writer.failed ? JSONFailure : JSONSuccess;
+}
+
+static JSON_Status write_to_stream(void *context, const char *data, size_t size) {
+    return fwrite(data, 1, size, (FILE*)context) == size ? JSONSuccess : JSONFailure;
+}
+
+/* Writes a file next to filename first, so that it is replaced as a whole or
+   not at all. */
+static JSON_Status serialize_to_file(const JSON_Value *value, const char *filename, int is_pretty) {
+    JSON_Status return_code = JSONSuccess;
+    FILE *fp = NULL;
+    char *temp_filename = (char*)parson_malloc(strlen(filename) + 32);
+    if (temp_filename == NULL)
+        return JSONFailure;
+    sprintf(temp_filename, "%s.%ld", filename, (long)getpid());
+    fp = fopen(temp_filename, "w");
+    if (fp == NULL) {
+        parson_free(temp_filename);
+        return JSONFailure;
+    }
+    return_code = serialize_to_writer(value, write_to_stream, fp, is_pretty);
+    if (fclose(fp) == EOF)
+        return_code = JSONFailure;
+#if defined(_WIN32)
+    if (return_code == JSONSuccess)
+        remove(filename); /* rename does not replace files there */
+#endif
+    if (return_code == JSONSuccess && rename(temp_filename, filename) != 0)
+        return_code = JSONFailure;
+    if (return_code == JSONFailure)
+        remove(temp_filename);
+    parson_free(temp_filename);
+    return return_code;
+}
 
 /* Parser API */
 JSON_Value * json_parse_file(const char *filename) {
@@ -906,7 +1338,7 @@ JSON_Value * json_parse_string(const char *string) {
     SKIP_WHITESPACES(&string);
     if (*string != '{' && *string != '[')
         return NULL;
-    return parse_value((const char**)&string, 0);
+    return parse_value(NULL, (const char**)&string, 0);
 }
 
 JSON_Value * json_parse_string_with_comments(const char *string) {
@@ -923,12 +1355,101 @@ JSON_Value * json_parse_string_with_comments(const char *string) {
         parson_free(string_mutable_copy);
         return NULL;
     }
-    result = parse_value((const char**)&string_mutable_copy_ptr, 0);
+    result = parse_value(NULL, (const char**)&string_mutable_copy_ptr, 0);
     parson_free(string_mutable_copy);
     return result;
 }
 
 
+JSON_Value * json_parse_string_in_arena(JSON_Arena *arena, const char *string) {
+    char *string_arena_copy = NULL;
+    if (arena == NULL || string == NULL)
+        return NULL;
+    string_arena_copy = json_arena_strdup(arena, string);
+    if (string_arena_copy == NULL)
+        return NULL;
+    SKIP_WHITESPACES(&string_arena_copy);
+    if (*string_arena_copy != '{' && *string_arena_copy != '[')
+        return NULL;
+    return parse_value(arena, (const char**)&string_arena_copy, 0);
+}
+
+/* Arena API */
+JSON_Arena * json_arena_init(void) {
+    JSON_Arena *arena = (JSON_Arena*)parson_malloc(sizeof(JSON_Arena));
+    if (!arena)
+        return NULL;
+    arena->chunks = NULL;
+    arena->top = NULL;
+    arena->left = 0;
+    return arena;
+}
+
+void * json_arena_alloc(JSON_Arena *arena, size_t size) {
+    JSON_Arena_Chunk *chunk = NULL;
+    void *result = NULL;
+    if (arena == NULL)
+        return NULL;
+    size = ARENA_ALIGN(MAX(size, 1));
+    if (size <= arena->left) {
+        result = arena->top;
+        arena->top += size;
+        arena->left -= size;
+        return result;
+    }
+    chunk = (JSON_Arena_Chunk*)parson_malloc(ARENA_HEADER_SIZE + MAX(size, ARENA_CHUNK_SIZE));
+    if (!chunk)
+        return NULL;
+    chunk->size = MAX(size, ARENA_CHUNK_SIZE);
+    result = (char*)chunk + ARENA_HEADER_SIZE;
+    if (size > ARENA_CHUNK_SIZE / 2 && arena->chunks != NULL) {
+        /* large blocks get a chunk of their own, keeping the current one */
+        chunk->next = arena->chunks->next;
+        arena->chunks->next = chunk;
+        return result;
+    }
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+    arena->top = (char*)result + size;
+    arena->left = chunk->size - size;
+    return result;
+}
+
+char * json_arena_strdup(JSON_Arena *arena, const char *string) {
+    size_t length = strlen(string);
+    char *copy = (char*)json_arena_alloc(arena, length + 1);
+    if (!copy)
+        return NULL;
+    memcpy(copy, string, length + 1);
+    return copy;
+}
+
+int json_arena_owns(const JSON_Arena *arena, const void *ptr) {
+    const JSON_Arena_Chunk *chunk = NULL;
+    const char *data = NULL;
+    if (arena == NULL || ptr == NULL)
+        return 0;
+    for (chunk = arena->chunks; chunk != NULL; chunk = chunk->next) {
+        data = (const char*)chunk + ARENA_HEADER_SIZE;
+        if ((const char*)ptr >= data && (const char*)ptr < data + chunk->size)
+            return 1;
+    }
+    return 0;
+}
+
+void json_arena_free(JSON_Arena *arena) {
+    JSON_Arena_Chunk *chunk = NULL;
+    if (arena == NULL)
+        return;
+    while (arena->chunks != NULL) {
+        chunk = arena->chunks;
+        arena->chunks = chunk->next;
+        parson_free(chunk);
+    }
+    parson_free(arena);
+}
+
+
 /* JSON Object API */
 
 JSON_Value * json_object_get_value(const JSON_Object *object, const char *name) {
@@ -1073,7 +1594,7 @@ JSON_Value * json_value_init_object(void) {
     if (!new_value)
         return NULL;
     new_value->type = JSONObject;
-    new_value->value.object = json_object_init();
+    new_value->value.object = json_object_init(NULL);
     if (!new_value->value.object) {
         parson_free(new_value);
         return NULL;
@@ -1086,7 +1607,7 @@ JSON_Value * json_value_init_array(void) {
     if (!new_value)
         return NULL;
     new_value->type = JSONArray;
-    new_value->value.array = json_array_init();
+    new_value->value.array = json_array_init(NULL);
     if (!new_value->value.array) {
         parson_free(new_value);
         return NULL;
@@ -1106,7 +1627,7 @@ JSON_Value * json_value_init_string(const char *string) {
     copy = parson_strndup(string, string_len);
     if (copy == NULL)
         return NULL;
-    value = json_value_init_string_no_copy(copy);
+    value = json_value_init_string_no_copy(NULL, copy);
     if (value == NULL)
         parson_free(copy);
     return value;
@@ -1160,7 +1681,7 @@ JSON_Value * json_value_deep_copy(const JSON_Value *value) {
                     json_value_free(return_value);
                     return NULL;
                 }
-                if (json_array_add(temp_array_copy, temp_value_copy) == JSONFailure) {
+                if (json_array_add(NULL, temp_array_copy, temp_value_copy) == JSONFailure) {
                     json_value_free(return_value);
                     json_value_free(temp_value_copy);
                     return NULL;
@@ -1181,7 +1702,7 @@ JSON_Value * json_value_deep_copy(const JSON_Value *value) {
                     json_value_free(return_value);
                     return NULL;
                 }
-                if (json_object_add(temp_object_copy, temp_key, temp_value_copy) == JSONFailure) {
+                if (json_object_add(NULL, temp_object_copy, temp_key, temp_value_copy) == JSONFailure) {
                     json_value_free(return_value);
                     json_value_free(temp_value_copy);
                     return NULL;
@@ -1197,7 +1718,7 @@ JSON_Value * json_value_deep_copy(const JSON_Value *value) {
             temp_string_copy = parson_strdup(temp_string);
             if (temp_string_copy == NULL)
                 return NULL;
-            return_value = json_value_init_string_no_copy(temp_string_copy);
+            return_value = json_value_init_string_no_copy(NULL, temp_string_copy);
             if (return_value == NULL)
                 parson_free(temp_string_copy);
             return return_value;
@@ -1211,116 +1732,52 @@ JSON_Value * json_value_deep_copy(const JSON_Value *value) {
 }
 
 size_t json_serialization_size(const JSON_Value *value) {
-    char num_buf[1100]; /* recursively allocating buffer on stack is a bad idea, so let's do it only once */
-    int res = json_serialize_to_buffer_r(value, NULL, 0, 0, num_buf);
-    return res < 0 ? 0 : (size_t)(res + 1);
+    return serialization_size(value, 0);
 }
 
 JSON_Status json_serialize_to_buffer(const JSON_Value *value, char *buf, size_t buf_size_in_bytes) {
-    int written = -1;
-    size_t needed_size_in_bytes = json_serialization_size(value);
-    if (needed_size_in_bytes == 0 || buf_size_in_bytes < needed_size_in_bytes) {
-        return JSONFailure;
-    }
-    written = json_serialize_to_buffer_r(value, buf, 0, 0, NULL);
-    if (written < 0)
-        return JSONFailure;
-    return JSONSuccess;
+    return serialize_to_buffer(value, buf, buf_size_in_bytes, 0);
 }
 
 JSON_Status json_serialize_to_file(const JSON_Value *value, const char *filename) {
-    JSON_Status return_code = JSONSuccess;
-    FILE *fp = NULL;
-    char *serialized_string = json_serialize_to_string(value);
-    if (serialized_string == NULL) {
-        return JSONFailure;
-    }
-    fp = fopen (filename, "w");
-    if (fp != NULL) {
-        if (fputs (serialized_string, fp) == EOF) {
-            return_code = JSONFailure;
-        }
-        if (fclose (fp) == EOF) {
-            return_code = JSONFailure;
-        }
-    }
-    json_free_serialized_string(serialized_string);
-    return return_code;
+    return serialize_to_file(value, filename, 0);
+}
+
+JSON_Status json_serialize_to_stream(const JSON_Value *value, FILE *fp) {
+    return serialize_to_writer(value, write_to_stream, fp, 0);
+}
+
+JSON_Status json_serialize_to_writer(const JSON_Value *value, JSON_Write_Function write_fun, void *context) {
+    return serialize_to_writer(value, write_fun, context, 0);
 }
 
 char * json_serialize_to_string(const JSON_Value *value) {
-    JSON_Status serialization_result = JSONFailure;
-    size_t buf_size_bytes = json_serialization_size(value);
-    char *buf = NULL;
-    if (buf_size_bytes == 0) {
-        return NULL;
-    }
-    buf = (char*)parson_malloc(buf_size_bytes);
-    if (buf == NULL)
-        return NULL;
-    serialization_result = json_serialize_to_buffer(value, buf, buf_size_bytes);
-    if (serialization_result == JSONFailure) {
-        json_free_serialized_string(buf);
-        return NULL;
-    }
-    return buf;
+    return serialize_to_string(value, 0);
 }
 
 size_t json_serialization_size_pretty(const JSON_Value *value) {
-    char num_buf[1100]; /* recursively allocating buffer on stack is a bad idea, so let's do it only once */
-    int res = json_serialize_to_buffer_r(value, NULL, 0, 1, num_buf);
-    return res < 0 ? 0 : (size_t)(res + 1);
+    return serialization_size(value, 1);
 }
 
 JSON_Status json_serialize_to_buffer_pretty(const JSON_Value *value, char *buf, size_t buf_size_in_bytes) {
-    int written = -1;
-    size_t needed_size_in_bytes = json_serialization_size_pretty(value);
-    if (needed_size_in_bytes == 0 || buf_size_in_bytes < needed_size_in_bytes)
-        return JSONFailure;
-    written = json_serialize_to_buffer_r(value, buf, 0, 1, NULL);
-    if (written < 0)
-        return JSONFailure;
-    return JSONSuccess;
+    return serialize_to_buffer(value, buf, buf_size_in_bytes, 1);
 }
 
 JSON_Status json_serialize_to_file_pretty(const JSON_Value *value, const char *filename) {
-    JSON_Status return_code = JSONSuccess;
-    FILE *fp = NULL;
-    char *serialized_string = json_serialize_to_string_pretty(value);
-    if (serialized_string == NULL) {
-        return JSONFailure;
-    }
-    fp = fopen (filename, "w");
-    if (fp != NULL) {
-        if (fputs (serialized_string, fp) == EOF) {
-            return_code = JSONFailure;
-        }
-        if (fclose (fp) == EOF) {
-            return_code = JSONFailure;
-        }
-    }
-    json_free_serialized_string(serialized_string);
-    return return_code;
+    return serialize_to_file(value, filename, 1);
 }
 
-char * json_serialize_to_string_pretty(const JSON_Value *value) {
-    JSON_Status serialization_result = JSONFailure;
-    size_t buf_size_bytes = json_serialization_size_pretty(value);
-    char *buf = NULL;
-    if (buf_size_bytes == 0) {
-        return NULL;
-    }
-    buf = (char*)parson_malloc(buf_size_bytes);
-    if (buf == NULL)
-        return NULL;
-    serialization_result = json_serialize_to_buffer_pretty(value, buf, buf_size_bytes);
-    if (serialization_result == JSONFailure) {
-        json_free_serialized_string(buf);
-        return NULL;
-    }
-    return buf;
+JSON_Status json_serialize_to_stream_pretty(const JSON_Value *value, FILE *fp) {
+    return serialize_to_writer(value, write_to_stream, fp, 1);
 }
 
+JSON_Status json_serialize_to_writer_pretty(const JSON_Value *value, JSON_Write_Function write_fun, void *context) {
+    return serialize_to_writer(value, write_fun, context, 1);
+}
+
+char * json_serialize_to_string_pretty(const JSON_Value *value) {
+    return serialize_to_string(value, 1);
+}
 
 void json_free_serialized_string(char *string) {
     parson_free(string);
@@ -1406,7 +1863,7 @@ JSON_Status json_array_clear(JSON_Array *array) {
 JSON_Status json_array_append_value(JSON_Array *array, JSON_Value *value) {
     if (array == NULL || value == NULL)
         return JSONFailure;
-    return json_array_add(array, value);
+    return json_array_add(NULL, array, value);
 }
 
 JSON_Status json_array_append_string(JSON_Array *array, const char *string) {
@@ -1455,21 +1912,16 @@ JSON_Status json_array_append_null(JSON_Array *array) {
 
 JSON_Status json_object_set_value(JSON_Object *object, const char *name, JSON_Value *value) {
     size_t i = 0;
-    JSON_Value *old_value;
     if (object == NULL || name == NULL || value == NULL)
         return JSONFailure;
-    old_value = json_object_get_value(object, name);
-    if (old_value != NULL) { /* free and overwrite old value */
-        json_value_free(old_value);
-        for (i = 0; i < json_object_get_count(object); i++) {
-            if (strcmp(object->names[i], name) == 0) {
-                object->values[i] = value;
-                return JSONSuccess;
-            }
-        }
+    i = json_object_find(object, name, strlen(name));
+    if (i < object->count) { /* free and overwrite old value */
+        json_value_free(object->values[i]);
+        object->values[i] = value;
+        return JSONSuccess;
     }
     /* add new key value pair */
-    return json_object_add(object, name, value);
+    return json_object_add(NULL, object, name, value);
 }
 
 JSON_Status json_object_set_string(JSON_Object *object, const char *name, const char *string) {
@@ -1507,7 +1959,7 @@ JSON_Status json_object_dotset_value(JSON_Object *object, const char *name, JSON
                 parson_free(current_name);
                 return JSONFailure;
             }
-            if (json_object_add(object, current_name, new_value) == JSONFailure) {
+            if (json_object_add(NULL, object, current_name, new_value) == JSONFailure) {
                 json_value_free(new_value);
                 parson_free(current_name);
                 return JSONFailure;
@@ -1565,22 +2017,22 @@ JSON_Status json_object_dotset_null(JSON_Object *object, const char *name) {
 
 JSON_Status json_object_remove(JSON_Object *object, const char *name) {
     size_t i = 0, last_item_index = 0;
-    if (object == NULL || json_object_get_value(object, name) == NULL)
+    if (object == NULL || name == NULL)
         return JSONFailure;
-    last_item_index = json_object_get_count(object) - 1;
-    for (i = 0; i < json_object_get_count(object); i++) {
-        if (strcmp(object->names[i], name) == 0) {
-            parson_free(object->names[i]);
-            json_value_free(object->values[i]);
-            if (i != last_item_index) { /* Replace key value pair with one from the end */
-                object->names[i] = object->names[last_item_index];
-                object->values[i] = object->values[last_item_index];
-            }
-            object->count -= 1;
-            return JSONSuccess;
-        }
-    }
-    return JSONFailure; /* No execution path should end here */
+    i = json_object_find(object, name, strlen(name));
+    if (i == object->count)
+        return JSONFailure;
+    last_item_index = object->count - 1;
+    parson_free(object->names[i]);
+    json_value_free(object->values[i]);
+    if (i != last_item_index) { /* Replace key value pair with one from the end */
+        object->names[i] = object->names[last_item_index];
+        object->values[i] = object->values[last_item_index];
+    }
+    object->count -= 1;
+    if (object->cells != NULL) /* positions moved, start the index over */
+        json_object_index(NULL, object);
+    return JSONSuccess;
 }
 
 JSON_Status json_object_dotremove(JSON_Object *object, const char *name) {
@@ -1611,6 +2063,7 @@ JSON_Status json_object_clear(JSON_Object *object) {
         json_value_free(object->values[i]);
     }
     object->count = 0;
+    json_object_index(NULL, object);
     return JSONSuccess;
 }
 
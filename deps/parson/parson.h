@@ -30,11 +30,13 @@ extern "C"
 #endif    
     
 #include <stddef.h>   /* size_t */    
+#include <stdio.h>    /* FILE */
     
 /* Types and enums */
 typedef struct json_object_t JSON_Object;
 typedef struct json_array_t  JSON_Array;
 typedef struct json_value_t  JSON_Value;
+typedef struct json_arena_t  JSON_Arena;
 
 enum json_value_type {
     JSONError   = -1,
@@ -56,6 +58,9 @@ typedef int JSON_Status;
 typedef void * (*JSON_Malloc_Function)(size_t);
 typedef void   (*JSON_Free_Function)(void *);
 
+/* Receives the serialized text chunk by chunk, returns JSONFailure to stop */
+typedef JSON_Status (*JSON_Write_Function)(void *context, const char *data, size_t size);
+
 /* Call only once, before calling any other function from parson API. If not called, malloc and free
    from stdlib will be used for all allocations */
 void json_set_allocation_functions(JSON_Malloc_Function malloc_fun, JSON_Free_Function free_fun);
@@ -74,16 +79,36 @@ JSON_Value * json_parse_string(const char *string);
     returns NULL in case of error */
 JSON_Value * json_parse_string_with_comments(const char *string);
     
-/* Serialization */
+/* Arenas
+   A value parsed in an arena is allocated from it along with everything it
+   holds, and all of it is released at once by json_arena_free. Strings point
+   into the arena's own copy of the parsed text instead of being copied one by
+   one. Such values are read-only: they must not be modified nor passed to
+   json_value_free. */
+JSON_Arena * json_arena_init(void);
+void       * json_arena_alloc(JSON_Arena *arena, size_t size);
+char       * json_arena_strdup(JSON_Arena *arena, const char *string);
+int          json_arena_owns(const JSON_Arena *arena, const void *ptr); /* returns 1 if ptr was allocated from arena */
+void         json_arena_free(JSON_Arena *arena);
+
+/*  Parses first JSON value in a string into arena, returns NULL in case of error */
+JSON_Value * json_parse_string_in_arena(JSON_Arena *arena, const char *string);
+
+/* Serialization, in a single pass. Files are written under a temporary name
+   then renamed, so that they are never left half written. */
 size_t      json_serialization_size(const JSON_Value *value); /* returns 0 on fail */
 JSON_Status json_serialize_to_buffer(const JSON_Value *value, char *buf, size_t buf_size_in_bytes);
 JSON_Status json_serialize_to_file(const JSON_Value *value, const char *filename);
+JSON_Status json_serialize_to_stream(const JSON_Value *value, FILE *fp);
+JSON_Status json_serialize_to_writer(const JSON_Value *value, JSON_Write_Function write_fun, void *context);
 char *      json_serialize_to_string(const JSON_Value *value);
 
 /* Pretty serialization */
 size_t      json_serialization_size_pretty(const JSON_Value *value); /* returns 0 on fail */
 JSON_Status json_serialize_to_buffer_pretty(const JSON_Value *value, char *buf, size_t buf_size_in_bytes);
 JSON_Status json_serialize_to_file_pretty(const JSON_Value *value, const char *filename);
+JSON_Status json_serialize_to_stream_pretty(const JSON_Value *value, FILE *fp);
+JSON_Status json_serialize_to_writer_pretty(const JSON_Value *value, JSON_Write_Function write_fun, void *context);
 char *      json_serialize_to_string_pretty(const JSON_Value *value);
 
 void        json_free_serialized_string(char *string); /* frees string from json_serialize_to_string and json_serialize_to_string_pretty */
@@ -9,9 +9,10 @@
 #include <string.h>
 #include <stdlib.h>
 #include "gumbo-parser/gumbo.h"
-#include "gumbo-text-content/gumbo-text-content.h"
-#include "gumbo-get-element-by-id/get-element-by-id.h"
-#include "gumbo-get-elements-by-tag-name/get-elements-by-tag-name.h"
+#include "gumbo-parser/error.h"
+#include "gumbo-parser/parser.h"
+#include "gumbo-parser/string_buffer.h"
+#include "gumbo-parser/tokenizer.h"
 #include "http-get/http-get.h"
 #include "list/list.h"
 #include "substr/substr.h"
@@ -20,9 +21,146 @@
 #include "trim/trim.h"
 #include "wiki-registry.h"
 
-//
-// TODO find dox on gumbo so the node iteration isn't so ugly
-//
+/**
+ * Maximum depth of nested list items.
+ */
+
+#define WIKI_REGISTRY_MAX_DEPTH 32
+
+/**
+ * Size of the chunks the tokenizer allocates from, and the number of size
+ * classes blocks are recycled by: 16 bytes to 4KB, doubling.
+ */
+
+#define WIKI_ARENA_CHUNK (256 * 1024)
+#define WIKI_ARENA_CLASSES 9
+#define WIKI_ARENA_HEADER 16
+
+/**
+ * A bump allocator handed to gumbo. Freed blocks are kept on a list per
+ * size class for the next allocations of that class, as the tokenizer
+ * frees every token right after it is read. Chunks are only released
+ * once the whole parse is done, which then takes a few calls to `free`.
+ */
+
+typedef struct wiki_arena_chunk {
+  struct wiki_arena_chunk *next;
+} wiki_arena_chunk_t;
+
+typedef struct wiki_arena_block {
+  struct wiki_arena_block *next;
+} wiki_arena_block_t;
+
+typedef struct {
+  wiki_arena_chunk_t *head;
+  char *top;
+  size_t left;
+  wiki_arena_block_t *free[WIKI_ARENA_CLASSES];
+} wiki_arena_t;
+
+/**
+ * An open `li`, collecting its text.
+ */
+
+typedef struct {
+  GumboStringBuffer text;
+  size_t slot;
+  int level;
+} wiki_item_t;
+
+/**
+ * State of a registry parse. The page is only ever seen as a stream of
+ * tokens: headings and list items are told apart by keeping track of how
+ * deep into `#wiki-body` the tokenizer is.
+ */
+
+typedef struct {
+  GumboParser parser;
+  GumboOptions options;
+  GumboOutput output;
+  wiki_arena_t arena;
+  wiki_package_cb cb;
+  void *data;
+  // pending text, a text node in a DOM
+  GumboStringBuffer run;
+  int run_has_text;
+  // nesting
+  int div_depth;
+  int body_depth;
+  int heading_depth;
+  int in_h2;
+  int ul_depth;
+  // current category
+  GumboStringBuffer heading;
+  char *category;
+  // open list items, and the packages waiting for their parents to close
+  wiki_item_t items[WIKI_REGISTRY_MAX_DEPTH];
+  int nitems;
+  wiki_package_t **pending;
+  size_t npending;
+  size_t pending_size;
+  int done;
+} wiki_registry_parser_t;
+
+static void *
+wiki_arena_alloc(void *userdata, size_t size) {
+  wiki_arena_t *arena = userdata;
+  size_t class = 0;
+
+  while (class < WIKI_ARENA_CLASSES && ((size_t) 16 << class) < size) class++;
+
+  if (class < WIKI_ARENA_CLASSES && arena->free[class]) {
+    wiki_arena_block_t *block = arena->free[class];
+    arena->free[class] = block->next;
+    return block;
+  }
+
+  // the size class is kept in front of the block
+  size_t block_size = WIKI_ARENA_HEADER
+    + (class < WIKI_ARENA_CLASSES ? (size_t) 16 << class : (size + 15) & ~(size_t) 15);
+
+  if (block_size > arena->left) {
+    size_t chunk_size = WIKI_ARENA_HEADER + block_size;
+    if (chunk_size < WIKI_ARENA_CHUNK) chunk_size = WIKI_ARENA_CHUNK;
+
+    wiki_arena_chunk_t *chunk = malloc(chunk_size);
+    if (!chunk) return NULL;
+    chunk->next = arena->head;
+    arena->head = chunk;
+    arena->top = (char *) chunk + WIKI_ARENA_HEADER;
+    arena->left = chunk_size - WIKI_ARENA_HEADER;
+  }
+
+  char *ptr = arena->top;
+  arena->top += block_size;
+  arena->left -= block_size;
+  *(size_t *) ptr = class;
+  return ptr + WIKI_ARENA_HEADER;
+}
+
+static void
+wiki_arena_free(void *userdata, void *ptr) {
+  wiki_arena_t *arena = userdata;
+  if (!ptr) return;
+
+  size_t class = *(size_t *) ((char *) ptr - WIKI_ARENA_HEADER);
+  if (class < WIKI_ARENA_CLASSES) {
+    wiki_arena_block_t *block = ptr;
+    block->next = arena->free[class];
+    arena->free[class] = block;
+  }
+}
+
+static void
+wiki_arena_destroy(wiki_arena_t *arena) {
+  wiki_arena_chunk_t *chunk = arena->head;
+  while (chunk) {
+    wiki_arena_chunk_t *next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+  arena->head = NULL;
+}
 
 /**
  * Create a new wiki package.
@@ -53,19 +191,15 @@ add_package_href(wiki_package_t *self) {
 }
 
 /**
- * Parse the given wiki `li` into a package.
+ * Parse the text of a wiki `li` into a package.
  */
 
 static wiki_package_t *
-parse_li(GumboNode *li) {
+parse_li(const char *text) {
   wiki_package_t *self = wiki_package_new();
-  char *text = NULL;
 
   if (!self) goto cleanup;
 
-  text = gumbo_text_content(li);
-  if (!text) goto cleanup;
-
   // TODO support unicode dashes
   char *tok = strstr(text, " - ");
   if (!tok) goto cleanup;
@@ -80,72 +214,336 @@ parse_li(GumboNode *li) {
   add_package_href(self);
 
 cleanup:
-  free(text);
   return self;
 }
 
 /**
- * Parse a list of packages from the given `html`
+ * Copy the content of `buffer` to a new string.
  */
 
-list_t *
-wiki_registry_parse(const char *html) {
-  GumboOutput *output = gumbo_parse(html);
-  list_t *pkgs = list_new();
+static char *
+buffer_to_string(GumboStringBuffer *buffer) {
+  char *str = malloc(buffer->length + 1);
+  if (str) {
+    memcpy(str, buffer->data, buffer->length);
+    str[buffer->length] = '\0';
+  }
+  return str;
+}
+
+/**
+ * Hand the packages over once the outermost `li` is closed, so nested
+ * lists come out in document order.
+ */
 
-  GumboNode *body = gumbo_get_element_by_id("wiki-body", output->root);
-  if (body) {
-    GumboNode* markdown_body = ((GumboNode*)((GumboVector)body->v.element.children).data[1]);
-    GumboVector children = (GumboVector)markdown_body->v.element.children;
+static void
+flush_pending(wiki_registry_parser_t *self) {
+  if (self->nitems) return;
 
-    size_t count = children.length - 1;
+  for (size_t i = 0; i < self->npending; i++) {
+    wiki_package_t *pkg = self->pending[i];
+    if (!pkg) continue;
+    // once the callback asked to stop, the rest is only freed
+    if (self->done) {
+      wiki_package_free(pkg);
+    } else if (self->cb(pkg, self->data)) {
+      self->done = 1;
+    }
+  }
+  self->npending = 0;
+}
+
+static void
+open_li(wiki_registry_parser_t *self) {
+  if (self->nitems == WIKI_REGISTRY_MAX_DEPTH) return;
+
+  if (self->npending == self->pending_size) {
+    size_t size = self->pending_size ? self->pending_size * 2 : 16;
+    wiki_package_t **pending = realloc(self->pending, size * sizeof(wiki_package_t *));
+    if (!pending) return;
+    self->pending = pending;
+    self->pending_size = size;
+  }
 
-    for (size_t index = 0; index < count; index++) {
-      GumboNode *heading = (GumboNode *)children.data[index];
-      GumboNode *ul = NULL;
+  wiki_item_t *item = &self->items[self->nitems++];
+  gumbo_string_buffer_init(&self->parser, &item->text);
+  item->level = self->ul_depth;
+  item->slot = self->npending;
+  self->pending[self->npending++] = NULL;
+}
+
+static void
+close_li(wiki_registry_parser_t *self) {
+  wiki_item_t *item = &self->items[--self->nitems];
+  wiki_package_t *package = NULL;
+  char *text = buffer_to_string(&item->text);
+
+  gumbo_string_buffer_destroy(&self->parser, &item->text);
+
+  if (text) {
+    package = parse_li(text);
+    free(text);
+  }
+
+  if (package && package->description) {
+    package->category = strdup(self->category);
+    self->pending[item->slot] = package;
+  } else {
+    // failed to parse package
+    if (package) wiki_package_free(package);
+  }
 
-      if (heading->v.element.tag != GUMBO_TAG_DIV) {
-        continue;
+  flush_pending(self);
+}
+
+/**
+ * Close every `li` opened at list depth `level` or deeper.
+ */
+
+static void
+close_li_from(wiki_registry_parser_t *self, int level) {
+  while (self->nitems && self->items[self->nitems - 1].level >= level) {
+    close_li(self);
+  }
+}
+
+/**
+ * Add the pending text to the open heading and list items. Whitespace only
+ * text is dropped, the same way it is left out of a node's text content.
+ */
+
+static void
+flush_text(wiki_registry_parser_t *self) {
+  if (self->run_has_text) {
+    GumboStringPiece piece = { self->run.data, self->run.length };
+
+    if (self->in_h2) {
+      gumbo_string_buffer_append_string(&self->parser, &piece, &self->heading);
+    }
+    for (int i = 0; i < self->nitems; i++) {
+      gumbo_string_buffer_append_string(&self->parser, &piece, &self->items[i].text);
+    }
+  }
+
+  self->run.length = 0;
+  self->run_has_text = 0;
+}
+
+static int
+has_class(GumboVector *attributes, const char *prefix) {
+  GumboAttribute *class = gumbo_get_attribute(attributes, "class");
+  return class && 0 == strncmp(class->value, prefix, strlen(prefix));
+}
+
+static void
+start_tag(wiki_registry_parser_t *self, GumboTokenStartTag *tag) {
+  switch (tag->tag) {
+    // content the tree builder would not tokenize as markup
+    case GUMBO_TAG_SCRIPT:
+      gumbo_tokenizer_set_state(&self->parser, GUMBO_LEX_SCRIPT);
+      return;
+    case GUMBO_TAG_STYLE:
+    case GUMBO_TAG_XMP:
+    case GUMBO_TAG_IFRAME:
+    case GUMBO_TAG_NOEMBED:
+    case GUMBO_TAG_NOFRAMES:
+      gumbo_tokenizer_set_state(&self->parser, GUMBO_LEX_RAWTEXT);
+      return;
+    case GUMBO_TAG_TITLE:
+    case GUMBO_TAG_TEXTAREA:
+      gumbo_tokenizer_set_state(&self->parser, GUMBO_LEX_RCDATA);
+      return;
+    case GUMBO_TAG_PLAINTEXT:
+      gumbo_tokenizer_set_state(&self->parser, GUMBO_LEX_PLAINTEXT);
+      return;
+
+    case GUMBO_TAG_DIV:
+      self->div_depth++;
+
+      if (!self->body_depth) {
+        GumboAttribute *id = gumbo_get_attribute(&tag->attributes, "id");
+        if (id && 0 == strcmp("wiki-body", id->value)) {
+          self->body_depth = self->div_depth;
+        }
+      } else if (self->div_depth == self->body_depth + 2
+              && has_class(&tag->attributes, "markdown-heading")) {
+        // headings are direct children of the markdown body
+        self->heading_depth = self->div_depth;
       }
+      return;
 
-      GumboAttribute *node_id = gumbo_get_attribute(&heading->v.element.attributes, "class");
-      if (node_id == NULL || strncmp(node_id->value, "markdown-heading", 16) != 0) {
-        continue;
+    case GUMBO_TAG_H2:
+      if (self->heading_depth && !self->ul_depth) {
+        self->in_h2 = 1;
+        self->heading.length = 0;
       }
+      return;
 
-      for (; index < count; index++) {
-        ul = (GumboNode *)children.data[index];
+    case GUMBO_TAG_UL:
+      if (self->ul_depth) {
+        self->ul_depth++;
+      } else if (self->category && self->div_depth == self->body_depth + 1) {
+        self->ul_depth = 1;
+      }
+      return;
 
-        if (ul->v.element.tag == GUMBO_TAG_UL) {
-          break;
-        }
+    case GUMBO_TAG_LI:
+      if (!self->ul_depth) return;
+      // an open item of the same list is implicitly closed
+      close_li_from(self, self->ul_depth);
+      open_li(self);
+      return;
+
+    default:
+      return;
+  }
+}
+
+static void
+end_tag(wiki_registry_parser_t *self, GumboTag tag) {
+  switch (tag) {
+    case GUMBO_TAG_DIV:
+      if (!self->div_depth) return;
+      if (self->heading_depth == self->div_depth) {
+        self->heading_depth = 0;
+        self->in_h2 = 0;
+      }
+      if (self->body_depth == self->div_depth) {
+        // nothing past the wiki body is part of the registry
+        close_li_from(self, 0);
+        self->done = 1;
       }
+      self->div_depth--;
+      return;
 
-      list_t *h2 = gumbo_get_elements_by_tag_name("h2", heading);
-      char *category = gumbo_text_content(h2->head->val);
-      if (!category) break;
-      trim(case_lower(category));
-
-      list_t *lis = gumbo_get_elements_by_tag_name("li", ul);
-      list_iterator_t *li_iterator = list_iterator_new(lis, LIST_HEAD);
-      list_node_t *li_node;
-      while ((li_node = list_iterator_next(li_iterator))) {
-        wiki_package_t *package = parse_li(li_node->val);
-        if (package && package->description) {
-          package->category = strdup(category);
-          list_rpush(pkgs, list_node_new(package));
-        } else {
-          // failed to parse package
-          if (package) wiki_package_free(package);
-        }
+    case GUMBO_TAG_H2:
+      if (!self->in_h2) return;
+      self->in_h2 = 0;
+      free(self->category);
+      self->category = buffer_to_string(&self->heading);
+      if (self->category) trim(case_lower(self->category));
+      return;
+
+    case GUMBO_TAG_UL:
+      if (!self->ul_depth) return;
+      close_li_from(self, self->ul_depth);
+      if (0 == --self->ul_depth) {
+        // a category only has the first list after its heading
+        free(self->category);
+        self->category = NULL;
       }
-      list_iterator_destroy(li_iterator);
-      list_destroy(lis);
-      free(category);
+      return;
+
+    case GUMBO_TAG_LI:
+      if (self->nitems && self->items[self->nitems - 1].level == self->ul_depth) {
+        close_li(self);
+      }
+      return;
+
+    default:
+      return;
+  }
+}
+
+/**
+ * Stream the packages listed in the given wiki `html` to `cb`, without
+ * building the document tree.
+ */
+
+void
+wiki_registry_parse_each(const char *html, wiki_package_cb cb, void *data) {
+  wiki_registry_parser_t self;
+  GumboToken token;
+
+  memset(&self, 0, sizeof(self));
+  // parse errors are of no use here, don't keep them
+  self.options = kGumboDefaultOptions;
+  self.options.max_errors = 0;
+  self.options.allocator = wiki_arena_alloc;
+  self.options.deallocator = wiki_arena_free;
+  self.options.userdata = &self.arena;
+  self.parser._options = &self.options;
+  self.parser._output = &self.output;
+  self.cb = cb;
+  self.data = data;
+
+  // skip the page chrome, starting right at the wiki body's tag
+  const char *start = strstr(html, "id=\"wiki-body\"");
+  while (start && start > html && '<' != *start) start--;
+  if (!start || '<' != *start) start = html;
+
+  gumbo_init_errors(&self.parser);
+  gumbo_tokenizer_state_init(&self.parser, start, strlen(start));
+  gumbo_tokenizer_set_emit_text(&self.parser, true);
+  gumbo_string_buffer_init(&self.parser, &self.run);
+  gumbo_string_buffer_init(&self.parser, &self.heading);
+
+  while (!self.done) {
+    gumbo_lex(&self.parser, &token);
+
+    switch (token.type) {
+      case GUMBO_TOKEN_TEXT:
+        self.run_has_text = 1;
+        if (self.in_h2 || self.nitems) {
+          gumbo_string_buffer_append_string(&self.parser, &token.original_text, &self.run);
+        }
+        break;
+      case GUMBO_TOKEN_CHARACTER:
+        self.run_has_text = 1;
+        // fall through
+      case GUMBO_TOKEN_WHITESPACE:
+        if (self.in_h2 || self.nitems) {
+          gumbo_string_buffer_append_codepoint(&self.parser, token.v.character, &self.run);
+        }
+        break;
+      case GUMBO_TOKEN_NULL:
+        break;
+      case GUMBO_TOKEN_START_TAG:
+        flush_text(&self);
+        start_tag(&self, &token.v.start_tag);
+        break;
+      case GUMBO_TOKEN_END_TAG:
+        flush_text(&self);
+        end_tag(&self, token.v.end_tag);
+        break;
+      case GUMBO_TOKEN_EOF:
+        flush_text(&self);
+        close_li_from(&self, 0);
+        self.done = 1;
+        break;
+      default:
+        flush_text(&self);
+        break;
     }
+
+    gumbo_token_destroy(&self.parser, &token);
+  }
+
+  // the callback may have stopped the parse early
+  for (size_t i = 0; i < self.npending; i++) {
+    if (self.pending[i]) wiki_package_free(self.pending[i]);
   }
 
-  gumbo_destroy_output(&kGumboDefaultOptions, output);
+  free(self.pending);
+  free(self.category);
+  // along with everything gumbo allocated
+  wiki_arena_destroy(&self.arena);
+}
+
+static int
+add_package(wiki_package_t *pkg, void *data) {
+  list_rpush((list_t *) data, list_node_new(pkg));
+  return 0;
+}
+
+/**
+ * Parse a list of packages from the given `html`
+ */
+
+list_t *
+wiki_registry_parse(const char *html) {
+  list_t *pkgs = list_new();
+  if (pkgs) wiki_registry_parse_each(html, add_package, pkgs);
   return pkgs;
 }
 
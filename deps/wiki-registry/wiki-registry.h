@@ -19,9 +19,19 @@ typedef struct {
   char *category;
 } wiki_package_t;
 
+/**
+ * Called with each package found, which it then owns. Returning non-zero
+ * stops the parse.
+ */
+
+typedef int (*wiki_package_cb)(wiki_package_t *, void *);
+
 list_t *
 wiki_registry(const char *);
 
+void
+wiki_registry_parse_each(const char *, wiki_package_cb, void *);
+
 list_t *
 wiki_registry_parse(const char *);
 
@@ -30,6 +30,7 @@
 
 #include "common/clib-cache.h"
 #include "common/clib-package.h"
+#include "common/clib-pool.h"
 
 #include <asprintf/asprintf.h>
 #include <commander/commander.h>
@@ -39,7 +40,9 @@
 #include <list/list.h>
 #include <logger/logger.h>
 #include "mkdirp/mkdirp.h"
+#include <parson/parson.h>
 #include <path-join/path-join.h>
+#include <sha1/sha1.h>
 #include <str-flatten/str-flatten.h>
 #include <trim/trim.h>
 
@@ -58,6 +61,12 @@
 #define DEFAULT_MAKE_CHECK_TARGET "test"
 #endif
 
+#ifndef BUILD_STATE_FILE
+#define BUILD_STATE_FILE ".clib-build.json"
+#endif
+
+#define BUILD_STATE_VERSION 1
+
 #if defined(_WIN32) || defined(WIN32) || defined(__MINGW32__) ||               \
     defined(__MINGW64__)
 #define setenv(k, v, _) _putenv_s(k, v)
@@ -107,81 +116,202 @@ options_t opts = {.skip_cache = 0,
 
 };
 
-int build_package(const char *dir);
+typedef struct build_task build_task_t;
+struct build_task {
+  char *dir;
+  char *path;
+  clib_package_t *package;
+  clib_pool_task_t *task;
+  list_t *dependencies; // build_task_t, done before this one
+  char fingerprint[41];
+  int skippable; // whether a matching fingerprint lets make be skipped
+};
+
+// every package found in the tree, by manifest path
+hash_t *tasks = 0;
+clib_pool_t *pool = 0;
+
+// fingerprints of the last successful build of each package
+JSON_Value *build_state = 0;
+char *build_state_path = 0;
+int build_state_changed = 0;
+
+// CFLAGS as given, before the include path of the deps is added
+char *cflags = 0;
 
 #ifdef HAVE_PTHREADS
 pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
-typedef struct clib_package_thread clib_package_thread_t;
-struct clib_package_thread {
-  const char *dir;
-};
+#endif
 
-void *build_package_with_manifest_name_thread(void *arg) {
-  clib_package_thread_t *wrap = arg;
-  const char *dir = wrap->dir;
-  build_package(dir);
-  return 0;
+int build_package(const char *dir, build_task_t **out);
+
+static void fingerprint_string(SHA1_CTX *ctx, const char *str) {
+  if (0 == str) {
+    str = "";
+  }
+
+  SHA1Update(ctx, (const unsigned char *)str, strlen(str) + 1);
 }
-#endif
 
-int build_package_with_manifest_name(const char *dir, const char *file) {
-  clib_package_t *package = 0;
-  char *json = 0;
-  int ok = 0;
-  int rc = 0;
+static void fingerprint_file(SHA1_CTX *ctx, const char *path) {
+  unsigned char buffer[BUFSIZ];
+  size_t n = 0;
+  FILE *file = fopen(path, "rb");
+
+  // a file going missing changes the fingerprint too
+  fingerprint_string(ctx, file ? path : "");
+
+  if (0 == file) {
+    return;
+  }
+
+  while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    SHA1Update(ctx, buffer, n);
+  }
+
+  fclose(file);
+}
+
+/**
+ * Fingerprint everything the build of a package depends on: its manifest,
+ * makefile and sources, the build environment, and the fingerprints of its
+ * dependencies, which are built before it.
+ */
+
+static void fingerprint_package(build_task_t *build, const char *flags,
+                                const char *prefix, const char *args) {
+  clib_package_t *package = build->package;
+  unsigned char digest[20];
+  SHA1_CTX ctx;
+
+  SHA1Init(&ctx);
+  fingerprint_file(&ctx, build->path);
+
+  if (0 != package->makefile) {
+    char *makefile = path_join(build->dir, package->makefile);
+    fingerprint_file(&ctx, makefile);
+    free(makefile);
+  }
+
+  if (0 != package->src) {
+    list_iterator_t *iterator = list_iterator_new(package->src, LIST_HEAD);
+    list_node_t *node = 0;
+
+    while ((node = list_iterator_next(iterator))) {
+      char *file = path_join(build->dir, node->val);
+
+      // installed dependencies keep their sources flat
+      if (0 != fs_exists(file)) {
+        free(file);
+        file = path_join(build->dir, basename(node->val));
+      }
+
+      fingerprint_file(&ctx, file);
+      free(file);
+    }
+
+    list_iterator_destroy(iterator);
+  }
+
+  fingerprint_string(&ctx, flags);
+  fingerprint_string(&ctx, prefix);
+  fingerprint_string(&ctx, args);
+
+  if (0 != build->dependencies) {
+    list_iterator_t *iterator =
+        list_iterator_new(build->dependencies, LIST_HEAD);
+    list_node_t *node = 0;
+
+    while ((node = list_iterator_next(iterator))) {
+      build_task_t *dependency = node->val;
+      fingerprint_string(&ctx, dependency->fingerprint);
+    }
+
+    list_iterator_destroy(iterator);
+  }
+
+  SHA1Final(digest, &ctx);
+
+  for (int i = 0; i < 20; i++) {
+    sprintf(build->fingerprint + i * 2, "%02x", digest[i]);
+  }
+}
 
+/**
+ * Only installed dependencies listing their sources can skip make: their
+ * directory holds nothing else, so the fingerprint covers every input.
+ * The root package, or any package without `src`, always runs make.
+ */
+
+static int build_skippable(build_task_t *build) {
 #ifdef PATH_MAX
-  long path_max = PATH_MAX;
-#elif defined(_PC_PATH_MAX)
-  long path_max = pathconf(dir, _PC_PATH_MAX);
+  char dir[PATH_MAX];
 #else
-  long path_max = 4096;
+  char dir[4096];
 #endif
+  size_t len = strlen(opts.dir);
 
-  char *path = path_join(dir, file);
-
-  if (0 == path) {
-    return -ENOMEM;
+  if (0 == len || 0 == build->package->src || 0 == realpath(build->dir, dir)) {
+    return 0;
   }
 
+  return 0 == strncmp(dir, opts.dir, len) &&
+         ('/' == dir[len] || '\\' == dir[len]);
+}
+
+/**
+ * @return 1 if `build` was built with the same fingerprint before
+ */
+
+static int build_state_fresh(build_task_t *build) {
+  const char *fingerprint = 0;
+  int fresh = 0;
+
 #ifdef HAVE_PTHREADS
   pthread_mutex_lock(&mutex);
 #endif
-
-  if (hash_has(built, path)) {
+  fingerprint = json_object_get_string(
+      json_object_get_object(json_object(build_state), "packages"),
+      build->path);
+  fresh = fingerprint && 0 == strcmp(fingerprint, build->fingerprint);
 #ifdef HAVE_PTHREADS
-    pthread_mutex_unlock(&mutex);
+  pthread_mutex_unlock(&mutex);
 #endif
-    goto cleanup;
-  }
 
+  return fresh;
+}
+
+static void build_state_save(build_task_t *build) {
+#ifdef HAVE_PTHREADS
+  pthread_mutex_lock(&mutex);
+#endif
+  json_object_set_string(
+      json_object_get_object(json_object(build_state), "packages"),
+      build->path, build->fingerprint);
+  build_state_changed = 1;
 #ifdef HAVE_PTHREADS
   pthread_mutex_unlock(&mutex);
 #endif
+}
 
-  if (0 == fs_exists(path)) {
-    debug(&debugger, "read %s", path);
-    json = fs_read(path);
-  }
+/**
+ * Run make for the package of `data`. Runs on a pool worker, once every
+ * dependency of the package is built.
+ */
 
-  if (0 != json) {
-#ifdef DEBUG
-    package = clib_package_new(json, 1);
-#else
-    package = clib_package_new(json, 0);
-#endif
-  } else {
-#ifdef DEBUG
-    package = clib_package_new_from_slug(dir, 1);
+int build_package_task(void *data) {
+  build_task_t *build = data;
+  clib_package_t *package = build->package;
+  const char *dir = build->dir;
+  int rc = 0;
+
+#ifdef PATH_MAX
+  long path_max = PATH_MAX;
+#elif defined(_PC_PATH_MAX)
+  long path_max = pathconf(dir, _PC_PATH_MAX);
 #else
-    package = clib_package_new_from_slug(dir, 0);
+  long path_max = 4096;
 #endif
-  }
-
-  if (0 == package) {
-    rc = -ENOMEM;
-    goto cleanup;
-  }
 
   if (0 != package->makefile) {
     char *makefile = path_join(dir, package->makefile);
@@ -193,10 +323,8 @@ int build_package_with_manifest_name(const char *dir, const char *file) {
     char *clean = 0;
     char *flags = 0;
 
-#ifdef _GNU_SOURCE
-    char *cflags = secure_getenv("CFLAGS");
-#else
-    char *cflags = getenv("CFLAGS");
+#ifdef HAVE_PTHREADS
+    pthread_mutex_lock(&mutex);
 #endif
 
     if (cflags) {
@@ -206,9 +334,7 @@ int build_package_with_manifest_name(const char *dir, const char *file) {
     }
 
     if (root_package && root_package->prefix) {
-      package_opts.prefix = root_package->prefix;
-      clib_package_set_opts(package_opts);
-      setenv("PREFIX", package_opts.prefix, 1);
+      setenv("PREFIX", root_package->prefix, 1);
     } else if (opts.prefix) {
       setenv("PREFIX", opts.prefix, 1);
     } else if (package->prefix) {
@@ -216,7 +342,7 @@ int build_package_with_manifest_name(const char *dir, const char *file) {
       memset(prefix, 0, path_max);
       realpath(package->prefix, prefix);
       unsigned long int size = strlen(prefix) + 1;
-      free(package->prefix);
+      clib_package_free_string(package, package->prefix);
       package->prefix = malloc(size);
       memset((void *)package->prefix, 0, size);
       memcpy((void *)package->prefix, prefix, size);
@@ -225,8 +351,42 @@ int build_package_with_manifest_name(const char *dir, const char *file) {
 
     setenv("CFLAGS", flags, 1);
 
+    char *prefix = getenv("PREFIX");
+    prefix = prefix ? strdup(prefix) : 0;
+
+#ifdef HAVE_PTHREADS
+    pthread_mutex_unlock(&mutex);
+#endif
+
+    fingerprint_package(build, flags, prefix, args);
+    free(prefix);
+
+    // nothing changed since the last build, don't even start make
+    if (!opts.force && !opts.clean && !opts.test && build->skippable &&
+        build_state_fresh(build)) {
+      if (0 != opts.verbose) {
+        logger_info("fresh", "%s: %s", package->name, package->makefile);
+      }
+
+      free(makefile);
+      free(flags);
+
+      if (rest_argc > 0) {
+        free(args);
+      }
+
+#ifdef HAVE_PTHREADS
+      pthread_mutex_lock(&mutex);
+#endif
+      hash_set(built, strdup(build->path), "f");
+#ifdef HAVE_PTHREADS
+      pthread_mutex_unlock(&mutex);
+#endif
+
+      return 0;
+    }
+
     if (opts.clean) {
-      char *clean = 0;
       asprintf(&clean, "make -C %s -f %s %s", dir, makefile, opts.clean);
     }
 
@@ -251,6 +411,10 @@ int build_package_with_manifest_name(const char *dir, const char *file) {
     rc = system(command);
     free(command);
 
+    if (0 == rc && !opts.test) {
+      build_state_save(build);
+    }
+
     if (clean) {
       free(clean);
     }
@@ -265,192 +429,170 @@ int build_package_with_manifest_name(const char *dir, const char *file) {
 
     command = 0;
 #ifdef HAVE_PTHREADS
-    rc = pthread_mutex_lock(&mutex);
+    pthread_mutex_lock(&mutex);
 #endif
 
-    hash_set(built, path, "t");
-    ok = 1;
+    hash_set(built, strdup(build->path), "t");
   } else {
+    // packages without a makefile still count for their dependents
+    fingerprint_package(build, 0, 0, 0);
+
 #ifdef HAVE_PTHREADS
-    rc = pthread_mutex_lock(&mutex);
+    pthread_mutex_lock(&mutex);
 #endif
 
-    hash_set(built, path, "f");
-    ok = 1;
-  }
-
-  if (0 != rc) {
-    goto cleanup;
+    hash_set(built, strdup(build->path), "f");
   }
 
 #ifdef HAVE_PTHREADS
   pthread_mutex_unlock(&mutex);
 #endif
 
-  if (0 != package->dependencies) {
-    list_iterator_t *iterator = 0;
-    list_node_t *node = 0;
-
-#ifdef HAVE_PTHREADS
-    clib_package_thread_t wraps[opts.concurrency];
-    pthread_t threads[opts.concurrency];
-    unsigned int i = 0;
-#endif
-
-    iterator = list_iterator_new(package->dependencies, LIST_HEAD);
+  return rc;
+}
 
-    while ((node = list_iterator_next(iterator))) {
-      clib_package_dependency_t *dep = node->val;
-      char *slug = 0;
-      char *dep_dir = 0;
-      asprintf(&slug, "%s/%s@%s", dep->author, dep->name, dep->version);
-
-      clib_package_t *dependency = clib_package_new_from_slug(slug, 0);
-      if (opts.dir && dependency && dependency->name) {
-        dep_dir = path_join(opts.dir, dependency->name);
-      }
+/**
+ * Make `build` wait for the packages in `dependencies`, scheduling them
+ * first if they were not found yet.
+ */
 
-      free(slug);
-      clib_package_free(dependency);
+int schedule_dependencies(build_task_t *build, list_t *dependencies) {
+  list_iterator_t *iterator = 0;
+  list_node_t *node = 0;
+  int rc = 0;
 
-      if (0 == dep_dir) {
-        rc = -ENOMEM;
-        goto cleanup;
-      }
+  iterator = list_iterator_new(dependencies, LIST_HEAD);
 
-#ifdef HAVE_PTHREADS
-      clib_package_thread_t *wrap = &wraps[i];
-      pthread_t *thread = &threads[i];
-      wrap->dir = dep_dir;
-      rc = pthread_create(thread, 0, build_package_with_manifest_name_thread,
-                          wrap);
-
-      if (++i >= opts.concurrency) {
-        for (int j = 0; j < i; ++j) {
-          pthread_join(threads[j], 0);
-          free((void *)wraps[j].dir);
-        }
+  while ((node = list_iterator_next(iterator))) {
+    clib_package_dependency_t *dep = node->val;
+    build_task_t *dep_build = 0;
+    char *slug = 0;
+    char *dep_dir = 0;
+    asprintf(&slug, "%s/%s@%s", dep->author, dep->name, dep->version);
 
-        i = 0;
-      }
-#if defined(__unix__) || (defined(__APPLE__) && defined(__MACH__))
-      usleep(1024 * 10);
-#endif
-#else
-      rc = build_package(dep_dir);
+    clib_package_t *dependency = clib_package_new_from_slug(slug, 0);
+    if (opts.dir && dependency && dependency->name) {
+      dep_dir = path_join(opts.dir, dependency->name);
+    }
 
-      free((void *)dep_dir);
+    free(slug);
+    clib_package_free(dependency);
 
-      if (0 != rc) {
-        goto cleanup;
-      }
-#endif
+    if (0 == dep_dir) {
+      rc = -ENOMEM;
+      break;
     }
 
-#ifdef HAVE_PTHREADS
-    for (int j = 0; j < i; ++j) {
-      pthread_join(threads[j], 0);
-      free((void *)wraps[j].dir);
-    }
-#endif
+    build_package(dep_dir, &dep_build);
+    free(dep_dir);
 
-    if (0 != iterator) {
-      list_iterator_destroy(iterator);
+    // a package still being scheduled depends on `build`, skip the cycle
+    if (dep_build && clib_pool_task_submitted(dep_build->task)) {
+      if (0 == clib_pool_task_depends(build->task, dep_build->task)) {
+        list_rpush(build->dependencies, list_node_new(dep_build));
+      }
     }
   }
 
-  if (opts.dev && 0 != package->development) {
-    list_iterator_t *iterator = 0;
-    list_node_t *node = 0;
+  list_iterator_destroy(iterator);
 
-#ifdef HAVE_PTHREADS
-    clib_package_thread_t wraps[opts.concurrency];
-    pthread_t threads[opts.concurrency];
-    unsigned int i = 0;
-#endif
+  return rc;
+}
 
-    iterator = list_iterator_new(package->development, LIST_HEAD);
+/**
+ * Schedule the package of the manifest `file` in `dir` on the pool, after
+ * its dependencies.
+ */
 
-    while ((node = list_iterator_next(iterator))) {
-      clib_package_dependency_t *dep = node->val;
-      char *slug = 0;
-      asprintf(&slug, "%s/%s@%s", dep->author, dep->name, dep->version);
+int build_package_with_manifest_name(const char *dir, const char *file,
+                                     build_task_t **out) {
+  clib_package_t *package = 0;
+  build_task_t *build = 0;
+  char *json = 0;
+  int rc = 0;
+
+  char *path = path_join(dir, file);
 
-      clib_package_t *dependency = clib_package_new_from_slug(slug, 0);
-      char *dep_dir = path_join(opts.dir, dependency->name);
+  if (0 == path) {
+    return -ENOMEM;
+  }
 
-      free(slug);
-      clib_package_free(dependency);
+  if ((build = hash_get(tasks, path))) {
+    *out = build;
+    free(path);
+    return 0;
+  }
 
-#ifdef HAVE_PTHREADS
-      clib_package_thread_t *wrap = &wraps[i];
-      pthread_t *thread = &threads[i];
-      wrap->dir = dep_dir;
-      rc = pthread_create(thread, 0, build_package_with_manifest_name_thread,
-                          wrap);
-
-      if (++i >= opts.concurrency) {
-        for (int j = 0; j < i; ++j) {
-          pthread_join(threads[j], 0);
-          free((void *)wraps[j].dir);
-        }
+  if (0 == fs_exists(path)) {
+    debug(&debugger, "read %s", path);
+    json = fs_read(path);
+  }
 
-        i = 0;
-      }
-#if defined(__unix__) || (defined(__APPLE__) && defined(__MACH__))
-      usleep(1024 * 10);
+  if (0 != json) {
+#ifdef DEBUG
+    package = clib_package_new(json, 1);
+#else
+    package = clib_package_new(json, 0);
 #endif
+  } else {
+#ifdef DEBUG
+    package = clib_package_new_from_slug(dir, 1);
 #else
-      if (0 == dep_dir) {
-        rc = -ENOMEM;
-        goto cleanup;
-      }
-
-      rc = build_package(dep_dir);
-
-      free((void *)dep_dir);
-
-      if (0 != rc) {
-        goto cleanup;
-      }
+    package = clib_package_new_from_slug(dir, 0);
 #endif
-    }
+  }
 
-#ifdef HAVE_PTHREADS
-    for (int j = 0; j < i; ++j) {
-      pthread_join(threads[j], 0);
-      free((void *)wraps[j].dir);
-    }
-#endif
+  free(json);
 
-    if (0 != iterator) {
-      list_iterator_destroy(iterator);
-    }
+  if (0 == package) {
+    free(path);
+    return -ENOMEM;
   }
 
-cleanup:
-  if (0 != package) {
+  build = malloc(sizeof(build_task_t));
+
+  if (0 == build) {
     clib_package_free(package);
+    free(path);
+    return -ENOMEM;
   }
-  if (0 != json) {
-    free(json);
+
+  build->dir = strdup(dir);
+  build->path = path;
+  build->package = package;
+  build->dependencies = list_new();
+  build->task = clib_pool_task_new(pool, build_package_task, build);
+  build->fingerprint[0] = 0;
+  build->skippable = build_skippable(build);
+
+  hash_set(tasks, path, build);
+  *out = build;
+
+  if (0 == build->task || 0 == build->dependencies) {
+    return -ENOMEM;
   }
-  if (0 == ok) {
-    if (0 != path) {
-      free(path);
-    }
+
+  if (0 != package->dependencies) {
+    rc = schedule_dependencies(build, package->dependencies);
   }
+
+  if (0 == rc && opts.dev && 0 != package->development) {
+    rc = schedule_dependencies(build, package->development);
+  }
+
+  clib_pool_submit(build->task);
+
   return rc;
 }
 
-int build_package(const char *dir) {
+int build_package(const char *dir, build_task_t **out) {
   const char *name = NULL;
   unsigned int i = 0;
   int rc = 0;
 
   do {
     name = manifest_names[i];
-    rc = build_package_with_manifest_name(dir, name);
+    rc = build_package_with_manifest_name(dir, name, out);
   } while (NULL != manifest_names[++i] && 0 != rc);
 
   return rc;
@@ -679,8 +821,46 @@ int main(int argc, char **argv) {
 
   clib_package_set_opts(package_opts);
 
+#ifdef _GNU_SOURCE
+  cflags = secure_getenv("CFLAGS");
+#else
+  cflags = getenv("CFLAGS");
+#endif
+
+  if (cflags) {
+    cflags = strdup(cflags);
+  }
+
+  build_state_path = path_join(opts.dir, BUILD_STATE_FILE);
+  build_state = json_parse_file(build_state_path);
+
+  if (BUILD_STATE_VERSION != json_object_get_number(json_object(build_state),
+                                                    "version") ||
+      0 == json_object_get_object(json_object(build_state), "packages")) {
+    json_value_free(build_state);
+    build_state = json_value_init_object();
+    json_object_set_number(json_object(build_state), "version",
+                           BUILD_STATE_VERSION);
+    json_object_set_value(json_object(build_state), "packages",
+                          json_value_init_object());
+  }
+
+#ifdef HAVE_PTHREADS
+  pool = clib_pool_new(opts.concurrency);
+#else
+  pool = clib_pool_new(1);
+#endif
+  tasks = hash_new();
+
+  if (0 == pool || 0 == tasks) {
+    logger_error("error", "Failed to start the build pool");
+    return 1;
+  }
+
+  build_task_t *build = 0;
+
   if (0 == program.argc || (argc == rest_offset + rest_argc)) {
-    rc = build_package(CWD);
+    rc = build_package(CWD, &build);
   } else {
     for (int i = 1; i <= rest_offset; ++i) {
       char *dep = program.nargv[i];
@@ -706,13 +886,14 @@ int main(int argc, char **argv) {
 #endif
                         )) {
         dep = basename(dep);
-        rc = build_package_with_manifest_name(dirname(dep), basename(dep));
+        rc = build_package_with_manifest_name(dirname(dep), basename(dep),
+                                              &build);
       } else {
-        rc = build_package(dep);
+        rc = build_package(dep, &build);
 
         // try with slug
         if (0 != rc) {
-          rc = build_package(program.nargv[i]);
+          rc = build_package(program.nargv[i], &build);
         }
       }
 
@@ -723,6 +904,34 @@ int main(int argc, char **argv) {
     }
   }
 
+  // packages build as soon as they are scheduled, wait for the last ones
+  if (0 != clib_pool_wait(pool) && 0 == rc) {
+    rc = 1;
+  }
+
+  clib_pool_free(pool);
+
+  hash_each(tasks, {
+    build_task_t *build = val;
+    free((void *)key);
+    free(build->dir);
+    clib_package_free(build->package);
+    if (build->dependencies) {
+      list_destroy(build->dependencies);
+    }
+    free(build);
+  });
+
+  if (build_state_changed && 0 == fs_exists(opts.dir)) {
+    json_serialize_to_file_pretty(build_state, build_state_path);
+  }
+
+  json_value_free(build_state);
+  free(build_state_path);
+  free(cflags);
+
+  hash_free(tasks);
+
   int total_built = 0;
   hash_each(built, {
     if (0 == strncmp("t", val, 1)) {
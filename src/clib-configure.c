@@ -29,6 +29,7 @@
 
 #include "common/clib-cache.h"
 #include "common/clib-package.h"
+#include "common/clib-pool.h"
 #include "common/clib-settings.h"
 
 #include <asprintf/asprintf.h>
@@ -97,27 +98,33 @@ options_t opts = {.skip_cache = 0,
 
 };
 
-int configure_package(const char *dir);
+typedef struct configure_task configure_task_t;
+struct configure_task {
+  char *dir;
+  char *path;
+  clib_package_t *package;
+  clib_pool_task_t *task;
+};
+
+// every package found in the tree, by manifest path
+hash_t *tasks = 0;
+clib_pool_t *pool = 0;
 
 #ifdef HAVE_PTHREADS
 pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
-typedef struct clib_package_thread clib_package_thread_t;
-struct clib_package_thread {
-  const char *dir;
-};
-
-void *configure_package_with_manifest_name_thread(void *arg) {
-  clib_package_thread_t *wrap = arg;
-  const char *dir = wrap->dir;
-  configure_package(dir);
-  return 0;
-}
 #endif
 
-int configure_package_with_manifest_name(const char *dir, const char *file) {
-  clib_package_t *package = 0;
-  char *json = NULL;
-  int ok = 0;
+int configure_package(const char *dir, configure_task_t **out);
+
+/**
+ * Configure the package of `data`, or print its flags. Runs on a pool
+ * worker, once every dependency of the package is configured.
+ */
+
+int configure_package_task(void *data) {
+  configure_task_t *configure = data;
+  clib_package_t *package = configure->package;
+  const char *dir = configure->dir;
   int rc = 0;
 
 #ifdef PATH_MAX
@@ -128,87 +135,12 @@ int configure_package_with_manifest_name(const char *dir, const char *file) {
   long path_max = 4096;
 #endif
 
-  char *path = path_join(dir, file);
-
-  if (0 == path) {
-    return -ENOMEM;
-  }
-
-#ifdef HAVE_PTHREADS
-  pthread_mutex_lock(&mutex);
-#endif
-
-  if (!root_package) {
-    const char *name = NULL;
-    unsigned int i = 0;
-
-    do {
-      name = manifest_names[i];
-      json = fs_read(name);
-    } while (NULL != manifest_names[++i] && !json);
-
-    if (json) {
-      root_package = clib_package_new(json, opts.verbose);
-    }
-
-    if (root_package && root_package->prefix) {
-      char prefix[path_max];
-      memset(prefix, 0, path_max);
-      realpath(root_package->prefix, prefix);
-      unsigned long int size = strlen(prefix) + 1;
-      free(root_package->prefix);
-      root_package->prefix = malloc(size);
-      memset((void *)root_package->prefix, 0, size);
-      memcpy((void *)root_package->prefix, prefix, size);
-    }
-  }
-
-  if (hash_has(configured, path)) {
-#ifdef HAVE_PTHREADS
-    pthread_mutex_unlock(&mutex);
-#endif
-    goto cleanup;
-  }
-
-#ifdef HAVE_PTHREADS
-  pthread_mutex_unlock(&mutex);
-#endif
-
-  // Free the json if it was allocated before attempting to modify it
-  free(json);
-  json = NULL; 
-
-  if (0 == fs_exists(path)) {
-    debug(&debugger, "read %s", path);
-    json = fs_read(path);
-  }
-
-  if (0 != json) {
-#ifdef DEBUG
-    package = clib_package_new(json, 1);
-#else
-    package = clib_package_new(json, 0);
-#endif
-  } else {
-#ifdef DEBUG
-    package = clib_package_new_from_slug(dir, 1);
-#else
-    package = clib_package_new_from_slug(dir, 0);
-#endif
-  }
-
-  if (0 == package) {
-    rc = -ENOMEM;
-    goto cleanup;
-  }
-
   if (0 != package->flags && opts.flags) {
 #ifdef HAVE_PTHREADS
-    rc = pthread_mutex_lock(&mutex);
+    pthread_mutex_lock(&mutex);
 #endif
 
-    hash_set(configured, path, "t");
-    ok = 1;
+    hash_set(configured, strdup(configure->path), "t");
     fprintf(stdout, "%s ", trim(package->flags));
     fflush(stdout);
   } else if (0 != package->configure) {
@@ -219,10 +151,12 @@ int configure_package_with_manifest_name(const char *dir, const char *file) {
 
     asprintf(&command, "cd %s && %s %s", dir, package->configure, args);
 
+#ifdef HAVE_PTHREADS
+    pthread_mutex_lock(&mutex);
+#endif
+
     if (root_package && root_package->prefix) {
-      package_opts.prefix = root_package->prefix;
-      clib_package_set_opts(package_opts);
-      setenv("PREFIX", package_opts.prefix, 1);
+      setenv("PREFIX", root_package->prefix, 1);
     } else if (opts.prefix) {
       setenv("PREFIX", opts.prefix, 1);
     } else if (package->prefix) {
@@ -230,13 +164,17 @@ int configure_package_with_manifest_name(const char *dir, const char *file) {
       memset(prefix, 0, path_max);
       realpath(package->prefix, prefix);
       unsigned long int size = strlen(prefix) + 1;
-      free(package->prefix);
+      clib_package_free_string(package, package->prefix);
       package->prefix = malloc(size);
       memset((void *)package->prefix, 0, size);
       memcpy((void *)package->prefix, prefix, size);
       setenv("PREFIX", package->prefix, 1);
     }
 
+#ifdef HAVE_PTHREADS
+    pthread_mutex_unlock(&mutex);
+#endif
+
     if (rest_argc > 0) {
       free(args);
     }
@@ -250,193 +188,202 @@ int configure_package_with_manifest_name(const char *dir, const char *file) {
     free(command);
     command = 0;
 #ifdef HAVE_PTHREADS
-    rc = pthread_mutex_lock(&mutex);
+    pthread_mutex_lock(&mutex);
 #endif
 
-    hash_set(configured, path, "t");
-    ok = 1;
+    hash_set(configured, strdup(configure->path), "t");
   } else {
 #ifdef HAVE_PTHREADS
-    rc = pthread_mutex_lock(&mutex);
+    pthread_mutex_lock(&mutex);
 #endif
 
-    hash_set(configured, path, "f");
-    ok = 1;
-  }
-
-  if (0 != rc) {
-    goto cleanup;
+    hash_set(configured, strdup(configure->path), "f");
   }
 
 #ifdef HAVE_PTHREADS
   pthread_mutex_unlock(&mutex);
 #endif
 
-  if (0 != package->dependencies) {
-    list_iterator_t *iterator = 0;
-    list_node_t *node = 0;
-
-#ifdef HAVE_PTHREADS
-    clib_package_thread_t wraps[opts.concurrency];
-    pthread_t threads[opts.concurrency];
-    unsigned int i = 0;
-#endif
+  return rc;
+}
 
-    iterator = list_iterator_new(package->dependencies, LIST_HEAD);
+/**
+ * Make `configure` wait for the packages in `dependencies`, scheduling
+ * them first if they were not found yet.
+ */
 
-    while ((node = list_iterator_next(iterator))) {
-      clib_package_dependency_t *dep = node->val;
-      char *slug = 0;
-      asprintf(&slug, "%s/%s@%s", dep->author, dep->name, dep->version);
+int schedule_dependencies(configure_task_t *configure, list_t *dependencies) {
+  list_iterator_t *iterator = 0;
+  list_node_t *node = 0;
+  int rc = 0;
 
-      clib_package_t *dependency = clib_package_new_from_slug(slug, 0);
-      char *dep_dir = path_join(opts.dir, dependency->name);
+  iterator = list_iterator_new(dependencies, LIST_HEAD);
 
-      free(slug);
-      clib_package_free(dependency);
+  while ((node = list_iterator_next(iterator))) {
+    clib_package_dependency_t *dep = node->val;
+    configure_task_t *dep_configure = 0;
+    char *slug = 0;
+    char *dep_dir = 0;
+    asprintf(&slug, "%s/%s@%s", dep->author, dep->name, dep->version);
 
-#ifdef HAVE_PTHREADS
-      clib_package_thread_t *wrap = &wraps[i];
-      pthread_t *thread = &threads[i];
-      wrap->dir = dep_dir;
-      rc = pthread_create(thread, 0,
-                          configure_package_with_manifest_name_thread, wrap);
-
-      if (++i >= opts.concurrency) {
-        for (int j = 0; j < i; ++j) {
-          pthread_join(threads[j], 0);
-          free((void *)wraps[j].dir);
-        }
-
-        i = 0;
-      }
-#if defined(__unix__) || (defined(__APPLE__) && defined(__MACH__))
-      if (!opts.flags) {
-        usleep(1024 * 10);
-      }
-#endif
-#else
-      if (0 == dep_dir) {
-        rc = -ENOMEM;
-        goto cleanup;
-      }
-
-      rc = configure_package(dep_dir);
+    clib_package_t *dependency = clib_package_new_from_slug(slug, 0);
+    if (opts.dir && dependency && dependency->name) {
+      dep_dir = path_join(opts.dir, dependency->name);
+    }
 
-      free((void *)dep_dir);
+    free(slug);
+    clib_package_free(dependency);
 
-      if (0 != rc) {
-        goto cleanup;
-      }
-#endif
+    if (0 == dep_dir) {
+      rc = -ENOMEM;
+      break;
     }
 
-#ifdef HAVE_PTHREADS
-    for (int j = 0; j < i; ++j) {
-      pthread_join(threads[j], 0);
-      free((void *)wraps[j].dir);
-    }
-#endif
+    configure_package(dep_dir, &dep_configure);
+    free(dep_dir);
 
-    if (0 != iterator) {
-      list_iterator_destroy(iterator);
+    // a package still being scheduled depends on `configure`, skip the cycle
+    if (dep_configure && clib_pool_task_submitted(dep_configure->task)) {
+      clib_pool_task_depends(configure->task, dep_configure->task);
     }
   }
 
-  if (opts.dev && 0 != package->development) {
-    list_iterator_t *iterator = 0;
-    list_node_t *node = 0;
+  list_iterator_destroy(iterator);
 
-#ifdef HAVE_PTHREADS
-    clib_package_thread_t wraps[opts.concurrency];
-    pthread_t threads[opts.concurrency];
-    unsigned int i = 0;
-#endif
-
-    iterator = list_iterator_new(package->development, LIST_HEAD);
+  return rc;
+}
 
-    while ((node = list_iterator_next(iterator))) {
-      clib_package_dependency_t *dep = node->val;
-      char *slug = 0;
-      asprintf(&slug, "%s/%s@%s", dep->author, dep->name, dep->version);
+/**
+ * Schedule the package of the manifest `file` in `dir` on the pool, after
+ * its dependencies.
+ */
 
-      clib_package_t *dependency = clib_package_new_from_slug(slug, 0);
-      char *dep_dir = path_join(opts.dir, dependency->name);
+int configure_package_with_manifest_name(const char *dir, const char *file,
+                                         configure_task_t **out) {
+  clib_package_t *package = 0;
+  configure_task_t *configure = 0;
+  char *json = NULL;
+  int rc = 0;
 
-      free(slug);
-      clib_package_free(dependency);
+#ifdef PATH_MAX
+  long path_max = PATH_MAX;
+#elif defined(_PC_PATH_MAX)
+  long path_max = pathconf(dir, _PC_PATH_MAX);
+#else
+  long path_max = 4096;
+#endif
 
-#ifdef HAVE_PTHREADS
-      clib_package_thread_t *wrap = &wraps[i];
-      pthread_t *thread = &threads[i];
-      wrap->dir = dep_dir;
-      rc = pthread_create(thread, 0,
-                          configure_package_with_manifest_name_thread, wrap);
-
-      if (++i >= opts.concurrency) {
-        for (int j = 0; j < i; ++j) {
-          pthread_join(threads[j], 0);
-          free((void *)wraps[j].dir);
-        }
+  char *path = path_join(dir, file);
 
-        i = 0;
-      }
-#if defined(__unix__) || (defined(__APPLE__) && defined(__MACH__))
-      if (!opts.flags) {
-        usleep(1024 * 10);
-      }
-#endif
-#else
-      if (0 == dep_dir) {
-        rc = -ENOMEM;
-        goto cleanup;
-      }
+  if (0 == path) {
+    return -ENOMEM;
+  }
 
-      rc = configure_package(dep_dir);
+  if (!root_package) {
+    const char *name = NULL;
+    unsigned int i = 0;
 
-      free((void *)dep_dir);
+    do {
+      name = manifest_names[i];
+      json = fs_read(name);
+    } while (NULL != manifest_names[++i] && !json);
 
-      if (0 != rc) {
-        goto cleanup;
-      }
-#endif
+    if (json) {
+      root_package = clib_package_new(json, opts.verbose);
     }
 
-#ifdef HAVE_PTHREADS
-    for (int j = 0; j < i; ++j) {
-      pthread_join(threads[j], 0);
-      free((void *)wraps[j].dir);
+    if (root_package && root_package->prefix) {
+      char prefix[path_max];
+      memset(prefix, 0, path_max);
+      realpath(root_package->prefix, prefix);
+      unsigned long int size = strlen(prefix) + 1;
+      clib_package_free_string(root_package, root_package->prefix);
+      root_package->prefix = malloc(size);
+      memset((void *)root_package->prefix, 0, size);
+      memcpy((void *)root_package->prefix, prefix, size);
+      package_opts.prefix = root_package->prefix;
+      clib_package_set_opts(package_opts);
     }
+  }
+
+  if ((configure = hash_get(tasks, path))) {
+    *out = configure;
+    free(json);
+    free(path);
+    return 0;
+  }
+
+  // Free the json if it was allocated before attempting to modify it
+  free(json);
+  json = NULL;
+
+  if (0 == fs_exists(path)) {
+    debug(&debugger, "read %s", path);
+    json = fs_read(path);
+  }
+
+  if (0 != json) {
+#ifdef DEBUG
+    package = clib_package_new(json, 1);
+#else
+    package = clib_package_new(json, 0);
 #endif
+  } else {
+#ifdef DEBUG
+    package = clib_package_new_from_slug(dir, 1);
+#else
+    package = clib_package_new_from_slug(dir, 0);
+#endif
+  }
 
-    if (0 != iterator) {
-      list_iterator_destroy(iterator);
-    }
+  free(json);
+
+  if (0 == package) {
+    free(path);
+    return -ENOMEM;
   }
 
-cleanup:
-  if (0 != package) {
+  configure = malloc(sizeof(configure_task_t));
+
+  if (0 == configure) {
     clib_package_free(package);
+    free(path);
+    return -ENOMEM;
   }
-  if (0 != json) {
-    free(json);
+
+  configure->dir = strdup(dir);
+  configure->path = path;
+  configure->package = package;
+  configure->task = clib_pool_task_new(pool, configure_package_task, configure);
+
+  hash_set(tasks, path, configure);
+  *out = configure;
+
+  if (0 == configure->task) {
+    return -ENOMEM;
   }
-  if (0 == ok) {
-    if (0 != path) {
-      free(path);
-    }
+
+  if (0 != package->dependencies) {
+    rc = schedule_dependencies(configure, package->dependencies);
+  }
+
+  if (0 == rc && opts.dev && 0 != package->development) {
+    rc = schedule_dependencies(configure, package->development);
   }
+
+  clib_pool_submit(configure->task);
+
   return rc;
 }
 
-int configure_package(const char *dir) {
+int configure_package(const char *dir, configure_task_t **out) {
   const char *name = NULL;
   unsigned int i = 0;
   int rc = 0;
 
   do {
     name = manifest_names[i];
-    rc = configure_package_with_manifest_name(dir, name);
+    rc = configure_package_with_manifest_name(dir, name, out);
   } while (NULL != manifest_names[++i] && 0 != rc);
 
   return rc;
@@ -611,8 +558,22 @@ int main(int argc, char **argv) {
 
   clib_package_set_opts(package_opts);
 
+#ifdef HAVE_PTHREADS
+  pool = clib_pool_new(opts.concurrency);
+#else
+  pool = clib_pool_new(1);
+#endif
+  tasks = hash_new();
+
+  if (0 == pool || 0 == tasks) {
+    logger_error("error", "Failed to start the configure pool");
+    return 1;
+  }
+
+  configure_task_t *configure = 0;
+
   if (0 == program.argc || (argc == rest_offset + rest_argc)) {
-    rc = configure_package(CWD);
+    rc = configure_package(CWD, &configure);
   } else {
     for (int i = 1; i <= rest_offset; ++i) {
       char *dep = program.nargv[i];
@@ -638,13 +599,14 @@ int main(int argc, char **argv) {
 #endif
                         )) {
         dep = basename(dep);
-        rc = configure_package_with_manifest_name(dirname(dep), basename(dep));
+        rc = configure_package_with_manifest_name(dirname(dep), basename(dep),
+                                                  &configure);
       } else {
-        rc = configure_package(dep);
+        rc = configure_package(dep, &configure);
 
         // try with slug
         if (0 != rc) {
-          rc = configure_package(program.nargv[i]);
+          rc = configure_package(program.nargv[i], &configure);
         }
       }
 
@@ -655,6 +617,23 @@ int main(int argc, char **argv) {
     }
   }
 
+  // packages configure as soon as they are scheduled, wait for the last ones
+  if (0 != clib_pool_wait(pool) && 0 == rc) {
+    rc = 1;
+  }
+
+  clib_pool_free(pool);
+
+  hash_each(tasks, {
+    configure_task_t *configure = val;
+    free((void *)key);
+    free(configure->dir);
+    clib_package_free(configure->package);
+    free(configure);
+  });
+
+  hash_free(tasks);
+
   int total_configured = 0;
   hash_each(configured, {
     if (0 == strncmp("t", val, 1)) {
@@ -81,38 +81,15 @@ static void ask_for(JSON_Object *root, const char *key,
   json_object_set_string(root, key, value);
 }
 
-static inline size_t write_to_file(const char *manifest, const char *str,
-                                   size_t length) {
-  size_t wrote = 0;
-
-  FILE *file = fopen(manifest, "w+");
-  if (!file) {
-    debug(&debugger, "Cannot open %s file.", manifest);
-    return 0;
-  }
-
-  wrote = fwrite(str, sizeof(char), length, file);
-  fclose(file);
-
-  return length - wrote;
-}
-
 static int write_package_file(const char *manifest, JSON_Value *pkg) {
-  int rc = 0;
-  char *package = json_serialize_to_string_pretty(pkg);
-
-  if (0 != write_to_file(manifest, package, strlen(package))) {
+  if (JSONSuccess != json_serialize_to_file_pretty(pkg, manifest)) {
     logger_error("Failed to write to %s", manifest);
-    rc = 1;
-    goto e1;
+    return 1;
   }
 
   debug(&debugger, "Wrote %s file.", manifest);
 
-e1:
-  json_free_serialized_string(package);
-
-  return rc;
+  return 0;
 }
 
 /**
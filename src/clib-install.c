@@ -5,8 +5,10 @@
 // MIT licensed
 //
 
+#include "asprintf/asprintf.h"
 #include "commander/commander.h"
 #include "common/clib-cache.h"
+#include "common/clib-lockfile.h"
 #include "common/clib-package.h"
 #include "common/clib-settings.h"
 #include "common/clib-validate.h"
@@ -49,6 +51,7 @@ struct options {
   int force;
   int global;
   int skip_cache;
+  int frozen;
 #ifdef HAVE_PTHREADS
   unsigned int concurrency;
 #endif
@@ -58,6 +61,7 @@ static struct options opts = {0};
 
 static clib_package_opts_t package_opts = {0};
 static clib_package_t *root_package = NULL;
+static clib_lockfile_t *lockfile = NULL;
 
 /**
  * Option setters.
@@ -127,6 +131,11 @@ static void setopt_skip_cache(command_t *self) {
   debug(&debugger, "set skip cache flag");
 }
 
+static void setopt_frozen(command_t *self) {
+  opts.frozen = 1;
+  debug(&debugger, "set frozen flag");
+}
+
 static int install_local_packages_with_package_name(const char *file) {
   if (0 != clib_validate(file)) {
     return 1;
@@ -286,6 +295,27 @@ static int install_package(const char *slug) {
     }
   }
 
+  if (!pkg && lockfile && lockfile->frozen) {
+    char *author = clib_package_parse_author(slug);
+    char *name = clib_package_parse_name(slug);
+    char *key = NULL;
+
+    if (author && name && -1 != asprintf(&key, "%s/%s", author, name)) {
+      pkg = clib_lockfile_get(lockfile, key, opts.verbose);
+      if (!pkg) {
+        logger_error("error", "%s is not pinned in %s", key,
+                     CLIB_LOCKFILE_NAME);
+      }
+    }
+
+    free(author);
+    free(name);
+    free(key);
+
+    if (NULL == pkg)
+      return -1;
+  }
+
   if (!pkg) {
     pkg = clib_package_new_from_slug(slug, opts.verbose);
   }
@@ -293,7 +323,7 @@ static int install_package(const char *slug) {
   if (NULL == pkg)
     return -1;
 
-  rc = clib_package_install(pkg, opts.dir, opts.verbose);
+  rc = clib_package_install_pinned(slug, pkg, opts.dir, opts.verbose);
   if (0 != rc) {
     goto cleanup;
   }
@@ -393,6 +423,10 @@ int main(int argc, char *argv[]) {
                  setopt_global);
   command_option(&program, "-t", "--token <token>",
                  "Access token used to read private content", setopt_token);
+  command_option(&program, "-F", "--frozen",
+                 "install exactly what " CLIB_LOCKFILE_NAME
+                 " pins, without resolving manifests",
+                 setopt_frozen);
 #ifdef HAVE_PTHREADS
   command_option(&program, "-C", "--concurrency <number>",
                  "Set concurrency (default: " S(MAX_THREADS) ")",
@@ -441,9 +475,39 @@ int main(int argc, char *argv[]) {
 
   clib_package_set_opts(package_opts);
 
+  if (opts.frozen) {
+    if (!(lockfile = clib_lockfile_load(CLIB_LOCKFILE_NAME))) {
+      logger_error("error", "--frozen requires a valid %s",
+                   CLIB_LOCKFILE_NAME);
+      command_free(&program);
+      return 1;
+    }
+    lockfile->frozen = 1;
+  } else if (!opts.global && (0 == program.argc || !opts.nosave)) {
+    // a full install pins the whole tree again, a partial one amends it
+    if (0 != program.argc) {
+      lockfile = clib_lockfile_load(CLIB_LOCKFILE_NAME);
+    }
+    if (!lockfile) {
+      lockfile = clib_lockfile_new();
+    }
+  }
+
+  clib_package_set_lockfile(lockfile);
+
   int code = 0 == program.argc ? install_local_packages()
                                : install_packages(program.argc, program.argv);
 
+  if (0 == code && lockfile && !lockfile->frozen) {
+    if (0 != clib_lockfile_save(lockfile, CLIB_LOCKFILE_NAME)) {
+      logger_error("error", "Failed to write %s", CLIB_LOCKFILE_NAME);
+      code = 1;
+    }
+  }
+
+  clib_package_set_lockfile(NULL);
+  clib_lockfile_free(lockfile);
+
   curl_global_cleanup();
   clib_package_cleanup();
 
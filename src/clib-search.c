@@ -6,10 +6,9 @@
 //
 
 #include "asprintf/asprintf.h"
-#include "case/case.h"
 #include "commander/commander.h"
 #include "common/clib-cache.h"
-#include "common/clib-package.h"
+#include "common/clib-search-index.h"
 #include "common/clib-settings.h"
 #include "console-colors/console-colors.h"
 #include "debug/debug.h"
@@ -39,6 +38,7 @@ debug_t debugger;
 static int opt_color;
 static int opt_cache;
 static int opt_json;
+static clib_search_options_t search_options;
 
 static void setopt_nocolor(command_t *self) { opt_color = 0; }
 
@@ -46,53 +46,23 @@ static void setopt_nocache(command_t *self) { opt_cache = 0; }
 
 static void setopt_json(command_t *self) { opt_json = 1; }
 
-#define COMPARE(v)                                                             \
-  {                                                                            \
-    if (NULL == v) {                                                           \
-      rc = 0;                                                                  \
-      goto cleanup;                                                            \
-    }                                                                          \
-    case_lower(v);                                                             \
-    for (int i = 0; i < count; i++) {                                          \
-      if (strstr(v, args[i])) {                                                \
-        rc = 1;                                                                \
-        break;                                                                 \
-      }                                                                        \
-    }                                                                          \
-  }
-
-static int matches(int count, char *args[], wiki_package_t *pkg) {
-  // Display all packages if there's no query
-  if (0 == count)
-    return 1;
-
-  char *description = NULL;
-  char *name = NULL;
-  char *repo = NULL;
-  char *href = NULL;
-  int rc = 0;
-
-  name = clib_package_parse_name(pkg->repo);
-  COMPARE(name);
+static void setopt_all(command_t *self) { search_options.all = 1; }
 
-  description = strdup(pkg->description);
-  COMPARE(description);
+static void setopt_fuzzy(command_t *self) { search_options.fuzzy = 1; }
 
-  repo = strdup(pkg->repo);
-  COMPARE(repo);
-
-  href = strdup(pkg->href);
-  COMPARE(href);
-
-cleanup:
-  free(description);
-  free(name);
-  free(repo);
-  free(href);
-  return rc;
+static void setopt_limit(command_t *self) {
+  if (self->arg) {
+    search_options.limit = atol(self->arg);
+    debug(&debugger, "set limit: %zu", search_options.limit);
+  }
 }
 
-static char *wiki_html_cache() {
+/**
+ * The wiki page, from the search cache while it is fresh. `*not_modified`
+ * is set when the expired copy was revalidated rather than downloaded.
+ */
+
+static char *wiki_html_cache(int *not_modified) {
 
   if (clib_cache_has_search() && opt_cache) {
     char *data = clib_cache_read_search();
@@ -107,12 +77,31 @@ static char *wiki_html_cache() {
 set_cache:
 
   debug(&debugger, "setting cache from %s", CLIB_WIKI_URL);
-  http_get_response_t *res = http_get(CLIB_WIKI_URL);
+
+  char *etag = NULL;
+  char *last_modified = NULL;
+
+  // revalidate the expired copy instead of downloading the page again
+  if (opt_cache) {
+    clib_cache_read_search_validators(&etag, &last_modified);
+  }
+
+  http_get_response_t *res = http_get_shared_conditional(
+      CLIB_WIKI_URL, NULL, etag, last_modified);
 
   char *html = NULL;
 
-  if (res->ok && (html = strdup(res->data)) != NULL) {
+  free(etag);
+  free(last_modified);
+
+  if (304 == res->status) {
+    clib_cache_touch_search();
+    html = clib_cache_read_search();
+    *not_modified = 1;
+    debug(&debugger, "cache not modified");
+  } else if (res->ok && (html = strdup(res->data)) != NULL) {
     clib_cache_save_search(html);
+    clib_cache_save_search_validators(res->etag, res->last_modified);
     debug(&debugger, "wrote cach");
   }
 
@@ -121,7 +110,63 @@ set_cache:
   return html;
 }
 
-static void display_package(const wiki_package_t *pkg,
+/**
+ * Map the index built from the search cache, or build it again if the
+ * wiki page changed since.
+ */
+
+static clib_search_index_t *search_index(void) {
+  const char *path = clib_cache_search_index();
+  clib_search_index_t *index = NULL;
+  int not_modified = 0;
+
+  if (opt_cache && clib_cache_has_search_index()) {
+    if ((index = clib_search_index_open(path))) {
+      return index;
+    }
+
+    debug(&debugger, "invalid search index %s", path);
+  }
+
+  char *html = wiki_html_cache(&not_modified);
+  if (NULL == html) {
+    return NULL;
+  }
+
+  // the index of the revalidated page is still good, unless it is damaged
+  if (not_modified && clib_cache_has_search_index() &&
+      (index = clib_search_index_open(path))) {
+    free(html);
+    return index;
+  }
+
+  list_t *pkgs = wiki_registry_parse(html);
+  free(html);
+
+  if (NULL == pkgs) {
+    return NULL;
+  }
+
+  debug(&debugger, "found %zu packages", pkgs->len);
+
+  index = clib_search_index_build(pkgs);
+
+  list_node_t *node;
+  list_iterator_t *it = list_iterator_new(pkgs, LIST_HEAD);
+  while ((node = list_iterator_next(it))) {
+    wiki_package_free((wiki_package_t *)node->val);
+  }
+  list_iterator_destroy(it);
+  list_destroy(pkgs);
+
+  if (index && 0 != clib_search_index_save(index, path)) {
+    debug(&debugger, "failed to write search index %s", path);
+  }
+
+  return index;
+}
+
+static void display_package(const clib_search_entry_t *pkg,
                             cc_color_t fg_color_highlight,
                             cc_color_t fg_color_text) {
   cc_fprintf(fg_color_highlight, stdout, "  %s\n", pkg->repo);
@@ -132,7 +177,7 @@ static void display_package(const wiki_package_t *pkg,
   printf("\n");
 }
 
-static void add_package_to_json(const wiki_package_t *pkg,
+static void add_package_to_json(const clib_search_entry_t *pkg,
                                 JSON_Array *json_list) {
   JSON_Value *json_pkg_root = json_value_init_object();
   JSON_Object *json_pkg = json_value_get_object(json_pkg_root);
@@ -155,7 +200,9 @@ int main(int argc, char *argv[]) {
 
   command_t program;
   command_init(&program, "clib-search", CLIB_VERSION);
-  program.usage = "[options] [query ...]";
+  program.usage = "[options] [query ...]\n\n"
+                  "  Packages are matched on the words of their repo and\n"
+                  "  description, not on their url.";
 
   command_option(&program, "-n", "--no-color", "don't colorize output",
                  setopt_nocolor);
@@ -166,29 +213,39 @@ int main(int argc, char *argv[]) {
   command_option(&program, "-j", "--json", "generate a serialized JSON output",
                  setopt_json);
 
-  command_parse(&program, argc, argv);
+  command_option(&program, "-a", "--all",
+                 "only list packages matching every term", setopt_all);
 
-  for (int i = 0; i < program.argc; i++)
-    case_lower(program.argv[i]);
+  command_option(&program, "-f", "--fuzzy",
+                 "also list packages matching misspelled terms", setopt_fuzzy);
+
+  command_option(&program, "-l", "--limit <n>",
+                 "list at most n packages, best matches first", setopt_limit);
+
+  command_parse(&program, argc, argv);
 
   // set color theme
   cc_color_t fg_color_highlight = opt_color ? CC_FG_DARK_CYAN : CC_FG_NONE;
   cc_color_t fg_color_text = opt_color ? CC_FG_DARK_GRAY : CC_FG_NONE;
 
-  char *html = wiki_html_cache();
-  if (NULL == html) {
+  clib_search_index_t *index = search_index();
+  if (NULL == index) {
     command_free(&program);
     logger_error("error", "failed to fetch wiki HTML");
     return 1;
   }
 
-  list_t *pkgs = wiki_registry_parse(html);
-  free(html);
-
-  debug(&debugger, "found %zu packages", pkgs->len);
+  clib_search_result_t *results = NULL;
+  int count = clib_search_index_query(index, program.argc, program.argv,
+                                      &search_options, &results);
+  if (count < 0) {
+    clib_search_index_free(index);
+    command_free(&program);
+    logger_error("error", "failed to search packages");
+    return 1;
+  }
 
-  list_node_t *node;
-  list_iterator_t *it = list_iterator_new(pkgs, LIST_HEAD);
+  debug(&debugger, "found %d packages", count);
 
   JSON_Array *json_list = NULL;
   JSON_Value *json_list_root = NULL;
@@ -200,31 +257,28 @@ int main(int argc, char *argv[]) {
 
   printf("\n");
 
-  while ((node = list_iterator_next(it))) {
-    wiki_package_t *pkg = (wiki_package_t *)node->val;
-    if (matches(program.argc, program.argv, pkg)) {
-      if (opt_json) {
-        add_package_to_json(pkg, json_list);
-      } else {
-        display_package(pkg, fg_color_highlight, fg_color_text);
-      }
+  for (int i = 0; i < count; i++) {
+    clib_search_entry_t pkg;
+
+    clib_search_index_entry(index, results[i].entry, &pkg);
+
+    if (opt_json) {
+      add_package_to_json(&pkg, json_list);
     } else {
-      debug(&debugger, "skipped package %s", pkg->repo);
+      display_package(&pkg, fg_color_highlight, fg_color_text);
     }
-
-    wiki_package_free(pkg);
   }
 
+  free(results);
+
   if (opt_json) {
-    char *serialized = json_serialize_to_string_pretty(json_list_root);
-    puts(serialized);
+    json_serialize_to_stream_pretty(json_list_root, stdout);
+    putchar('\n');
 
-    json_free_serialized_string(serialized);
     json_value_free(json_list_root);
   }
 
-  list_iterator_destroy(it);
-  list_destroy(pkgs);
+  clib_search_index_free(index);
   command_free(&program);
   return 0;
 }
@@ -9,9 +9,9 @@
 #include "asprintf/asprintf.h"
 #include "commander/commander.h"
 #include "common/clib-settings.h"
+#include "common/clib-untar.h"
 #include "debug/debug.h"
 #include "fs/fs.h"
-#include "http-get/http-get.h"
 #include "logger/logger.h"
 #include "parse-repo/parse-repo.h"
 #include "parson/parson.h"
@@ -46,31 +46,6 @@ static char *get_tarball_url(const char *owner, const char *name,
   return tarball;
 }
 
-static char *get_tar_filepath(const char *name, const char *version) {
-  char *file = NULL;
-  int size = asprintf(&file, "%s-%s.tar.gz", name, version);
-  if (-1 == size)
-    return NULL;
-  return file;
-}
-
-static char *get_tmp_tarball(const char *file) {
-  char *tmp = NULL;
-  int size = asprintf(&tmp, "/tmp/%s", file);
-  if (-1 == size)
-    return NULL;
-  return tmp;
-}
-
-static char *get_untar_command(const char *file) {
-  char *cmd = NULL;
-  int size = 0;
-  size = asprintf(&cmd, "cd /tmp && tar -xf %s", file);
-  if (-1 == size)
-    return NULL;
-  return cmd;
-}
-
 static char *get_manifest_path(const char *dir) {
   char *path = NULL;
   int i = 0;
@@ -141,9 +116,6 @@ done:
 static int clib_uninstall(const char *owner, const char *name,
                           const char *version) {
   char *tarball = NULL;
-  char *file = NULL;
-  char *tarpath = NULL;
-  char *cmd = NULL;
   char *target = NULL;
   int rc = -1;
 
@@ -153,23 +125,11 @@ static int clib_uninstall(const char *owner, const char *name,
 
   if (!(tarball = get_tarball_url(owner, name, version)))
     goto done;
-  if (!(file = get_tar_filepath(name, version)))
-    goto done;
-  if (!(tarpath = get_tmp_tarball(file)))
-    goto done;
 
+  // the archive is unpacked in /tmp as it downloads
   logger_info("fetch", tarball);
-  if (-1 == http_get_file(tarball, tarpath)) {
-    logger_error("error", "failed to fetch tarball");
-    goto done;
-  }
-
-  if (!(cmd = get_untar_command(file)))
-    goto done;
-
-  logger_info("untar", tarpath);
-  if (0 != system(cmd)) {
-    logger_error("error", "failed to untar");
+  if (-1 == clib_untar_url(tarball, "/tmp", NULL)) {
+    logger_error("error", "failed to fetch or untar tarball");
     goto done;
   }
 
@@ -181,9 +141,6 @@ static int clib_uninstall(const char *owner, const char *name,
 
 done:
   free(tarball);
-  free(file);
-  free(tarpath);
-  free(cmd);
   free(target);
   return rc;
 }
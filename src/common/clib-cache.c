@@ -9,11 +9,21 @@
 #include "copy/copy.h"
 #include "fs/fs.h"
 #include "rimraf/rimraf.h"
+#include "sha1/sha1.h"
+#include "strdup/strdup.h"
+#include "tinydir/tinydir.h"
 #include <limits.h>
 #include <mkdirp/mkdirp.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
+#include <utime.h>
+
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
 
 #define GET_PKG_CACHE(a, n, v)                                                 \
   char pkg_cache[BUFSIZ];                                                      \
@@ -32,14 +42,64 @@
 #define BASE_CACHE_PATTERN "%s/.cache/clib"
 #define PKG_CACHE_PATTERN "%s/%s_%s_%s"
 #define JSON_CACHE_PATTERN "%s/%s_%s_%s.json"
+#define VALIDATORS_PATTERN "%s.meta"
+#define STORE_OBJECT_PATTERN "%s/%.2s/%s"
+#define LOAD_PARALLEL 4
+#define ENTRY_LOCKS 16
 
 /** Portable PATH_MAX ? */
 static char package_cache_dir[BUFSIZ];
 static char search_cache[BUFSIZ];
+static char search_index[BUFSIZ];
 static char json_cache_dir[BUFSIZ];
 static char meta_cache_dir[BUFSIZ];
+static char store_dir[BUFSIZ];
 static time_t expiration;
 
+#ifdef HAVE_PTHREADS
+/**
+ * Every function reading or writing a json or package entry holds the lock
+ * of that entry, so the cache can be used from several threads at once.
+ * Entries share locks by hash of their path: copying a package in or out
+ * only holds up the few entries hashing to the same lock. Store objects,
+ * shared between packages, have locks of their own, always taken after the
+ * entry lock.
+ */
+
+static pthread_mutex_t entry_locks[ENTRY_LOCKS];
+static pthread_mutex_t object_locks[ENTRY_LOCKS];
+static pthread_once_t locks_once = PTHREAD_ONCE_INIT;
+
+static void init_locks(void) {
+  for (int i = 0; i < ENTRY_LOCKS; i++) {
+    pthread_mutex_init(&entry_locks[i], NULL);
+    pthread_mutex_init(&object_locks[i], NULL);
+  }
+}
+
+static pthread_mutex_t *lock_of(pthread_mutex_t *locks, const char *path) {
+  unsigned long hash = 5381;
+
+  pthread_once(&locks_once, init_locks);
+
+  while (*path) {
+    hash = hash * 33 + (unsigned char)*path++;
+  }
+
+  return &locks[hash % ENTRY_LOCKS];
+}
+
+#define LOCK_ENTRY(path) pthread_mutex_lock(lock_of(entry_locks, path))
+#define UNLOCK_ENTRY(path) pthread_mutex_unlock(lock_of(entry_locks, path))
+#define LOCK_OBJECT(path) pthread_mutex_lock(lock_of(object_locks, path))
+#define UNLOCK_OBJECT(path) pthread_mutex_unlock(lock_of(object_locks, path))
+#else
+#define LOCK_ENTRY(path)
+#define UNLOCK_ENTRY(path)
+#define LOCK_OBJECT(path)
+#define UNLOCK_OBJECT(path)
+#endif
+
 static void json_cache_path(char *pkg_cache, char *author, char *name,
                             char *version) {
   sprintf(pkg_cache, JSON_CACHE_PATTERN, json_cache_dir, author, name, version);
@@ -78,6 +138,8 @@ int clib_cache_init(time_t exp) {
   sprintf(package_cache_dir, BASE_CACHE_PATTERN "/packages", BASE_DIR);
   sprintf(json_cache_dir, BASE_CACHE_PATTERN "/json", BASE_DIR);
   sprintf(search_cache, BASE_CACHE_PATTERN "/search.html", BASE_DIR);
+  sprintf(search_index, BASE_CACHE_PATTERN "/search.idx", BASE_DIR);
+  sprintf(store_dir, BASE_CACHE_PATTERN "/store", BASE_DIR);
 
   if (0 != check_dir(package_cache_dir)) {
     return -1;
@@ -85,6 +147,9 @@ int clib_cache_init(time_t exp) {
   if (0 != check_dir(json_cache_dir)) {
     return -1;
   }
+  if (0 != check_dir(store_dir)) {
+    return -1;
+  }
 
   return 0;
 }
@@ -103,33 +168,159 @@ static int is_expired(char *cache) {
   return now - modified >= expiration;
 }
 
+/**
+ * The validators of `cache` are kept next to it, the ETag on the first
+ * line and the Last-Modified date on the second.
+ */
+
+static int save_validators(char *cache, const char *etag,
+                           const char *last_modified) {
+  char path[BUFSIZ + 8];
+  char *content = NULL;
+  int rc = 0;
+
+  sprintf(path, VALIDATORS_PATTERN, cache);
+
+  if (!etag && !last_modified) {
+    unlink(path);
+    return 0;
+  }
+
+  // header values never contain line breaks
+  content = malloc((etag ? strlen(etag) : 0) +
+                   (last_modified ? strlen(last_modified) : 0) + 3);
+  if (!content) {
+    return -1;
+  }
+
+  sprintf(content, "%s\n%s\n", etag ? etag : "",
+          last_modified ? last_modified : "");
+  rc = fs_write(path, content);
+  free(content);
+
+  return -1 == rc ? -1 : 0;
+}
+
+static char *read_line(char **content) {
+  char *line = *content;
+  char *end = strchr(line, '\n');
+
+  if (end) {
+    *end = '\0';
+    *content = end + 1;
+  } else {
+    *content = line + strlen(line);
+  }
+
+  return *line ? strdup(line) : NULL;
+}
+
+static int read_validators(char *cache, char **etag, char **last_modified) {
+  char path[BUFSIZ + 8];
+  char *content = NULL;
+  char *cursor = NULL;
+
+  *etag = NULL;
+  *last_modified = NULL;
+
+  sprintf(path, VALIDATORS_PATTERN, cache);
+
+  if (0 != fs_exists(cache) || !(content = fs_read(path))) {
+    return -1;
+  }
+
+  cursor = content;
+  *etag = read_line(&cursor);
+  *last_modified = read_line(&cursor);
+  free(content);
+
+  return *etag || *last_modified ? 0 : -1;
+}
+
+static int delete_validators(char *cache) {
+  char path[BUFSIZ + 8];
+
+  sprintf(path, VALIDATORS_PATTERN, cache);
+
+  return unlink(path);
+}
+
 int clib_cache_has_json(char *author, char *name, char *version) {
   GET_JSON_CACHE(author, name, version);
 
-  return 0 == fs_exists(json_cache) && !is_expired(json_cache);
+  LOCK_ENTRY(json_cache);
+  int rc = 0 == fs_exists(json_cache) && !is_expired(json_cache);
+  UNLOCK_ENTRY(json_cache);
+
+  return rc;
 }
 
 char *clib_cache_read_json(char *author, char *name, char *version) {
   GET_JSON_CACHE(author, name, version);
+  char *json = NULL;
 
-  if (is_expired(json_cache)) {
-    return NULL;
+  LOCK_ENTRY(json_cache);
+  if (!is_expired(json_cache)) {
+    json = fs_read(json_cache);
   }
+  UNLOCK_ENTRY(json_cache);
 
-  return fs_read(json_cache);
+  return json;
 }
 
 int clib_cache_save_json(char *author, char *name, char *version,
                          char *content) {
   GET_JSON_CACHE(author, name, version);
 
-  return fs_write(json_cache, content);
+  LOCK_ENTRY(json_cache);
+  int rc = fs_write(json_cache, content);
+  UNLOCK_ENTRY(json_cache);
+
+  return rc;
 }
 
 int clib_cache_delete_json(char *author, char *name, char *version) {
   GET_JSON_CACHE(author, name, version);
 
-  return unlink(json_cache);
+  LOCK_ENTRY(json_cache);
+  delete_validators(json_cache);
+  int rc = unlink(json_cache);
+  UNLOCK_ENTRY(json_cache);
+
+  return rc;
+}
+
+int clib_cache_save_json_validators(char *author, char *name, char *version,
+                                    const char *etag,
+                                    const char *last_modified) {
+  GET_JSON_CACHE(author, name, version);
+
+  LOCK_ENTRY(json_cache);
+  int rc = save_validators(json_cache, etag, last_modified);
+  UNLOCK_ENTRY(json_cache);
+
+  return rc;
+}
+
+int clib_cache_read_json_validators(char *author, char *name, char *version,
+                                    char **etag, char **last_modified) {
+  GET_JSON_CACHE(author, name, version);
+
+  LOCK_ENTRY(json_cache);
+  int rc = read_validators(json_cache, etag, last_modified);
+  UNLOCK_ENTRY(json_cache);
+
+  return rc;
+}
+
+int clib_cache_touch_json(char *author, char *name, char *version) {
+  GET_JSON_CACHE(author, name, version);
+
+  LOCK_ENTRY(json_cache);
+  int rc = utime(json_cache, NULL);
+  UNLOCK_ENTRY(json_cache);
+
+  return rc;
 }
 
 int clib_cache_has_search(void) {
@@ -147,50 +338,295 @@ int clib_cache_save_search(char *content) {
   return fs_write(search_cache, content);
 }
 
-int clib_cache_delete_search(void) { return unlink(search_cache); }
+int clib_cache_delete_search(void) {
+  delete_validators(search_cache);
+  unlink(search_index);
+  return unlink(search_cache);
+}
+
+int clib_cache_save_search_validators(const char *etag,
+                                      const char *last_modified) {
+  return save_validators(search_cache, etag, last_modified);
+}
+
+int clib_cache_read_search_validators(char **etag, char **last_modified) {
+  return read_validators(search_cache, etag, last_modified);
+}
+
+int clib_cache_touch_search(void) {
+  struct stat html;
+  struct stat index;
+  int current = 0 == stat(search_cache, &html) &&
+                0 == stat(search_index, &index) &&
+                index.st_mtime >= html.st_mtime;
+
+  if (0 != utime(search_cache, NULL)) {
+    return -1;
+  }
+
+  // the page did not change, neither did the index built from it, unless
+  // it was built from an older page
+  if (current) {
+    utime(search_index, NULL);
+  }
+
+  return 0;
+}
+
+const char *clib_cache_search_index(void) { return search_index; }
+
+int clib_cache_has_search_index(void) {
+  struct stat html;
+  struct stat index;
+
+  if (!clib_cache_has_search()) {
+    return 0;
+  }
+  if (0 != stat(search_cache, &html) || 0 != stat(search_index, &index)) {
+    return 0;
+  }
+
+  return index.st_mtime >= html.st_mtime;
+}
 
 int clib_cache_has_package(char *author, char *name, char *version) {
   GET_PKG_CACHE(author, name, version);
 
-  return 0 == fs_exists(pkg_cache) && !is_expired(pkg_cache);
+  LOCK_ENTRY(pkg_cache);
+  int rc = 0 == fs_exists(pkg_cache) && !is_expired(pkg_cache);
+  UNLOCK_ENTRY(pkg_cache);
+
+  return rc;
 }
 
 int clib_cache_is_expired_package(char *author, char *name, char *version) {
   GET_PKG_CACHE(author, name, version);
 
-  return is_expired(pkg_cache);
+  LOCK_ENTRY(pkg_cache);
+  int rc = is_expired(pkg_cache);
+  UNLOCK_ENTRY(pkg_cache);
+
+  return rc;
+}
+
+/**
+ * Path of the store object holding the content and mode of `file`.
+ */
+
+static int object_path(char *object, const char *file, mode_t *mode) {
+  unsigned char buffer[BUFSIZ];
+  unsigned char digest[20];
+  char hex[41];
+  size_t n = 0;
+  SHA1_CTX ctx;
+  struct stat stats;
+
+  FILE *fp = NULL;
+
+  if (0 != stat(file, &stats) || !(fp = fopen(file, "rb"))) {
+    return -1;
+  }
+
+  // hard links share the mode, so it is part of the key
+  *mode = stats.st_mode & 07777;
+  n = sprintf((char *)buffer, "%o", (unsigned)*mode);
+
+  SHA1Init(&ctx);
+  SHA1Update(&ctx, buffer, n + 1);
+  while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+    SHA1Update(&ctx, buffer, n);
+  }
+  SHA1Final(digest, &ctx);
+  fclose(fp);
+
+  for (int i = 0; i < 20; i++) {
+    sprintf(hex + i * 2, "%02x", digest[i]);
+  }
+
+  sprintf(object, STORE_OBJECT_PATTERN, store_dir, hex, hex + 2);
+  return 0;
+}
+
+static int store_object(char *file, char *object, mode_t mode,
+                        char *target) {
+  char tmp[BUFSIZ + 16];
+
+  if (0 != fs_exists(object)) {
+    char *dir = strrchr(object, '/');
+
+    *dir = '\0';
+    check_dir(object);
+    *dir = '/';
+
+    // write then rename so concurrent readers never see a partial object
+    sprintf(tmp, "%s.%d", object, (int)getpid());
+    if (0 != copy_file(file, tmp) || 0 != chmod(tmp, mode) ||
+        0 != rename(tmp, object)) {
+      unlink(tmp);
+      return copy_file(file, target);
+    }
+  }
+
+#ifndef _WIN32
+  if (0 == link(object, target)) {
+    return 0;
+  }
+#endif
+
+  return copy_file(object, target);
+}
+
+/**
+ * Add `file` to the store, unless an identical file is already there, and
+ * make `target` a hard link to the stored object.
+ */
+
+static int store_file(char *file, char *target) {
+  char object[BUFSIZ];
+  mode_t mode;
+
+  if (0 != object_path(object, file, &mode)) {
+    return -1;
+  }
+
+  LOCK_OBJECT(object);
+  int rc = store_object(file, object, mode, target);
+  UNLOCK_OBJECT(object);
+
+  return rc;
+}
+
+/**
+ * Drop the store object of `file` when `file` is a link to it, and
+ * nothing but the store links to it otherwise. A file that was copied
+ * because it could not be linked leaves the object alone.
+ */
+
+static int release_file(char *file, char *target) {
+  char object[BUFSIZ];
+  struct stat file_stats;
+  struct stat object_stats;
+  mode_t mode;
+
+  if (0 != object_path(object, file, &mode)) {
+    return 0;
+  }
+
+  LOCK_OBJECT(object);
+  if (0 == stat(file, &file_stats) && 0 == stat(object, &object_stats) &&
+      file_stats.st_dev == object_stats.st_dev &&
+      file_stats.st_ino == object_stats.st_ino) {
+    // one link from the store and one from the package being released
+    if (object_stats.st_nlink <= 2) {
+      unlink(object);
+    }
+  }
+  UNLOCK_OBJECT(object);
+
+  return 0;
+}
+
+/**
+ * Call `fn` for every regular file under `dir`, with the matching path
+ * under `target_dir`, creating the directories in `target_dir` if
+ * `target_dir` is set.
+ */
+
+static int walk_files(char *dir_path, char *target_dir,
+                      int (*fn)(char *file, char *target)) {
+  tinydir_dir dir;
+  int rc = 0;
+
+  if (-1 == tinydir_open(&dir, dir_path)) {
+    return -1;
+  }
+
+  if (target_dir) {
+    check_dir(target_dir);
+  }
+
+  while (dir.has_next && 0 == rc) {
+    tinydir_file file;
+
+    if (-1 == tinydir_readfile(&dir, &file)) {
+      rc = -1;
+      break;
+    }
+
+    if (0 != strcmp(".", file.name) && 0 != strcmp("..", file.name)) {
+      char target[BUFSIZ];
+
+      sprintf(target, "%s/%s", target_dir ? target_dir : dir_path, file.name);
+
+      if (file.is_dir) {
+        rc = walk_files(file.path, target_dir ? target : NULL, fn);
+      } else if (file.is_reg) {
+        rc = fn(file.path, target);
+      }
+    }
+
+    if (-1 == tinydir_next(&dir)) {
+      rc = -1;
+    }
+  }
+
+  tinydir_close(&dir);
+  return rc;
+}
+
+static int remove_package(char *pkg_cache) {
+  walk_files(pkg_cache, NULL, release_file);
+  return rimraf(pkg_cache);
 }
 
 int clib_cache_save_package(char *author, char *name, char *version,
                             char *pkg_dir) {
   GET_PKG_CACHE(author, name, version);
 
+  LOCK_ENTRY(pkg_cache);
+
   if (0 == fs_exists(pkg_cache)) {
-    rimraf(pkg_cache);
+    remove_package(pkg_cache);
   }
 
-  return copy_dir(pkg_dir, pkg_cache);
+  int rc = walk_files(pkg_dir, pkg_cache, store_file);
+
+  UNLOCK_ENTRY(pkg_cache);
+
+  return rc;
 }
 
 int clib_cache_load_package(char *author, char *name, char *version,
                             char *target_dir) {
   GET_PKG_CACHE(author, name, version);
+  int rc = 0;
+
+  LOCK_ENTRY(pkg_cache);
 
   if (-1 == fs_exists(pkg_cache)) {
-    return -1;
+    rc = -1;
+  } else if (is_expired(pkg_cache)) {
+    remove_package(pkg_cache);
+    rc = -2;
+  } else {
+    // packages in deps/ are written to in place (manifests, forced
+    // fetches), so they are copied, and never share an inode with the store
+    copy_dir_opts_t opts = {.parallel = LOAD_PARALLEL, .preserve_mode = 1};
+
+    rc = copy_dir_with_opts(pkg_cache, target_dir, &opts);
   }
 
-  if (is_expired(pkg_cache)) {
-    rimraf(pkg_cache);
+  UNLOCK_ENTRY(pkg_cache);
 
-    return -2;
-  }
-
-  return copy_dir(pkg_cache, target_dir);
+  return rc;
 }
 
 int clib_cache_delete_package(char *author, char *name, char *version) {
   GET_PKG_CACHE(author, name, version);
 
-  return rimraf(pkg_cache);
+  LOCK_ENTRY(pkg_cache);
+  int rc = remove_package(pkg_cache);
+  UNLOCK_ENTRY(pkg_cache);
+
+  return rc;
 }
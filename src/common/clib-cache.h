@@ -62,6 +62,34 @@ int clib_cache_save_json(char *author, char *name, char *version,
  */
 int clib_cache_delete_json(char *author, char *name, char *version);
 
+/**
+ * Keep the ETag and Last-Modified headers of the response the cached
+ * package.json came from. Either may be NULL.
+ *
+ * @return 0 on success, -1 on error
+ */
+int clib_cache_save_json_validators(char *author, char *name, char *version,
+                                    const char *etag,
+                                    const char *last_modified);
+
+/**
+ * Read the validators of the cached package.json, even if it expired.
+ * Either may be set to NULL, and must be freed.
+ *
+ * @return 0 on success, -1 if the package.json or its validators are not
+ * cached
+ */
+int clib_cache_read_json_validators(char *author, char *name, char *version,
+                                    char **etag, char **last_modified);
+
+/**
+ * Mark the cached package.json as fresh, after the server confirmed it did
+ * not change
+ *
+ * @return 0 on success, -1 on error
+ */
+int clib_cache_touch_json(char *author, char *name, char *version);
+
 /**
  * @return 0/1 if the search cache exists
  */
@@ -84,6 +112,34 @@ int clib_cache_save_search(char *content);
  */
 int clib_cache_delete_search(void);
 
+/**
+ * Same as clib_cache_save_json_validators, for the search cache
+ */
+int clib_cache_save_search_validators(const char *etag,
+                                      const char *last_modified);
+
+/**
+ * Same as clib_cache_read_json_validators, for the search cache
+ */
+int clib_cache_read_search_validators(char **etag, char **last_modified);
+
+/**
+ * Same as clib_cache_touch_json, for the search cache. The search index
+ * is marked as fresh too, if it was built from the cached page.
+ */
+int clib_cache_touch_search(void);
+
+/**
+ * @return Where the search index built from the search cache is kept
+ */
+const char *clib_cache_search_index(void);
+
+/**
+ * @return 0/1 if the search cache is fresh, and the search index was built
+ * from it
+ */
+int clib_cache_has_search_index(void);
+
 /**
  * @return 0/1 if the packe is cached
  */
@@ -107,7 +163,9 @@ int clib_cache_load_package(char *author, char *name, char *version,
 /**
  * @param pkg_dir The downloaded package (e.g. ./deps/my_package).
  *                If the package was already cached, it will be deleted first,
- * then saved
+ * then saved.
+ *                Files are kept once in a content-addressed store, and
+ * packages sharing a file hard link the same object.
  *
  * @return 0 on success, -1 on error
  */
@@ -115,6 +173,8 @@ int clib_cache_save_package(char *author, char *name, char *version,
                             char *pkg_dir);
 
 /**
+ * Store objects no longer referenced by any cached package are removed.
+ *
  * @return 0 on success, -1 on error
  */
 int clib_cache_delete_package(char *author, char *name, char *version);
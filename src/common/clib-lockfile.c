@@ -0,0 +1,357 @@
+//
+// clib-lockfile.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#include "clib-lockfile.h"
+#include "clib-settings.h"
+#include "debug/debug.h"
+#include "fs/fs.h"
+#include "logger/logger.h"
+#include "path-join/path-join.h"
+#include "sha1/sha1.h"
+#include "strdup/strdup.h"
+#include <libgen.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INTEGRITY_PREFIX "sha1-"
+
+static debug_t debugger;
+
+#define _debug(...)                                                            \
+  ({                                                                           \
+    if (!(debugger.name))                                                      \
+      debug_init(&debugger, "clib-lockfile");                                  \
+    debug(&debugger, __VA_ARGS__);                                             \
+  })
+
+/**
+ * Hash `name` and the length of `size` bytes of `data`, so that bytes
+ * can't move from one part to the next without changing the digest
+ */
+
+static void hash_header(SHA1_CTX *ctx, const char *name, long size) {
+  char length[32];
+
+  SHA1Update(ctx, (const unsigned char *)name, strlen(name) + 1);
+  snprintf(length, sizeof(length), "%ld", size);
+  SHA1Update(ctx, (const unsigned char *)length, strlen(length) + 1);
+}
+
+static int hash_file(SHA1_CTX *ctx, const char *name, const char *path) {
+  unsigned char buffer[BUFSIZ];
+  size_t n = 0;
+  FILE *file = fopen(path, "rb");
+
+  if (!file) {
+    logger_error("error", "unable to read %s", path);
+    return -1;
+  }
+
+  hash_header(ctx, name, (long)fs_fsize(file));
+
+  while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    SHA1Update(ctx, buffer, n);
+  }
+
+  fclose(file);
+  return 0;
+}
+
+/**
+ * Hash the manifest of `pkg` and the sources installed in `pkg_dir`
+ * into `integrity` (`sha1-<hex>`). Each part is framed by its name and
+ * length.
+ *
+ * Returns -1 if a source is missing.
+ */
+
+static int package_integrity(clib_package_t *pkg, const char *pkg_dir,
+                             char integrity[sizeof(INTEGRITY_PREFIX) + 40]) {
+  unsigned char digest[20];
+  SHA1_CTX ctx;
+  int rc = 0;
+
+  SHA1Init(&ctx);
+
+  if (pkg->json) {
+    hash_header(&ctx, "manifest", strlen(pkg->json));
+    SHA1Update(&ctx, (const unsigned char *)pkg->json, strlen(pkg->json));
+  }
+
+  if (pkg->src && pkg_dir) {
+    list_iterator_t *iterator = list_iterator_new(pkg->src, LIST_HEAD);
+    list_node_t *node = NULL;
+
+    if (!iterator)
+      return -1;
+
+    while (0 == rc && (node = list_iterator_next(iterator))) {
+      char *file = strdup(node->val);
+      char *path = NULL;
+
+      // sources are flattened into `pkg_dir` when they are fetched
+      if (!file || !(path = path_join(pkg_dir, basename(file)))) {
+        rc = -1;
+      } else {
+        rc = hash_file(&ctx, node->val, path);
+      }
+
+      free(path);
+      free(file);
+    }
+
+    list_iterator_destroy(iterator);
+  }
+
+  if (0 != rc)
+    return -1;
+
+  SHA1Final(digest, &ctx);
+
+  strcpy(integrity, INTEGRITY_PREFIX);
+  for (int i = 0; i < 20; i++) {
+    sprintf(integrity + strlen(INTEGRITY_PREFIX) + i * 2, "%02x", digest[i]);
+  }
+
+  return 0;
+}
+
+clib_lockfile_t *clib_lockfile_new(void) {
+  clib_lockfile_t *lockfile = malloc(sizeof(clib_lockfile_t));
+
+  if (!lockfile)
+    return NULL;
+
+  memset(lockfile, 0, sizeof(clib_lockfile_t));
+
+  lockfile->root = json_value_init_object();
+  if (!lockfile->root) {
+    free(lockfile);
+    return NULL;
+  }
+
+  json_object_set_number(json_object(lockfile->root), "lockfileVersion",
+                         CLIB_LOCKFILE_VERSION);
+  json_object_set_value(json_object(lockfile->root), "packages",
+                        json_value_init_object());
+  lockfile->packages =
+      json_object_get_object(json_object(lockfile->root), "packages");
+
+  if (!lockfile->packages) {
+    clib_lockfile_free(lockfile);
+    return NULL;
+  }
+
+  return lockfile;
+}
+
+clib_lockfile_t *clib_lockfile_load(const char *path) {
+  clib_lockfile_t *lockfile = NULL;
+  JSON_Value *root = NULL;
+  JSON_Object *packages = NULL;
+
+  if (-1 == fs_exists(path))
+    return NULL;
+
+  if (!(root = json_parse_file(path))) {
+    logger_error("error", "unable to parse %s", path);
+    return NULL;
+  }
+
+  packages = json_object_get_object(json_object(root), "packages");
+
+  if (!packages || CLIB_LOCKFILE_VERSION !=
+                       json_object_get_number(json_object(root),
+                                              "lockfileVersion")) {
+    logger_error("error", "unsupported %s", path);
+    json_value_free(root);
+    return NULL;
+  }
+
+  if (!(lockfile = malloc(sizeof(clib_lockfile_t)))) {
+    json_value_free(root);
+    return NULL;
+  }
+
+  memset(lockfile, 0, sizeof(clib_lockfile_t));
+  lockfile->root = root;
+  lockfile->packages = packages;
+
+  _debug("loaded %s (%zu packages)", path, json_object_get_count(packages));
+
+  return lockfile;
+}
+
+int clib_lockfile_save(clib_lockfile_t *lockfile, const char *path) {
+  if (!lockfile || !path)
+    return -1;
+
+  if (JSONSuccess != json_serialize_to_file_pretty(lockfile->root, path)) {
+    return -1;
+  }
+
+  _debug("wrote %s", path);
+  return 0;
+}
+
+int clib_lockfile_add(clib_lockfile_t *lockfile, const char *key,
+                      clib_package_t *pkg, const char *pkg_dir) {
+  char integrity[sizeof(INTEGRITY_PREFIX) + 40];
+  JSON_Value *entry_value = NULL;
+  JSON_Value *src_value = NULL;
+  JSON_Object *entry = NULL;
+
+  if (!lockfile || !key || !pkg || !pkg->json)
+    return -1;
+
+  if (!(entry_value = json_value_init_object()))
+    return -1;
+
+  entry = json_value_get_object(entry_value);
+
+  if (0 != package_integrity(pkg, pkg_dir, integrity)) {
+    json_value_free(entry_value);
+    return -1;
+  }
+
+  json_object_set_string(entry, "version", pkg->version);
+  json_object_set_string(entry, "ref", clib_package_ref(pkg));
+  if (pkg->repo) {
+    json_object_set_string(entry, "repo", pkg->repo);
+  }
+  if (pkg->filename) {
+    json_object_set_string(entry, "manifest", pkg->filename);
+  }
+
+  if (pkg->src) {
+    list_iterator_t *iterator = list_iterator_new(pkg->src, LIST_HEAD);
+    list_node_t *node = NULL;
+
+    src_value = json_value_init_array();
+    while ((node = list_iterator_next(iterator))) {
+      json_array_append_string(json_array(src_value), node->val);
+    }
+    list_iterator_destroy(iterator);
+
+    json_object_set_value(entry, "src", src_value);
+  }
+
+  json_object_set_string(entry, "integrity", integrity);
+  json_object_set_string(entry, "json", pkg->json);
+
+  if (JSONSuccess != json_object_set_value(lockfile->packages, key,
+                                           entry_value)) {
+    json_value_free(entry_value);
+    return -1;
+  }
+
+  _debug("pinned %s@%s (%s)", key, pkg->version, integrity);
+  return 0;
+}
+
+int clib_lockfile_verify(clib_lockfile_t *lockfile, const char *key,
+                         clib_package_t *pkg, const char *pkg_dir) {
+  char integrity[sizeof(INTEGRITY_PREFIX) + 40];
+  const char *expected = NULL;
+  JSON_Object *entry = NULL;
+
+  if (!lockfile || !key || !pkg)
+    return -1;
+
+  entry = json_object_get_object(lockfile->packages, key);
+
+  if (!entry || !(expected = json_object_get_string(entry, "integrity")))
+    return -1;
+
+  if (0 != package_integrity(pkg, pkg_dir, integrity))
+    return -1;
+
+  if (0 != strcmp(expected, integrity)) {
+    logger_error("error", "integrity mismatch for %s: expected %s, got %s",
+                 key, expected, integrity);
+    return -1;
+  }
+
+  return 0;
+}
+
+clib_package_t *clib_lockfile_get(clib_lockfile_t *lockfile, const char *key,
+                                  int verbose) {
+  clib_package_t *pkg = NULL;
+  JSON_Object *entry = NULL;
+  const char *manifest = NULL;
+  const char *version = NULL;
+  const char *json = NULL;
+  const char *repo = NULL;
+  const char *ref = NULL;
+
+  if (!lockfile || !key)
+    return NULL;
+
+  entry = json_object_get_object(lockfile->packages, key);
+
+  if (!entry || !(json = json_object_get_string(entry, "json")) ||
+      !(version = json_object_get_string(entry, "version"))) {
+    return NULL;
+  }
+
+  if (!(pkg = clib_package_new(json, verbose)))
+    return NULL;
+
+  // the pinned entry wins over the manifest, as it does when resolving
+  clib_package_free_string(pkg, pkg->version);
+  pkg->version = strdup(version);
+  clib_package_free_string(pkg, pkg->author);
+  pkg->author = clib_package_parse_author(key);
+
+  if ((repo = json_object_get_string(entry, "repo"))) {
+    clib_package_free_string(pkg, pkg->repo);
+    pkg->repo = strdup(repo);
+  } else if (!pkg->repo) {
+    pkg->repo = strdup(key);
+  }
+
+  // `filename` must point to a static manifest name
+  manifest = json_object_get_string(entry, "manifest");
+  for (int i = 0; manifest && manifest_names[i]; i++) {
+    if (0 == strcmp(manifest, manifest_names[i])) {
+      pkg->filename = (char *)manifest_names[i];
+    }
+  }
+
+  if (!pkg->filename) {
+    pkg->filename = (char *)manifest_names[0];
+  }
+
+  if (!(ref = json_object_get_string(entry, "ref"))) {
+    ref = pkg->version;
+  }
+
+  pkg->url = clib_package_url_from_repo(pkg->repo, ref);
+
+  if (!pkg->version || !pkg->author || !pkg->repo || !pkg->url) {
+    clib_package_free(pkg);
+    return NULL;
+  }
+
+  if (verbose) {
+    logger_info("lock", "%s@%s", key, pkg->version);
+  }
+
+  return pkg;
+}
+
+void clib_lockfile_free(clib_lockfile_t *lockfile) {
+  if (!lockfile)
+    return;
+
+  if (lockfile->root)
+    json_value_free(lockfile->root);
+
+  free(lockfile);
+}
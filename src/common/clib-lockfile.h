@@ -0,0 +1,68 @@
+//
+// clib-lockfile.h
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#ifndef CLIB_LOCKFILE_H
+#define CLIB_LOCKFILE_H
+
+#include "clib-package.h"
+#include "parson/parson.h"
+
+#define CLIB_LOCKFILE_NAME "clib.lock"
+#define CLIB_LOCKFILE_VERSION 2
+
+typedef struct clib_lockfile clib_lockfile_t;
+struct clib_lockfile {
+  JSON_Value *root;
+  JSON_Object *packages;
+  int frozen; // resolve only from the lockfile, never from the network
+};
+
+/**
+ * @return A new empty lockfile, or NULL on error
+ */
+clib_lockfile_t *clib_lockfile_new(void);
+
+/**
+ * @return The lockfile read from `path`, or NULL if it is missing or invalid
+ */
+clib_lockfile_t *clib_lockfile_load(const char *path);
+
+/**
+ * @return 0 on success, -1 otherwise
+ */
+int clib_lockfile_save(clib_lockfile_t *lockfile, const char *path);
+
+/**
+ * Pin `pkg`, resolved from `key` (`author/name`) and installed in
+ * `pkg_dir`, replacing any previous entry for `key`
+ *
+ * @return 0 on success, -1 otherwise
+ */
+int clib_lockfile_add(clib_lockfile_t *lockfile, const char *key,
+                      clib_package_t *pkg, const char *pkg_dir);
+
+/**
+ * Check the content hash of `pkg`, installed in `pkg_dir`, against the
+ * entry pinned for `key`
+ *
+ * @return 0 if it matches, -1 otherwise
+ */
+int clib_lockfile_verify(clib_lockfile_t *lockfile, const char *key,
+                         clib_package_t *pkg, const char *pkg_dir);
+
+/**
+ * Build the package pinned for `key` (`author/name`) without touching the
+ * network
+ *
+ * @return The package, or NULL if it is not in the lockfile
+ */
+clib_package_t *clib_lockfile_get(clib_lockfile_t *lockfile, const char *key,
+                                  int verbose);
+
+void clib_lockfile_free(clib_lockfile_t *lockfile);
+
+#endif
@@ -12,8 +12,10 @@
 
 #include "asprintf/asprintf.h"
 #include "clib-cache.h"
+#include "clib-lockfile.h"
 #include "clib-package.h"
 #include "clib-settings.h"
+#include "clib-untar.h"
 #include "debug/debug.h"
 #include "fs/fs.h"
 #include "hash/hash.h"
@@ -49,6 +51,13 @@
 
 #define GITHUB_CONTENT_URL "https://raw.githubusercontent.com/"
 #define GITHUB_CONTENT_URL_WITH_TOKEN "https://%s@raw.githubusercontent.com/"
+#define GITHUB_ARCHIVE_URL "https://github.com/%s/archive/%s.tar.gz"
+
+// packages with this many sources are fetched as one archive
+#define TARBALL_MIN_SOURCES 8
+
+// archives larger than this fall back to a request per source
+#define TARBALL_MAX_SIZE (32 * 1024 * 1024)
 
 #if defined(_WIN32) || defined(WIN32) || defined(__MINGW32__) ||               \
     defined(__MINGW64__)
@@ -57,25 +66,70 @@
 #endif
 
 static hash_t *visited_packages = 0;
+static clib_lockfile_t *lockfile = 0;
 
-#ifdef HAVE_PTHREADS
-typedef struct fetch_package_file_thread_data fetch_package_file_thread_data_t;
-struct fetch_package_file_thread_data {
+typedef struct clib_package_node clib_package_node_t;
+struct clib_package_node {
+  char *key;  // `author/name`
+  char *slug; // `author/name@version`
+  clib_package_t *pkg;
+  int mark;
+};
+
+typedef struct tarball tarball_t;
+
+typedef struct install_state install_state_t;
+struct install_state {
   clib_package_t *pkg;
-  const char *dir;
-  char *file;
+  char *pkg_dir;
+  char *makefile; // path of the makefile, which is allowed to be missing
+  tarball_t *tarball;
   int verbose;
-  pthread_t thread;
-  pthread_attr_t attr;
-  void *data;
+  int failed; // files that could not be fetched
+  int cached; // restored from the cache, which needs no update
+  char *key;  // pinned in the frozen lockfile, checked before it is finished
+};
+
+typedef struct tarball_file tarball_file_t;
+struct tarball_file {
+  char *file; // as listed in `src`
+  char *path; // where it is installed
+  int done;
+};
+
+// sources of a package extracted from its archive as it downloads
+struct tarball {
+  install_state_t *files;
+  clib_untar_t *untar;
+  hash_t *wanted; // path in the archive -> tarball_file_t
+  size_t size;
 };
 
+// one download queue for every package of an install
+static http_get_multi_t *fetches = 0;
+
+#ifdef HAVE_PTHREADS
 typedef struct clib_package_lock clib_package_lock_t;
 struct clib_package_lock {
-  pthread_mutex_t mutex;
+  pthread_mutex_t log;      // keeps the lines of a message together
+  pthread_mutex_t init;     // opts.prefix and the globals created on demand
+  pthread_mutex_t lockfile; // the lockfile being added to or verified
 };
 
-static clib_package_lock_t lock = {PTHREAD_MUTEX_INITIALIZER};
+// the cache and the curl share lock themselves, see clib-cache.c and
+// http-get.c
+static clib_package_lock_t lock = {PTHREAD_MUTEX_INITIALIZER,
+                                   PTHREAD_MUTEX_INITIALIZER,
+                                   PTHREAD_MUTEX_INITIALIZER};
+
+typedef struct resolve_packages_thread_data resolve_packages_thread_data_t;
+struct resolve_packages_thread_data {
+  clib_package_node_t **nodes;
+  unsigned int count;
+  unsigned int next;
+  int verbose;
+  pthread_mutex_t mutex;
+};
 
 #endif
 
@@ -111,9 +165,10 @@ static clib_package_opts_t opts = {
  * Pre-declare prototypes.
  */
 
-static inline char *json_object_get_string_safe(JSON_Object *, const char *);
+static inline char *json_object_get_string_borrowed(JSON_Object *,
+                                                    const char *);
 
-static inline char *json_array_get_string_safe(JSON_Array *, int);
+static inline char *json_array_get_string_borrowed(JSON_Array *, int);
 
 static inline char *clib_package_file_url(const char *, const char *);
 
@@ -125,6 +180,22 @@ static inline list_t *parse_package_deps(JSON_Object *);
 
 static inline int install_packages(list_t *, const char *, int);
 
+static int install_package(clib_package_t *, const char *, int, int,
+                           const char *);
+
+static int prepare_package(clib_package_t *, const char *, int,
+                           install_state_t **);
+
+static int fetch_packages();
+
+static int finish_package(install_state_t *, const char *, int);
+
+static void clib_package_node_free(void *);
+
+#ifdef HAVE_PTHREADS
+static void init_curl_share();
+#endif
+
 void clib_package_set_opts(clib_package_opts_t o) {
   if (1 == opts.skip_cache && 0 == o.skip_cache) {
     opts.skip_cache = 0;
@@ -171,31 +242,27 @@ void clib_package_set_opts(clib_package_opts_t o) {
   }
 }
 
+void clib_package_set_lockfile(clib_lockfile_t *l) { lockfile = l; }
+
 /**
- * Create a copy of the result of a `json_object_get_string`
- * invocation.  This allows us to `json_value_free()` the
- * parent `JSON_Value` without destroying the string.
+ * Borrow the result of a `json_object_get_string` invocation on
+ * a manifest parsed in the arena of a package. The string lives
+ * as long as the package, and must not be freed on its own.
  */
 
-static inline char *json_object_get_string_safe(JSON_Object *obj,
-                                                const char *key) {
-  const char *val = json_object_get_string(obj, key);
-  if (!val)
-    return NULL;
-  return strdup(val);
+static inline char *json_object_get_string_borrowed(JSON_Object *obj,
+                                                    const char *key) {
+  return (char *)json_object_get_string(obj, key);
 }
 
 /**
- * Create a copy of the result of a `json_array_get_string`
- * invocation.  This allows us to `json_value_free()` the
- * parent `JSON_Value` without destroying the string.
+ * Borrow the result of a `json_array_get_string` invocation on
+ * a manifest parsed in the arena of a package.
  */
 
-static inline char *json_array_get_string_safe(JSON_Array *array, int index) {
-  const char *val = json_array_get_string(array, index);
-  if (!val)
-    return NULL;
-  return strdup(val);
+static inline char *json_array_get_string_borrowed(JSON_Array *array,
+                                                   int index) {
+  return (char *)json_array_get_string(array, index);
 }
 
 /**
@@ -313,13 +380,13 @@ static inline list_t *parse_package_deps(JSON_Object *obj) {
 
   for (unsigned int i = 0; i < json_object_get_count(obj); i++) {
     const char *name = NULL;
-    char *version = NULL;
+    const char *version = NULL;
     clib_package_dependency_t *dep = NULL;
     int error = 1;
 
     if (!(name = json_object_get_name(obj, i)))
       goto loop_cleanup;
-    if (!(version = json_object_get_string_safe(obj, name)))
+    if (!(version = json_object_get_string(obj, name)))
       goto loop_cleanup;
     if (!(dep = clib_package_dependency_new(name, version)))
       goto loop_cleanup;
@@ -338,8 +405,6 @@ static inline list_t *parse_package_deps(JSON_Object *obj) {
     error = 0;
 
   loop_cleanup:
-    if (version)
-      free(version);
     if (error) {
       list_destroy(list);
       list = NULL;
@@ -351,96 +416,416 @@ done:
   return list;
 }
 
+/**
+ * Create a dependency graph node for `dep`.
+ */
+
+static clib_package_node_t *
+clib_package_node_new(clib_package_dependency_t *dep) {
+  clib_package_node_t *node = malloc(sizeof(clib_package_node_t));
+  if (!node)
+    return NULL;
+
+  memset(node, 0, sizeof(clib_package_node_t));
+
+  node->key = clib_package_repo(dep->author, dep->name);
+  node->slug = clib_package_slug(dep->author, dep->name, dep->version);
+
+  if (!node->key || !node->slug) {
+    clib_package_node_free(node);
+    return NULL;
+  }
+
+  return node;
+}
+
+static void clib_package_node_free(void *_node) {
+  clib_package_node_t *node = (clib_package_node_t *)_node;
+  if (!node)
+    return;
+  free(node->key);
+  free(node->slug);
+  if (node->pkg)
+    clib_package_free(node->pkg);
+  free(node);
+}
+
+/**
+ * Add the nodes for `deps` that are not already in the graph to
+ * `nodes` and `level`.
+ */
+
+static int add_package_nodes(list_t *deps, hash_t *graph, list_t *nodes,
+                             list_t *level) {
+  list_iterator_t *iterator = NULL;
+  list_node_t *item = NULL;
+
+  if (!deps)
+    return 0;
+
+  if (!(iterator = list_iterator_new(deps, LIST_HEAD)))
+    return -1;
+
+  while ((item = list_iterator_next(iterator))) {
+    clib_package_dependency_t *dep = item->val;
+    clib_package_node_t *node = clib_package_node_new(dep);
+
+    if (!node) {
+      list_iterator_destroy(iterator);
+      return -1;
+    }
+
+    if (hash_get(graph, node->key)) {
+      clib_package_node_free(node);
+      continue;
+    }
+
+    hash_set(graph, node->key, node);
+    list_rpush(nodes, list_node_new(node));
+    list_rpush(level, list_node_new(node));
+  }
+
+  list_iterator_destroy(iterator);
+  return 0;
+}
+
+static void resolve_package_node(clib_package_node_t *node, int verbose) {
+  if (lockfile && lockfile->frozen) {
+    node->pkg = clib_lockfile_get(lockfile, node->key, verbose);
+    if (!node->pkg && verbose) {
+      logger_error("error", "%s is not pinned in %s", node->key,
+                   CLIB_LOCKFILE_NAME);
+    }
+    return;
+  }
+
+  node->pkg = clib_package_new_from_slug(node->slug, verbose);
+  if (!node->pkg && verbose) {
+    logger_error("error", "unable to resolve %s", node->slug);
+  }
+}
+
+#ifdef HAVE_PTHREADS
+static void *resolve_packages_thread(void *arg) {
+  resolve_packages_thread_data_t *data = arg;
+
+  while (1) {
+    clib_package_node_t *node = NULL;
+
+    pthread_mutex_lock(&data->mutex);
+    if (data->next < data->count) {
+      node = data->nodes[data->next++];
+    }
+    pthread_mutex_unlock(&data->mutex);
+
+    if (!node)
+      break;
+
+    resolve_package_node(node, data->verbose);
+  }
+
+  return 0;
+}
+#endif
+
+/**
+ * Fetch the manifests of every node in `level`, at most
+ * `opts.concurrency` at a time.
+ */
+
+static void resolve_package_level(list_t *level, int verbose) {
+  clib_package_node_t **nodes = NULL;
+  list_iterator_t *iterator = NULL;
+  list_node_t *item = NULL;
+  unsigned int count = 0;
+
+  if (0 == level->len)
+    return;
+
+  // a level can be as wide as the whole graph, keep it off the stack
+  if (!(nodes = malloc(level->len * sizeof(clib_package_node_t *))))
+    return;
+
+  if (!(iterator = list_iterator_new(level, LIST_HEAD))) {
+    free(nodes);
+    return;
+  }
+
+  while ((item = list_iterator_next(iterator))) {
+    nodes[count++] = item->val;
+  }
+
+  list_iterator_destroy(iterator);
+
+#ifdef HAVE_PTHREADS
+  unsigned int max = opts.concurrency < count ? opts.concurrency : count;
+  // the calling thread is one of the `max` workers
+  pthread_t *threads = max > 1 ? malloc((max - 1) * sizeof(pthread_t)) : NULL;
+
+  if (threads) {
+    resolve_packages_thread_data_t data = {
+        .nodes = nodes,
+        .count = count,
+        .next = 0,
+        .verbose = verbose,
+        .mutex = PTHREAD_MUTEX_INITIALIZER,
+    };
+    unsigned int started = 0;
+
+    init_curl_share();
+
+    for (unsigned int i = 0; i < max - 1; i++) {
+      if (0 != pthread_create(&threads[i], NULL, resolve_packages_thread,
+                              &data)) {
+        break;
+      }
+      started++;
+    }
+
+    // and resolves whatever the others do not pick up
+    resolve_packages_thread(&data);
+
+    for (unsigned int i = 0; i < started; i++) {
+      pthread_join(threads[i], NULL);
+    }
+
+    pthread_mutex_destroy(&data.mutex);
+    free(threads);
+    free(nodes);
+    return;
+  }
+#endif
+
+  for (unsigned int i = 0; i < count; i++) {
+    resolve_package_node(nodes[i], verbose);
+  }
+
+  free(nodes);
+}
+
+/**
+ * Push `node` on `sorted` after all of its dependencies.
+ */
+
+static void sort_package_node(hash_t *graph, clib_package_node_t *node,
+                              list_t *sorted) {
+  list_iterator_t *iterator = NULL;
+  list_node_t *item = NULL;
+
+  if (node->mark)
+    return;
+  // mark before descending so that cycles terminate
+  node->mark = 1;
+
+  if (!node->pkg)
+    return;
+
+  if (node->pkg->dependencies &&
+      (iterator = list_iterator_new(node->pkg->dependencies, LIST_HEAD))) {
+    while ((item = list_iterator_next(iterator))) {
+      clib_package_dependency_t *dep = item->val;
+      char *key = clib_package_repo(dep->author, dep->name);
+      if (!key)
+        continue;
+
+      clib_package_node_t *child = hash_get(graph, key);
+      free(key);
+
+      if (child) {
+        sort_package_node(graph, child, sorted);
+      }
+    }
+    list_iterator_destroy(iterator);
+  }
+
+  list_rpush(sorted, list_node_new(node));
+}
+
+/**
+ * Resolve the dependency graph rooted at `list` breadth first, fetching
+ * the manifests of each level concurrently, and return its nodes in
+ * topological order (dependencies before their dependents).
+ *
+ * `nodes` owns every node of the graph; the returned list only references
+ * them. Sets `error` if any package could not be resolved.
+ */
+
+static list_t *resolve_packages(list_t *list, list_t *nodes, int verbose,
+                                int *error) {
+  hash_t *graph = NULL;
+  list_t *level = NULL;
+  list_t *sorted = NULL;
+  list_iterator_t *iterator = NULL;
+  list_node_t *item = NULL;
+
+  if (!(graph = hash_new()))
+    goto cleanup;
+
+  if (!(level = list_new()))
+    goto cleanup;
+
+  if (-1 == add_package_nodes(list, graph, nodes, level))
+    goto cleanup;
+
+  while (level->len > 0) {
+    list_t *next = NULL;
+
+    resolve_package_level(level, verbose);
+
+    if (!(next = list_new()))
+      goto cleanup;
+
+    iterator = list_iterator_new(level, LIST_HEAD);
+    while ((item = list_iterator_next(iterator))) {
+      clib_package_node_t *node = item->val;
+
+      if (!node->pkg) {
+        *error = 1;
+        continue;
+      }
+
+      if (-1 == add_package_nodes(node->pkg->dependencies, graph, nodes,
+                                  next)) {
+        list_iterator_destroy(iterator);
+        list_destroy(next);
+        goto cleanup;
+      }
+    }
+    list_iterator_destroy(iterator);
+
+    list_destroy(level);
+    level = next;
+  }
+
+  if (!(sorted = list_new()))
+    goto cleanup;
+
+  // walk the roots in manifest order to keep installs deterministic
+  iterator = list_iterator_new(nodes, LIST_HEAD);
+  while ((item = list_iterator_next(iterator))) {
+    sort_package_node(graph, item->val, sorted);
+  }
+  list_iterator_destroy(iterator);
+
+cleanup:
+  if (!sorted)
+    *error = 1;
+  if (level)
+    list_destroy(level);
+  if (graph)
+    hash_free(graph);
+  return sorted;
+}
+
 static inline int install_packages(list_t *list, const char *dir, int verbose) {
   list_node_t *node = NULL;
   list_iterator_t *iterator = NULL;
+  install_state_t **states = NULL;
+  list_t *nodes = NULL;
+  list_t *sorted = NULL;
+  int prepared = 0;
+  int error = 0;
   int rc = -1;
-  list_t *freelist = NULL;
+  int i = 0;
 
   if (!list || !dir)
     goto cleanup;
 
-  iterator = list_iterator_new(list, LIST_HEAD);
+  if (!(nodes = list_new()))
+    goto cleanup;
+  nodes->free = clib_package_node_free;
+
+  if (!(sorted = resolve_packages(list, nodes, verbose, &error)))
+    goto cleanup;
+
+  if (!(states = calloc(sorted->len + 1, sizeof(install_state_t *))))
+    goto cleanup;
+
+  // queue the files of every package first, so they download together
+  iterator = list_iterator_new(sorted, LIST_HEAD);
   if (NULL == iterator)
     goto cleanup;
 
-  freelist = list_new();
+  for (i = 0; (node = list_iterator_next(iterator)); i++) {
+    clib_package_node_t *pkg_node = node->val;
 
-  while ((node = list_iterator_next(iterator))) {
-    clib_package_dependency_t *dep = NULL;
-    char *slug = NULL;
-    clib_package_t *pkg = NULL;
-    int error = 1;
+    if (-1 == prepare_package(pkg_node->pkg, dir, verbose, &states[i])) {
+      error = 1;
+      // its state is finished below, but nothing after it is installed
+      i++;
+      break;
+    }
 
-    dep = (clib_package_dependency_t *)node->val;
-    slug = clib_package_slug(dep->author, dep->name, dep->version);
-    if (NULL == slug)
-      goto loop_cleanup;
+    if (states[i] && lockfile && lockfile->frozen &&
+        !(states[i]->key = strdup(pkg_node->key))) {
+      states[i]->failed++;
+    }
+  }
 
-    pkg = clib_package_new_from_slug(slug, verbose);
-    if (NULL == pkg)
-      goto loop_cleanup;
+  prepared = i;
 
-    if (-1 == clib_package_install(pkg, dir, verbose))
-      goto loop_cleanup;
+  list_iterator_destroy(iterator);
+  iterator = NULL;
 
-    list_rpush(freelist, list_node_new(pkg));
-    error = 0;
+  if (-1 == fetch_packages()) {
+    for (i = 0; i < sorted->len; i++) {
+      if (states[i])
+        states[i]->failed++;
+    }
+  }
 
-  loop_cleanup:
-    if (slug)
-      free(slug);
-    if (error) {
-      list_iterator_destroy(iterator);
-      iterator = NULL;
-      rc = -1;
+  iterator = list_iterator_new(sorted, LIST_HEAD);
+  if (NULL == iterator)
+    goto cleanup;
+
+  for (i = 0; i < prepared && (node = list_iterator_next(iterator)); i++) {
+    clib_package_node_t *pkg_node = node->val;
+    install_state_t *state = states[i];
+
+    states[i] = NULL;
+
+    // dependencies are already part of `sorted`, don't recurse
+    if (state && -1 == finish_package(state, dir, 0))
+      goto cleanup;
+
+    // frozen packages were checked before they were finished
+    if (!(lockfile && lockfile->frozen) &&
+        -1 == clib_package_pin(pkg_node->slug, pkg_node->pkg, dir))
       goto cleanup;
-    }
   }
 
-  rc = 0;
+  rc = error ? -1 : 0;
 
 cleanup:
-  if (iterator)
-    list_iterator_destroy(iterator);
-
-  if (freelist) {
-    iterator = list_iterator_new(freelist, LIST_HEAD);
-    while ((node = list_iterator_next(iterator))) {
-      clib_package_t *pkg = node->val;
-      if (pkg)
-        clib_package_free(pkg);
+  if (states) {
+    for (i = 0; i < sorted->len; i++) {
+      if (states[i]) {
+        // not installed, release it and drop what was fetched
+        states[i]->failed++;
+        finish_package(states[i], dir, 0);
+      }
     }
-    list_iterator_destroy(iterator);
-    list_destroy(freelist);
+    free(states);
   }
+  if (iterator)
+    list_iterator_destroy(iterator);
+  if (sorted)
+    list_destroy(sorted);
+  if (nodes)
+    list_destroy(nodes);
   return rc;
 }
 
 #ifdef HAVE_PTHREADS
-static void curl_lock_callback(CURL *handle, curl_lock_data data,
-                               curl_lock_access access, void *userptr) {
-  pthread_mutex_lock(&lock.mutex);
-}
-
-static void curl_unlock_callback(CURL *handle, curl_lock_data data,
-                                 curl_lock_access access, void *userptr) {
-  pthread_mutex_unlock(&lock.mutex);
-}
-
+// every request shares the DNS cache, TLS sessions and connections of the
+// process wide http-get context
 static void init_curl_share() {
   if (0 == clib_package_curl_share) {
-    pthread_mutex_lock(&lock.mutex);
-    clib_package_curl_share = curl_share_init();
-    curl_share_setopt(clib_package_curl_share, CURLSHOPT_SHARE,
-                      CURL_LOCK_DATA_CONNECT);
-    curl_share_setopt(clib_package_curl_share, CURLSHOPT_LOCKFUNC,
-                      curl_lock_callback);
-    curl_share_setopt(clib_package_curl_share, CURLSHOPT_UNLOCKFUNC,
-                      curl_unlock_callback);
-    curl_share_setopt(clib_package_curl_share, CURLOPT_NETRC,
-                      CURL_NETRC_OPTIONAL);
-    pthread_mutex_unlock(&lock.mutex);
+    pthread_mutex_lock(&lock.init);
+    if (0 == clib_package_curl_share) {
+      clib_package_curl_share = http_get_share();
+    }
+    pthread_mutex_unlock(&lock.init);
   }
 }
 #endif
@@ -451,6 +836,7 @@ static void init_curl_share() {
 
 clib_package_t *clib_package_new(const char *json, int verbose) {
   clib_package_t *pkg = NULL;
+  JSON_Arena *arena = NULL;
   JSON_Value *root = NULL;
   JSON_Object *json_object = NULL;
   JSON_Array *src = NULL;
@@ -465,7 +851,12 @@ clib_package_t *clib_package_new(const char *json, int verbose) {
     goto cleanup;
   }
 
-  if (!(root = json_parse_string(json))) {
+  // the package borrows its strings from the parsed manifest
+  if (!(arena = json_arena_init())) {
+    goto cleanup;
+  }
+
+  if (!(root = json_parse_string_in_arena(arena, json))) {
     if (verbose) {
       logger_error("error", "unable to parse JSON");
     }
@@ -485,20 +876,24 @@ clib_package_t *clib_package_new(const char *json, int verbose) {
 
   memset(pkg, 0, sizeof(clib_package_t));
 
-  pkg->json = strdup(json);
-  pkg->name = json_object_get_string_safe(json_object, "name");
-  pkg->repo = json_object_get_string_safe(json_object, "repo");
-  pkg->version = json_object_get_string_safe(json_object, "version");
-  pkg->license = json_object_get_string_safe(json_object, "license");
-  pkg->description = json_object_get_string_safe(json_object, "description");
-  pkg->configure = json_object_get_string_safe(json_object, "configure");
-  pkg->install = json_object_get_string_safe(json_object, "install");
-  pkg->makefile = json_object_get_string_safe(json_object, "makefile");
-  pkg->prefix = json_object_get_string_safe(json_object, "prefix");
-  pkg->flags = json_object_get_string_safe(json_object, "flags");
+  pkg->arena = arena;
+  arena = NULL;
+
+  pkg->json = json_arena_strdup(pkg->arena, json);
+  pkg->name = json_object_get_string_borrowed(json_object, "name");
+  pkg->repo = json_object_get_string_borrowed(json_object, "repo");
+  pkg->version = json_object_get_string_borrowed(json_object, "version");
+  pkg->license = json_object_get_string_borrowed(json_object, "license");
+  pkg->description =
+      json_object_get_string_borrowed(json_object, "description");
+  pkg->configure = json_object_get_string_borrowed(json_object, "configure");
+  pkg->install = json_object_get_string_borrowed(json_object, "install");
+  pkg->makefile = json_object_get_string_borrowed(json_object, "makefile");
+  pkg->prefix = json_object_get_string_borrowed(json_object, "prefix");
+  pkg->flags = json_object_get_string_borrowed(json_object, "flags");
 
   if (!pkg->flags) {
-    pkg->flags = json_object_get_string_safe(json_object, "cflags");
+    pkg->flags = json_object_get_string_borrowed(json_object, "cflags");
   }
 
   // try as array
@@ -511,7 +906,7 @@ clib_package_t *clib_package_new(const char *json, int verbose) {
 
     if (flags) {
       for (unsigned int i = 0; i < json_array_get_count(flags); i++) {
-        char *flag = json_array_get_string_safe(flags, i);
+        char *flag = json_array_get_string_borrowed(flags, i);
         if (flag) {
           char *old_flags = pkg->flags;
 
@@ -524,7 +919,6 @@ clib_package_t *clib_package_new(const char *json, int verbose) {
           }
 
           free(old_flags);
-          free(flag);
         }
       }
     }
@@ -563,9 +957,8 @@ clib_package_t *clib_package_new(const char *json, int verbose) {
   if (src) {
     if (!(pkg->src = list_new()))
       goto cleanup;
-    pkg->src->free = free;
     for (unsigned int i = 0; i < json_array_get_count(src); i++) {
-      char *file = json_array_get_string_safe(src, i);
+      char *file = json_array_get_string_borrowed(src, i);
       _debug("file: %s", file);
       if (!file)
         goto cleanup;
@@ -599,8 +992,7 @@ clib_package_t *clib_package_new(const char *json, int verbose) {
   error = 0;
 
 cleanup:
-  if (root)
-    json_value_free(root);
+  json_arena_free(arena);
   if (error && pkg) {
     clib_package_free(pkg);
     pkg = NULL;
@@ -642,9 +1034,6 @@ clib_package_new_from_slug_with_package_name(const char *slug, int verbose,
   _debug("name: %s", name);
   _debug("version: %s", version);
 
-#ifdef HAVE_PTHREADS
-  pthread_mutex_lock(&lock.mutex);
-#endif
   // fetch json
   if (clib_cache_has_json(author, name, version)) {
     if (opts.skip_cache) {
@@ -659,32 +1048,48 @@ clib_package_new_from_slug_with_package_name(const char *slug, int verbose,
     }
 
     log = "cache";
-#ifdef HAVE_PTHREADS
-    pthread_mutex_unlock(&lock.mutex);
-#endif
   } else {
   download:
-#ifdef HAVE_PTHREADS
-    pthread_mutex_unlock(&lock.mutex);
-#endif
     if (retries-- <= 0) {
       goto error;
     } else {
+      char *etag = NULL;
+      char *last_modified = NULL;
+
+      // an expired copy is still good if the server says it is unchanged
+      if (!opts.skip_cache) {
+        clib_cache_read_json_validators(author, name, version, &etag,
+                                        &last_modified);
+      }
 #ifdef HAVE_PTHREADS
       init_curl_share();
+#endif
       _debug("GET %s", json_url);
       // clean up when retrying
       http_get_free(res);
-      res = http_get_shared(json_url, clib_package_curl_share);
-#else
-      res = http_get(json_url);
-#endif
+      res = http_get_shared_conditional(json_url, clib_package_curl_share,
+                                        etag, last_modified);
+      free(etag);
+      free(last_modified);
       json = res->data;
       _debug("status: %d", res->status);
-      if (!res || !res->ok) {
+
+      if (304 == res->status) {
+        clib_cache_touch_json(author, name, version);
+        json = clib_cache_read_json(author, name, version);
+        http_get_free(res);
+        res = NULL;
+
+        if (!json) {
+          goto download;
+        }
+
+        log = "cache";
+      } else if (!res->ok) {
         goto download;
+      } else {
+        log = "fetch";
       }
-      log = "fetch";
     }
   }
 
@@ -709,7 +1114,7 @@ clib_package_new_from_slug_with_package_name(const char *slug, int verbose,
   if (pkg->version) {
     if (0 != strcmp(version, DEFAULT_REPO_VERSION)) {
       _debug("forcing version number: %s (%s)", version, pkg->version);
-      free(pkg->version);
+      clib_package_free_string(pkg, pkg->version);
       pkg->version = version;
     } else {
       free(version);
@@ -722,7 +1127,7 @@ clib_package_new_from_slug_with_package_name(const char *slug, int verbose,
   // force package author (don't know how this could fail)
   if (pkg->author) {
     if (0 != strcmp(author, pkg->author)) {
-      free(pkg->author);
+      clib_package_free_string(pkg, pkg->author);
       pkg->author = author;
     } else {
       free(author);
@@ -750,9 +1155,6 @@ clib_package_new_from_slug_with_package_name(const char *slug, int verbose,
 
   pkg->url = url;
 
-#ifdef HAVE_PTHREADS
-  pthread_mutex_lock(&lock.mutex);
-#endif
   // cache json
   if (pkg && pkg->author && pkg->name && pkg->version) {
     if (-1 ==
@@ -761,11 +1163,13 @@ clib_package_new_from_slug_with_package_name(const char *slug, int verbose,
              pkg->version);
     } else {
       _debug("cached json: %s/%s@%s", pkg->author, pkg->name, pkg->version);
+
+      if (res) {
+        clib_cache_save_json_validators(pkg->author, pkg->name, pkg->version,
+                                        res->etag, res->last_modified);
+      }
     }
   }
-#ifdef HAVE_PTHREADS
-  pthread_mutex_unlock(&lock.mutex);
-#endif
 
   if (res) {
     http_get_free(res);
@@ -877,6 +1281,23 @@ char *clib_package_url_from_repo(const char *repo, const char *version) {
   return slug;
 }
 
+/**
+ * The git ref the sources of `pkg` are fetched from, which is not always
+ * `pkg->version` (e.g. `master` for unversioned slugs).
+ */
+
+const char *clib_package_ref(clib_package_t *pkg) {
+  const char *ref = NULL;
+
+  if (pkg->url && pkg->repo && (ref = strstr(pkg->url, pkg->repo))) {
+    ref += strlen(pkg->repo);
+    if ('/' == ref[0] && '\0' != ref[1])
+      return ref + 1;
+  }
+
+  return pkg->version;
+}
+
 /**
  * Parse the package author from the given `slug`
  */
@@ -924,19 +1345,58 @@ clib_package_dependency_t *clib_package_dependency_new(const char *repo,
   return dep;
 }
 
-static int fetch_package_file_work(clib_package_t *pkg, const char *dir,
-                                   char *file, int verbose) {
-  char *url = NULL;
-  char *path = NULL;
-  int saved = 0;
-  int rc = 0;
+/**
+ * Log the outcome of a file fetched for `data->pkg`.
+ */
 
-  _debug("fetch file: %s/%s", pkg->repo, file);
+static void fetch_package_file_done(const char *url, const char *path, int ok,
+                                    long status, void *data) {
+  install_state_t *files = data;
+  clib_package_t *pkg = files->pkg;
+  int optional = files->makefile && 0 == strcmp(path, files->makefile);
 
-  if (NULL == pkg) {
-    return 1;
+#ifdef HAVE_PTHREADS
+  pthread_mutex_lock(&lock.log);
+#endif
+
+  if (ok) {
+    if (files->verbose) {
+      logger_info("save", path);
+      fflush(stdout);
+    }
+  } else if (optional) {
+    logger_warn("warning", "unable to fetch Makefile (%s) for '%s'",
+                pkg->makefile, pkg->name);
+  } else {
+    files->failed++;
+    if (files->verbose) {
+      logger_error("error", "unable to fetch %s:%s (%ld)", pkg->repo,
+                   basename((char *)path), status);
+      fflush(stderr);
+    }
   }
 
+#ifdef HAVE_PTHREADS
+  pthread_mutex_unlock(&lock.log);
+#endif
+}
+
+/**
+ * Queue a file associated with the given `pkg` on `fetches`, unless it is
+ * already in `dir`.
+ *
+ * Returns 0 on success.
+ */
+
+static int fetch_package_file(install_state_t *files, const char *dir,
+                              char *file) {
+  clib_package_t *pkg = files->pkg;
+  char *url = NULL;
+  char *path = NULL;
+  int rc = 0;
+
+  _debug("fetch file: %s/%s", pkg->repo, file);
+
   if (NULL == pkg->url) {
     return 1;
   }
@@ -965,131 +1425,278 @@ static int fetch_package_file_work(clib_package_t *pkg, const char *dir,
     goto cleanup;
   }
 
-#ifdef HAVE_PTHREADS
-  pthread_mutex_lock(&lock.mutex);
-#endif
-
   if (1 == opts.force || -1 == fs_exists(path)) {
-    if (verbose) {
+    if (files->verbose) {
       logger_info("fetch", "%s:%s", pkg->repo, file);
       fflush(stdout);
     }
 
-#ifdef HAVE_PTHREADS
-    pthread_mutex_unlock(&lock.mutex);
-#endif
+    rc = http_get_multi_add_file(fetches, url, path, fetch_package_file_done,
+                                 files);
+  }
 
-    rc = http_get_file_shared(url, path, clib_package_curl_share);
-    saved = 1;
-  } else {
-#ifdef HAVE_PTHREADS
-    pthread_mutex_unlock(&lock.mutex);
-#endif
+cleanup:
+
+  free(url);
+  free(path);
+  return rc;
+}
+
+/**
+ * Whether to fetch the sources of `pkg` as one archive rather than a
+ * request each. Archives need the `author/name` of a GitHub repository,
+ * and are not fetched with a token.
+ */
+
+static int use_tarball(clib_package_t *pkg) {
+  list_iterator_t *iterator = NULL;
+  list_node_t *source = NULL;
+  int count = 0;
+
+  if (0 != opts.token || !pkg->repo || !pkg->version || !pkg->src) {
+    return 0;
   }
 
-  if (-1 == rc) {
-    if (verbose) {
-#ifdef HAVE_PTHREADS
-      pthread_mutex_lock(&lock.mutex);
-#endif
-      logger_error("error", "unable to fetch %s:%s", pkg->repo, file);
-      fflush(stderr);
-      rc = 1;
-#ifdef HAVE_PTHREADS
-      pthread_mutex_unlock(&lock.mutex);
-#endif
-      goto cleanup;
+  if (!(iterator = list_iterator_new(pkg->src, LIST_HEAD))) {
+    return 0;
+  }
+
+  while ((source = list_iterator_next(iterator))) {
+    if (0 != strncmp(source->val, "http", 4)) {
+      count++;
     }
   }
 
-  if (saved) {
-    if (verbose) {
-#ifdef HAVE_PTHREADS
-      pthread_mutex_lock(&lock.mutex);
-#endif
-      logger_info("save", path);
-      fflush(stdout);
+  list_iterator_destroy(iterator);
+  return count >= TARBALL_MIN_SOURCES;
+}
+
+static void tarball_free(tarball_t *tarball) {
+  if (NULL == tarball) {
+    return;
+  }
+
+  if (tarball->untar) {
+    clib_untar_free(tarball->untar);
+  }
+
+  if (tarball->wanted) {
+    hash_each_val(tarball->wanted, {
+      tarball_file_t *entry = val;
+      free(entry->file);
+      free(entry->path);
+      free(entry);
+    });
+    hash_free(tarball->wanted);
+  }
+
+  free(tarball);
+}
+
+/**
+ * Pick the sources out of the archive, whose entries are all under a
+ * `name-version/` directory.
+ */
+
+static char *tarball_filter(const char *name, void *data) {
+  tarball_t *tarball = data;
+  const char *slash = strchr(name, '/');
+  tarball_file_t *entry = NULL;
+
+  if (NULL == slash) {
+    return NULL;
+  }
+
+  entry = hash_get(tarball->wanted, (char *)slash + 1);
+  if (NULL == entry || entry->done) {
+    return NULL;
+  }
+
+  entry->done = 1;
+  return strdup(entry->path);
+}
+
+static int tarball_length(size_t length, void *userdata) {
+  tarball_t *tarball = userdata;
+
+  if (length > TARBALL_MAX_SIZE) {
+    _debug("archive of %s is too large", tarball->files->pkg->repo);
+    return -1;
+  }
+
+  return 0;
+}
+
+// archives sent without a Content-Length are capped as they arrive
+static int tarball_write(const void *data, size_t size, void *userdata) {
+  tarball_t *tarball = userdata;
+
+  tarball->size += size;
+  if (tarball->size > TARBALL_MAX_SIZE) {
+    _debug("archive of %s is too large", tarball->files->pkg->repo);
+    return -1;
+  }
+
+  return clib_untar_write(tarball->untar, data, size);
+}
+
+/**
+ * Once the archive is extracted, queue a request for each source it did
+ * not have. If it failed, every source is requested on its own.
+ */
+
+static void tarball_done(const char *url, const char *path, int ok,
+                         long status, void *data) {
+  tarball_t *tarball = data;
+  install_state_t *files = tarball->files;
+
+  ok = ok && 0 == clib_untar_finish(tarball->untar);
+  clib_untar_free(tarball->untar);
+  tarball->untar = NULL;
+
+  if (!ok) {
+    _debug("falling back to a request per file: %s (%ld)", url, status);
+  }
+
 #ifdef HAVE_PTHREADS
-      pthread_mutex_unlock(&lock.mutex);
+  pthread_mutex_lock(&lock.log);
 #endif
+
+  hash_each_val(tarball->wanted, {
+    tarball_file_t *entry = val;
+
+    if (ok && entry->done) {
+      if (files->verbose) {
+        logger_info("save", entry->path);
+      }
+      continue;
     }
-  }
 
-cleanup:
+    if (entry->done) {
+      unlink(entry->path);
+    }
 
-  free(url);
-  free(path);
-  return rc;
-}
+    if (0 != fetch_package_file(files, files->pkg_dir, entry->file)) {
+      files->failed++;
+    }
+  });
+
+  if (files->verbose) {
+    fflush(stdout);
+  }
 
 #ifdef HAVE_PTHREADS
-static void *fetch_package_file_thread(void *arg) {
-  fetch_package_file_thread_data_t *data = arg;
-  int *status = malloc(sizeof(int));
-  int rc =
-      fetch_package_file_work(data->pkg, data->dir, data->file, data->verbose);
-  *status = rc;
-  (void)data->pkg->refs--;
-  pthread_exit((void *)status);
-  return (void *)(intptr_t)rc;
-}
+  pthread_mutex_unlock(&lock.log);
 #endif
+}
 
 /**
- * Fetch a file associated with the given `pkg`.
+ * Queue the archive of `files->pkg` on `fetches`, to be extracted into
+ * `dir` as it downloads. Sources already in `dir` and URLs are left out.
  *
  * Returns 0 on success.
  */
 
-static int fetch_package_file(clib_package_t *pkg, const char *dir, char *file,
-                              int verbose, void **data) {
-#ifndef HAVE_PTHREADS
-  return fetch_package_file_work(pkg, dir, file, verbose);
-#else
-  fetch_package_file_thread_data_t *fetch = malloc(sizeof(*fetch));
-  int rc = 0;
+static int fetch_package_tarball(install_state_t *files, const char *dir) {
+  clib_package_t *pkg = files->pkg;
+  list_iterator_t *iterator = NULL;
+  list_node_t *source = NULL;
+  tarball_t *tarball = NULL;
+  char *url = NULL;
+  int rc = -1;
 
-  if (0 == fetch) {
+  if (!(tarball = calloc(1, sizeof(tarball_t)))) {
     return -1;
   }
 
-  *data = 0;
+  tarball->files = files;
 
-  memset(fetch, 0, sizeof(*fetch));
+  if (!(tarball->wanted = hash_new()) ||
+      !(iterator = list_iterator_new(pkg->src, LIST_HEAD))) {
+    goto cleanup;
+  }
 
-  fetch->pkg = pkg;
-  fetch->dir = dir;
-  fetch->file = file;
-  fetch->verbose = verbose;
+  while ((source = list_iterator_next(iterator))) {
+    char *file = source->val;
+    char *name = file + (0 == strncmp(file, "./", 2) ? 2 : 0);
+    char *path = NULL;
+    tarball_file_t *entry = NULL;
 
-  rc = pthread_attr_init(&fetch->attr);
+    if (0 == strncmp(file, "http", 4)) {
+      if (0 != fetch_package_file(files, dir, file)) {
+        goto cleanup;
+      }
+      continue;
+    }
 
-  if (0 != rc) {
-    free(fetch);
-    return rc;
+    if (!(path = path_join(dir, basename(file)))) {
+      goto cleanup;
+    }
+
+    // sources listed twice, or already installed, are not extracted again
+    if ((0 == opts.force && 0 == fs_exists(path)) ||
+        hash_has(tarball->wanted, name)) {
+      free(path);
+      continue;
+    }
+
+    if (!(entry = calloc(1, sizeof(tarball_file_t))) ||
+        !(entry->file = strdup(file))) {
+      free(entry);
+      free(path);
+      goto cleanup;
+    }
+
+    entry->path = path;
+
+    // keyed by its path in the archive, owned by the entry
+    hash_set(tarball->wanted, entry->file + (name - file), entry);
   }
 
-  (void)pkg->refs++;
-  rc = pthread_create(&fetch->thread, NULL, fetch_package_file_thread, fetch);
+  // everything is already there
+  if (0 == hash_size(tarball->wanted)) {
+    rc = 0;
+    goto cleanup;
+  }
 
-  if (0 != rc) {
-    pthread_attr_destroy(&fetch->attr);
-    free(fetch);
-    return rc;
+  if (!(tarball->untar = clib_untar_new(dir))) {
+    goto cleanup;
   }
 
-  rc = pthread_attr_destroy(&fetch->attr);
+  clib_untar_set_filter(tarball->untar, tarball_filter, tarball);
 
-  if (0 != rc) {
-    pthread_cancel(fetch->thread);
-    free(fetch);
-    return rc;
+  E_FORMAT(&url, GITHUB_ARCHIVE_URL, pkg->repo, clib_package_ref(pkg));
+
+  _debug("archive URL: %s", url);
+
+  if (files->verbose) {
+#ifdef HAVE_PTHREADS
+    pthread_mutex_lock(&lock.log);
+#endif
+    logger_info("fetch", "%s (%d files)", url,
+                (int)hash_size(tarball->wanted));
+    fflush(stdout);
+#ifdef HAVE_PTHREADS
+    pthread_mutex_unlock(&lock.log);
+#endif
   }
 
-  *data = fetch;
+  if (0 != http_get_multi_add_stream(fetches, url, tarball_length,
+                                     tarball_write, tarball_done, tarball)) {
+    rc = -1;
+    goto cleanup;
+  }
+
+  files->tarball = tarball;
+  tarball = NULL;
+  rc = 0;
 
+cleanup:
+  if (iterator)
+    list_iterator_destroy(iterator);
+  free(url);
+  tarball_free(tarball);
   return rc;
-#endif
 }
 
 static void set_prefix(clib_package_t *pkg, long path_max) {
@@ -1121,8 +1728,6 @@ int clib_package_install_executable(clib_package_t *pkg, const char *dir,
 
   int rc;
   char *url = NULL;
-  char *file = NULL;
-  char *tarball = NULL;
   char *command = NULL;
   char *unpack_dir = NULL;
   char *deps = NULL;
@@ -1162,11 +1767,11 @@ int clib_package_install_executable(clib_package_t *pkg, const char *dir,
   E_FORMAT(&url, "https://github.com/%s/archive/%s.tar.gz", pkg->repo,
            pkg->version);
 
-  E_FORMAT(&file, "%s-%s.tar.gz", reponame, pkg->version);
-
-  E_FORMAT(&tarball, "%s/%s", tmp, file);
+  _debug("download url: %s", url);
+  _debug("extract to: %s", tmp);
 
-  rc = http_get_file_shared(url, tarball, clib_package_curl_share);
+  // unpack the archive as it downloads
+  rc = clib_untar_url(url, tmp, clib_package_curl_share);
 
   if (0 != rc) {
     if (verbose) {
@@ -1177,21 +1782,6 @@ int clib_package_install_executable(clib_package_t *pkg, const char *dir,
     goto cleanup;
   }
 
-  E_FORMAT(&command, "cd %s && gzip -dc %s | tar x", tmp, file);
-
-  _debug("download url: %s", url);
-  _debug("file: %s", file);
-  _debug("tarball: %s", tarball);
-  _debug("command(extract): %s", command);
-
-  // cheap untar
-  rc = system(command);
-  if (0 != rc)
-    goto cleanup;
-
-  free(command);
-  command = NULL;
-
   set_prefix(pkg, path_max);
 
   const char *configure = pkg->configure;
@@ -1257,24 +1847,55 @@ int clib_package_install_executable(clib_package_t *pkg, const char *dir,
 cleanup:
   free(tmp);
   free(command);
-  free(tarball);
-  free(file);
   free(url);
   return rc;
 }
 
 /**
- * Install the given `pkg` in `dir`
+ * Release `state`, removing what was installed unless `rc` is 0.
  */
 
-int clib_package_install(clib_package_t *pkg, const char *dir, int verbose) {
+static void install_state_free(install_state_t *state, int rc) {
+  clib_package_t *pkg = state->pkg;
+
+  if (state->pkg_dir) {
+    if (0 != rc) {
+      rimraf(state->pkg_dir);
+      _debug("deleted inconsistent package dir: %s", state->pkg_dir);
+    }
+
+    free(state->pkg_dir);
+  }
+  if (state->makefile)
+    free(state->makefile);
+  free(state->key);
+  tarball_free(state->tarball);
+
+  if (0 != rc && pkg) {
+    clib_cache_delete_json(pkg->author, pkg->name, pkg->version);
+    _debug("deleted json cache: %s/%s@%s", pkg->author, pkg->name,
+           pkg->version);
+  }
+
+  free(state);
+}
+
+/**
+ * First half of installing `pkg` in `dir`: write its manifest and restore
+ * it from the cache, or queue its files on `fetches`. Nothing is downloaded
+ * until `fetch_packages()`, so the files of many packages share one queue.
+ *
+ * `*out` is left NULL if the package was already installed. Otherwise it
+ * must be passed to `finish_package()`, even when this fails.
+ */
+
+static int prepare_package(clib_package_t *pkg, const char *dir, int verbose,
+                           install_state_t **out) {
   list_iterator_t *iterator = NULL;
+  install_state_t *state = NULL;
   char *package_json = NULL;
   char *pkg_dir = NULL;
-  char *command = NULL;
-  int pending = 0;
   int rc = 0;
-  int i = 0;
 
 #ifdef PATH_MAX
   long path_max = PATH_MAX;
@@ -1284,25 +1905,23 @@ int clib_package_install(clib_package_t *pkg, const char *dir, int verbose) {
   long path_max = 4096;
 #endif
 
-#ifdef HAVE_PTHREADS
-  int max = opts.concurrency;
-#endif
+  *out = NULL;
 
 #ifdef CLIB_PACKAGE_PREFIX
   if (0 == opts.prefix) {
 #ifdef HAVE_PTHREADS
-    pthread_mutex_lock(&lock.mutex);
+    pthread_mutex_lock(&lock.init);
 #endif
     opts.prefix = CLIB_PACKAGE_PREFIX;
 #ifdef HAVE_PTHREADS
-    pthread_mutex_unlock(&lock.mutex);
+    pthread_mutex_unlock(&lock.init);
 #endif
   }
 #endif
 
   if (0 == opts.prefix) {
 #ifdef HAVE_PTHREADS
-    pthread_mutex_lock(&lock.mutex);
+    pthread_mutex_lock(&lock.init);
 #endif
 #ifdef _GNU_SOURCE
     char *prefix = secure_getenv("PREFIX");
@@ -1314,54 +1933,50 @@ int clib_package_install(clib_package_t *pkg, const char *dir, int verbose) {
       opts.prefix = prefix;
     }
 #ifdef HAVE_PTHREADS
-    pthread_mutex_unlock(&lock.mutex);
+    pthread_mutex_unlock(&lock.init);
 #endif
   }
 
-  if (0 == visited_packages) {
-#ifdef HAVE_PTHREADS
-    pthread_mutex_lock(&lock.mutex);
-#endif
-
-    visited_packages = hash_new();
-    // initial write because sometimes `hash_set()` crashes
-    hash_set(visited_packages, strdup(""), "");
+  // claim the package, so that it is only installed once
+  if (pkg && pkg->name) {
+    int visited = 0;
 
 #ifdef HAVE_PTHREADS
-    pthread_mutex_unlock(&lock.mutex);
+    pthread_mutex_lock(&lock.init);
 #endif
-  }
+    if (0 == visited_packages) {
+      visited_packages = hash_new();
+    }
 
-  if (0 == opts.force && pkg && pkg->name) {
-#ifdef HAVE_PTHREADS
-    pthread_mutex_lock(&lock.mutex);
-#endif
+    // hash_has() reads past an empty table, hash_get() does not
+    if (visited_packages &&
+        !(visited = NULL != hash_get(visited_packages, pkg->name))) {
+      char *name = strdup(pkg->name);
 
-    if (hash_has(visited_packages, pkg->name)) {
-#ifdef HAVE_PTHREADS
-      pthread_mutex_unlock(&lock.mutex);
-#endif
-      return 0;
+      if (name) {
+        hash_set(visited_packages, name, "t");
+      }
     }
-
 #ifdef HAVE_PTHREADS
-    pthread_mutex_unlock(&lock.mutex);
+    pthread_mutex_unlock(&lock.init);
 #endif
-  }
 
-#ifdef HAVE_PTHREADS
-  fetch_package_file_thread_data_t **fetchs = 0;
-  if (NULL != pkg && NULL != pkg->src) {
-    if (pkg->src->len > 0) {
-      fetchs = malloc(pkg->src->len * sizeof(fetch_package_file_thread_data_t));
+    if (0 == visited_packages) {
+      return -1;
+    }
+
+    if (visited && 0 == opts.force) {
+      return 0;
     }
   }
 
-  if (fetchs) {
-    memset(fetchs, 0, pkg->src->len * sizeof(fetch_package_file_thread_data_t));
+  if (!(state = malloc(sizeof(install_state_t)))) {
+    return -1;
   }
 
-#endif
+  memset(state, 0, sizeof(install_state_t));
+  state->pkg = pkg;
+  state->verbose = verbose;
 
   if (!pkg || !dir) {
     rc = -1;
@@ -1375,6 +1990,8 @@ int clib_package_install(clib_package_t *pkg, const char *dir, int verbose) {
     goto cleanup;
   }
 
+  state->pkg_dir = pkg_dir;
+
   if (!opts.global) {
     _debug("mkdir -p %s", pkg_dir);
     // create directory for pkg
@@ -1411,165 +2028,159 @@ int clib_package_install(clib_package_t *pkg, const char *dir, int verbose) {
     }
   }
 
-  if (pkg->name) {
+  if (!opts.global && 0 == fetches) {
 #ifdef HAVE_PTHREADS
-    pthread_mutex_lock(&lock.mutex);
+    pthread_mutex_lock(&lock.init);
 #endif
-    if (!hash_has(visited_packages, pkg->name)) {
-      hash_set(visited_packages, strdup(pkg->name), "t");
+    if (0 == fetches) {
+      fetches = http_get_multi_new(clib_package_curl_share, opts.concurrency);
     }
 #ifdef HAVE_PTHREADS
-    pthread_mutex_unlock(&lock.mutex);
+    pthread_mutex_unlock(&lock.init);
 #endif
+
+    if (0 == fetches) {
+      rc = -1;
+      goto cleanup;
+    }
   }
 
   // fetch makefile
   if (!opts.global && pkg->makefile) {
     _debug("fetch: %s/%s", pkg->repo, pkg->makefile);
-    void *fetch = 0;
-    rc = fetch_package_file(pkg, pkg_dir, pkg->makefile, verbose, &fetch);
+    state->makefile = path_join(pkg_dir, basename(pkg->makefile));
+    rc = fetch_package_file(state, pkg_dir, pkg->makefile);
     if (0 != rc) {
       goto cleanup;
     }
-
-#ifdef HAVE_PTHREADS
-    if (0 != fetch) {
-      fetch_package_file_thread_data_t *data = fetch;
-      int *status;
-      pthread_join(data->thread, (void **)&status);
-      if (NULL != status) {
-        rc = *status;
-        free(status);
-        status = 0;
-        if (0 != rc) {
-          rc = 0;
-          logger_warn("warning", "unable to fetch Makefile (%s) for '%s'",
-                      pkg->makefile, pkg->name);
-        }
-      }
-    }
-#endif
   }
 
   // if no sources are listed, just install
   if (opts.global || NULL == pkg->src)
-    goto install;
-
-#ifdef HAVE_PTHREADS
-  pthread_mutex_lock(&lock.mutex);
-#endif
+    goto cleanup;
 
   if (clib_cache_has_package(pkg->author, pkg->name, pkg->version)) {
     if (opts.skip_cache) {
       clib_cache_delete_package(pkg->author, pkg->name, pkg->version);
-#ifdef HAVE_PTHREADS
-      pthread_mutex_unlock(&lock.mutex);
-#endif
       goto download;
     }
 
     if (0 != clib_cache_load_package(pkg->author, pkg->name, pkg->version,
                                      pkg_dir)) {
-#ifdef HAVE_PTHREADS
-      pthread_mutex_unlock(&lock.mutex);
-#endif
       goto download;
     }
 
     if (verbose) {
+#ifdef HAVE_PTHREADS
+      pthread_mutex_lock(&lock.log);
+#endif
       logger_info("cache", pkg->repo);
-    }
-
 #ifdef HAVE_PTHREADS
-    pthread_mutex_unlock(&lock.mutex);
+      pthread_mutex_unlock(&lock.log);
 #endif
+    }
 
-    goto install;
+    state->cached = 1;
+    goto cleanup;
   }
 
-#ifdef HAVE_PTHREADS
-  pthread_mutex_unlock(&lock.mutex);
-#endif
-
 download:
 
+  // one archive rather than a request per source
+  if (use_tarball(pkg)) {
+    rc = fetch_package_tarball(state, pkg_dir);
+    goto cleanup;
+  }
+
   iterator = list_iterator_new(pkg->src, LIST_HEAD);
   list_node_t *source;
 
   while ((source = list_iterator_next(iterator))) {
-    void *fetch = NULL;
-    rc = fetch_package_file(pkg, pkg_dir, source->val, verbose, &fetch);
+    rc = fetch_package_file(state, pkg_dir, source->val);
 
     if (0 != rc) {
-      list_iterator_destroy(iterator);
-      iterator = NULL;
       rc = -1;
       goto cleanup;
     }
+  }
 
-#ifdef HAVE_PTHREADS
-    if (i < 0) {
-      i = 0;
-    }
+cleanup:
+  if (package_json)
+    free(package_json);
+  if (iterator)
+    list_iterator_destroy(iterator);
 
-    fetchs[i] = fetch;
+  if (0 != rc) {
+    // jobs already queued point at `state`, `finish_package()` releases it
+    state->failed++;
+  }
 
-    (void)pending++;
+  *out = state;
+  return rc;
+}
 
-    if (i < (max - 1)) {
-      (void)i++;
-    } else {
-      for (int j = 0; j <= i; j++) {
-        fetch_package_file_thread_data_t *data = fetchs[j];
-        int *status;
-        pthread_join(data->thread, (void **)&status);
-        free(data);
-        fetchs[j] = NULL;
-
-        (void)pending--;
-
-        if (NULL != status) {
-          rc = *status;
-          free(status);
-          status = 0;
-        }
+/**
+ * Download everything queued by `prepare_package()`. A slot is refilled
+ * as soon as any transfer completes, whichever package it belongs to.
+ */
 
-        if (0 != rc) {
-          rc = -1;
-          goto cleanup;
-        }
-      }
-      i = 0;
-    }
-#endif
+static int fetch_packages() {
+  if (0 == fetches) {
+    return 0;
+  }
+
+  return -1 == http_get_multi_perform(fetches) ? -1 : 0;
+}
+
+/**
+ * Check the sources of `state` against the entry pinned for it in the
+ * frozen lockfile, before anything runs them or caches them
+ */
+
+static int verify_package(install_state_t *state) {
+  clib_package_t *pkg = state->pkg;
+  int rc = 0;
+
+  if (!state->key) {
+    return 0;
   }
 
 #ifdef HAVE_PTHREADS
-  // Here there are i-1 threads running.
-  for (int j = 0; j < i; j++) {
-    fetch_package_file_thread_data_t *data = fetchs[j];
-    int *status;
+  pthread_mutex_lock(&lock.lockfile);
+#endif
+  rc = clib_lockfile_verify(lockfile, state->key, pkg, state->pkg_dir);
+#ifdef HAVE_PTHREADS
+  pthread_mutex_unlock(&lock.lockfile);
+#endif
+
+  // don't restore the same sources next time
+  if (0 != rc && state->cached) {
+    clib_cache_delete_package(pkg->author, pkg->name, pkg->version);
+    _debug("deleted cached package: %s/%s@%s", pkg->author, pkg->name,
+           pkg->version);
+  }
 
-    pthread_join(data->thread, (void **)&status);
+  return rc;
+}
 
-    (void)pending--;
-    free(data);
-    fetchs[j] = NULL;
+/**
+ * Second half of installing a package, once its files are fetched: check
+ * them when the lockfile is frozen, run its configure and install
+ * commands, install its dependencies when `deps` is set, and cache it.
+ * `state` is released.
+ */
 
-    if (NULL != status) {
-      rc = *status;
-      free(status);
-      status = 0;
-    }
+static int finish_package(install_state_t *state, const char *dir, int deps) {
+  clib_package_t *pkg = state->pkg;
+  char *command = NULL;
+  int verbose = state->verbose;
+  int rc = 0;
 
-    if (0 != rc) {
-      rc = -1;
-      goto cleanup;
-    }
+  if (0 != state->failed || 0 != verify_package(state)) {
+    rc = -1;
+    goto cleanup;
   }
-#endif
 
-install:
   if (pkg->configure) {
     E_FORMAT(&command, "cd %s/%s && %s", dir, pkg->name, pkg->configure);
 
@@ -1584,59 +2195,143 @@ install:
     rc = clib_package_install_executable(pkg, dir, verbose);
   }
 
-  if (0 == rc) {
+  if (0 == rc && deps) {
     rc = clib_package_install_dependencies(pkg, dir, verbose);
   }
 
-#ifdef HAVE_PTHREADS
-  pthread_mutex_lock(&lock.mutex);
-#endif
-  if (0 == rc) {
-    clib_cache_save_package(pkg->author, pkg->name, pkg->version, pkg_dir);
+  if (0 == rc && !state->cached) {
+    clib_cache_save_package(pkg->author, pkg->name, pkg->version,
+                            state->pkg_dir);
     _debug("cached package: %s/%s@%s", pkg->author, pkg->name, pkg->version);
   }
-#ifdef HAVE_PTHREADS
-  pthread_mutex_unlock(&lock.mutex);
-#endif
 
 cleanup:
-  if (pkg_dir) {
-    if (0 != rc) {
-      rimraf(pkg_dir);
-      _debug("deleted inconsistent package dir: %s", pkg_dir);
-    }
-
-    free(pkg_dir);
-  }
-  if (package_json)
-    free(package_json);
-  if (iterator)
-    list_iterator_destroy(iterator);
   if (command)
     free(command);
-#ifdef HAVE_PTHREADS
-  if (NULL != pkg && NULL != pkg->src) {
-    if (pkg->src->len > 0) {
-      if (fetchs) {
-        free(fetchs);
-      }
-    }
+
+  install_state_free(state, rc);
+  return rc;
+}
+
+/**
+ * Install the given `pkg` in `dir`, and its dependencies when `deps`
+ * is set. Its sources are checked against the entry pinned for `key` in
+ * the frozen lockfile, if any.
+ */
+
+static int install_package(clib_package_t *pkg, const char *dir, int verbose,
+                           int deps, const char *key) {
+  install_state_t *state = NULL;
+  int rc = prepare_package(pkg, dir, verbose, &state);
+
+  if (NULL == state) {
+    return rc;
   }
-  fetchs = NULL;
-#endif
+
+  if (key && !(state->key = strdup(key))) {
+    state->failed++;
+  }
+
+  if (-1 == fetch_packages()) {
+    state->failed++;
+  }
+
+  return finish_package(state, dir, deps);
+}
+
+/**
+ * Install the given `pkg` in `dir`
+ */
+
+int clib_package_install(clib_package_t *pkg, const char *dir, int verbose) {
+  return install_package(pkg, dir, verbose, 1, NULL);
+}
+
+/**
+ * `author/name` of `slug`, the key of its lockfile entry
+ */
+
+static char *pinned_key(const char *slug) {
+  char *author = NULL;
+  char *name = NULL;
+  char *key = NULL;
+
+  if ((author = clib_package_parse_author(slug)) &&
+      (name = clib_package_parse_name(slug))) {
+    key = clib_package_repo(author, name);
+  }
+
+  free(author);
+  free(name);
+  return key;
+}
+
+/**
+ * Install the given `pkg`, resolved from `slug`, in `dir` and pin it, or
+ * check it against its pinned entry before it is configured or cached
+ * when the lockfile is frozen
+ */
+
+int clib_package_install_pinned(const char *slug, clib_package_t *pkg,
+                                const char *dir, int verbose) {
+  char *key = NULL;
+  int rc = -1;
+
+  if (!lockfile || !lockfile->frozen) {
+    rc = clib_package_install(pkg, dir, verbose);
+    return 0 == rc ? clib_package_pin(slug, pkg, dir) : rc;
+  }
+
+  if (!slug || !(key = pinned_key(slug)))
+    return -1;
+
+  rc = install_package(pkg, dir, verbose, 1, key);
+  free(key);
+  return rc;
+}
+
+/**
+ * Record `pkg`, resolved from `slug` and installed in `dir`, in the
+ * lockfile, or check it against its pinned entry when the lockfile is
+ * frozen.
+ */
+
+int clib_package_pin(const char *slug, clib_package_t *pkg, const char *dir) {
+  char *key = NULL;
+  char *pkg_dir = NULL;
+  int rc = -1;
+
+  if (!lockfile)
+    return 0;
+
+  if (!slug || !pkg || !dir)
+    return -1;
+
+  if (!(key = pinned_key(slug)))
+    goto cleanup;
+
+  if (!opts.global && pkg->name && !(pkg_dir = path_join(dir, pkg->name)))
+    goto cleanup;
 
 #ifdef HAVE_PTHREADS
-  pthread_mutex_lock(&lock.mutex);
+  pthread_mutex_lock(&lock.lockfile);
 #endif
-  if (0 != rc && pkg) {
-    clib_cache_delete_json(pkg->author, pkg->name, pkg->version);
-    _debug("deleted json cache: %s/%s@%s", pkg->author, pkg->name,
-           pkg->version);
+  if (lockfile->frozen) {
+    rc = clib_lockfile_verify(lockfile, key, pkg, pkg_dir);
+    if (0 != rc && pkg_dir) {
+      rimraf(pkg_dir);
+      _debug("deleted inconsistent package dir: %s", pkg_dir);
+    }
+  } else {
+    rc = clib_lockfile_add(lockfile, key, pkg, pkg_dir);
   }
 #ifdef HAVE_PTHREADS
-  pthread_mutex_unlock(&lock.mutex);
+  pthread_mutex_unlock(&lock.lockfile);
 #endif
 
+cleanup:
+  free(key);
+  free(pkg_dir);
   return rc;
 }
 
@@ -1683,7 +2378,7 @@ void clib_package_free(clib_package_t *pkg) {
 
 #define FREE(k)                                                                \
   if (pkg->k) {                                                                \
-    free(pkg->k);                                                              \
+    clib_package_free_string(pkg, pkg->k);                                     \
     pkg->k = 0;                                                                \
   }
   FREE(author);
@@ -1699,6 +2394,7 @@ void clib_package_free(clib_package_t *pkg) {
   FREE(url);
   FREE(version);
   FREE(flags);
+  FREE(prefix);
 #undef FREE
 
   if (pkg->src)
@@ -1713,10 +2409,24 @@ void clib_package_free(clib_package_t *pkg) {
     list_destroy(pkg->development);
   pkg->development = 0;
 
+  json_arena_free(pkg->arena);
+  pkg->arena = 0;
+
   free(pkg);
   pkg = 0;
 }
 
+/**
+ * Free `str`, one of the strings of `pkg`, unless it is borrowed
+ * from the manifest of the package
+ */
+
+void clib_package_free_string(clib_package_t *pkg, char *str) {
+  if (!json_arena_owns(pkg->arena, str)) {
+    free(str);
+  }
+}
+
 void clib_package_dependency_free(void *_dep) {
   clib_package_dependency_t *dep = (clib_package_dependency_t *)_dep;
   free(dep->name);
@@ -1736,5 +2446,11 @@ void clib_package_cleanup() {
     visited_packages = 0;
   }
 
-  curl_share_cleanup(clib_package_curl_share);
+  if (0 != fetches) {
+    http_get_multi_free(fetches);
+    fetches = 0;
+  }
+
+  http_get_cleanup();
+  clib_package_curl_share = 0;
 }
@@ -18,6 +18,8 @@ typedef struct {
   char *version;
 } clib_package_dependency_t;
 
+struct json_arena_t;
+
 typedef struct {
   char *author;
   char *description;
@@ -39,6 +41,7 @@ typedef struct {
   list_t *src;
   void *data; // user data
   unsigned int refs;
+  struct json_arena_t *arena; // the parsed manifest, strings borrow from it
 } clib_package_t;
 
 typedef struct {
@@ -52,8 +55,12 @@ typedef struct {
 
 extern CURLSH *clib_package_curl_share;
 
+struct clib_lockfile;
+
 void clib_package_set_opts(clib_package_opts_t opts);
 
+void clib_package_set_lockfile(struct clib_lockfile *lockfile);
+
 clib_package_t *clib_package_new(const char *, int);
 
 clib_package_t *clib_package_new_from_slug(const char *, int);
@@ -66,6 +73,8 @@ char *clib_package_url(const char *, const char *, const char *);
 
 char *clib_package_url_from_repo(const char *repo, const char *version);
 
+const char *clib_package_ref(clib_package_t *pkg);
+
 char *clib_package_parse_version(const char *);
 
 char *clib_package_parse_author(const char *);
@@ -80,12 +89,19 @@ int clib_package_install_executable(clib_package_t *pkg, const char *dir,
 
 int clib_package_install(clib_package_t *, const char *, int);
 
+int clib_package_install_pinned(const char *slug, clib_package_t *pkg,
+                                const char *dir, int verbose);
+
 int clib_package_install_dependencies(clib_package_t *, const char *, int);
 
 int clib_package_install_development(clib_package_t *, const char *, int);
 
+int clib_package_pin(const char *, clib_package_t *, const char *);
+
 void clib_package_free(clib_package_t *);
 
+void clib_package_free_string(clib_package_t *, char *);
+
 void clib_package_dependency_free(void *);
 
 void clib_package_cleanup();
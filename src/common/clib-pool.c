@@ -0,0 +1,341 @@
+//
+// clib-pool.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#include "clib-pool.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
+#if defined(__unix__) || (defined(__APPLE__) && defined(__MACH__))
+#include <unistd.h>
+#endif
+
+#define CLIB_POOL_MAX_WORKERS 256
+
+enum { TASK_NEW, TASK_SUBMITTED, TASK_DONE };
+
+struct clib_pool_task {
+  clib_pool_t *pool;
+  clib_pool_fn fn;
+  void *data;
+  int state;
+  int rc;
+  int pending;     // unfinished dependencies, plus one until submitted
+  int failed_deps; // dependencies that failed or were skipped
+  clib_pool_task_t **dependents;
+  unsigned int dependents_len;
+  unsigned int dependents_size;
+  clib_pool_task_t *next_ready;
+  clib_pool_task_t *next; // every task of the pool, for freeing
+};
+
+struct clib_pool {
+  clib_pool_task_t *tasks;
+  clib_pool_task_t *ready_head;
+  clib_pool_task_t *ready_tail;
+  int outstanding; // submitted, not done yet
+  int failed;
+#ifdef HAVE_PTHREADS
+  pthread_mutex_t mutex;
+  pthread_cond_t ready;
+  pthread_cond_t done;
+  pthread_t *threads;
+  unsigned int workers;
+  int stopping;
+#endif
+};
+
+#ifdef HAVE_PTHREADS
+#define LOCK(pool) pthread_mutex_lock(&(pool)->mutex)
+#define UNLOCK(pool) pthread_mutex_unlock(&(pool)->mutex)
+#else
+#define LOCK(pool)
+#define UNLOCK(pool)
+#endif
+
+static void push_ready(clib_pool_t *pool, clib_pool_task_t *task) {
+  task->next_ready = NULL;
+
+  if (pool->ready_tail) {
+    pool->ready_tail->next_ready = task;
+  } else {
+    pool->ready_head = task;
+  }
+  pool->ready_tail = task;
+
+#ifdef HAVE_PTHREADS
+  pthread_cond_signal(&pool->ready);
+#endif
+}
+
+static clib_pool_task_t *pop_ready(clib_pool_t *pool) {
+  clib_pool_task_t *task = pool->ready_head;
+
+  if (task) {
+    pool->ready_head = task->next_ready;
+    if (!pool->ready_head) {
+      pool->ready_tail = NULL;
+    }
+  }
+
+  return task;
+}
+
+/**
+ * Run `task`, which was popped from the ready queue, and release its
+ * dependents. Called, and returns, without the lock held.
+ */
+
+static void run_task(clib_pool_t *pool, clib_pool_task_t *task) {
+  int rc = task->failed_deps ? -1 : task->fn(task->data);
+
+  LOCK(pool);
+
+  task->rc = rc;
+  task->state = TASK_DONE;
+
+  if (0 != rc) {
+    pool->failed++;
+  }
+
+  for (unsigned int i = 0; i < task->dependents_len; i++) {
+    clib_pool_task_t *dependent = task->dependents[i];
+
+    if (0 != rc) {
+      dependent->failed_deps++;
+    }
+    if (0 == --dependent->pending) {
+      push_ready(pool, dependent);
+    }
+  }
+
+  pool->outstanding--;
+
+#ifdef HAVE_PTHREADS
+  if (0 == pool->outstanding) {
+    pthread_cond_broadcast(&pool->done);
+  }
+#endif
+
+  UNLOCK(pool);
+}
+
+#ifdef HAVE_PTHREADS
+static void *worker(void *arg) {
+  clib_pool_t *pool = arg;
+
+  while (1) {
+    clib_pool_task_t *task = NULL;
+
+    LOCK(pool);
+    while (!pool->stopping && !(task = pop_ready(pool))) {
+      pthread_cond_wait(&pool->ready, &pool->mutex);
+    }
+    UNLOCK(pool);
+
+    if (!task) {
+      break;
+    }
+
+    run_task(pool, task);
+  }
+
+  return NULL;
+}
+#endif
+
+clib_pool_t *clib_pool_new(unsigned int workers) {
+  clib_pool_t *pool = malloc(sizeof(clib_pool_t));
+
+  if (!pool) {
+    return NULL;
+  }
+
+  memset(pool, 0, sizeof(clib_pool_t));
+
+#ifdef HAVE_PTHREADS
+#ifdef _SC_NPROCESSORS_ONLN
+  if (0 == workers) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    workers = cpus > 0 ? cpus : 1;
+  }
+#endif
+
+  if (0 == workers) {
+    workers = 1;
+  } else if (workers > CLIB_POOL_MAX_WORKERS) {
+    workers = CLIB_POOL_MAX_WORKERS;
+  }
+
+  pthread_mutex_init(&pool->mutex, NULL);
+  pthread_cond_init(&pool->ready, NULL);
+  pthread_cond_init(&pool->done, NULL);
+
+  if (!(pool->threads = malloc(workers * sizeof(pthread_t)))) {
+    clib_pool_free(pool);
+    return NULL;
+  }
+
+  for (; pool->workers < workers; pool->workers++) {
+    if (0 != pthread_create(&pool->threads[pool->workers], NULL, worker,
+                            pool)) {
+      break;
+    }
+  }
+
+  if (0 == pool->workers) {
+    clib_pool_free(pool);
+    return NULL;
+  }
+#endif
+
+  return pool;
+}
+
+clib_pool_task_t *clib_pool_task_new(clib_pool_t *pool, clib_pool_fn fn,
+                                     void *data) {
+  clib_pool_task_t *task = malloc(sizeof(clib_pool_task_t));
+
+  if (!task) {
+    return NULL;
+  }
+
+  memset(task, 0, sizeof(clib_pool_task_t));
+  task->pool = pool;
+  task->fn = fn;
+  task->data = data;
+  task->pending = 1;
+
+  LOCK(pool);
+  task->next = pool->tasks;
+  pool->tasks = task;
+  UNLOCK(pool);
+
+  return task;
+}
+
+int clib_pool_task_depends(clib_pool_task_t *task,
+                           clib_pool_task_t *dependency) {
+  clib_pool_t *pool = task->pool;
+  int rc = 0;
+
+  LOCK(pool);
+
+  if (TASK_NEW != task->state) {
+    rc = -1;
+  } else if (TASK_DONE == dependency->state) {
+    if (0 != dependency->rc) {
+      task->failed_deps++;
+    }
+  } else if (dependency->dependents_len == dependency->dependents_size) {
+    unsigned int size = dependency->dependents_size
+                            ? dependency->dependents_size * 2
+                            : 4;
+    clib_pool_task_t **dependents =
+        realloc(dependency->dependents, size * sizeof(clib_pool_task_t *));
+
+    if (dependents) {
+      dependency->dependents = dependents;
+      dependency->dependents_size = size;
+    } else {
+      rc = -1;
+    }
+  }
+
+  if (0 == rc && TASK_DONE != dependency->state) {
+    dependency->dependents[dependency->dependents_len++] = task;
+    task->pending++;
+  }
+
+  UNLOCK(pool);
+
+  return rc;
+}
+
+int clib_pool_task_submitted(clib_pool_task_t *task) {
+  int submitted = 0;
+
+  LOCK(task->pool);
+  submitted = TASK_NEW != task->state;
+  UNLOCK(task->pool);
+
+  return submitted;
+}
+
+void clib_pool_submit(clib_pool_task_t *task) {
+  clib_pool_t *pool = task->pool;
+
+  LOCK(pool);
+
+  if (TASK_NEW == task->state) {
+    task->state = TASK_SUBMITTED;
+    pool->outstanding++;
+
+    if (0 == --task->pending) {
+      push_ready(pool, task);
+    }
+  }
+
+  UNLOCK(pool);
+}
+
+int clib_pool_wait(clib_pool_t *pool) {
+  int failed = 0;
+
+#ifdef HAVE_PTHREADS
+  LOCK(pool);
+  while (pool->outstanding > 0) {
+    pthread_cond_wait(&pool->done, &pool->mutex);
+  }
+  failed = pool->failed;
+  UNLOCK(pool);
+#else
+  clib_pool_task_t *task = NULL;
+
+  while ((task = pop_ready(pool))) {
+    run_task(pool, task);
+  }
+  failed = pool->failed;
+#endif
+
+  return failed;
+}
+
+void clib_pool_free(clib_pool_t *pool) {
+  clib_pool_task_t *task = NULL;
+
+  if (!pool) {
+    return;
+  }
+
+#ifdef HAVE_PTHREADS
+  LOCK(pool);
+  pool->stopping = 1;
+  pthread_cond_broadcast(&pool->ready);
+  UNLOCK(pool);
+
+  for (unsigned int i = 0; i < pool->workers; i++) {
+    pthread_join(pool->threads[i], NULL);
+  }
+
+  free(pool->threads);
+  pthread_cond_destroy(&pool->done);
+  pthread_cond_destroy(&pool->ready);
+  pthread_mutex_destroy(&pool->mutex);
+#endif
+
+  while ((task = pool->tasks)) {
+    pool->tasks = task->next;
+    free(task->dependents);
+    free(task);
+  }
+
+  free(pool);
+}
@@ -0,0 +1,71 @@
+//
+// clib-pool.h
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#ifndef CLIB_POOL_H
+#define CLIB_POOL_H
+
+/**
+ * A bounded pool of worker threads running a graph of tasks. A task only
+ * starts once every task it depends on has finished, and is skipped (and
+ * counted as failed) if one of them failed. Without pthreads, tasks run on
+ * the calling thread in `clib_pool_wait()`.
+ */
+
+typedef struct clib_pool clib_pool_t;
+typedef struct clib_pool_task clib_pool_task_t;
+
+/**
+ * @return 0 on success
+ */
+typedef int (*clib_pool_fn)(void *data);
+
+/**
+ * @param workers The number of threads, 0 for one per online CPU
+ *
+ * @return A new pool, or NULL on error
+ */
+clib_pool_t *clib_pool_new(unsigned int workers);
+
+/**
+ * @return A new task calling `fn(data)`, owned by `pool`, or NULL on error
+ */
+clib_pool_task_t *clib_pool_task_new(clib_pool_t *pool, clib_pool_fn fn,
+                                     void *data);
+
+/**
+ * Make `task` wait for `dependency`. Must be called before `task` is
+ * submitted.
+ *
+ * @return 0 on success, -1 otherwise
+ */
+int clib_pool_task_depends(clib_pool_task_t *task,
+                           clib_pool_task_t *dependency);
+
+/**
+ * @return 1 once `task` has been submitted
+ */
+int clib_pool_task_submitted(clib_pool_task_t *task);
+
+/**
+ * Hand `task` over to the pool. It runs as soon as its dependencies are
+ * done and a worker is free.
+ */
+void clib_pool_submit(clib_pool_task_t *task);
+
+/**
+ * Block until every submitted task is done.
+ *
+ * @return The number of tasks that failed or were skipped
+ */
+int clib_pool_wait(clib_pool_t *pool);
+
+/**
+ * Stop the workers and free every task. Pending tasks never run.
+ */
+void clib_pool_free(clib_pool_t *pool);
+
+#endif
@@ -0,0 +1,1069 @@
+//
+// clib-search-index.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#include "clib-search-index.h"
+#include "hash/hash.h"
+#include "strdup/strdup.h"
+#include "wiki-registry/wiki-registry.h"
+#include <fcntl.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+#define INDEX_MAGIC "CLSI"
+#define INDEX_VERSION 3
+
+#define TOKEN_MAX 64
+#define GRAM_MAX TOKEN_MAX
+#define FUZZY_SIMILARITY 0.3
+#define FUZZY_TOKENS 8
+#define REPO_WEIGHT 2
+#define BM25_K1 1.2
+#define BM25_B 0.75
+
+/**
+ * On disk, the index is a header, followed by one entry per package, the
+ * sorted tokens, their postings, the sorted trigrams of every token with
+ * the tokens containing them, and the pool of NUL terminated strings the
+ * entries and tokens point into. Offsets are from the start of the index.
+ */
+
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  uint32_t count;
+  uint32_t tokens;
+  uint32_t postings;
+  uint32_t length; // of every package, in tokens
+  uint32_t grams;
+  uint32_t gram_tokens;
+  uint32_t size;
+} index_header_t;
+
+typedef struct {
+  uint32_t repo;
+  uint32_t href;
+  uint32_t description;
+  uint32_t category;
+  uint32_t length; // weighted number of tokens
+} index_entry_t;
+
+typedef struct {
+  uint32_t text;
+  uint32_t postings; // first posting
+  uint32_t count;    // packages containing the token
+  float idf;
+} index_token_t;
+
+typedef struct {
+  uint32_t entry;
+  uint32_t frequency; // weighted
+} index_posting_t;
+
+typedef struct {
+  uint32_t gram; // three bytes
+  uint32_t tokens; // first token id in the gram tokens
+  uint32_t count;
+} index_gram_t;
+
+struct clib_search_index {
+  char *data;
+  size_t size;
+  int mapped;
+  index_header_t *header;
+  index_entry_t *entries;
+  index_token_t *tokens;
+  index_posting_t *postings;
+  index_gram_t *grams;
+  uint32_t *gram_tokens;
+};
+
+typedef struct {
+  char *data;
+  size_t len;
+  size_t size;
+} buffer_t;
+
+typedef struct {
+  uint32_t *entries;
+  uint32_t *frequencies;
+  uint32_t len;
+  uint32_t size;
+} posting_list_t;
+
+static int buffer_reserve(buffer_t *buffer, size_t len) {
+  if (buffer->len + len <= buffer->size) {
+    return 0;
+  }
+
+  size_t size = buffer->size ? buffer->size : 4096;
+  while (size < buffer->len + len) {
+    size *= 2;
+  }
+
+  char *data = realloc(buffer->data, size);
+  if (!data) {
+    return -1;
+  }
+
+  buffer->data = data;
+  buffer->size = size;
+  return 0;
+}
+
+/**
+ * @return The offset of `str` in the pool
+ */
+
+static uint32_t add_string(buffer_t *buffer, const char *str, int *err) {
+  uint32_t offset = buffer->len;
+  size_t len = str ? strlen(str) : 0;
+
+  if (0 != buffer_reserve(buffer, len + 1)) {
+    *err = -1;
+    return 0;
+  }
+
+  memcpy(buffer->data + buffer->len, str ? str : "", len);
+  buffer->data[buffer->len + len] = '\0';
+  buffer->len += len + 1;
+  return offset;
+}
+
+static int is_token_char(unsigned char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+         (c >= '0' && c <= '9') || c >= 0x80;
+}
+
+/**
+ * Copy the next word of `*str` to `token`, lowercased, and move `*str`
+ * past it. Words longer than a token are cut.
+ *
+ * @return The length of the token, 0 once there are no words left
+ */
+
+static size_t next_token(const char **str, char token[TOKEN_MAX]) {
+  const unsigned char *p = (const unsigned char *)*str;
+  size_t len = 0;
+
+  while (*p && !is_token_char(*p)) {
+    p++;
+  }
+
+  for (; *p && is_token_char(*p); p++) {
+    if (len < TOKEN_MAX - 1) {
+      token[len++] = (*p >= 'A' && *p <= 'Z') ? *p + ('a' - 'A') : *p;
+    }
+  }
+
+  token[len] = '\0';
+  *str = (const char *)p;
+  return len;
+}
+
+static int add_posting(hash_t *tokens, char *token, uint32_t entry,
+                       uint32_t weight, uint32_t *postings) {
+  posting_list_t *list = hash_get(tokens, token);
+
+  if (!list) {
+    char *key = strdup(token);
+
+    if (!key || !(list = calloc(1, sizeof(posting_list_t)))) {
+      free(key);
+      return -1;
+    }
+    hash_set(tokens, key, list);
+  }
+
+  // postings are added package after package
+  if (list->len > 0 && entry == list->entries[list->len - 1]) {
+    list->frequencies[list->len - 1] += weight;
+    return 0;
+  }
+
+  if (list->len == list->size) {
+    uint32_t size = list->size ? list->size * 2 : 4;
+    uint32_t *entries = realloc(list->entries, size * sizeof(uint32_t));
+
+    if (entries) {
+      list->entries = entries;
+    }
+
+    uint32_t *frequencies =
+        realloc(list->frequencies, size * sizeof(uint32_t));
+
+    if (frequencies) {
+      list->frequencies = frequencies;
+    }
+
+    if (!entries || !frequencies) {
+      return -1;
+    }
+    list->size = size;
+  }
+
+  list->entries[list->len] = entry;
+  list->frequencies[list->len] = weight;
+  list->len++;
+  (*postings)++;
+  return 0;
+}
+
+/**
+ * @return The weighted number of words in `text`
+ */
+
+static uint32_t add_words(hash_t *tokens, const char *text, uint32_t entry,
+                          uint32_t weight, uint32_t *postings, int *err) {
+  char token[TOKEN_MAX];
+  uint32_t length = 0;
+
+  if (!text) {
+    return 0;
+  }
+
+  while (next_token(&text, token)) {
+    if (0 != add_posting(tokens, token, entry, weight, postings)) {
+      *err = -1;
+    }
+    length += weight;
+  }
+
+  return length;
+}
+
+/**
+ * Fill `grams` with the distinct trigrams of `token`, sorted. The token is
+ * padded on both sides, so its first and last letters count as much as
+ * the others, and a single letter still has a trigram.
+ *
+ * @return The number of trigrams
+ */
+
+static uint32_t token_grams(const char *token, uint32_t grams[GRAM_MAX]) {
+  size_t len = strlen(token);
+  uint32_t count = 0;
+
+  if (len > GRAM_MAX) {
+    len = GRAM_MAX;
+  }
+
+  for (size_t i = 0; i < len; i++) {
+    unsigned char a = i > 0 ? token[i - 1] : '$';
+    unsigned char b = token[i];
+    unsigned char c = i + 1 < len ? token[i + 1] : '$';
+    uint32_t gram = (uint32_t)a << 16 | (uint32_t)b << 8 | c;
+    uint32_t j = count;
+
+    // insertion sort, dropping duplicates
+    while (j > 0 && grams[j - 1] > gram) {
+      j--;
+    }
+    if (j > 0 && grams[j - 1] == gram) {
+      continue;
+    }
+    memmove(&grams[j + 1], &grams[j], (count - j) * sizeof(uint32_t));
+    grams[j] = gram;
+    count++;
+  }
+
+  return count;
+}
+
+static int compare_pairs(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+static int compare_tokens(const void *a, const void *b) {
+  return strcmp(*(const char **)a, *(const char **)b);
+}
+
+static clib_search_index_t *index_new(char *data, size_t size, int mapped) {
+  clib_search_index_t *index = malloc(sizeof(clib_search_index_t));
+
+  if (!index) {
+    return NULL;
+  }
+
+  index->data = data;
+  index->size = size;
+  index->mapped = mapped;
+  index->header = (index_header_t *)data;
+  index->entries = (index_entry_t *)(data + sizeof(index_header_t));
+  index->tokens = (index_token_t *)(index->entries + index->header->count);
+  index->postings = (index_posting_t *)(index->tokens + index->header->tokens);
+  index->grams = (index_gram_t *)(index->postings + index->header->postings);
+  index->gram_tokens = (uint32_t *)(index->grams + index->header->grams);
+  return index;
+}
+
+clib_search_index_t *clib_search_index_build(list_t *packages) {
+  buffer_t pool = {0};
+  hash_t *tokens = hash_new();
+  index_entry_t *entries = NULL;
+  const char **keys = NULL;
+  uint64_t *pairs = NULL;
+  list_node_t *node = NULL;
+  list_iterator_t *it = NULL;
+  clib_search_index_t *index = NULL;
+  index_header_t header;
+  uint32_t count = 0;
+  uint32_t postings = 0;
+  uint32_t length = 0;
+  char *data = NULL;
+  int err = 0;
+
+  if (!tokens) {
+    return NULL;
+  }
+  if (!(entries = malloc((packages->len + 1) * sizeof(index_entry_t)))) {
+    goto cleanup;
+  }
+  if (!(it = list_iterator_new(packages, LIST_HEAD))) {
+    goto cleanup;
+  }
+
+  while ((node = list_iterator_next(it))) {
+    wiki_package_t *pkg = node->val;
+    index_entry_t *entry = &entries[count];
+
+    entry->repo = add_string(&pool, pkg->repo, &err);
+    entry->href = add_string(&pool, pkg->href, &err);
+    entry->description = add_string(&pool, pkg->description, &err);
+    entry->category = add_string(&pool, pkg->category, &err);
+    entry->length =
+        add_words(tokens, pkg->repo, count, REPO_WEIGHT, &postings, &err) +
+        add_words(tokens, pkg->description, count, 1, &postings, &err);
+
+    length += entry->length;
+    count++;
+  }
+
+  if (0 != err) {
+    goto cleanup;
+  }
+
+  // tokens are kept sorted, so a prefix matches a range of them
+  uint32_t ntokens = hash_size(tokens);
+  uint32_t i = 0;
+
+  if (!(keys = malloc((ntokens + 1) * sizeof(char *)))) {
+    goto cleanup;
+  }
+  hash_each_key(tokens, keys[i++] = key);
+  qsort(keys, ntokens, sizeof(char *), compare_tokens);
+
+  // (trigram, token) pairs, sorted by trigram
+  size_t npairs = 0;
+  size_t pairs_size = 0;
+  uint32_t ngrams = 0;
+
+  for (i = 0; i < ntokens; i++) {
+    uint32_t grams[GRAM_MAX];
+    uint32_t n = token_grams(keys[i], grams);
+
+    if (npairs + n > pairs_size) {
+      size_t size = pairs_size ? pairs_size * 2 : 4096;
+      uint64_t *more = NULL;
+
+      while (size < npairs + n) {
+        size *= 2;
+      }
+      if (!(more = realloc(pairs, size * sizeof(uint64_t)))) {
+        goto cleanup;
+      }
+      pairs = more;
+      pairs_size = size;
+    }
+
+    for (uint32_t j = 0; j < n; j++) {
+      pairs[npairs++] = (uint64_t)grams[j] << 32 | i;
+    }
+  }
+
+  if (npairs > 0) {
+    qsort(pairs, npairs, sizeof(uint64_t), compare_pairs);
+  }
+
+  for (size_t j = 0; j < npairs; j++) {
+    if (0 == j || pairs[j] >> 32 != pairs[j - 1] >> 32) {
+      ngrams++;
+    }
+  }
+
+  size_t base = sizeof(index_header_t) + count * sizeof(index_entry_t) +
+                ntokens * sizeof(index_token_t) +
+                postings * sizeof(index_posting_t) +
+                ngrams * sizeof(index_gram_t) + npairs * sizeof(uint32_t);
+  size_t pool_start = pool.len;
+
+  for (i = 0; i < ntokens; i++) {
+    add_string(&pool, keys[i], &err);
+  }
+
+  if (0 != err || base + pool.len > UINT32_MAX) {
+    goto cleanup;
+  }
+  if (!(data = malloc(base + pool.len))) {
+    goto cleanup;
+  }
+
+  memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+  header.version = INDEX_VERSION;
+  header.count = count;
+  header.tokens = ntokens;
+  header.postings = postings;
+  header.length = length;
+  header.grams = ngrams;
+  header.gram_tokens = npairs;
+  header.size = base + pool.len;
+  memcpy(data, &header, sizeof(index_header_t));
+  memcpy(data + base, pool.data, pool.len);
+
+  if (!(index = index_new(data, base + pool.len, 0))) {
+    goto cleanup;
+  }
+
+  for (i = 0; i < count; i++) {
+    index_entry_t *entry = &index->entries[i];
+
+    *entry = entries[i];
+    entry->repo += base;
+    entry->href += base;
+    entry->description += base;
+    entry->category += base;
+  }
+
+  uint32_t offset = base + pool_start;
+  uint32_t posting = 0;
+
+  for (i = 0; i < ntokens; i++) {
+    posting_list_t *list = hash_get(tokens, (char *)keys[i]);
+    index_token_t *token = &index->tokens[i];
+
+    token->text = offset;
+    token->postings = posting;
+    token->count = list->len;
+    token->idf = log(1.0 + (count - list->len + 0.5) / (list->len + 0.5));
+    offset += strlen(keys[i]) + 1;
+
+    for (uint32_t j = 0; j < list->len; j++, posting++) {
+      index->postings[posting].entry = list->entries[j];
+      index->postings[posting].frequency = list->frequencies[j];
+    }
+  }
+
+  index_gram_t *gram = index->grams - 1;
+
+  for (size_t j = 0; j < npairs; j++) {
+    if (0 == j || pairs[j] >> 32 != pairs[j - 1] >> 32) {
+      gram++;
+      gram->gram = pairs[j] >> 32;
+      gram->tokens = j;
+      gram->count = 0;
+    }
+    gram->count++;
+    index->gram_tokens[j] = (uint32_t)pairs[j];
+  }
+
+  data = NULL;
+
+cleanup:
+  if (it) {
+    list_iterator_destroy(it);
+  }
+  hash_each(tokens, {
+    posting_list_t *list = val;
+
+    free(list->entries);
+    free(list->frequencies);
+    free(list);
+    free((char *)key);
+  });
+  hash_free(tokens);
+  free(keys);
+  free(pairs);
+  free(entries);
+  free(pool.data);
+  free(data);
+  return index;
+}
+
+int clib_search_index_save(clib_search_index_t *index, const char *path) {
+  char tmp[strlen(path) + 32];
+  FILE *file = NULL;
+  int rc = -1;
+
+  sprintf(tmp, "%s.%ld", path, (long)getpid());
+
+  if (!(file = fopen(tmp, "wb"))) {
+    return -1;
+  }
+
+  if (index->size == fwrite(index->data, 1, index->size, file)) {
+    rc = 0;
+  }
+
+  if (0 != fclose(file)) {
+    rc = -1;
+  }
+
+  if (0 == rc && 0 != rename(tmp, path)) {
+    rc = -1;
+  }
+
+  if (0 != rc) {
+    unlink(tmp);
+  }
+
+  return rc;
+}
+
+/**
+ * Make sure every offset stays within its section, and every string is
+ * terminated, before trusting a file read from disk.
+ */
+
+static int index_valid(char *data, size_t size) {
+  index_header_t *header = (index_header_t *)data;
+  uint64_t pool = sizeof(index_header_t);
+
+  if (size < sizeof(index_header_t)) {
+    return 0;
+  }
+  if (0 != memcmp(header->magic, INDEX_MAGIC, sizeof(header->magic)) ||
+      INDEX_VERSION != header->version || size != header->size) {
+    return 0;
+  }
+
+  pool += (uint64_t)header->count * sizeof(index_entry_t) +
+          (uint64_t)header->tokens * sizeof(index_token_t) +
+          (uint64_t)header->postings * sizeof(index_posting_t) +
+          (uint64_t)header->grams * sizeof(index_gram_t) +
+          (uint64_t)header->gram_tokens * sizeof(uint32_t);
+  if (pool > size || (pool < size && '\0' != data[size - 1])) {
+    return 0;
+  }
+
+#define IN_POOL(offset) ((offset) >= pool && (offset) < size)
+
+  index_entry_t *entries = (index_entry_t *)(data + sizeof(index_header_t));
+  index_token_t *tokens = (index_token_t *)(entries + header->count);
+  index_posting_t *postings = (index_posting_t *)(tokens + header->tokens);
+  index_gram_t *grams = (index_gram_t *)(postings + header->postings);
+  uint32_t *gram_tokens = (uint32_t *)(grams + header->grams);
+
+  for (uint32_t i = 0; i < header->count; i++) {
+    if (!IN_POOL(entries[i].repo) || !IN_POOL(entries[i].href) ||
+        !IN_POOL(entries[i].description) || !IN_POOL(entries[i].category)) {
+      return 0;
+    }
+  }
+
+  for (uint32_t i = 0; i < header->tokens; i++) {
+    if (!IN_POOL(tokens[i].text) ||
+        (uint64_t)tokens[i].postings + tokens[i].count > header->postings) {
+      return 0;
+    }
+  }
+
+  for (uint32_t i = 0; i < header->postings; i++) {
+    if (postings[i].entry >= header->count) {
+      return 0;
+    }
+  }
+
+  for (uint32_t i = 0; i < header->grams; i++) {
+    if ((uint64_t)grams[i].tokens + grams[i].count > header->gram_tokens) {
+      return 0;
+    }
+  }
+
+  for (uint32_t i = 0; i < header->gram_tokens; i++) {
+    if (gram_tokens[i] >= header->tokens) {
+      return 0;
+    }
+  }
+
+#undef IN_POOL
+
+  return 1;
+}
+
+clib_search_index_t *clib_search_index_open(const char *path) {
+  clib_search_index_t *index = NULL;
+  struct stat stats;
+  char *data = NULL;
+  int mapped = 0;
+  int fd = open(path, O_RDONLY | O_BINARY);
+
+  if (fd < 0) {
+    return NULL;
+  }
+  if (0 != fstat(fd, &stats) || (size_t)stats.st_size < sizeof(index_header_t)) {
+    goto cleanup;
+  }
+
+#ifdef _WIN32
+  if (!(data = malloc(stats.st_size))) {
+    goto cleanup;
+  }
+  if (stats.st_size != read(fd, data, stats.st_size)) {
+    free(data);
+    data = NULL;
+    goto cleanup;
+  }
+#else
+  data = mmap(NULL, stats.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (MAP_FAILED == data) {
+    data = NULL;
+    goto cleanup;
+  }
+  mapped = 1;
+#endif
+
+  if (index_valid(data, stats.st_size)) {
+    index = index_new(data, stats.st_size, mapped);
+  }
+
+  if (!index) {
+#ifdef _WIN32
+    free(data);
+#else
+    munmap(data, stats.st_size);
+#endif
+  }
+
+cleanup:
+  close(fd);
+  return index;
+}
+
+size_t clib_search_index_count(clib_search_index_t *index) {
+  return index->header->count;
+}
+
+int clib_search_index_entry(clib_search_index_t *index, size_t i,
+                            clib_search_entry_t *entry) {
+  if (i >= index->header->count) {
+    return -1;
+  }
+
+  entry->repo = index->data + index->entries[i].repo;
+  entry->href = index->data + index->entries[i].href;
+  entry->description = index->data + index->entries[i].description;
+  entry->category = index->data + index->entries[i].category;
+  return 0;
+}
+
+/**
+ * @return The first token not sorted before `token`
+ */
+
+static uint32_t lower_bound(clib_search_index_t *index, const char *token) {
+  uint32_t low = 0;
+  uint32_t high = index->header->tokens;
+
+  while (low < high) {
+    uint32_t middle = low + (high - low) / 2;
+
+    if (strcmp(index->data + index->tokens[middle].text, token) < 0) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+
+  return low;
+}
+
+typedef struct {
+  clib_search_index_t *index;
+  double average;     // package length
+  double *best;       // score of each package for the current word
+  uint32_t *touched;  // packages with a score for the current word
+  uint32_t ntouched;
+  uint32_t *shared;   // trigrams shared with the current word, per token
+  uint32_t *similar;  // tokens sharing trigrams with the current word
+} query_t;
+
+/**
+ * Score every package containing the token `id`. A package is scored once
+ * per word, by its best token.
+ */
+
+static void score_token(query_t *query, uint32_t id, double weight) {
+  clib_search_index_t *index = query->index;
+  index_token_t *token = &index->tokens[id];
+
+  for (uint32_t i = token->postings; i < token->postings + token->count;
+       i++) {
+    index_posting_t *posting = &index->postings[i];
+    double frequency = posting->frequency;
+    double length = index->entries[posting->entry].length;
+    double score =
+        token->idf * weight * frequency * (BM25_K1 + 1) /
+        (frequency +
+         BM25_K1 * (1 - BM25_B + BM25_B * length / query->average));
+
+    if (0 == query->best[posting->entry]) {
+      query->touched[query->ntouched++] = posting->entry;
+    }
+    if (score > query->best[posting->entry]) {
+      query->best[posting->entry] = score;
+    }
+  }
+}
+
+/**
+ * Match every token containing `word`, as `strstr()` on the package used
+ * to. The tokens `word` is a prefix of are a range of the sorted tokens,
+ * the others take a scan of every token. A partial match weighs less than
+ * the whole token, and a match inside a token half as much as a prefix.
+ */
+
+static void match_word(query_t *query, const char *word, size_t len) {
+  clib_search_index_t *index = query->index;
+
+  for (uint32_t i = lower_bound(index, word); i < index->header->tokens;
+       i++) {
+    const char *text = index->data + index->tokens[i].text;
+
+    if (0 != strncmp(text, word, len)) {
+      break;
+    }
+
+    score_token(query, i, (double)len / strlen(text));
+  }
+
+  for (uint32_t i = 0; i < index->header->tokens; i++) {
+    const char *text = index->data + index->tokens[i].text;
+
+    if ('\0' != text[0] && strstr(text + 1, word)) {
+      score_token(query, i, 0.5 * len / strlen(text));
+    }
+  }
+}
+
+/**
+ * @return The gram table entry for `gram`, or NULL
+ */
+
+static index_gram_t *find_gram(clib_search_index_t *index, uint32_t gram) {
+  uint32_t low = 0;
+  uint32_t high = index->header->grams;
+
+  while (low < high) {
+    uint32_t middle = low + (high - low) / 2;
+
+    if (index->grams[middle].gram < gram) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+
+  if (low < index->header->grams && gram == index->grams[low].gram) {
+    return &index->grams[low];
+  }
+
+  return NULL;
+}
+
+/**
+ * Match the tokens sharing enough trigrams with `word`, weighted by their
+ * similarity. Only tokens sharing a trigram are looked at, and only the
+ * FUZZY_TOKENS most similar ones are scored, so a misspelled word costs
+ * about as much as a correct one.
+ */
+
+static void fuzzy_word(query_t *query, const char *word) {
+  clib_search_index_t *index = query->index;
+  uint32_t grams[GRAM_MAX];
+  uint32_t count = token_grams(word, grams);
+  uint32_t nsimilar = 0;
+  uint32_t best[FUZZY_TOKENS];
+  double similarities[FUZZY_TOKENS];
+  uint32_t nbest = 0;
+
+  for (uint32_t i = 0; i < count; i++) {
+    index_gram_t *gram = find_gram(index, grams[i]);
+
+    if (!gram) {
+      continue;
+    }
+
+    for (uint32_t j = gram->tokens; j < gram->tokens + gram->count; j++) {
+      uint32_t id = index->gram_tokens[j];
+
+      if (0 == query->shared[id]++) {
+        query->similar[nsimilar++] = id;
+      }
+    }
+  }
+
+  for (uint32_t i = 0; i < nsimilar; i++) {
+    uint32_t id = query->similar[i];
+    uint32_t shared = query->shared[id];
+    uint32_t token[GRAM_MAX];
+    uint32_t n = token_grams(index->data + index->tokens[id].text, token);
+    // Jaccard similarity of both sets of trigrams
+    double similarity = (double)shared / (count + n - shared);
+
+    query->shared[id] = 0;
+
+    if (similarity < FUZZY_SIMILARITY) {
+      continue;
+    }
+
+    // keep the most similar tokens, least similar last
+    uint32_t j = nbest < FUZZY_TOKENS ? nbest++ : FUZZY_TOKENS;
+
+    while (j > 0 && similarities[j - 1] < similarity) {
+      if (j < FUZZY_TOKENS) {
+        best[j] = best[j - 1];
+        similarities[j] = similarities[j - 1];
+      }
+      j--;
+    }
+    if (j < FUZZY_TOKENS) {
+      best[j] = id;
+      similarities[j] = similarity;
+    }
+  }
+
+  for (uint32_t i = 0; i < nbest; i++) {
+    score_token(query, best[i], similarities[i]);
+  }
+}
+
+static int compare_results(const void *a, const void *b) {
+  const clib_search_result_t *x = a;
+  const clib_search_result_t *y = b;
+
+  if (x->score != y->score) {
+    return x->score < y->score ? 1 : -1;
+  }
+
+  return x->entry < y->entry ? -1 : x->entry > y->entry;
+}
+
+/**
+ * Restore the heap of the `len` best results from `i` down, the worst of
+ * them at the root.
+ */
+
+static void sift_down(clib_search_result_t *heap, size_t len, size_t i) {
+  for (;;) {
+    size_t worst = i;
+    size_t left = 2 * i + 1;
+    size_t right = left + 1;
+
+    if (left < len && compare_results(&heap[left], &heap[worst]) > 0) {
+      worst = left;
+    }
+    if (right < len && compare_results(&heap[right], &heap[worst]) > 0) {
+      worst = right;
+    }
+    if (worst == i) {
+      return;
+    }
+
+    clib_search_result_t tmp = heap[i];
+    heap[i] = heap[worst];
+    heap[worst] = tmp;
+    i = worst;
+  }
+}
+
+/**
+ * Add `result` to the `*len` best results found so far, keeping at most
+ * `limit` of them (all of them if 0). Once full, the results are a heap.
+ */
+
+static void keep_result(clib_search_result_t *results, size_t *len,
+                        size_t limit, clib_search_result_t result) {
+  if (0 == limit || *len < limit) {
+    results[(*len)++] = result;
+
+    if (*len == limit) {
+      for (size_t i = limit / 2; i-- > 0;) {
+        sift_down(results, limit, i);
+      }
+    }
+  } else if (compare_results(&result, &results[0]) < 0) {
+    results[0] = result;
+    sift_down(results, limit, 0);
+  }
+}
+
+/**
+ * @return Whether `terms` hold at least one word
+ */
+
+static int has_words(int count, char *terms[]) {
+  char word[TOKEN_MAX];
+
+  for (int i = 0; i < count; i++) {
+    const char *term = terms[i];
+
+    if (next_token(&term, word)) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+int clib_search_index_query(clib_search_index_t *index, int count,
+                            char *terms[], clib_search_options_t *options,
+                            clib_search_result_t **results) {
+  clib_search_options_t defaults = {0};
+  uint32_t total = index->header->count;
+  query_t query = {0};
+  double *scores = NULL;
+  uint32_t *hits = NULL;
+  uint32_t words = 0;
+  int rc = -1;
+
+  if (!options) {
+    options = &defaults;
+  }
+
+  *results = NULL;
+
+  // list every package if there's no query, or only punctuation
+  if (!has_words(count, terms)) {
+    size_t len = options->limit && options->limit < total ? options->limit
+                                                          : total;
+
+    if (!(*results = malloc((len + 1) * sizeof(clib_search_result_t)))) {
+      return -1;
+    }
+
+    for (size_t i = 0; i < len; i++) {
+      (*results)[i].entry = i;
+      (*results)[i].score = 0;
+    }
+
+    return len;
+  }
+
+  query.index = index;
+  query.average = total ? (double)index->header->length / total : 1;
+  if (query.average <= 0) {
+    query.average = 1;
+  }
+
+  scores = calloc(total + 1, sizeof(double));
+  hits = calloc(total + 1, sizeof(uint32_t));
+  query.best = calloc(total + 1, sizeof(double));
+  query.touched = malloc((total + 1) * sizeof(uint32_t));
+
+  if (!scores || !hits || !query.best || !query.touched) {
+    goto cleanup;
+  }
+
+  if (options->fuzzy) {
+    query.shared = calloc(index->header->tokens + 1, sizeof(uint32_t));
+    query.similar = malloc((index->header->tokens + 1) * sizeof(uint32_t));
+
+    if (!query.shared || !query.similar) {
+      goto cleanup;
+    }
+  }
+
+  for (int i = 0; i < count; i++) {
+    const char *term = terms[i];
+    char word[TOKEN_MAX];
+    size_t len;
+
+    while ((len = next_token(&term, word))) {
+      query.ntouched = 0;
+
+      match_word(&query, word, len);
+
+      if (options->fuzzy) {
+        fuzzy_word(&query, word);
+      }
+
+      for (uint32_t j = 0; j < query.ntouched; j++) {
+        uint32_t entry = query.touched[j];
+
+        scores[entry] += query.best[entry];
+        hits[entry]++;
+        query.best[entry] = 0;
+      }
+
+      words++;
+    }
+  }
+
+  size_t limit = options->limit < total ? options->limit : 0;
+  size_t len = 0;
+
+  if (!(*results = malloc(((limit ? limit : total) + 1) *
+                          sizeof(clib_search_result_t)))) {
+    goto cleanup;
+  }
+
+  // only the best `limit` results are kept, and sorted
+  for (uint32_t i = 0; i < total && words > 0; i++) {
+    if (options->all ? hits[i] == words : hits[i] > 0) {
+      clib_search_result_t result = {i, scores[i]};
+
+      keep_result(*results, &len, limit, result);
+    }
+  }
+
+  qsort(*results, len, sizeof(clib_search_result_t), compare_results);
+  rc = len;
+
+cleanup:
+  free(scores);
+  free(hits);
+  free(query.best);
+  free(query.touched);
+  free(query.shared);
+  free(query.similar);
+  return rc;
+}
+
+void clib_search_index_free(clib_search_index_t *index) {
+  if (!index) {
+    return;
+  }
+
+#ifdef _WIN32
+  free(index->data);
+#else
+  if (index->mapped) {
+    munmap(index->data, index->size);
+  } else {
+    free(index->data);
+  }
+#endif
+
+  free(index);
+}
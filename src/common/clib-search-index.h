@@ -0,0 +1,100 @@
+//
+// clib-search-index.h
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#ifndef CLIB_SEARCH_INDEX_H
+#define CLIB_SEARCH_INDEX_H
+
+#include "list/list.h"
+#include <stddef.h>
+
+/**
+ * A compact, read-only view of the packages listed in the wiki. It is
+ * built once from the parsed registry and written to disk as is, so later
+ * searches only need to map the file: every string lives in a single
+ * pool, and the words of each package are kept in an inverted index, a
+ * sorted list of tokens each pointing to the packages containing it. The
+ * trigrams of every token are indexed too, for typo tolerant searches.
+ */
+
+typedef struct clib_search_index clib_search_index_t;
+
+typedef struct {
+  const char *repo;
+  const char *href;
+  const char *description;
+  const char *category;
+} clib_search_entry_t;
+
+typedef struct {
+  int all;      // packages must match every term, instead of any of them
+  int fuzzy;    // also match words sharing enough trigrams with a term
+  size_t limit; // stop after that many results, 0 for all of them
+} clib_search_options_t;
+
+typedef struct {
+  size_t entry;
+  double score;
+} clib_search_result_t;
+
+/**
+ * @param packages A list of `wiki_package_t`, as returned by
+ * `wiki_registry_parse()`
+ *
+ * @return A new in-memory index, or NULL on error
+ */
+clib_search_index_t *clib_search_index_build(list_t *packages);
+
+/**
+ * Write `index` to `path`, through a temporary file renamed over it.
+ *
+ * @return 0 on success, -1 on error
+ */
+int clib_search_index_save(clib_search_index_t *index, const char *path);
+
+/**
+ * Map the index saved at `path`.
+ *
+ * @return The index, or NULL if it is missing, corrupt, or was written by
+ * another version of clib
+ */
+clib_search_index_t *clib_search_index_open(const char *path);
+
+/**
+ * @return The number of packages in `index`
+ */
+size_t clib_search_index_count(clib_search_index_t *index);
+
+/**
+ * Fill `entry` with the package at position `i`. The strings belong to
+ * `index`.
+ *
+ * @return 0 on success, -1 if `i` is out of range
+ */
+int clib_search_index_entry(clib_search_index_t *index, size_t i,
+                            clib_search_entry_t *entry);
+
+/**
+ * Look `terms` up in the index. Terms are split into words the same way
+ * packages are, and a word matches every token containing it. With
+ * `options->fuzzy`, a word also matches the tokens most similar to it,
+ * going by the trigrams they have in common. Results
+ * are ranked with BM25, best first, words from the repo weighing more
+ * than words from the description. Without terms, or with terms holding
+ * no words at all, every package is returned in wiki order.
+ *
+ * @param options May be NULL
+ * @param results Set to the results, which must be freed
+ *
+ * @return The number of results, or -1 on error
+ */
+int clib_search_index_query(clib_search_index_t *index, int count,
+                            char *terms[], clib_search_options_t *options,
+                            clib_search_result_t **results);
+
+void clib_search_index_free(clib_search_index_t *index);
+
+#endif
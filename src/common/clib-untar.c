@@ -0,0 +1,796 @@
+//
+// clib-untar.c
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+// symlink(), lstat() and friends are POSIX, hidden by -std=c99 otherwise
+#define _POSIX_C_SOURCE 200809L
+
+#include "clib-untar.h"
+#include "http-get/http-get.h"
+#include "mkdirp/mkdirp.h"
+#include "strdup/strdup.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+#include <zlib.h>
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+#define BLOCK_SIZE 512
+#define INFLATE_CHUNK 65536
+#define MAX_META_SIZE (1 << 20)
+
+enum { UNTAR_HEADER, UNTAR_DATA, UNTAR_PADDING, UNTAR_END, UNTAR_ERROR };
+
+struct clib_untar {
+  char *dir;
+  z_stream zs;
+  int inflating; // zs is initialized
+  int inflated;  // the last gzip member is complete
+  int state;
+  int zero_blocks;
+  unsigned char block[BLOCK_SIZE];
+  size_t block_len;
+  // current entry
+  char type;
+  unsigned long long remaining;
+  size_t padding;
+  int fd;
+  char *path;
+  time_t mtime;
+  // body of a pax or GNU long name entry
+  char *meta;
+  size_t meta_len;
+  // names overriding the ones of the next header
+  char *long_name;
+  char *long_link;
+  // parent of the last file, known to exist
+  char *last_parent;
+  // directory of the last entry, known not to go through a symbolic link
+  char *last_checked;
+  clib_untar_filter_cb filter;
+  void *filter_data;
+  unsigned char out[INFLATE_CHUNK];
+};
+
+static size_t field_len(const unsigned char *field, size_t size) {
+  size_t len = 0;
+  while (len < size && field[len]) {
+    len++;
+  }
+  return len;
+}
+
+static char *strndup_(const char *str, size_t len) {
+  char *copy = malloc(len + 1);
+  if (copy) {
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+  }
+  return copy;
+}
+
+/**
+ * Octal numbers, or base-256 ones (GNU) when the high bit is set
+ */
+
+static unsigned long long parse_number(const unsigned char *field,
+                                       size_t size) {
+  unsigned long long n = 0;
+  size_t i = 0;
+
+  if (field[0] & 0x80) {
+    n = field[0] & 0x7f;
+    for (i = 1; i < size; i++) {
+      n = (n << 8) | field[i];
+    }
+    return n;
+  }
+
+  while (i < size && ' ' == field[i]) {
+    i++;
+  }
+  while (i < size && field[i] >= '0' && field[i] <= '7') {
+    n = n * 8 + (field[i++] - '0');
+  }
+
+  return n;
+}
+
+static int checksum_ok(const unsigned char *header) {
+  unsigned long long sum = 0;
+
+  for (int i = 0; i < BLOCK_SIZE; i++) {
+    // the checksum field counts as spaces
+    sum += (i >= 148 && i < 156) ? ' ' : header[i];
+  }
+
+  return sum == parse_number(header + 148, 8);
+}
+
+static char *header_name(const unsigned char *header) {
+  size_t name_len = field_len(header, 100);
+  size_t prefix_len = 0;
+
+  if (0 == memcmp(header + 257, "ustar", 5)) {
+    prefix_len = field_len(header + 345, 155);
+  }
+
+  if (0 == prefix_len) {
+    return strndup_((const char *)header, name_len);
+  }
+
+  char *name = malloc(prefix_len + 1 + name_len + 1);
+  if (name) {
+    memcpy(name, header + 345, prefix_len);
+    name[prefix_len] = '/';
+    memcpy(name + prefix_len + 1, header, name_len);
+    name[prefix_len + 1 + name_len] = '\0';
+  }
+
+  return name;
+}
+
+/**
+ * Relative, and without `..` components
+ */
+
+static int path_safe(const char *name) {
+  const char *p = name;
+
+  if ('\0' == *name || '/' == *name) {
+    return 0;
+  }
+
+  while (*p) {
+    const char *end = strchr(p, '/');
+    size_t len = end ? (size_t)(end - p) : strlen(p);
+
+    if (2 == len && 0 == strncmp(p, "..", 2)) {
+      return 0;
+    }
+
+    if (!end) {
+      break;
+    }
+
+    p = end + 1;
+  }
+
+  return 1;
+}
+
+/**
+ * Whether the symbolic link `name` to `target` may resolve out of the
+ * destination. Targets only climb before they descend: `s/..` is not the
+ * parent of `s` once `s` is itself a link, whichever entry comes first, so
+ * it is refused however harmless it reads.
+ */
+
+static int link_escapes(const char *name, const char *target) {
+  const char *p = NULL;
+  int depth = 0;
+  int descended = 0;
+
+  if ('/' == *target) {
+    return 1;
+  }
+
+  // directories holding the link
+  for (p = name; (p = strchr(p, '/')); p++) {
+    depth++;
+  }
+
+  for (p = target; *p;) {
+    const char *end = strchr(p, '/');
+    size_t len = end ? (size_t)(end - p) : strlen(p);
+
+    if (2 == len && 0 == strncmp(p, "..", 2)) {
+      if (descended || --depth < 0) {
+        return 1;
+      }
+    } else if (len > 0 && !(1 == len && '.' == *p)) {
+      descended = 1;
+    }
+
+    if (!end) {
+      break;
+    }
+
+    p = end + 1;
+  }
+
+  return 0;
+}
+
+static char *join(clib_untar_t *untar, const char *name) {
+  size_t dir_len = strlen(untar->dir);
+  size_t name_len = strlen(name);
+  char *path = malloc(dir_len + 1 + name_len + 1);
+
+  if (path) {
+    memcpy(path, untar->dir, dir_len);
+    path[dir_len] = '/';
+    memcpy(path + dir_len + 1, name, name_len + 1);
+  }
+
+  return path;
+}
+
+/**
+ * Whether a directory of `name` is a symbolic link, which could take the
+ * entry out of the destination however safe its name is
+ */
+
+static int crosses_link(clib_untar_t *untar, const char *name) {
+  const char *slash = strrchr(name, '/');
+  size_t len = slash ? (size_t)(slash - name) : 0;
+  char *parent = NULL;
+  char *path = NULL;
+  int rc = 0;
+
+  if (0 == len) {
+    return 0;
+  }
+
+  // archives list the files of a directory together
+  if (untar->last_checked && len == strlen(untar->last_checked) &&
+      0 == strncmp(name, untar->last_checked, len)) {
+    return 0;
+  }
+
+  if (!(parent = strndup_(name, len)) || !(path = join(untar, parent))) {
+    free(parent);
+    return 1;
+  }
+
+  for (size_t i = strlen(untar->dir) + 1; !rc; i++) {
+    char c = path[i];
+
+    if ('/' == c || '\0' == c) {
+      struct stat stats;
+
+      path[i] = '\0';
+      rc = 0 == lstat(path, &stats) && S_ISLNK(stats.st_mode);
+      path[i] = c;
+
+      if ('\0' == c) {
+        break;
+      }
+    }
+  }
+
+  free(path);
+
+  if (rc) {
+    free(parent);
+  } else {
+    free(untar->last_checked);
+    untar->last_checked = parent;
+  }
+
+  return rc;
+}
+
+static int make_parent(clib_untar_t *untar, const char *path) {
+  const char *slash = strrchr(path, '/');
+  char *parent = strndup_(path, slash - path);
+
+  if (NULL == parent) {
+    return -1;
+  }
+
+  // archives list the files of a directory together
+  if (untar->last_parent && 0 == strcmp(parent, untar->last_parent)) {
+    free(parent);
+    return 0;
+  }
+
+  if (0 != mkdirp(parent, 0777)) {
+    free(parent);
+    return -1;
+  }
+
+  free(untar->last_parent);
+  untar->last_parent = parent;
+  return 0;
+}
+
+/**
+ * Open the regular file at `path` for the data of the current entry,
+ * taking ownership of `path`
+ */
+
+static int open_file(clib_untar_t *untar, char *path, int mode) {
+  if (0 != make_parent(untar, path)) {
+    free(path);
+    return -1;
+  }
+
+  unlink(path);
+  untar->fd =
+      open(path, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, mode ? mode : 0644);
+  if (-1 == untar->fd) {
+    free(path);
+    return -1;
+  }
+
+  untar->path = path;
+  return 0;
+}
+
+static int is_file(char type, const char *name) {
+  return ('0' == type || '7' == type || '\0' == type) &&
+         '/' != name[strlen(name) - 1];
+}
+
+static int start_entry(clib_untar_t *untar) {
+  const unsigned char *header = untar->block;
+  unsigned long long size = parse_number(header + 124, 12);
+  int mode = (int)(parse_number(header + 100, 8) & 0777);
+  char *name = NULL;
+  char *linkname = NULL;
+  char *path = NULL;
+  int rc = -1;
+
+  untar->type = (char)header[156];
+  untar->remaining = size;
+  untar->padding = (size_t)((BLOCK_SIZE - size % BLOCK_SIZE) % BLOCK_SIZE);
+  untar->mtime = (time_t)parse_number(header + 136, 12);
+
+  switch (untar->type) {
+  case 'x':
+  case 'L':
+  case 'K':
+    if (size > MAX_META_SIZE || !(untar->meta = malloc(size + 1))) {
+      return -1;
+    }
+    untar->meta_len = 0;
+    return 0;
+
+  case 'g':
+    // global pax header, the commit id in GitHub archives
+    return 0;
+  }
+
+  if (untar->long_name) {
+    name = untar->long_name;
+    untar->long_name = NULL;
+  } else {
+    name = header_name(header);
+  }
+
+  if (untar->long_link) {
+    linkname = untar->long_link;
+    untar->long_link = NULL;
+  } else {
+    linkname =
+        strndup_((const char *)header + 157, field_len(header + 157, 100));
+  }
+
+  if (!name || !linkname) {
+    goto done;
+  }
+
+  // only the regular files the filter names are extracted
+  if (untar->filter) {
+    if ('\0' != *name && is_file(untar->type, name) &&
+        (path = untar->filter(name, untar->filter_data))) {
+      rc = open_file(untar, path, mode);
+      path = NULL;
+    } else {
+      rc = 0;
+    }
+    goto done;
+  }
+
+  if (!path_safe(name) || crosses_link(untar, name) ||
+      !(path = join(untar, name))) {
+    goto done;
+  }
+
+  switch (untar->type) {
+  case '0':
+  case '7':
+  case '\0':
+    if (is_file(untar->type, path)) {
+      rc = open_file(untar, path, mode);
+      path = NULL;
+      goto done;
+    }
+    // old archives mark directories with a trailing slash
+
+  case '5':
+    if (0 != mkdirp(path, mode | 0700)) {
+      goto done;
+    }
+    break;
+
+#ifndef _WIN32
+  case '2':
+    if (link_escapes(name, linkname)) {
+      break;
+    }
+
+    if (0 != make_parent(untar, path)) {
+      goto done;
+    }
+
+    unlink(path);
+    if (0 != symlink(linkname, path)) {
+      goto done;
+    }
+
+    // the directory checked last may go through it now
+    free(untar->last_checked);
+    untar->last_checked = NULL;
+    break;
+
+  case '1': {
+    char *target = NULL;
+
+    if (!path_safe(linkname) || crosses_link(untar, linkname) ||
+        !(target = join(untar, linkname))) {
+      goto done;
+    }
+
+    if (0 != make_parent(untar, path)) {
+      free(target);
+      goto done;
+    }
+
+    unlink(path);
+    int linked = link(target, path);
+    free(target);
+
+    if (0 != linked) {
+      goto done;
+    }
+    break;
+  }
+#endif
+
+  default:
+    // devices and fifos are not extracted
+    break;
+  }
+
+  rc = 0;
+
+done:
+  free(name);
+  free(linkname);
+  free(path);
+  return rc;
+}
+
+static int replace_name(char **name, const char *value, size_t len) {
+  free(*name);
+  *name = strndup_(value, len);
+  return *name ? 0 : -1;
+}
+
+/**
+ * Records of a pax header are "<length> <key>=<value>\n"
+ */
+
+static int parse_pax(clib_untar_t *untar) {
+  char *p = untar->meta;
+  char *end = untar->meta + untar->meta_len;
+
+  while (p < end) {
+    char *key = NULL;
+    unsigned long len = strtoul(p, &key, 10);
+
+    if (key == p || ' ' != *key || 0 == len || len > (size_t)(end - p) ||
+        '\n' != p[len - 1]) {
+      return -1;
+    }
+
+    char *record_end = p + len - 1;
+    char *eq = NULL;
+
+    key++;
+    eq = memchr(key, '=', record_end - key);
+
+    if (NULL == eq) {
+      return -1;
+    }
+
+    size_t key_len = eq - key;
+    int rc = 0;
+
+    if (4 == key_len && 0 == strncmp(key, "path", 4)) {
+      rc = replace_name(&untar->long_name, eq + 1, record_end - eq - 1);
+    } else if (8 == key_len && 0 == strncmp(key, "linkpath", 8)) {
+      rc = replace_name(&untar->long_link, eq + 1, record_end - eq - 1);
+    }
+
+    if (0 != rc) {
+      return -1;
+    }
+
+    p += len;
+  }
+
+  return 0;
+}
+
+static int end_entry(clib_untar_t *untar) {
+  int rc = 0;
+
+  if (untar->meta) {
+    untar->meta[untar->meta_len] = '\0';
+
+    if ('x' == untar->type) {
+      rc = parse_pax(untar);
+    } else {
+      char **name = 'L' == untar->type ? &untar->long_name : &untar->long_link;
+      rc = replace_name(name, untar->meta, strlen(untar->meta));
+    }
+
+    free(untar->meta);
+    untar->meta = NULL;
+    return rc;
+  }
+
+  if (-1 != untar->fd) {
+    rc = close(untar->fd);
+    untar->fd = -1;
+
+    struct utimbuf times;
+    times.actime = untar->mtime;
+    times.modtime = untar->mtime;
+    utime(untar->path, &times);
+
+    free(untar->path);
+    untar->path = NULL;
+  }
+
+  return rc;
+}
+
+static int write_data(clib_untar_t *untar, const unsigned char *data,
+                      size_t size) {
+  if (untar->meta) {
+    memcpy(untar->meta + untar->meta_len, data, size);
+    untar->meta_len += size;
+    return 0;
+  }
+
+  while (-1 != untar->fd && size > 0) {
+    int written = (int)write(untar->fd, data, size);
+
+    if (written <= 0) {
+      return -1;
+    }
+
+    data += written;
+    size -= written;
+  }
+
+  return 0;
+}
+
+static int read_header(clib_untar_t *untar) {
+  int zeros = 1;
+
+  for (int i = 0; zeros && i < BLOCK_SIZE; i++) {
+    zeros = 0 == untar->block[i];
+  }
+
+  // the archive ends with two empty blocks
+  if (zeros) {
+    if (2 == ++untar->zero_blocks) {
+      untar->state = UNTAR_END;
+    }
+    return 0;
+  }
+
+  untar->zero_blocks = 0;
+
+  if (!checksum_ok(untar->block) || 0 != start_entry(untar)) {
+    return -1;
+  }
+
+  if (untar->remaining > 0) {
+    untar->state = UNTAR_DATA;
+    return 0;
+  }
+
+  return end_entry(untar);
+}
+
+static int untar_data(clib_untar_t *untar, const unsigned char *data,
+                      size_t size) {
+  while (size > 0 && UNTAR_ERROR != untar->state) {
+    size_t n = 0;
+
+    switch (untar->state) {
+    case UNTAR_HEADER:
+      n = BLOCK_SIZE - untar->block_len;
+      n = n < size ? n : size;
+      memcpy(untar->block + untar->block_len, data, n);
+      untar->block_len += n;
+
+      if (BLOCK_SIZE == untar->block_len) {
+        untar->block_len = 0;
+        if (0 != read_header(untar)) {
+          untar->state = UNTAR_ERROR;
+        }
+      }
+      break;
+
+    case UNTAR_DATA:
+      n = size < untar->remaining ? size : (size_t)untar->remaining;
+      untar->remaining -= n;
+
+      if (0 != write_data(untar, data, n)) {
+        untar->state = UNTAR_ERROR;
+      } else if (0 == untar->remaining) {
+        if (0 != end_entry(untar)) {
+          untar->state = UNTAR_ERROR;
+        } else {
+          untar->state = untar->padding ? UNTAR_PADDING : UNTAR_HEADER;
+        }
+      }
+      break;
+
+    case UNTAR_PADDING:
+      n = size < untar->padding ? size : untar->padding;
+      untar->padding -= n;
+
+      if (0 == untar->padding) {
+        untar->state = UNTAR_HEADER;
+      }
+      break;
+
+    case UNTAR_END:
+      // what follows the end of the archive is ignored
+      return 0;
+    }
+
+    data += n;
+    size -= n;
+  }
+
+  return UNTAR_ERROR == untar->state ? -1 : 0;
+}
+
+clib_untar_t *clib_untar_new(const char *dir) {
+  clib_untar_t *untar = calloc(1, sizeof(clib_untar_t));
+
+  if (NULL == untar) {
+    return NULL;
+  }
+
+  untar->fd = -1;
+  untar->state = UNTAR_HEADER;
+
+  // 15 window bits, plus 32 to detect the gzip header
+  if (!(untar->dir = strdup(dir)) ||
+      Z_OK != inflateInit2(&untar->zs, 15 + 32)) {
+    clib_untar_free(untar);
+    return NULL;
+  }
+
+  untar->inflating = 1;
+  return untar;
+}
+
+void clib_untar_set_filter(clib_untar_t *untar, clib_untar_filter_cb filter,
+                           void *data) {
+  untar->filter = filter;
+  untar->filter_data = data;
+}
+
+int clib_untar_write(clib_untar_t *untar, const void *data, size_t size) {
+  z_stream *zs = &untar->zs;
+
+  if (UNTAR_ERROR == untar->state) {
+    return -1;
+  }
+
+  zs->next_in = (Bytef *)data;
+  zs->avail_in = (uInt)size;
+
+  do {
+    if (untar->inflated) {
+      if (UNTAR_END == untar->state || 0 == zs->avail_in) {
+        break;
+      }
+
+      // another gzip member follows
+      if (Z_OK != inflateReset(zs)) {
+        untar->state = UNTAR_ERROR;
+        return -1;
+      }
+      untar->inflated = 0;
+    }
+
+    zs->next_out = untar->out;
+    zs->avail_out = INFLATE_CHUNK;
+
+    int rc = inflate(zs, Z_NO_FLUSH);
+
+    if (Z_STREAM_END == rc) {
+      untar->inflated = 1;
+    } else if (Z_OK != rc && Z_BUF_ERROR != rc) {
+      untar->state = UNTAR_ERROR;
+      return -1;
+    }
+
+    if (0 != untar_data(untar, untar->out, INFLATE_CHUNK - zs->avail_out)) {
+      return -1;
+    }
+  } while (zs->avail_in > 0 || 0 == zs->avail_out);
+
+  return 0;
+}
+
+int clib_untar_finish(clib_untar_t *untar) {
+  if (!untar->inflated) {
+    return -1;
+  }
+
+  // some archives lack the final empty blocks
+  if (UNTAR_END == untar->state ||
+      (UNTAR_HEADER == untar->state && 0 == untar->block_len)) {
+    return 0;
+  }
+
+  return -1;
+}
+
+void clib_untar_free(clib_untar_t *untar) {
+  if (NULL == untar) {
+    return;
+  }
+
+  if (-1 != untar->fd) {
+    close(untar->fd);
+  }
+
+  if (untar->inflating) {
+    inflateEnd(&untar->zs);
+  }
+
+  free(untar->dir);
+  free(untar->path);
+  free(untar->meta);
+  free(untar->long_name);
+  free(untar->long_link);
+  free(untar->last_parent);
+  free(untar->last_checked);
+  free(untar);
+}
+
+static int on_data(const void *data, size_t size, void *untar) {
+  return clib_untar_write(untar, data, size);
+}
+
+int clib_untar_url(const char *url, const char *dir, void *share) {
+  clib_untar_t *untar = clib_untar_new(dir);
+  int rc = -1;
+
+  if (NULL == untar) {
+    return -1;
+  }
+
+  rc = http_get_stream_shared(url, on_data, untar, share);
+
+  if (0 == rc) {
+    rc = clib_untar_finish(untar);
+  }
+
+  clib_untar_free(untar);
+  return rc;
+}
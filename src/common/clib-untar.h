@@ -0,0 +1,69 @@
+//
+// clib-untar.h
+//
+// Copyright (c) 2021 clib authors
+// MIT licensed
+//
+
+#ifndef CLIB_UNTAR_H
+#define CLIB_UNTAR_H
+
+#include <stddef.h>
+
+/**
+ * A streaming gzip and tar extractor. Bytes are inflated and unpacked as
+ * they are written, so an archive can be extracted straight from the body
+ * of an HTTP response, without a temporary file or an external `tar`.
+ *
+ * Regular files, directories, symbolic and hard links are extracted, with
+ * GNU and pax long names. Entries with an absolute path, a `..`
+ * component or a directory that is a symbolic link fail the extraction,
+ * and symbolic links pointing out of the destination, or going up a
+ * directory after going down one, are skipped.
+ */
+
+typedef struct clib_untar clib_untar_t;
+
+/**
+ * @return A new extractor unpacking into `dir`, or NULL on error
+ */
+clib_untar_t *clib_untar_new(const char *dir);
+
+/**
+ * Returns the path to extract the regular file `name` of the archive to,
+ * to be freed by the extractor, or NULL to skip it.
+ */
+typedef char *(*clib_untar_filter_cb)(const char *name, void *data);
+
+/**
+ * Extract only the regular files `filter` picks, wherever it puts them,
+ * instead of the whole archive under the destination.
+ */
+void clib_untar_set_filter(clib_untar_t *untar, clib_untar_filter_cb filter,
+                           void *data);
+
+/**
+ * Feed the next `size` bytes of the gzipped archive to `untar`.
+ *
+ * @return 0 on success, -1 on error, after which every call fails
+ */
+int clib_untar_write(clib_untar_t *untar, const void *data, size_t size);
+
+/**
+ * @return 0 if the whole archive was written and extracted, -1 otherwise
+ */
+int clib_untar_finish(clib_untar_t *untar);
+
+void clib_untar_free(clib_untar_t *untar);
+
+/**
+ * Download the gzipped archive at `url` and extract it into `dir` as it
+ * arrives.
+ *
+ * @param share A curl share handle, or NULL for the process wide one
+ *
+ * @return 0 on success, -1 on error
+ */
+int clib_untar_url(const char *url, const char *dir, void *share);
+
+#endif
@@ -41,4 +41,31 @@ fi
 
 cd ../../
 
+printf "\nRunning clib search tests\n\n"
+cd test/search && make clean
+
+if ! make test; then
+  EXIT_CODE=1
+fi
+
+cd ../../
+
+printf "\nRunning parson tests\n\n"
+cd test/parson && make clean
+
+if ! make test; then
+  EXIT_CODE=1
+fi
+
+cd ../../
+
+printf "\nRunning clib untar tests\n\n"
+cd test/untar && make clean
+
+if ! make test; then
+  EXIT_CODE=1
+fi
+
+cd ../../
+
 exit $EXIT_CODE
@@ -0,0 +1,49 @@
+#!/bin/sh
+mkdir -p tmp/test-build/deps/dep
+RUNDIR="$PWD"
+trap 'rm -rf "$RUNDIR/tmp"' EXIT
+
+cd tmp/test-build || exit
+
+# the root package lists no sources, make has to run every time
+cat > clib.json <<'JSON'
+{ "name": "app", "version": "0.0.0", "makefile": "Makefile" }
+JSON
+printf 'app.out: app.c\n\tcp app.c app.out\n\techo app >> builds.log\n' > Makefile
+echo "int a;" > app.c
+
+# an installed dependency lists its sources, so it can be skipped
+cat > deps/dep/clib.json <<'JSON'
+{ "name": "dep", "version": "0.0.0", "makefile": "Makefile", "src": ["dep.c"] }
+JSON
+printf 'all:\n\techo dep >> ../../builds.log\n' > deps/dep/Makefile
+echo "int d;" > deps/dep/dep.c
+
+builds() {
+  grep -c "$1" builds.log
+}
+
+"$RUNDIR/clib-build" >/dev/null 2>&1
+echo "int b;" > app.c
+"$RUNDIR/clib-build" >/dev/null 2>&1
+
+if [ "$(builds app)" != 2 ]; then
+  echo >&2 "Failed to rebuild the root package after editing an unlisted source"
+  exit 1
+fi
+
+"$RUNDIR/clib-build" ./deps/dep >/dev/null 2>&1
+"$RUNDIR/clib-build" ./deps/dep >/dev/null 2>&1
+
+if [ "$(builds dep)" != 1 ]; then
+  echo >&2 "Failed to skip an unchanged dependency"
+  exit 1
+fi
+
+echo "int e;" > deps/dep/dep.c
+"$RUNDIR/clib-build" ./deps/dep >/dev/null 2>&1
+
+if [ "$(builds dep)" != 2 ]; then
+  echo >&2 "Failed to rebuild a dependency after editing its sources"
+  exit 1
+fi
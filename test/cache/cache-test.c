@@ -5,6 +5,7 @@
 #include <limits.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #define assert_exists(f) assert_equal(0, fs_exists(f));
@@ -55,6 +56,84 @@ int main() {
       assert_cached_files(pkg_dir);
     }
 
+    it("should share identical files between packages") {
+      char a[BUFSIZ];
+      char b[BUFSIZ];
+      struct stat sa;
+      struct stat sb;
+
+      assert_equal(
+          0, clib_cache_save_package(author, name, "1.3.0", "../../deps/copy"));
+
+      sprintf(a, "%s/author_pkg_1.2.0/copy.c", clib_cache_dir());
+      sprintf(b, "%s/author_pkg_1.3.0/copy.c", clib_cache_dir());
+      assert_equal(0, stat(a, &sa));
+      assert_equal(0, stat(b, &sb));
+      assert_equal(sa.st_ino, sb.st_ino);
+      assert_equal(3, (int)sa.st_nlink);
+
+      assert_equal(0, clib_cache_delete_package(author, name, "1.3.0"));
+      assert_equal(0, stat(a, &sa));
+      assert_equal(2, (int)sa.st_nlink);
+    }
+
+    it("should keep objects that copied files do not own") {
+      char a[BUFSIZ];
+      char b[BUFSIZ];
+      struct stat sa;
+      char *content;
+
+      assert_equal(
+          0, clib_cache_save_package(author, name, "1.4.0", "../../deps/copy"));
+
+      // as if linking had failed and the file had been copied instead
+      sprintf(a, "%s/author_pkg_1.2.0/copy.c", clib_cache_dir());
+      sprintf(b, "%s/author_pkg_1.4.0/copy.c", clib_cache_dir());
+      content = fs_read(b);
+      unlink(b);
+      fs_write(b, content);
+      free(content);
+
+      assert_equal(0, stat(a, &sa));
+      assert_equal(2, (int)sa.st_nlink);
+
+      assert_equal(0, clib_cache_delete_package(author, name, "1.4.0"));
+      assert_equal(0, stat(a, &sa));
+      assert_equal(2, (int)sa.st_nlink);
+    }
+
+    it("should restore a cached package") {
+      char file[BUFSIZ];
+      struct stat sa;
+      struct stat sb;
+      char *a;
+      char *b;
+
+      rimraf("tmp");
+      assert_equal(0, clib_cache_load_package(author, name, version, "tmp"));
+      assert_cached_files("tmp");
+
+      a = fs_read("tmp/copy.c");
+      b = fs_read("../../deps/copy/copy.c");
+      assert_str_equal(b, a);
+      free(a);
+      free(b);
+
+      assert_equal(0, stat("tmp/copy.c", &sa));
+      assert_equal(0, stat("../../deps/copy/copy.c", &sb));
+      assert_equal(sb.st_mode, sa.st_mode);
+      assert_equal(sb.st_size, sa.st_size);
+
+      // writing to a restored file must not reach the cache
+      fs_write("tmp/copy.c", "");
+      snprintf(file, sizeof(file), "%s/copy.c", pkg_dir);
+      a = fs_read(file);
+      assert(strlen(a) > 0);
+      free(a);
+
+      rimraf("tmp");
+    }
+
     it("should manage the json cache") {
       char *cached_json;
 
@@ -86,7 +165,12 @@ int main() {
           0, strcmp("<html></html>", cached_search = clib_cache_read_search()));
       free(cached_search);
 
+      assert_equal(0, clib_cache_has_search_index());
+      assert_equal(5, fs_write(clib_cache_search_index(), "index"));
+      assert_equal(1, clib_cache_has_search_index());
+
       assert_equal(0, clib_cache_delete_search());
+      assert_equal(0, clib_cache_has_search_index());
       assert_equal(0, clib_cache_has_search());
       assert_null(clib_cache_read_search());
     }
@@ -102,6 +186,61 @@ int main() {
       assert_equal(0, clib_cache_has_search());
     }
 
+    it("should refresh the search index built from a revalidated page") {
+      clib_cache_delete_search();
+
+      assert_equal(13, clib_cache_save_search("<html></html>"));
+      assert_equal(5, fs_write(clib_cache_search_index(), "index"));
+
+      sleep(expiraton + 1);
+      assert_equal(0, clib_cache_has_search_index());
+
+      assert_equal(0, clib_cache_touch_search());
+      assert_equal(1, clib_cache_has_search());
+      assert_equal(1, clib_cache_has_search_index());
+    }
+
+    it("should not refresh a search index older than the page") {
+      clib_cache_delete_search();
+
+      assert_equal(5, fs_write(clib_cache_search_index(), "index"));
+      sleep(1);
+      assert_equal(13, clib_cache_save_search("<html></html>"));
+
+      sleep(expiraton + 1);
+      assert_equal(0, clib_cache_touch_search());
+      assert_equal(1, clib_cache_has_search());
+      assert_equal(0, clib_cache_has_search_index());
+    }
+
+    it("should revalidate an expired json cache") {
+      char *etag = NULL;
+      char *last_modified = NULL;
+
+      assert_equal(-1, clib_cache_read_json_validators("a", "n", "v", &etag,
+                                                       &last_modified));
+
+      assert_equal(2, clib_cache_save_json("a", "n", "v", "{}"));
+      assert_equal(0, clib_cache_save_json_validators("a", "n", "v", "\"abc\"",
+                                                      NULL));
+
+      sleep(expiraton + 1);
+      assert_equal(0, clib_cache_has_json("a", "n", "v"));
+
+      assert_equal(0, clib_cache_read_json_validators("a", "n", "v", &etag,
+                                                      &last_modified));
+      assert_str_equal("\"abc\"", etag);
+      assert_null(last_modified);
+      free(etag);
+
+      assert_equal(0, clib_cache_touch_json("a", "n", "v"));
+      assert_equal(1, clib_cache_has_json("a", "n", "v"));
+
+      assert_equal(0, clib_cache_delete_json("a", "n", "v"));
+      assert_equal(-1, clib_cache_read_json_validators("a", "n", "v", &etag,
+                                                       &last_modified));
+    }
+
     clib_cache_delete_search();
   }
 
@@ -0,0 +1,173 @@
+#include "clib-cache.h"
+#include "clib-lockfile.h"
+#include "clib-package.h"
+#include "describe/describe.h"
+#include "fs/fs.h"
+#include "mkdirp/mkdirp.h"
+#include "rimraf/rimraf.h"
+#include <stdio.h>
+#include <string.h>
+
+#define LOCKFILE "./test/fixtures/clib.lock"
+#define PKG_DIR "./test/fixtures/deps/buffer"
+
+int main() {
+  clib_cache_init(100);
+  rimraf(clib_cache_dir());
+
+  mkdirp(PKG_DIR, 0777);
+  fs_write(PKG_DIR "/buffer.c", "int buffer;\n");
+
+  describe("clib_lockfile") {
+    char json[] = "{"
+                  "  \"name\": \"buffer\","
+                  "  \"version\": \"0.4.0\","
+                  "  \"repo\": \"clibs/buffer\","
+                  "  \"src\": [\"src/buffer.c\"]"
+                  "}";
+
+    clib_package_t *pkg = clib_package_new(json, 0);
+    pkg->url = clib_package_url("clibs", "buffer", "0.4.0");
+    pkg->filename = "clib.json";
+
+    it("should pin a package and write it out") {
+      clib_lockfile_t *lockfile = clib_lockfile_new();
+      assert(NULL != lockfile);
+      assert(0 == clib_lockfile_add(lockfile, "clibs/buffer", pkg, PKG_DIR));
+      assert(0 == clib_lockfile_save(lockfile, LOCKFILE));
+      assert(0 == fs_exists(LOCKFILE));
+      clib_lockfile_free(lockfile);
+    }
+
+    it("should build pinned packages without resolving them") {
+      clib_lockfile_t *lockfile = clib_lockfile_load(LOCKFILE);
+      assert(NULL != lockfile);
+
+      clib_package_t *locked = clib_lockfile_get(lockfile, "clibs/buffer", 0);
+      assert(NULL != locked);
+      assert_str_equal("buffer", locked->name);
+      assert_str_equal("0.4.0", locked->version);
+      assert_str_equal("clibs", locked->author);
+      assert_str_equal("clib.json", locked->filename);
+      assert_str_equal(pkg->url, locked->url);
+      assert_str_equal("src/buffer.c", locked->src->head->val);
+
+      assert(NULL == clib_lockfile_get(lockfile, "clibs/list", 0));
+
+      clib_package_free(locked);
+      clib_lockfile_free(lockfile);
+    }
+
+    it("should verify the content of pinned packages") {
+      clib_lockfile_t *lockfile = clib_lockfile_load(LOCKFILE);
+      assert(NULL != lockfile);
+      assert(0 == clib_lockfile_verify(lockfile, "clibs/buffer", pkg, PKG_DIR));
+
+      fs_write(PKG_DIR "/buffer.c", "int tampered;\n");
+      assert(-1 ==
+             clib_lockfile_verify(lockfile, "clibs/buffer", pkg, PKG_DIR));
+      assert(-1 == clib_lockfile_verify(lockfile, "clibs/list", pkg, PKG_DIR));
+
+      clib_lockfile_free(lockfile);
+    }
+
+    it("should tell apart bytes moved between sources") {
+      char two[] = "{"
+                   "  \"name\": \"buffer\","
+                   "  \"version\": \"0.4.0\","
+                   "  \"repo\": \"clibs/buffer\","
+                   "  \"src\": [\"src/buffer.c\", \"src/buffer.h\"]"
+                   "}";
+      clib_package_t *split = clib_package_new(two, 0);
+      clib_lockfile_t *lockfile = clib_lockfile_new();
+      assert(NULL != split);
+      assert(NULL != lockfile);
+
+      fs_write(PKG_DIR "/buffer.c", "int a;\nint b;\n");
+      fs_write(PKG_DIR "/buffer.h", "");
+      assert(0 == clib_lockfile_add(lockfile, "clibs/buffer", split, PKG_DIR));
+      assert(0 == clib_lockfile_verify(lockfile, "clibs/buffer", split,
+                                       PKG_DIR));
+
+      fs_write(PKG_DIR "/buffer.c", "int a;\n");
+      fs_write(PKG_DIR "/buffer.h", "int b;\n");
+      assert(-1 == clib_lockfile_verify(lockfile, "clibs/buffer", split,
+                                        PKG_DIR));
+
+      clib_lockfile_free(lockfile);
+      clib_package_free(split);
+    }
+
+    it("should fail on a missing source") {
+      clib_lockfile_t *lockfile = clib_lockfile_new();
+      assert(NULL != lockfile);
+
+      fs_write(PKG_DIR "/buffer.c", "int buffer;\n");
+      assert(0 == clib_lockfile_add(lockfile, "clibs/buffer", pkg, PKG_DIR));
+
+      remove(PKG_DIR "/buffer.c");
+      assert(-1 ==
+             clib_lockfile_verify(lockfile, "clibs/buffer", pkg, PKG_DIR));
+      assert(-1 == clib_lockfile_add(lockfile, "clibs/buffer", pkg, PKG_DIR));
+
+      clib_lockfile_free(lockfile);
+    }
+
+    it("should check frozen packages before configuring or caching them") {
+      char configured[] = "{"
+                          "  \"name\": \"buffer\","
+                          "  \"version\": \"0.4.0\","
+                          "  \"repo\": \"clibs/buffer\","
+                          "  \"configure\": \"touch configured\","
+                          "  \"src\": [\"src/buffer.c\"]"
+                          "}";
+      clib_package_t *added = clib_package_new(configured, 0);
+      clib_package_t *frozen = NULL;
+      clib_lockfile_t *lockfile = clib_lockfile_new();
+      assert(NULL != added);
+      assert(NULL != lockfile);
+      added->url = clib_package_url("clibs", "buffer", "0.4.0");
+      added->filename = "clib.json";
+
+      fs_write(PKG_DIR "/buffer.c", "int buffer;\n");
+      assert(0 == clib_lockfile_add(lockfile, "clibs/buffer", added, PKG_DIR));
+      lockfile->frozen = 1;
+      frozen = clib_lockfile_get(lockfile, "clibs/buffer", 0);
+      assert(NULL != frozen);
+      assert_str_equal("touch configured", frozen->configure);
+
+      // the sources are restored from a tampered cache, without a request
+      clib_package_set_opts((clib_package_opts_t){.skip_cache = 0});
+      clib_cache_init(100);
+      fs_write(PKG_DIR "/buffer.c", "int tampered;\n");
+      assert(0 == clib_cache_save_package("clibs", "buffer", "0.4.0", PKG_DIR));
+      assert(1 == clib_cache_has_package("clibs", "buffer", "0.4.0"));
+
+      clib_package_set_lockfile(lockfile);
+      assert(-1 == clib_package_install_pinned("clibs/buffer@0.4.0", frozen,
+                                               "./test/fixtures/frozen", 0));
+      assert(0 != fs_exists("./test/fixtures/frozen/buffer/configured"));
+      assert(0 == clib_cache_has_package("clibs", "buffer", "0.4.0"));
+
+      // untouched, it is configured
+      fs_write(PKG_DIR "/buffer.c", "int buffer;\n");
+      assert(0 == clib_cache_save_package("clibs", "buffer", "0.4.0", PKG_DIR));
+      clib_package_cleanup();
+      assert(0 == clib_package_install_pinned("clibs/buffer@0.4.0", frozen,
+                                              "./test/fixtures/frozen", 0));
+      assert(0 == fs_exists("./test/fixtures/frozen/buffer/configured"));
+
+      clib_package_set_lockfile(NULL);
+      clib_lockfile_free(lockfile);
+      clib_package_free(frozen);
+      clib_package_free(added);
+    }
+
+    clib_package_free(pkg);
+  }
+
+  rimraf("./test/fixtures");
+  rimraf(clib_cache_dir());
+
+  return assert_failures();
+}
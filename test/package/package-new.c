@@ -2,6 +2,7 @@
 #include "clib-package.h"
 #include "describe/describe.h"
 #include "rimraf/rimraf.h"
+#include "strdup/strdup.h"
 
 int main() {
   clib_cache_init(100);
@@ -81,6 +82,30 @@ int main() {
       assert(pkg);
       clib_package_free(pkg);
     }
+
+    it("should unescape the strings of the json") {
+      char json[] = "{"
+                    "  \"name\": \"foo\","
+                    "  \"repo\": \"foobar/foo\","
+                    "  \"description\": \"\\\"foo\\\"\\tand \\u00e9\","
+                    "  \"flags\": [\"-DA\", \"-DB=\\\"b\\\"\"],"
+                    "  \"src\": [\"foo.c\"]"
+                    "}";
+
+      clib_package_t *pkg = clib_package_new(json, 0);
+      assert(pkg);
+
+      assert_str_equal(json, pkg->json);
+      assert_str_equal("\"foo\"\tand \xc3\xa9", pkg->description);
+      assert_str_equal(" -DA -DB=\"b\"", pkg->flags);
+      assert_str_equal("foo.c", list_at(pkg->src, 0)->val);
+
+      // fields borrowed from the json can still be replaced
+      clib_package_free_string(pkg, pkg->name);
+      pkg->name = strdup("bar");
+
+      clib_package_free(pkg);
+    }
   }
 
   return assert_failures();
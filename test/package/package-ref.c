@@ -0,0 +1,58 @@
+#include "clib-cache.h"
+#include "clib-package.h"
+#include "describe/describe.h"
+#include "rimraf/rimraf.h"
+
+int main() {
+  clib_cache_init(100);
+  rimraf(clib_cache_dir());
+
+  char json[] = "{"
+                "  \"name\": \"buffer\","
+                "  \"version\": \"0.4.0\","
+                "  \"repo\": \"clibs/buffer\","
+                "  \"src\": [\"src/buffer.c\"]"
+                "}";
+
+  // resolved from the cache, without a request
+  clib_package_set_opts((clib_package_opts_t){.skip_cache = 0});
+  clib_cache_init(100);
+  clib_cache_save_json("clibs", "buffer", "master", json);
+  clib_cache_save_json("clibs", "buffer", "0.3.0", json);
+
+  describe("clib_package_ref") {
+    it("should be master for an unversioned slug") {
+      clib_package_t *pkg = clib_package_new_from_slug("clibs/buffer", 0);
+      assert(pkg);
+      // the manifest version, while the sources come from master
+      assert_str_equal("0.4.0", pkg->version);
+      assert_str_equal("master", clib_package_ref(pkg));
+      clib_package_free(pkg);
+    }
+
+    it("should be master for a `*` slug") {
+      clib_package_t *pkg = clib_package_new_from_slug("clibs/buffer@*", 0);
+      assert(pkg);
+      assert_str_equal("master", clib_package_ref(pkg));
+      clib_package_free(pkg);
+    }
+
+    it("should be the version of a versioned slug") {
+      clib_package_t *pkg = clib_package_new_from_slug("clibs/buffer@0.3.0", 0);
+      assert(pkg);
+      assert_str_equal("0.3.0", pkg->version);
+      assert_str_equal("0.3.0", clib_package_ref(pkg));
+      clib_package_free(pkg);
+    }
+
+    it("should fall back to the version without a url") {
+      clib_package_t *pkg = clib_package_new(json, 0);
+      assert(pkg);
+      assert_str_equal("0.4.0", clib_package_ref(pkg));
+      clib_package_free(pkg);
+    }
+  }
+
+  rimraf(clib_cache_dir());
+  return assert_failures();
+}
@@ -0,0 +1,144 @@
+#include "parson/parson.h"
+#include <describe/describe.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// well above the number of names objects are indexed from
+#define NAMES 200
+
+static void name_at(char name[32], int i) { sprintf(name, "key%d", i); }
+
+static int has_number(JSON_Object *object, int i) {
+  char name[32];
+
+  name_at(name, i);
+  return JSONNumber == json_value_get_type(json_object_get_value(object, name)) &&
+         i == (int)json_object_get_number(object, name);
+}
+
+int main() {
+  describe("parson object name index") {
+    JSON_Value *root = json_value_init_object();
+    JSON_Object *object = json_value_get_object(root);
+    char name[32];
+
+    it("should find every name inserted") {
+      for (int i = 0; i < NAMES; i++) {
+        name_at(name, i);
+        assert_equal(JSONSuccess, json_object_set_number(object, name, i));
+      }
+
+      assert_equal(NAMES, (int)json_object_get_count(object));
+      for (int i = 0; i < NAMES; i++) {
+        assert(has_number(object, i));
+      }
+    }
+
+    it("should not find missing names") {
+      assert(NULL == json_object_get_value(object, "key"));
+      assert(NULL == json_object_get_value(object, "key1000"));
+      assert(NULL == json_object_get_value(object, "key1 "));
+      assert(NULL == json_object_get_value(object, ""));
+    }
+
+    it("should replace the value of a name set again") {
+      assert_equal(JSONSuccess, json_object_set_string(object, "key10", "ten"));
+      assert_equal(NAMES, (int)json_object_get_count(object));
+      assert_str_equal("ten", json_object_get_string(object, "key10"));
+      assert_equal(JSONSuccess, json_object_set_number(object, "key10", 10));
+    }
+
+    it("should forget removed names and keep the others") {
+      // from the front, the middle and the end, which moves names around
+      for (int i = 0; i < NAMES; i += 3) {
+        name_at(name, i);
+        assert_equal(JSONSuccess, json_object_remove(object, name));
+        assert_equal(JSONFailure, json_object_remove(object, name));
+      }
+
+      for (int i = 0; i < NAMES; i++) {
+        int kept = 0 != i % 3;
+        assert_equal(kept, has_number(object, i));
+      }
+    }
+
+    it("should find names inserted again") {
+      for (int i = 0; i < NAMES; i += 3) {
+        name_at(name, i);
+        assert_equal(JSONSuccess, json_object_set_number(object, name, i));
+      }
+
+      assert_equal(NAMES, (int)json_object_get_count(object));
+      for (int i = 0; i < NAMES; i++) {
+        assert(has_number(object, i));
+      }
+    }
+
+    it("should go back to small objects once cleared") {
+      assert_equal(JSONSuccess, json_object_clear(object));
+      assert_equal(0, (int)json_object_get_count(object));
+      assert(NULL == json_object_get_value(object, "key1"));
+
+      for (int i = 0; i < NAMES; i++) {
+        name_at(name, i);
+        assert_equal(JSONSuccess, json_object_set_number(object, name, i));
+        assert(has_number(object, i));
+      }
+    }
+
+    it("should find names through dotted paths") {
+      JSON_Value *child = json_value_deep_copy(root);
+
+      assert_equal(JSONSuccess, json_object_set_value(object, "child", child));
+      assert_equal(42, (int)json_object_dotget_number(object, "child.key42"));
+      assert_equal(JSONSuccess, json_object_dotremove(object, "child.key42"));
+      assert(NULL == json_object_dotget_value(object, "child.key42"));
+      assert_equal(43, (int)json_object_dotget_number(object, "child.key43"));
+    }
+
+    json_value_free(root);
+  }
+
+  describe("parsing large objects") {
+    char *json = malloc(NAMES * 32 + 16);
+    size_t len = 0;
+
+    len += sprintf(json + len, "{");
+    for (int i = 0; i < NAMES; i++) {
+      len += sprintf(json + len, "%s\"key%d\":%d", i ? "," : "", i, i);
+    }
+
+    it("should index the names parsed") {
+      strcpy(json + len, "}");
+
+      JSON_Value *root = json_parse_string(json);
+      assert(NULL != root);
+
+      for (int i = 0; root && i < NAMES; i++) {
+        assert(has_number(json_value_get_object(root), i));
+      }
+      json_value_free(root);
+    }
+
+    it("should index the names parsed in an arena") {
+      JSON_Arena *arena = json_arena_init();
+      JSON_Value *root = json_parse_string_in_arena(arena, json);
+
+      assert(NULL != root);
+      for (int i = 0; root && i < NAMES; i++) {
+        assert(has_number(json_value_get_object(root), i));
+      }
+      json_arena_free(arena);
+    }
+
+    it("should reject a name repeated past the index threshold") {
+      sprintf(json + len, ",\"key%d\":0}", NAMES / 2);
+      assert(NULL == json_parse_string(json));
+    }
+
+    free(json);
+  }
+
+  return assert_failures();
+}
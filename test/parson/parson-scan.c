@@ -0,0 +1,192 @@
+#define _DEFAULT_SOURCE
+#include "parson/parson.h"
+#include <describe/describe.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// longer than two of the widest blocks strings and whitespace are scanned by
+#define RUN_MAX 80
+#define DOC_MAX (RUN_MAX * 4 + 32)
+
+static char *page;
+static size_t page_size;
+
+/**
+ * Copy `doc` to `offset` bytes from the start of a page followed by an
+ * unreadable one, or so that its null byte ends the page if `offset` is
+ * negative, and parse it there.
+ */
+
+static JSON_Value *parse_at(const char *doc, long offset, JSON_Arena *arena) {
+  size_t size = strlen(doc) + 1;
+  char *text = offset < 0 ? page + page_size - size : page + offset;
+
+  memcpy(text, doc, size);
+  return arena ? json_parse_string_in_arena(arena, text)
+               : json_parse_string(text);
+}
+
+static int offsets[] = {-1, 0, 1, 7, 13, 15, 16, 17, 29, 31, 32, 33, 47, 63};
+
+#define EACH_OFFSET(offset)                                                    \
+  for (size_t o = 0; o < sizeof(offsets) / sizeof(int); o++)                   \
+    for (long offset = offsets[o], once = 1; once; once = 0)
+
+/**
+ * Parse `["<body>"]` everywhere, and check it holds `expected`, or fails to
+ * parse if NULL.
+ */
+
+static int parses_string(const char *body, const char *expected) {
+  char doc[DOC_MAX];
+  int ok = 1;
+
+  snprintf(doc, sizeof(doc), "[\"%s\"]", body);
+
+  EACH_OFFSET(offset) {
+    for (int in_arena = 0; in_arena < 2; in_arena++) {
+      JSON_Arena *arena = in_arena ? json_arena_init() : NULL;
+      JSON_Value *value = parse_at(doc, offset, arena);
+      const char *string = json_array_get_string(json_value_get_array(value), 0);
+
+      if (expected) {
+        ok = ok && string && 0 == strcmp(expected, string);
+      } else {
+        ok = ok && NULL == value;
+      }
+
+      if (arena) {
+        json_arena_free(arena);
+      } else {
+        json_value_free(value);
+      }
+    }
+  }
+
+  return ok;
+}
+
+static void fill(char *str, char c, int n) {
+  memset(str, c, n);
+  str[n] = '\0';
+}
+
+int main() {
+  page_size = sysconf(_SC_PAGESIZE);
+  page = mmap(NULL, page_size * 2, PROT_READ | PROT_WRITE,
+              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  if (MAP_FAILED == page || 0 != mprotect(page + page_size, page_size,
+                                          PROT_NONE)) {
+    perror("mmap");
+    return 1;
+  }
+
+  describe("parson string scan") {
+    char body[DOC_MAX];
+    char expected[DOC_MAX];
+
+    it("should read plain strings across blocks and pages") {
+      for (int n = 0; n <= RUN_MAX; n++) {
+        fill(body, 'a', n);
+        assert(parses_string(body, body));
+      }
+    }
+
+    it("should read escapes at every position") {
+      const char *escapes[] = {"\\n", "\\\"", "\\\\", "\\/", "\\u00e9"};
+      const char *decoded[] = {"\n", "\"", "\\", "/", "\xc3\xa9"};
+
+      for (size_t e = 0; e < sizeof(escapes) / sizeof(char *); e++) {
+        for (int k = 0; k <= RUN_MAX; k++) {
+          fill(body, 'b', k);
+          strcat(body, escapes[e]);
+          strcat(body, "bbbb");
+          fill(expected, 'b', k);
+          strcat(expected, decoded[e]);
+          strcat(expected, "bbbb");
+          assert(parses_string(body, expected));
+        }
+      }
+    }
+
+    it("should reject control characters at every position") {
+      for (int k = 0; k <= RUN_MAX; k++) {
+        for (int c = 1; c < 0x20; c += 7) {
+          fill(body, 'c', k);
+          body[k] = (char)c;
+          body[k + 1] = '\0';
+          strcat(body, "cc");
+          assert(parses_string(body, NULL));
+        }
+      }
+    }
+
+    it("should stop at the end of unterminated strings") {
+      char doc[DOC_MAX];
+
+      for (int n = 0; n <= RUN_MAX; n++) {
+        strcpy(doc, "[\"");
+        fill(doc + 2, 'd', n);
+        EACH_OFFSET(offset) { assert(NULL == parse_at(doc, offset, NULL)); }
+
+        // and right after a backslash
+        strcat(doc, "\\");
+        EACH_OFFSET(offset) { assert(NULL == parse_at(doc, offset, NULL)); }
+      }
+    }
+  }
+
+  describe("parson whitespace scan") {
+    const char spaces[] = " \t\n\v\f\r";
+
+    it("should skip whitespace runs across blocks and pages") {
+      char run[RUN_MAX + 1];
+      char doc[DOC_MAX];
+
+      for (int n = 0; n <= RUN_MAX; n++) {
+        for (int i = 0; i < n; i++) {
+          run[i] = spaces[(i * 5 + n) % (sizeof(spaces) - 1)];
+        }
+        run[n] = '\0';
+
+        snprintf(doc, sizeof(doc), "[%s1%s,%s2%s]", run, run, run, run);
+        EACH_OFFSET(offset) {
+          JSON_Value *value = parse_at(doc, offset, NULL);
+          JSON_Array *array = json_value_get_array(value);
+
+          assert_equal(2, (int)json_array_get_count(array));
+          assert_equal(2, (int)json_array_get_number(array, 1));
+          json_value_free(value);
+        }
+
+        // whitespace running into the end of the text
+        snprintf(doc, sizeof(doc), "%s[]%s", run, run);
+        EACH_OFFSET(offset) {
+          JSON_Value *value = parse_at(doc, offset, NULL);
+
+          assert_equal(JSONArray, json_value_get_type(value));
+          json_value_free(value);
+        }
+
+        snprintf(doc, sizeof(doc), "[%s", run);
+        EACH_OFFSET(offset) { assert(NULL == parse_at(doc, offset, NULL)); }
+      }
+    }
+
+    it("should not take other characters for whitespace") {
+      const char *docs[] = {"[1\x01]", "[\x1f" "1]", "[1\x0e]", "[\x08" "1]",
+                            "[1\xa0]", "[\x85" "1]"};
+
+      for (size_t i = 0; i < sizeof(docs) / sizeof(char *); i++) {
+        EACH_OFFSET(offset) { assert(NULL == parse_at(docs[i], offset, NULL)); }
+      }
+    }
+  }
+
+  munmap(page, page_size * 2);
+  return assert_failures();
+}
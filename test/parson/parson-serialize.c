@@ -0,0 +1,350 @@
+#define _DEFAULT_SOURCE
+#include "parson/parson.h"
+#include <describe/describe.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SAVE_DIR "parson-save.test"
+#define SAVE_PATH SAVE_DIR "/value.json"
+
+/**
+ * Documents, and what parson serialized them to before the serializer
+ * wrote in a single pass: the output must not change by a byte.
+ */
+
+typedef struct {
+  const char *name;
+  const char *json;
+  const char *compact;
+  const char *pretty;
+} serialize_case_t;
+
+static serialize_case_t cases[] = {
+    {"should serialize a manifest as before",
+     "{\"name\":\"clib\",\"version\":\"2.8.7\",\"dependencies\":{\"a/b\":\"*\",\"c\":\"0.0.1\"},\"src\":[\"a.c\",\"b.h\"],\"n\":null,\"t\":true,\"f\":false,\"empty\":{},\"list\":[]}",
+     "{\"name\":\"clib\",\"version\":\"2.8.7\",\"dependencies\":{\"a/b\":\"*\",\"c\":\"0.0.1\"},\"src\":[\"a.c\",\"b.h\"],\"n\":null,\"t\":true,\"f\":false,\"empty\":{},\"list\":[]}",
+      "{\n"
+      "  \"name\": \"clib\",\n"
+      "  \"version\": \"2.8.7\",\n"
+      "  \"dependencies\": {\n"
+      "    \"a/b\": \"*\",\n"
+      "    \"c\": \"0.0.1\"\n"
+      "  },\n"
+      "  \"src\": [\n"
+      "    \"a.c\",\n"
+      "    \"b.h\"\n"
+      "  ],\n"
+      "  \"n\": null,\n"
+      "  \"t\": true,\n"
+      "  \"f\": false,\n"
+      "  \"empty\": {},\n"
+      "  \"list\": []\n"
+      "}"},
+    {"should serialize escaped strings as before",
+     "[\"quote \\\" backslash \\\\ slash / tab \\t nl \\n cr \\r bs \\b ff \\f ctrl \\u0001 \\u001f del \\u007f utf8 \xc3\xa9 \xe2\x82\xac \xf0\x9f\x98\x80\", \"\", {\"k\\\"ey\\n\":\"\\/\"}]",
+     "[\"quote \\\" backslash \\\\ slash / tab \\t nl \\n cr \\r bs \\b ff \\f ctrl \x01"" \x1f"" del \x7f"" utf8 \xc3""\xa9"" \xe2""\x82""\xac"" \xf0""\x9f""\x98""\x80""\",\"\",{\"k\\\"ey\\n\":\"/\"}]",
+      "[\n"
+      "  \"quote \\\" backslash \\\\ slash / tab \\t nl \\n cr \\r bs \\b ff \\f ctrl \x01"" \x1f"" del \x7f"" utf8 \xc3""\xa9"" \xe2""\x82""\xac"" \xf0""\x9f""\x98""\x80""\",\n"
+      "  \"\",\n"
+      "  {\n"
+      "    \"k\\\"ey\\n\": \"/\"\n"
+      "  }\n"
+      "]"},
+    {"should serialize numbers as before",
+     "[0,-0,1,-1,0.5,-0.25,1e100,5e-324,123456789012,9007199254740993,3.141592653589793,1e-7,100,1e21,0.1,-1.5e-10,2.5e15]",
+     "[0,0,1,-1,0.500000,-0.250000,10000000000000000159028911097599180468360808563945281389781327557747838772170381060813469985856815104.000000,0.000000,123456789012.000000,9007199254740992.000000,3.141593,0.000000,100,1000000000000000000000.000000,0.100000,-0.000000,2500000000000000.000000]",
+      "[\n"
+      "  0,\n"
+      "  0,\n"
+      "  1,\n"
+      "  -1,\n"
+      "  0.500000,\n"
+      "  -0.250000,\n"
+      "  10000000000000000159028911097599180468360808563945281389781327557747838772170381060813469985856815104.000000,\n"
+      "  0.000000,\n"
+      "  123456789012.000000,\n"
+      "  9007199254740992.000000,\n"
+      "  3.141593,\n"
+      "  0.000000,\n"
+      "  100,\n"
+      "  1000000000000000000000.000000,\n"
+      "  0.100000,\n"
+      "  -0.000000,\n"
+      "  2500000000000000.000000\n"
+      "]"},
+    {"should serialize nested containers as before",
+     "[[[]],[{}],{\"a\":[1,{\"b\":[2,[3]]}],\"c\":{\"d\":{}}}]",
+     "[[[]],[{}],{\"a\":[1,{\"b\":[2,[3]]}],\"c\":{\"d\":{}}}]",
+      "[\n"
+      "  [\n"
+      "    []\n"
+      "  ],\n"
+      "  [\n"
+      "    {}\n"
+      "  ],\n"
+      "  {\n"
+      "    \"a\": [\n"
+      "      1,\n"
+      "      {\n"
+      "        \"b\": [\n"
+      "          2,\n"
+      "          [\n"
+      "            3\n"
+      "          ]\n"
+      "        ]\n"
+      "      }\n"
+      "    ],\n"
+      "    \"c\": {\n"
+      "      \"d\": {}\n"
+      "    }\n"
+      "  }\n"
+      "]"},
+};
+
+typedef struct {
+  char data[1 << 16];
+  size_t len;
+  size_t calls;
+} writer_t;
+
+static JSON_Status write_to(void *context, const char *data, size_t size) {
+  writer_t *writer = context;
+
+  if (writer->len + size >= sizeof(writer->data)) {
+    return JSONFailure;
+  }
+
+  memcpy(writer->data + writer->len, data, size);
+  writer->len += size;
+  writer->data[writer->len] = '\0';
+  writer->calls++;
+  return JSONSuccess;
+}
+
+static JSON_Status fail_write(void *context, const char *data, size_t size) {
+  return JSONFailure;
+}
+
+static char *read_file(const char *path) {
+  FILE *file = fopen(path, "rb");
+  char *data = NULL;
+  long size = 0;
+
+  if (!file) {
+    return NULL;
+  }
+
+  fseek(file, 0, SEEK_END);
+  size = ftell(file);
+  rewind(file);
+
+  if ((data = malloc(size + 1))) {
+    data[fread(data, 1, size, file)] = '\0';
+  }
+
+  fclose(file);
+  return data;
+}
+
+static int serializes_to(JSON_Value *value, const char *expected,
+                         int is_pretty) {
+  size_t len = strlen(expected);
+  char *string = is_pretty ? json_serialize_to_string_pretty(value)
+                           : json_serialize_to_string(value);
+  size_t size = is_pretty ? json_serialization_size_pretty(value)
+                          : json_serialization_size(value);
+  char *buf = malloc(len + 1);
+  writer_t *writer = calloc(1, sizeof(writer_t));
+  FILE *stream = tmpfile();
+  char *file = NULL;
+  int ok = string && 0 == strcmp(expected, string) && size == len + 1;
+
+  // into a buffer, which must hold the null byte too
+  ok = ok && buf &&
+       JSONSuccess == (is_pretty ? json_serialize_to_buffer_pretty(
+                                       value, buf, len + 1)
+                                 : json_serialize_to_buffer(value, buf,
+                                                            len + 1)) &&
+       0 == strcmp(expected, buf);
+  ok = ok && JSONFailure == (is_pretty ? json_serialize_to_buffer_pretty(
+                                             value, buf, len)
+                                       : json_serialize_to_buffer(value, buf,
+                                                                  len));
+
+  ok = ok && writer &&
+       JSONSuccess == (is_pretty ? json_serialize_to_writer_pretty(
+                                       value, write_to, writer)
+                                 : json_serialize_to_writer(value, write_to,
+                                                            writer)) &&
+       len == writer->len && 0 == memcmp(expected, writer->data, len);
+
+  ok = ok && stream &&
+       JSONSuccess == (is_pretty ? json_serialize_to_stream_pretty(value,
+                                                                   stream)
+                                 : json_serialize_to_stream(value, stream));
+  if (stream) {
+    char *streamed = calloc(1, len + 2);
+
+    rewind(stream);
+    ok = ok && streamed && len == fread(streamed, 1, len + 1, stream) &&
+         0 == memcmp(expected, streamed, len);
+    free(streamed);
+    fclose(stream);
+  }
+
+  ok = ok && JSONSuccess == (is_pretty ? json_serialize_to_file_pretty(
+                                             value, SAVE_PATH)
+                                       : json_serialize_to_file(value,
+                                                                SAVE_PATH));
+  ok = ok && (file = read_file(SAVE_PATH)) && 0 == strcmp(expected, file);
+
+  json_free_serialized_string(string);
+  free(file);
+  free(writer);
+  free(buf);
+  return ok;
+}
+
+static int save_dir_is_empty(void) {
+  char *files[] = {SAVE_PATH, NULL};
+  char tmp[sizeof(SAVE_PATH) + 32];
+
+  // the temporary file is the path followed by the pid
+  sprintf(tmp, "%s.%ld", SAVE_PATH, (long)getpid());
+  files[1] = tmp;
+
+  for (int i = 0; i < 2; i++) {
+    struct stat st;
+
+    if (0 == lstat(files[i], &st) && S_ISREG(st.st_mode)) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+int main() {
+  mkdir(SAVE_DIR, 0755);
+  unlink(SAVE_PATH);
+
+  describe("parson serialization") {
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+      JSON_Value *value = json_parse_string(cases[i].json);
+
+      it(cases[i].name) {
+        assert(NULL != value);
+        assert(serializes_to(value, cases[i].compact, 0));
+        assert(serializes_to(value, cases[i].pretty, 1));
+      }
+
+      json_value_free(value);
+    }
+
+    it("should write values past the size of its buffer") {
+      size_t len = 100000;
+      char *string = malloc(len + 1);
+      char *expected = malloc(len + 8);
+      JSON_Value *value = NULL;
+
+      memset(string, 'x', len);
+      string[len] = '\0';
+      sprintf(expected, "\"%s\"", string);
+      value = json_value_init_string(string);
+
+      char *serialized = json_serialize_to_string(value);
+      assert_str_equal(expected, serialized);
+      assert(json_serialization_size(value) == strlen(expected) + 1);
+      assert_equal(JSONSuccess, json_serialize_to_file(value, SAVE_PATH));
+
+      char *file = read_file(SAVE_PATH);
+      assert(NULL != file && 0 == strcmp(expected, file));
+
+      free(file);
+      json_free_serialized_string(serialized);
+      json_value_free(value);
+      free(expected);
+      free(string);
+    }
+
+    it("should fail when the writer does") {
+      JSON_Value *value = json_parse_string(cases[0].json);
+
+      assert_equal(JSONFailure,
+                   json_serialize_to_writer(value, fail_write, NULL));
+      assert_equal(JSONFailure,
+                   json_serialize_to_writer_pretty(value, fail_write, NULL));
+      json_value_free(value);
+    }
+  }
+
+  describe("parson atomic save") {
+    JSON_Value *value = json_parse_string(cases[0].json);
+
+    it("should replace the saved file") {
+      unlink(SAVE_PATH);
+      assert_equal(JSONSuccess, json_serialize_to_file(value, SAVE_PATH));
+      assert_equal(JSONSuccess,
+                   json_serialize_to_file_pretty(value, SAVE_PATH));
+
+      char *file = read_file(SAVE_PATH);
+      assert(NULL != file && 0 == strcmp(cases[0].pretty, file));
+      free(file);
+      unlink(SAVE_PATH);
+    }
+
+    it("should leave nothing behind when the temporary file can't be made") {
+      assert_equal(JSONFailure, json_serialize_to_file(
+                                    value, SAVE_DIR "/missing/value.json"));
+      assert(save_dir_is_empty());
+    }
+
+    it("should remove the temporary file when the rename fails") {
+      // a directory can't be replaced by a file
+      assert_equal(0, mkdir(SAVE_PATH, 0755));
+      assert_equal(JSONFailure, json_serialize_to_file(value, SAVE_PATH));
+      assert(save_dir_is_empty());
+      assert_equal(0, rmdir(SAVE_PATH));
+    }
+
+    it("should keep the saved file when writing fails") {
+      struct rlimit limit;
+      struct rlimit small;
+      char *string = malloc(100001);
+      JSON_Value *large = NULL;
+
+      memset(string, 'x', 100000);
+      string[100000] = '\0';
+      large = json_value_init_string(string);
+      assert_equal(JSONSuccess, json_serialize_to_file(value, SAVE_PATH));
+
+      // files can't grow past a few bytes, and writing more fails
+      signal(SIGXFSZ, SIG_IGN);
+      getrlimit(RLIMIT_FSIZE, &limit);
+      small = limit;
+      small.rlim_cur = 1024;
+      assert_equal(0, setrlimit(RLIMIT_FSIZE, &small));
+      assert_equal(JSONFailure, json_serialize_to_file(large, SAVE_PATH));
+      setrlimit(RLIMIT_FSIZE, &limit);
+
+      char *file = read_file(SAVE_PATH);
+      assert(NULL != file && 0 == strcmp(cases[0].compact, file));
+      unlink(SAVE_PATH);
+      assert(save_dir_is_empty());
+
+      free(file);
+      json_value_free(large);
+      free(string);
+    }
+
+    json_value_free(value);
+  }
+
+  rmdir(SAVE_DIR);
+  return assert_failures();
+}
@@ -0,0 +1,360 @@
+#include "../../src/common/clib-search-index.h"
+#include "strdup/strdup.h"
+#include "wiki-registry/wiki-registry.h"
+#include <describe/describe.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define INDEX_PATH "search-index.test"
+
+static void add_package(list_t *packages, const char *repo,
+                        const char *description, const char *category) {
+  wiki_package_t *pkg = calloc(1, sizeof(wiki_package_t));
+  char href[256];
+
+  snprintf(href, sizeof(href), "https://github.com/%s", repo);
+  pkg->repo = strdup(repo);
+  pkg->href = strdup(href);
+  pkg->description = strdup(description);
+  pkg->category = strdup(category);
+  list_rpush(packages, list_node_new(pkg));
+}
+
+static list_t *packages_new(void) {
+  list_t *packages = list_new();
+
+  add_package(packages, "clibs/parson", "small json parser and serializer",
+              "json");
+  add_package(packages, "stephenmathieson/trim.c", "trim a string",
+              "string manipulation");
+  add_package(packages, "someone/json", "fast reader", "json");
+  add_package(packages, "someone/strings",
+              "string helpers, from splitting to json escaping, with many "
+              "more utilities than anyone needs",
+              "string manipulation");
+  add_package(packages, "clibs/list", "doubly linked list", "data structures");
+  return packages;
+}
+
+static void packages_free(list_t *packages) {
+  list_node_t *node = NULL;
+  list_iterator_t *it = list_iterator_new(packages, LIST_HEAD);
+
+  while ((node = list_iterator_next(it))) {
+    wiki_package_free(node->val);
+  }
+  list_iterator_destroy(it);
+  list_destroy(packages);
+}
+
+static const char *result_repo(clib_search_index_t *index,
+                               clib_search_result_t *results, int i) {
+  clib_search_entry_t entry;
+
+  if (0 != clib_search_index_entry(index, results[i].entry, &entry)) {
+    return NULL;
+  }
+
+  return entry.repo;
+}
+
+static char *read_index(size_t *size) {
+  FILE *file = fopen(INDEX_PATH, "rb");
+  char *data = NULL;
+
+  if (!file) {
+    return NULL;
+  }
+
+  fseek(file, 0, SEEK_END);
+  *size = ftell(file);
+  rewind(file);
+
+  if ((data = malloc(*size)) && *size != fread(data, 1, *size, file)) {
+    free(data);
+    data = NULL;
+  }
+
+  fclose(file);
+  return data;
+}
+
+static void write_index(const char *data, size_t size) {
+  FILE *file = fopen(INDEX_PATH, "wb");
+
+  fwrite(data, 1, size, file);
+  fclose(file);
+}
+
+int main() {
+  list_t *packages = packages_new();
+  clib_search_index_t *index = clib_search_index_build(packages);
+
+  describe("clib_search_index_build") {
+    it("should index every package") {
+      clib_search_entry_t entry;
+
+      assert(NULL != index);
+      assert_equal(5, (int)clib_search_index_count(index));
+      assert_equal(0, clib_search_index_entry(index, 1, &entry));
+      assert_str_equal("stephenmathieson/trim.c", entry.repo);
+      assert_str_equal("https://github.com/stephenmathieson/trim.c",
+                       entry.href);
+      assert_str_equal("trim a string", entry.description);
+      assert_str_equal("string manipulation", entry.category);
+      assert_equal(-1, clib_search_index_entry(index, 5, &entry));
+    }
+  }
+
+  describe("clib_search_index_save and clib_search_index_open") {
+    it("should round-trip the index") {
+      clib_search_index_t *saved = NULL;
+      clib_search_result_t *expected = NULL;
+      clib_search_result_t *actual = NULL;
+      char *terms[] = {"json"};
+
+      unlink(INDEX_PATH);
+      assert_equal(0, clib_search_index_save(index, INDEX_PATH));
+      assert(NULL != (saved = clib_search_index_open(INDEX_PATH)));
+      assert_equal((int)clib_search_index_count(index),
+                   (int)clib_search_index_count(saved));
+
+      for (size_t i = 0; i < clib_search_index_count(index); i++) {
+        clib_search_entry_t a;
+        clib_search_entry_t b;
+
+        clib_search_index_entry(index, i, &a);
+        clib_search_index_entry(saved, i, &b);
+        assert_str_equal(a.repo, b.repo);
+        assert_str_equal(a.href, b.href);
+        assert_str_equal(a.description, b.description);
+        assert_str_equal(a.category, b.category);
+      }
+
+      int count = clib_search_index_query(index, 1, terms, NULL, &expected);
+      assert_equal(count,
+                   clib_search_index_query(saved, 1, terms, NULL, &actual));
+      for (int i = 0; i < count; i++) {
+        assert_equal((int)expected[i].entry, (int)actual[i].entry);
+        assert(expected[i].score == actual[i].score);
+      }
+
+      free(expected);
+      free(actual);
+      clib_search_index_free(saved);
+    }
+
+    it("should reject a missing index") {
+      assert(NULL == clib_search_index_open("missing-search-index.test"));
+    }
+
+    it("should reject truncated indexes") {
+      size_t size = 0;
+      char *data = read_index(&size);
+
+      assert(NULL != data);
+      write_index(data, size - 1);
+      assert(NULL == clib_search_index_open(INDEX_PATH));
+      write_index(data, 16);
+      assert(NULL == clib_search_index_open(INDEX_PATH));
+      write_index(data, 0);
+      assert(NULL == clib_search_index_open(INDEX_PATH));
+      write_index(data, size);
+      free(data);
+    }
+
+    it("should reject corrupted indexes") {
+      size_t size = 0;
+      char *data = read_index(&size);
+      char *copy = malloc(size);
+
+      assert(NULL != data && NULL != copy);
+
+      // magic
+      memcpy(copy, data, size);
+      copy[0] = 'X';
+      write_index(copy, size);
+      assert(NULL == clib_search_index_open(INDEX_PATH));
+
+      // unterminated string pool
+      memcpy(copy, data, size);
+      copy[size - 1] = 'X';
+      write_index(copy, size);
+      assert(NULL == clib_search_index_open(INDEX_PATH));
+
+      // repo of the first package, right after the 36 bytes header
+      memcpy(copy, data, size);
+      memset(copy + 36, 0xff, 4);
+      write_index(copy, size);
+      assert(NULL == clib_search_index_open(INDEX_PATH));
+
+      // untouched, it still opens
+      write_index(data, size);
+      clib_search_index_t *saved = clib_search_index_open(INDEX_PATH);
+      assert(NULL != saved);
+      clib_search_index_free(saved);
+
+      free(copy);
+      free(data);
+    }
+  }
+
+  describe("clib_search_index_query") {
+    it("should list every package without terms") {
+      clib_search_result_t *results = NULL;
+
+      assert_equal(5, clib_search_index_query(index, 0, NULL, NULL, &results));
+      for (int i = 0; i < 5; i++) {
+        assert_equal(i, (int)results[i].entry);
+      }
+      free(results);
+    }
+
+    it("should rank matches with BM25") {
+      clib_search_result_t *results = NULL;
+      char *terms[] = {"json"};
+
+      assert_equal(3, clib_search_index_query(index, 1, terms, NULL, &results));
+      // a word of the repo weighs more than one of the description, and a
+      // short description more than a long one
+      assert_str_equal("someone/json", result_repo(index, results, 0));
+      assert_str_equal("clibs/parson", result_repo(index, results, 1));
+      assert_str_equal("someone/strings", result_repo(index, results, 2));
+      assert(results[0].score > results[1].score);
+      assert(results[1].score > results[2].score);
+      free(results);
+    }
+
+    it("should match words within tokens") {
+      clib_search_result_t *results = NULL;
+      char *terms[] = {"rson"};
+
+      assert_equal(1, clib_search_index_query(index, 1, terms, NULL, &results));
+      assert_str_equal("clibs/parson", result_repo(index, results, 0));
+      free(results);
+    }
+  }
+
+  describe("clib_search_index_query options") {
+    it("should match the tokens a word is a prefix of") {
+      clib_search_result_t *prefix = NULL;
+      clib_search_result_t *exact = NULL;
+      char *terms[] = {"pars"};
+      char *whole[] = {"parson"};
+
+      assert_equal(1, clib_search_index_query(index, 1, terms, NULL, &prefix));
+      assert_str_equal("clibs/parson", result_repo(index, prefix, 0));
+      assert_equal(1, clib_search_index_query(index, 1, whole, NULL, &exact));
+      // a prefix weighs less than the whole token
+      assert(exact[0].score > prefix[0].score);
+      free(prefix);
+      free(exact);
+    }
+
+    it("should list packages matching any term by default") {
+      clib_search_result_t *results = NULL;
+      char *terms[] = {"trim", "linked"};
+
+      assert_equal(2, clib_search_index_query(index, 2, terms, NULL, &results));
+      free(results);
+    }
+
+    it("should only list packages matching every term with all") {
+      clib_search_options_t options = {.all = 1};
+      clib_search_result_t *results = NULL;
+      char *terms[] = {"json", "parser"};
+
+      assert_equal(1,
+                   clib_search_index_query(index, 2, terms, &options, &results));
+      assert_str_equal("clibs/parson", result_repo(index, results, 0));
+      free(results);
+
+      char *none[] = {"trim", "linked"};
+
+      assert_equal(0,
+                   clib_search_index_query(index, 2, none, &options, &results));
+      free(results);
+    }
+
+    it("should keep the best results within the limit") {
+      clib_search_options_t options = {.limit = 2};
+      clib_search_result_t *all = NULL;
+      clib_search_result_t *results = NULL;
+      char *terms[] = {"json", "string", "list"};
+
+      int count = clib_search_index_query(index, 3, terms, NULL, &all);
+      assert_equal(5, count);
+      assert_equal(2,
+                   clib_search_index_query(index, 3, terms, &options, &results));
+      for (int i = 0; i < 2; i++) {
+        assert_equal((int)all[i].entry, (int)results[i].entry);
+      }
+      free(results);
+
+      options.limit = 1;
+      assert_equal(1,
+                   clib_search_index_query(index, 3, terms, &options, &results));
+      assert_equal((int)all[0].entry, (int)results[0].entry);
+      free(results);
+      free(all);
+    }
+
+    it("should list every package for punctuation") {
+      clib_search_result_t *results = NULL;
+      char *terms[] = {".", "-"};
+
+      assert_equal(5, clib_search_index_query(index, 2, terms, NULL, &results));
+      free(results);
+    }
+  }
+
+  describe("clib_search_index_query fuzzy") {
+    it("should match misspelled words as the right ones, ranked below") {
+      clib_search_options_t options = {.fuzzy = 1};
+      clib_search_result_t *exact = NULL;
+      clib_search_result_t *fuzzy = NULL;
+      char *right[] = {"string"};
+      char *wrong[] = {"strng"};
+
+      assert_equal(0, clib_search_index_query(index, 1, wrong, NULL, &fuzzy));
+      free(fuzzy);
+
+      int count = clib_search_index_query(index, 1, right, NULL, &exact);
+      assert_equal(2, count);
+      assert_equal(count,
+                   clib_search_index_query(index, 1, wrong, &options, &fuzzy));
+      // both only match `string` in their description, the shorter first
+      assert_str_equal("stephenmathieson/trim.c", result_repo(index, fuzzy, 0));
+      assert_str_equal("someone/strings", result_repo(index, fuzzy, 1));
+      for (int i = 0; i < count; i++) {
+        for (int j = 0; j < count; j++) {
+          if (exact[j].entry == fuzzy[i].entry) {
+            assert(fuzzy[i].score < exact[j].score);
+          }
+        }
+      }
+      free(exact);
+      free(fuzzy);
+    }
+
+    it("should rank exact matches above misspelled ones") {
+      clib_search_options_t options = {.fuzzy = 1};
+      clib_search_result_t *results = NULL;
+      char *terms[] = {"trim", "strng"};
+
+      assert_equal(2,
+                   clib_search_index_query(index, 2, terms, &options, &results));
+      assert_str_equal("stephenmathieson/trim.c",
+                       result_repo(index, results, 0));
+      assert_str_equal("someone/strings", result_repo(index, results, 1));
+      free(results);
+    }
+  }
+
+  clib_search_index_free(index);
+  packages_free(packages);
+  unlink(INDEX_PATH);
+  return assert_failures();
+}
@@ -0,0 +1,110 @@
+#include "fs/fs.h"
+#include "wiki-registry/wiki-registry.h"
+#include <describe/describe.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WIKI_HTML "../data/wiki-packages.html"
+
+static void assert_package(list_t *packages, int i, const char *repo,
+                           const char *description, const char *category) {
+  list_node_t *node = list_at(packages, i);
+  wiki_package_t *pkg = node ? node->val : NULL;
+
+  assert(NULL != pkg);
+  if (!pkg) {
+    return;
+  }
+
+  assert_str_equal(repo, pkg->repo);
+  if (description) {
+    assert_str_equal(description, pkg->description);
+  }
+  assert_str_equal(category, pkg->category);
+}
+
+static int stop_after_one(wiki_package_t *pkg, void *data) {
+  (*(int *)data)++;
+  wiki_package_free(pkg);
+  return 1;
+}
+
+static int stop_at_strdup(wiki_package_t *pkg, void *data) {
+  int stop = 0 == strcmp("clibs/strdup", pkg->repo);
+
+  (*(int *)data)++;
+  wiki_package_free(pkg);
+  return stop;
+}
+
+int main() {
+  char *html = fs_read(WIKI_HTML);
+
+  describe("wiki_registry_parse") {
+    it("should read the saved wiki page") { assert(NULL != html); }
+
+    list_t *packages = html ? wiki_registry_parse(html) : NULL;
+
+    it("should list the packages of every category") {
+      assert(NULL != packages);
+      if (!packages) {
+        return assert_failures();
+      }
+
+      assert_equal(5, (int)packages->len);
+      assert_package(packages, 0, "stephenmathieson/trim.c",
+                     "trim leading & trailing whitespace",
+                     "string manipulation");
+      // nested lists come out in document order, and an item's text
+      // holds the items nested in it
+      assert_package(packages, 1, "clibs/strdup", NULL, "string manipulation");
+      wiki_package_t *strdup_pkg = list_at(packages, 1)->val;
+      assert(0 == strncmp("strdup(3) for every platform",
+                          strdup_pkg->description, 28));
+      assert(NULL != strstr(strdup_pkg->description, "someone/strndup"));
+      assert_package(packages, 2, "someone/strndup", "nested under strdup",
+                     "string manipulation");
+      assert_package(packages, 3, "clibs/parson", "small json parser", "json");
+      assert_package(packages, 4, "clibs/list", "doubly linked list",
+                     "data structures");
+    }
+
+    it("should link every package to github") {
+      wiki_package_t *pkg = list_at(packages, 3)->val;
+
+      assert_str_equal("https://github.com/clibs/parson", pkg->href);
+    }
+
+    if (packages) {
+      list_node_t *node = NULL;
+      list_iterator_t *it = list_iterator_new(packages, LIST_HEAD);
+
+      while ((node = list_iterator_next(it))) {
+        wiki_package_free(node->val);
+      }
+      list_iterator_destroy(it);
+      list_destroy(packages);
+    }
+  }
+
+  describe("wiki_registry_parse_each") {
+    it("should stop once the callback asks to") {
+      int count = 0;
+
+      wiki_registry_parse_each(html, stop_after_one, &count);
+      assert_equal(1, count);
+    }
+
+    it("should not hand over the nested packages after stopping") {
+      int count = 0;
+
+      // someone/strndup is nested in clibs/strdup, both are handed over
+      // once the outer item closes
+      wiki_registry_parse_each(html, stop_at_strdup, &count);
+      assert_equal(2, count);
+    }
+  }
+
+  free(html);
+  return assert_failures();
+}
@@ -0,0 +1,402 @@
+// symlink(), lstat() and readlink() are POSIX, hidden by -std=c99 otherwise
+#define _POSIX_C_SOURCE 200809L
+
+#include "../../src/common/clib-untar.h"
+#include <describe/describe.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define DEST "untar-test.d"
+// what `../outside` resolves to from the destination
+#define OUTSIDE "outside"
+
+typedef struct {
+  unsigned char *data;
+  size_t len;
+} buffer_t;
+
+static void append(buffer_t *buf, const void *data, size_t len) {
+  buf->data = realloc(buf->data, buf->len + len);
+  memcpy(buf->data + buf->len, data, len);
+  buf->len += len;
+}
+
+static void add_entry(buffer_t *tar, const char *name, char type,
+                      const char *linkname, const char *data) {
+  unsigned char header[512] = {0};
+  size_t size = data ? strlen(data) : 0;
+  size_t name_len = strlen(name);
+  unsigned sum = 0;
+
+  // names that do not fit are split at a slash into the ustar prefix
+  if (name_len > 100) {
+    const char *slash = strchr(name + name_len - 100, '/');
+    memcpy(header + 345, name, slash - name);
+    name = slash + 1;
+  }
+
+  strncpy((char *)header, name, 100);
+  sprintf((char *)header + 100, "%07o", 0644);
+  sprintf((char *)header + 108, "%07o", 0);
+  sprintf((char *)header + 116, "%07o", 0);
+  sprintf((char *)header + 124, "%011o", (unsigned)size);
+  sprintf((char *)header + 136, "%011o", 0);
+  header[156] = type;
+  if (linkname) {
+    strncpy((char *)header + 157, linkname, 100);
+  }
+  memcpy(header + 257, "ustar\0" "00", 8);
+
+  memset(header + 148, ' ', 8);
+  for (int i = 0; i < 512; i++) {
+    sum += header[i];
+  }
+  sprintf((char *)header + 148, "%06o", sum);
+
+  append(tar, header, 512);
+
+  if (size) {
+    unsigned char padding[512] = {0};
+    append(tar, data, size);
+    append(tar, padding, (512 - size % 512) % 512);
+  }
+}
+
+static void add_end(buffer_t *tar) {
+  unsigned char blocks[1024] = {0};
+  append(tar, blocks, sizeof(blocks));
+}
+
+static buffer_t gzip(buffer_t *tar) {
+  buffer_t gz = {0};
+  z_stream zs = {0};
+
+  // 15 window bits, plus 16 for a gzip header
+  deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+               Z_DEFAULT_STRATEGY);
+  gz.data = malloc(deflateBound(&zs, tar->len));
+  zs.next_in = tar->data;
+  zs.avail_in = (uInt)tar->len;
+  zs.next_out = gz.data;
+  zs.avail_out = (uInt)deflateBound(&zs, tar->len);
+  deflate(&zs, Z_FINISH);
+  gz.len = zs.total_out;
+  deflateEnd(&zs);
+
+  free(tar->data);
+  tar->data = NULL;
+  tar->len = 0;
+  return gz;
+}
+
+/**
+ * rm -rf `path`, without following the symbolic links rimraf() follows
+ */
+
+static void remove_tree(const char *path) {
+  struct stat stats;
+  struct dirent *entry = NULL;
+  DIR *dir = NULL;
+
+  if (0 != lstat(path, &stats)) {
+    return;
+  }
+
+  if (!S_ISDIR(stats.st_mode) || !(dir = opendir(path))) {
+    unlink(path);
+    return;
+  }
+
+  while ((entry = readdir(dir))) {
+    char child[1024];
+
+    if (0 == strcmp(".", entry->d_name) || 0 == strcmp("..", entry->d_name)) {
+      continue;
+    }
+
+    snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+    remove_tree(child);
+  }
+
+  closedir(dir);
+  rmdir(path);
+}
+
+/**
+ * Extract `len` bytes of `gz` into a fresh destination, a few bytes at a
+ * time, and free them
+ */
+
+static int extract(buffer_t gz, size_t len) {
+  clib_untar_t *untar = NULL;
+  int rc = 0;
+
+  remove_tree(DEST);
+  remove_tree(OUTSIDE);
+  mkdir(DEST, 0777);
+
+  if (!(untar = clib_untar_new(DEST))) {
+    free(gz.data);
+    return -1;
+  }
+
+  for (size_t i = 0; 0 == rc && i < len; i += 7) {
+    rc = clib_untar_write(untar, gz.data + i, len - i < 7 ? len - i : 7);
+  }
+
+  if (0 == rc) {
+    rc = clib_untar_finish(untar);
+  }
+
+  clib_untar_free(untar);
+  free(gz.data);
+  return rc;
+}
+
+static char *read_file(const char *path) {
+  static char data[1024];
+  FILE *file = fopen(path, "rb");
+  size_t n = 0;
+
+  if (!file) {
+    return NULL;
+  }
+
+  n = fread(data, 1, sizeof(data) - 1, file);
+  data[n] = '\0';
+  fclose(file);
+  return data;
+}
+
+static int exists(const char *path) {
+  struct stat stats;
+  return 0 == lstat(path, &stats);
+}
+
+int main() {
+  describe("clib_untar_write") {
+    it("should extract files, directories and links") {
+      buffer_t tar = {0};
+      buffer_t gz = {0};
+      int rc = 0;
+      char target[64] = {0};
+
+      add_entry(&tar, "pkg/", '5', NULL, NULL);
+      add_entry(&tar, "pkg/src/file.c", '0', NULL, "int main;\n");
+      add_entry(&tar, "pkg/link.c", '2', "src/file.c", NULL);
+      add_entry(&tar, "pkg/hard.c", '1', "pkg/src/file.c", NULL);
+      add_end(&tar);
+      gz = gzip(&tar);
+
+      rc = extract(gz, gz.len);
+      assert_equal(0, rc);
+      assert_str_equal("int main;\n", read_file(DEST "/pkg/src/file.c"));
+      assert_str_equal("int main;\n", read_file(DEST "/pkg/hard.c"));
+      assert(0 < readlink(DEST "/pkg/link.c", target, sizeof(target) - 1));
+      assert_str_equal("src/file.c", target);
+    }
+
+    it("should fail on a `..` entry") {
+      buffer_t tar = {0};
+      buffer_t gz = {0};
+      int rc = 0;
+
+      add_entry(&tar, "../" OUTSIDE, '0', NULL, "escaped\n");
+      add_end(&tar);
+      gz = gzip(&tar);
+
+      rc = extract(gz, gz.len);
+      assert_equal(-1, rc);
+      assert(!exists(OUTSIDE));
+
+      add_entry(&tar, "pkg/../../" OUTSIDE, '0', NULL, "escaped\n");
+      add_end(&tar);
+      gz = gzip(&tar);
+
+      rc = extract(gz, gz.len);
+      assert_equal(-1, rc);
+      assert(!exists(OUTSIDE));
+    }
+
+    it("should fail on an absolute path") {
+      buffer_t tar = {0};
+      buffer_t gz = {0};
+      int rc = 0;
+      char cwd[256];
+      char path[512];
+
+      assert(NULL != getcwd(cwd, sizeof(cwd)));
+      snprintf(path, sizeof(path), "%s/" OUTSIDE, cwd);
+      add_entry(&tar, path, '0', NULL, "escaped\n");
+      add_end(&tar);
+      gz = gzip(&tar);
+
+      rc = extract(gz, gz.len);
+      assert_equal(-1, rc);
+      assert(!exists(OUTSIDE));
+    }
+
+    it("should skip symbolic links out of the destination") {
+      buffer_t tar = {0};
+      buffer_t gz = {0};
+      int rc = 0;
+
+      add_entry(&tar, "pkg/up", '2', "../../" OUTSIDE, NULL);
+      add_entry(&tar, "pkg/root", '2', "/", NULL);
+      add_entry(&tar, "pkg/in", '2', "../pkg", NULL);
+      add_end(&tar);
+      gz = gzip(&tar);
+
+      rc = extract(gz, gz.len);
+      assert_equal(0, rc);
+      assert(!exists(DEST "/pkg/up"));
+      assert(!exists(DEST "/pkg/root"));
+      assert(exists(DEST "/pkg/in"));
+    }
+
+    it("should skip symbolic links going up through another one") {
+      buffer_t tar = {0};
+      buffer_t gz = {0};
+      int rc = 0;
+
+      // `s/..` reads as the destination, but is its parent once `s` is `.`
+      add_entry(&tar, "s", '2', ".", NULL);
+      add_entry(&tar, "t", '2', "s/..", NULL);
+      add_end(&tar);
+      gz = gzip(&tar);
+
+      rc = extract(gz, gz.len);
+      assert_equal(0, rc);
+      assert(exists(DEST "/s"));
+      assert(!exists(DEST "/t"));
+
+      // in either order
+      add_entry(&tar, "t", '2', "s/..", NULL);
+      add_entry(&tar, "s", '2', ".", NULL);
+      add_end(&tar);
+      gz = gzip(&tar);
+
+      rc = extract(gz, gz.len);
+      assert_equal(0, rc);
+      assert(exists(DEST "/s"));
+      assert(!exists(DEST "/t"));
+    }
+
+    it("should fail on entries through a symbolic link") {
+      buffer_t tar = {0};
+      buffer_t gz = {0};
+      int rc = 0;
+
+      // each link stays in the destination, but the second goes through
+      // the first, and out of it
+      add_entry(&tar, "pkg/up", '2', "..", NULL);
+      add_entry(&tar, "pkg/up/escape", '2', "..", NULL);
+      add_end(&tar);
+      gz = gzip(&tar);
+
+      rc = extract(gz, gz.len);
+      assert_equal(-1, rc);
+      assert(!exists(DEST "/escape"));
+
+      add_entry(&tar, "pkg/up", '2', "..", NULL);
+      add_entry(&tar, "pkg/up/file", '0', NULL, "through\n");
+      add_end(&tar);
+      gz = gzip(&tar);
+
+      rc = extract(gz, gz.len);
+      assert_equal(-1, rc);
+      assert(!exists(DEST "/file"));
+    }
+
+    it("should extract names longer than 100 bytes") {
+      buffer_t tar = {0};
+      buffer_t gz = {0};
+      int rc = 0;
+      char name[256];
+      char path[512];
+      char pax[512];
+      char record[300];
+
+      memset(name, 'a', 150);
+      name[50] = '/';
+      name[150] = '\0';
+
+      // GNU long name
+      add_entry(&tar, "././@LongLink", 'L', NULL, name);
+      add_entry(&tar, "truncated", '0', NULL, "gnu\n");
+
+      // pax path, its length counting its own 3 digits
+      name[0] = 'b';
+      snprintf(record, sizeof(record), " path=%s\n", name);
+      snprintf(pax, sizeof(pax), "%d%s", (int)strlen(record) + 3, record);
+      add_entry(&tar, "PaxHeaders/truncated", 'x', NULL, pax);
+      add_entry(&tar, "truncated", '0', NULL, "pax\n");
+
+      // ustar prefix
+      name[0] = 'c';
+      add_entry(&tar, name, '0', NULL, "ustar\n");
+
+      add_end(&tar);
+      gz = gzip(&tar);
+
+      rc = extract(gz, gz.len);
+      assert_equal(0, rc);
+      assert(!exists(DEST "/truncated"));
+
+      name[0] = 'a';
+      snprintf(path, sizeof(path), DEST "/%s", name);
+      assert_str_equal("gnu\n", read_file(path));
+
+      name[0] = 'b';
+      snprintf(path, sizeof(path), DEST "/%s", name);
+      assert_str_equal("pax\n", read_file(path));
+
+      name[0] = 'c';
+      snprintf(path, sizeof(path), DEST "/%s", name);
+      assert_str_equal("ustar\n", read_file(path));
+    }
+  }
+
+  describe("clib_untar_finish") {
+    it("should fail on a truncated gzip stream") {
+      buffer_t tar = {0};
+      buffer_t gz = {0};
+      int rc = 0;
+
+      add_entry(&tar, "pkg/file.c", '0', NULL, "int main;\n");
+      add_end(&tar);
+      gz = gzip(&tar);
+      rc = extract(gz, gz.len / 2);
+      assert_equal(-1, rc);
+
+      add_entry(&tar, "pkg/file.c", '0', NULL, "int main;\n");
+      add_end(&tar);
+      gz = gzip(&tar);
+      // all of the archive, but the gzip trailer
+      rc = extract(gz, gz.len - 8);
+      assert_equal(-1, rc);
+    }
+
+    it("should fail on corrupted gzip data") {
+      buffer_t tar = {0};
+      buffer_t gz = {0};
+      int rc = 0;
+
+      add_entry(&tar, "pkg/file.c", '0', NULL, "int main;\n");
+      add_end(&tar);
+      gz = gzip(&tar);
+      // the crc32 of the trailer
+      gz.data[gz.len - 8] ^= 0xff;
+      rc = extract(gz, gz.len);
+      assert_equal(-1, rc);
+    }
+  }
+
+  remove_tree(DEST);
+  return assert_failures();
+}